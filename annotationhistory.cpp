@@ -0,0 +1,92 @@
+#include "annotationhistory.h"
+#include <QtGlobal>
+
+qint64 AnnotationHistory::Command::cost() const
+{
+    // A cleared store is the only large payload
+    return qint64(sizeof(Command)) + (cleared ? cleared->memoryUsage() : 0);
+}
+
+AnnotationHistory::AnnotationHistory(qint64 budgetBytes, int maxCommands)
+    : budgetBytes(budgetBytes)
+    , maxCommands(maxCommands)
+    , used(0)
+{
+}
+
+void AnnotationHistory::push(Command command)
+{
+    for (const Command &dropped : redoStack) {
+        used -= dropped.bytes;
+    }
+    redoStack.clear();
+
+    command.bytes = command.cost();
+    used += command.bytes;
+    undoStack.push_back(std::move(command));
+    trim();
+}
+
+bool AnnotationHistory::canUndo() const
+{
+    return !undoStack.empty();
+}
+
+bool AnnotationHistory::canRedo() const
+{
+    return !redoStack.empty();
+}
+
+AnnotationHistory::Command AnnotationHistory::undo()
+{
+    Command command = undoStack.back();
+    undoStack.pop_back();
+    redoStack.push_back(command);
+    return command;
+}
+
+AnnotationHistory::Command AnnotationHistory::redo()
+{
+    Command command = redoStack.back();
+    redoStack.pop_back();
+    undoStack.push_back(command);
+    return command;
+}
+
+void AnnotationHistory::clear()
+{
+    undoStack.clear();
+    redoStack.clear();
+    used = 0;
+}
+
+void AnnotationHistory::setLimits(qint64 bytes, int commands)
+{
+    budgetBytes = qMax<qint64>(0, bytes);
+    maxCommands = qMax(0, commands);
+    trim();
+}
+
+void AnnotationHistory::trim()
+{
+    // Oldest first, the most recent edits are the ones worth undoing
+    while (!undoStack.empty() && (used > budgetBytes || int(undoStack.size()) > maxCommands)) {
+        used -= undoStack.front().bytes;
+        undoStack.pop_front();
+    }
+}
+
+qint64 AnnotationHistory::bytesUsed() const
+{
+    return used;
+}
+
+int AnnotationHistory::undoCount() const
+{
+    return int(undoStack.size());
+}
+
+int AnnotationHistory::redoCount() const
+{
+    return int(redoStack.size());
+}
@@ -0,0 +1,64 @@
+#ifndef ANNOTATIONHISTORY_H
+#define ANNOTATIONHISTORY_H
+
+#include <QLineF>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "annotationjournal.h"
+#include "annotationstore.h"
+
+// Undo/redo log of annotation edits. Commands only record what changed, the
+// caller applies them. A clear keeps the cleared store itself, so undoing it
+// is a swap rather than re-adding every line. Memory is bounded by a byte
+// budget and a command count, the oldest commands are dropped first.
+class AnnotationHistory
+{
+public:
+    struct Command {
+        enum Type { AddLine, DeleteLine, ClearAll, ChangeStyle };
+
+        Type type = AddLine;
+        AnnotationStore::Id id = AnnotationStore::invalidId;
+        QLineF line;
+        std::shared_ptr<AnnotationStore> cleared;  // ClearAll, the lines before
+        AnnotationJournal::Style before;            // ChangeStyle
+        AnnotationJournal::Style after;
+
+        // Memory charged to the history, fixed when the command is pushed
+        qint64 bytes = 0;
+
+        qint64 cost() const;
+    };
+
+    explicit AnnotationHistory(qint64 budgetBytes = 64LL * 1024 * 1024, int maxCommands = 10000);
+
+    // Records a command that was just applied, the redo steps are dropped
+    void push(Command command);
+
+    bool canUndo() const;
+    bool canRedo() const;
+
+    // Moves the last command to the redo side and returns it for reverting
+    Command undo();
+    // Moves the next redo command back and returns it for re-applying
+    Command redo();
+
+    void clear();
+    void setLimits(qint64 budgetBytes, int maxCommands);
+    qint64 bytesUsed() const;
+    int undoCount() const;
+    int redoCount() const;
+
+private:
+    void trim();
+
+    std::deque<Command> undoStack;
+    std::vector<Command> redoStack;
+    qint64 budgetBytes;
+    int maxCommands;
+    qint64 used;
+};
+
+#endif // ANNOTATIONHISTORY_H
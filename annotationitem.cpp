@@ -0,0 +1,175 @@
+#include "annotationitem.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+
+#include "measurement.h"
+#include "profiler.h"
+
+namespace {
+
+// Labels are only drawn while they stay readable and cheap
+const int maxLabels = 200;
+
+// Label box in screen pixels, centred above the line's midpoint
+const qreal labelWidth = 88.0;
+const qreal labelHeight = 16.0;
+const qreal labelLift = 12.0;
+
+}
+
+AnnotationItem::AnnotationItem(const AnnotationStore *store, QGraphicsItem *parent)
+    : QGraphicsItem(parent)
+    , store(store)
+    , selectedId(AnnotationStore::invalidId)
+    , spacingX(0.0)
+    , spacingY(0.0)
+    , viewScale(1.0)
+{
+    // exposedRect is only filled in with the extended style option
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    setZValue(1);
+}
+
+qreal AnnotationItem::penMargin() const
+{
+    return qMax(normalPen.widthF(), selectedPen.widthF()) / 2.0 + 1.0;
+}
+
+qreal AnnotationItem::margin() const
+{
+    // Far enough for a label of a line at the edge of an update rect
+    const qreal labelReach = (labelWidth / 2.0 + labelLift + labelHeight) / viewScale;
+    return qMax(penMargin(), labelReach);
+}
+
+QRectF AnnotationItem::boundingRect() const
+{
+    if (extent.isNull()) {
+        return QRectF();
+    }
+    const qreal margin = this->margin();
+    return extent.adjusted(-margin, -margin, margin, margin);
+}
+
+void AnnotationItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+                           QWidget *widget)
+{
+    PROFILE_SCOPE("AnnotationItem::paint");
+    Q_UNUSED(widget);
+
+    if (!store || store->size() == 0) {
+        return;
+    }
+
+    // Lines just outside the exposed rect can still reach into it with the
+    // pen or their label
+    const qreal margin = this->margin();
+    store->query(option->exposedRect.adjusted(-margin, -margin, margin, margin), visible);
+
+    batch.clear();
+    batch.reserve(int(visible.size()));
+    for (AnnotationStore::Id id : visible) {
+        if (id != selectedId) {
+            batch.append(store->line(id));
+        }
+    }
+
+    painter->setPen(normalPen);
+    painter->drawLines(batch);
+
+    if (store->contains(selectedId)) {
+        painter->setPen(selectedPen);
+        painter->drawLine(store->line(selectedId));
+    }
+
+    if (int(visible.size()) <= maxLabels) {
+        drawLabels(painter);
+    }
+}
+
+void AnnotationItem::drawLabels(QPainter *painter)
+{
+    // Drawn untransformed so the text keeps its size at every zoom
+    const QTransform transform = painter->worldTransform();
+    painter->save();
+    painter->resetTransform();
+
+    QFont font = painter->font();
+    font.setPixelSize(11);
+    painter->setFont(font);
+
+    for (AnnotationStore::Id id : visible) {
+        const QLineF line = store->line(id);
+        const QPointF anchor = transform.map(line.center());
+        const QRectF box(anchor.x() - labelWidth / 2.0, anchor.y() - labelLift - labelHeight,
+                         labelWidth, labelHeight);
+        const QString text = Measurement::lengthText(line, spacingX, spacingY);
+        const QRectF textBox = painter->fontMetrics().boundingRect(box.toRect(), Qt::AlignCenter, text);
+
+        painter->fillRect(textBox.adjusted(-2, 0, 2, 0), QColor(0, 0, 0, 160));
+        painter->setPen(id == selectedId ? selectedPen.color() : Qt::white);
+        painter->drawText(box, Qt::AlignCenter, text);
+    }
+
+    painter->restore();
+}
+
+void AnnotationItem::setCalibration(double x, double y)
+{
+    spacingX = x;
+    spacingY = y;
+    update();
+}
+
+void AnnotationItem::setViewScale(qreal scale)
+{
+    if (scale <= 0.0 || qFuzzyCompare(scale, viewScale)) {
+        return;
+    }
+    prepareGeometryChange();
+    viewScale = scale;
+}
+
+void AnnotationItem::setPens(const QPen &normal, const QPen &selected)
+{
+    prepareGeometryChange();
+    normalPen = normal;
+    selectedPen = selected;
+    update();
+}
+
+void AnnotationItem::setSelectedId(AnnotationStore::Id id)
+{
+    if (id == selectedId) {
+        return;
+    }
+    const AnnotationStore::Id previous = selectedId;
+    selectedId = id;
+
+    // Only the two affected lines are repainted
+    const qreal margin = this->margin();
+    for (AnnotationStore::Id changed : {previous, id}) {
+        if (store->contains(changed)) {
+            const QLineF line = store->line(changed);
+            update(QRectF(line.p1(), line.p2()).normalized().adjusted(-margin, -margin, margin, margin));
+        }
+    }
+}
+
+void AnnotationItem::lineChanged(const QLineF &line)
+{
+    if (store->bounds() != extent) {
+        prepareGeometryChange();
+        extent = store->bounds();
+    }
+    const qreal margin = this->margin();
+    update(QRectF(line.p1(), line.p2()).normalized().adjusted(-margin, -margin, margin, margin));
+}
+
+void AnnotationItem::storeReset()
+{
+    prepareGeometryChange();
+    extent = store->bounds();
+    selectedId = AnnotationStore::invalidId;
+    update();
+}
@@ -0,0 +1,54 @@
+#ifndef ANNOTATIONITEM_H
+#define ANNOTATIONITEM_H
+
+#include <QGraphicsItem>
+#include <QPen>
+#include <vector>
+
+#include "annotationstore.h"
+
+// Draws every line of an AnnotationStore as one scene item. Only lines in the
+// exposed area are looked up through the store's grid, and they are drawn
+// with a single batched drawLines call per pen. When few lines are visible
+// each one also gets a length label in screen sized text.
+class AnnotationItem : public QGraphicsItem
+{
+public:
+    explicit AnnotationItem(const AnnotationStore *store, QGraphicsItem *parent = nullptr);
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+               QWidget *widget) override;
+
+    void setPens(const QPen &normal, const QPen &selected);
+    void setSelectedId(AnnotationStore::Id id);
+
+    // Pixel spacing in mm for the length labels, 0 labels in pixels
+    void setCalibration(double spacingX, double spacingY);
+    // View zoom, labels keep their screen size and need a scene margin to match
+    void setViewScale(qreal scale);
+
+    // Call after the store changed, line is the one added or removed
+    void lineChanged(const QLineF &line);
+    void storeReset();
+
+private:
+    qreal penMargin() const;
+    qreal margin() const;
+    void drawLabels(QPainter *painter);
+
+    const AnnotationStore *store;
+    QRectF extent;
+    QPen normalPen;
+    QPen selectedPen;
+    AnnotationStore::Id selectedId;
+    double spacingX;
+    double spacingY;
+    qreal viewScale;
+
+    // Reused between paints to avoid allocating per frame
+    std::vector<AnnotationStore::Id> visible;
+    QVector<QLineF> batch;
+};
+
+#endif // ANNOTATIONITEM_H
@@ -0,0 +1,397 @@
+#include "annotationjournal.h"
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+#include <cstring>
+
+#include "profiler.h"
+
+namespace {
+
+const char magic[4] = {'M', 'I', 'A', 'J'};
+const quint16 version = 1;
+
+// Ids come from AnnotationStore::add, one past the highest so far, so a much
+// larger one in a record is damage. Restoring it would size the id table for it.
+const qint64 maxIdGap = 1 << 24;
+
+enum Op : quint8 {
+    OpAdd = 1,
+    OpRemove = 2,
+    OpClear = 3,
+    OpStyle = 4,
+};
+
+int payloadSize(quint8 op)
+{
+    switch (op) {
+    case OpAdd:
+        return 20;
+    case OpRemove:
+        return 4;
+    case OpClear:
+        return 0;
+    case OpStyle:
+        return 8;
+    default:
+        return -1;
+    }
+}
+
+void putU32(QByteArray &out, quint32 value)
+{
+    char bytes[4];
+    qToLittleEndian(value, bytes);
+    out.append(bytes, 4);
+}
+
+void putF32(QByteArray &out, float value)
+{
+    quint32 bits;
+    std::memcpy(&bits, &value, 4);
+    putU32(out, bits);
+}
+
+quint32 getU32(const char *data)
+{
+    return qFromLittleEndian<quint32>(data);
+}
+
+float getF32(const char *data)
+{
+    const quint32 bits = getU32(data);
+    float value;
+    std::memcpy(&value, &bits, 4);
+    return value;
+}
+
+void putAdd(QByteArray &out, AnnotationStore::Id id, const QLineF &line)
+{
+    out.append(char(OpAdd));
+    putU32(out, id);
+    putF32(out, float(line.x1()));
+    putF32(out, float(line.y1()));
+    putF32(out, float(line.x2()));
+    putF32(out, float(line.y2()));
+}
+
+void putStyle(QByteArray &out, const AnnotationJournal::Style &style)
+{
+    out.append(char(OpStyle));
+    putU32(out, style.color);
+    putF32(out, style.width);
+}
+
+}
+
+AnnotationJournal::AnnotationJournal()
+    : records(0)
+    , pendingWrites(0)
+    , compactedAt(0)
+    , compacting(false)
+{
+    pool.setMaxThreadCount(1);
+}
+
+AnnotationJournal::~AnnotationJournal()
+{
+    close();
+}
+
+QString AnnotationJournal::pathFor(const QString &directory, const QString &imageKey)
+{
+    // UIDs and paths are not safe file names, a hash of them is
+    const QByteArray hash = QCryptographicHash::hash(imageKey.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QDir(directory).filePath(QString::fromLatin1(hash) + ".ann");
+}
+
+QByteArray AnnotationJournal::header(const QString &imageKey)
+{
+    const QByteArray key = imageKey.toUtf8();
+    QByteArray out(magic, 4);
+    char bytes[2];
+    qToLittleEndian(version, bytes);
+    out.append(bytes, 2);
+    qToLittleEndian(quint16(key.size()), bytes);
+    out.append(bytes, 2);
+    out.append(key);
+    return out;
+}
+
+bool AnnotationJournal::open(const QString &path, const QString &key, AnnotationStore &store, Style &style)
+{
+    close();
+    store.clear();
+    style = Style();
+    imageKey = key;
+    records = 0;
+
+    QDir().mkpath(QFileInfo(path).path());
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadWrite)) {
+        qDebug() << "Cannot open annotation journal:" << path << file.errorString();
+        return false;
+    }
+
+    // One read, then records are decoded straight from memory
+    const QByteArray data = file.readAll();
+    const QByteArray expected = header(key);
+    if (!data.startsWith(expected)) {
+        if (!data.isEmpty()) {
+            qDebug() << "Annotation journal belongs to another image, starting over:" << path;
+        }
+        file.resize(0);
+        file.seek(0);
+        file.write(expected);
+        file.flush();
+        return true;
+    }
+
+    const char *bytes = data.constData();
+    const qint64 size = data.size();
+    qint64 pos = expected.size();
+    while (pos < size) {
+        const quint8 op = quint8(bytes[pos]);
+        const int payload = payloadSize(op);
+        if (payload < 0 || pos + 1 + payload > size) {
+            break;
+        }
+        const char *p = bytes + pos + 1;
+        if (op == OpAdd && getU32(p) >= store.nextId() + maxIdGap) {
+            break;
+        }
+
+        switch (op) {
+        case OpAdd:
+            store.restore(getU32(p), QLineF(getF32(p + 4), getF32(p + 8), getF32(p + 12), getF32(p + 16)));
+            break;
+        case OpRemove:
+            store.remove(getU32(p));
+            break;
+        case OpClear:
+            store.clear();
+            break;
+        case OpStyle:
+            style.color = getU32(p);
+            style.width = getF32(p + 4);
+            style.isSet = true;
+            break;
+        }
+        pos += 1 + payload;
+        ++records;
+    }
+
+    // A torn last record from a crash, or anything after an impossible id, is
+    // dropped, appends continue after it
+    if (pos < size) {
+        qDebug() << "Dropping" << (size - pos) << "bytes of damaged annotation journal";
+        file.resize(pos);
+    }
+    file.seek(pos);
+
+    qDebug() << "Replayed" << records << "annotation records," << store.size() << "lines";
+    compactIfNeeded(store, style);
+    return true;
+}
+
+void AnnotationJournal::close()
+{
+    // A running compaction still writes to the current file
+    pool.waitForDone();
+
+    QMutexLocker locker(&mutex);
+    if (file.isOpen()) {
+        file.close();
+    }
+    records = 0;
+}
+
+bool AnnotationJournal::isOpen() const
+{
+    QMutexLocker locker(&mutex);
+    return file.isOpen();
+}
+
+qint64 AnnotationJournal::recordCount() const
+{
+    QMutexLocker locker(&mutex);
+    return records;
+}
+
+void AnnotationJournal::append(const QByteArray &record)
+{
+    PROFILE_SCOPE("AnnotationJournal::append");
+    QMutexLocker locker(&mutex);
+    if (!file.isOpen()) {
+        return;
+    }
+    if (pendingWrites > 0) {
+        locker.unlock();
+        queueWrite(record, 1);
+        return;
+    }
+
+    // Flushed per record so a crash loses at most the edit in flight
+    file.write(record);
+    file.flush();
+    ++records;
+}
+
+void AnnotationJournal::queueWrite(const QByteArray &bytes, qint64 recordsInBytes)
+{
+    // The pool has one thread, so queued writes land in order, and appends
+    // made while any are pending queue up behind them
+    {
+        QMutexLocker locker(&mutex);
+        ++pendingWrites;
+    }
+    pool.start([this, bytes, recordsInBytes]() {
+        PROFILE_SCOPE("AnnotationJournal::queuedWrite");
+        QMutexLocker locker(&mutex);
+        if (file.isOpen()) {
+            file.write(bytes);
+            file.flush();
+            records += recordsInBytes;
+        }
+        --pendingWrites;
+    });
+}
+
+void AnnotationJournal::appendAdd(AnnotationStore::Id id, const QLineF &line)
+{
+    QByteArray record;
+    putAdd(record, id, line);
+    append(record);
+}
+
+void AnnotationJournal::appendRemove(AnnotationStore::Id id)
+{
+    QByteArray record;
+    record.append(char(OpRemove));
+    putU32(record, id);
+    append(record);
+}
+
+void AnnotationJournal::appendClear()
+{
+    append(QByteArray(1, char(OpClear)));
+}
+
+void AnnotationJournal::appendReset(const AnnotationStore &store)
+{
+    PROFILE_SCOPE("AnnotationJournal::appendReset");
+    if (!isOpen()) {
+        return;
+    }
+
+    // Undoing a clear brings back every line, a few MB for a large store,
+    // so the disk write stays off the caller's thread
+    QByteArray batch(1, char(OpClear));
+    batch.reserve(1 + store.size() * 21);
+    for (int i = 0; i < store.size(); ++i) {
+        putAdd(batch, store.idAt(i), store.lineAt(i));
+    }
+    queueWrite(batch, 1 + store.size());
+}
+
+void AnnotationJournal::appendStyle(const Style &style)
+{
+    QByteArray record;
+    putStyle(record, style);
+    append(record);
+}
+
+void AnnotationJournal::compactIfNeeded(const AnnotationStore &store, const Style &style)
+{
+    if (compacting || !isOpen()) {
+        return;
+    }
+    {
+        // The snapshot offset must be taken with every queued write on disk
+        QMutexLocker locker(&mutex);
+        if (pendingWrites > 0) {
+            return;
+        }
+    }
+
+    // Small journals are cheap to replay, large ones only when mostly garbage
+    const qint64 live = store.size() + (style.isSet ? 1 : 0);
+    const qint64 total = recordCount();
+    if (total < 1024 || total < 2 * live) {
+        return;
+    }
+
+    // The snapshot is taken here so it matches the store exactly
+    QByteArray snapshot = header(imageKey);
+    snapshot.reserve(snapshot.size() + 9 + store.size() * 21);
+    if (style.isSet) {
+        putStyle(snapshot, style);
+    }
+    for (int i = 0; i < store.size(); ++i) {
+        putAdd(snapshot, store.idAt(i), store.lineAt(i));
+    }
+
+    qint64 recordsAtSnapshot;
+    {
+        QMutexLocker locker(&mutex);
+        file.flush();
+        compactedAt = file.size();
+        recordsAtSnapshot = records;
+    }
+
+    compacting = true;
+    pool.start([this, snapshot, live, recordsAtSnapshot]() {
+        const bool compacted = compact(snapshot, live);
+
+        // Records appended while the snapshot was written were carried over
+        QMutexLocker locker(&mutex);
+        if (compacted) {
+            records = live + (records - recordsAtSnapshot);
+        }
+        compacting = false;
+    });
+}
+
+bool AnnotationJournal::compact(const QByteArray &snapshot, qint64 snapshotRecords)
+{
+    PROFILE_SCOPE("AnnotationJournal::compact");
+    QString path;
+    {
+        QMutexLocker locker(&mutex);
+        path = file.fileName();
+    }
+
+    // Written next to the journal and renamed over it on commit
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly) || out.write(snapshot) != snapshot.size()) {
+        qDebug() << "Annotation journal compaction failed:" << out.errorString();
+        return false;
+    }
+
+    QMutexLocker locker(&mutex);
+
+    // Edits appended since the snapshot follow it in the new file
+    file.flush();
+    QFile current(path);
+    if (current.open(QIODevice::ReadOnly) && current.seek(compactedAt)) {
+        out.write(current.readAll());
+    }
+    current.close();
+
+    // Reopened either way, the old file stays if the commit failed
+    file.close();
+    const bool committed = out.commit();
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        qDebug() << "Cannot reopen annotation journal:" << path;
+    }
+
+    if (committed) {
+        qDebug() << "Compacted annotation journal to" << snapshotRecords << "records";
+    } else {
+        qDebug() << "Annotation journal compaction failed:" << out.errorString();
+    }
+    return committed;
+}
@@ -0,0 +1,78 @@
+#ifndef ANNOTATIONJOURNAL_H
+#define ANNOTATIONJOURNAL_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+
+#include "annotationstore.h"
+
+// Append-only binary journal of the annotation edits made on one image.
+// Each edit is a few bytes appended to the file, nothing is ever rewritten
+// on the caller's thread. Resets, which carry every live line, are written
+// on the journal's thread, later edits queue behind them to keep the order.
+// Once most records are dead (removed or cleared
+// lines) the journal is compacted on a background thread into a snapshot of
+// the live lines, edits made meanwhile are carried over.
+//
+// File layout, little endian: "MIAJ", u16 version, u16 key length, UTF-8
+// image key, then records of a u8 opcode and its payload:
+//   Add    u32 id, f32 x1, y1, x2, y2
+//   Remove u32 id
+//   Clear
+//   Style  u32 ARGB color, f32 width
+class AnnotationJournal
+{
+public:
+    struct Style {
+        quint32 color = 0xFFFF0000u;
+        float width = 2.0f;
+        bool isSet = false;  // false until a Style record was read or written
+    };
+
+    AnnotationJournal();
+    ~AnnotationJournal();
+
+    // File in directory that holds the journal for imageKey (SOP Instance
+    // UID or file path)
+    static QString pathFor(const QString &directory, const QString &imageKey);
+
+    // Replays the journal at path into store, which is cleared first, and
+    // keeps it open for appending. A missing file starts an empty journal.
+    bool open(const QString &path, const QString &imageKey, AnnotationStore &store, Style &style);
+    void close();
+    bool isOpen() const;
+
+    void appendAdd(AnnotationStore::Id id, const QLineF &line);
+    void appendRemove(AnnotationStore::Id id);
+    void appendClear();
+    // A Clear followed by every line of store. Only the serialisation runs
+    // on the caller's thread, the write and flush are queued.
+    void appendReset(const AnnotationStore &store);
+    void appendStyle(const Style &style);
+
+    // Starts a background compaction when dead records dominate the file
+    void compactIfNeeded(const AnnotationStore &store, const Style &style);
+
+    qint64 recordCount() const;
+
+private:
+    static QByteArray header(const QString &imageKey);
+    void append(const QByteArray &record);
+    void queueWrite(const QByteArray &bytes, qint64 recordsInBytes);
+    bool compact(const QByteArray &snapshot, qint64 snapshotRecords);
+
+    QThreadPool pool;  // one thread, runs compactions and queued writes
+    mutable QMutex mutex;  // guards file, between appends and compaction
+    QFile file;
+    QString imageKey;
+    qint64 records;
+    int pendingWrites;  // queued on pool, appends go behind them while set
+    qint64 compactedAt;  // file offset the running compaction copied up to
+    std::atomic<bool> compacting;
+};
+
+#endif // ANNOTATIONJOURNAL_H
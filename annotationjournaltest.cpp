@@ -0,0 +1,274 @@
+// Replays annotation journals and compares the result with the store the
+// edits were made on, including a crash that tore the last record, a record
+// with a corrupt id and a journal compacted in the background.
+
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTest>
+#include <random>
+
+#include "annotationjournal.h"
+#include "annotationstore.h"
+
+namespace {
+
+// Coordinates a float holds exactly, the journal stores f32
+QLineF randomLine(std::mt19937 &random)
+{
+    std::uniform_int_distribution<int> position(0, 8192 * 4);
+    return QLineF(position(random) / 4.0, position(random) / 4.0, position(random) / 4.0, position(random) / 4.0);
+}
+
+// Same ids with the same lines, the array order may differ
+bool sameLines(const AnnotationStore &a, const AnnotationStore &b)
+{
+    if (a.size() != b.size()) {
+        qWarning() << "Line counts differ:" << a.size() << b.size();
+        return false;
+    }
+    for (int i = 0; i < a.size(); ++i) {
+        const AnnotationStore::Id id = a.idAt(i);
+        if (!b.contains(id) || b.line(id) != a.lineAt(i)) {
+            qWarning() << "Line" << id << "differs after replay";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Mixed adds, removes, clears and undone clears, mirrored in store
+void randomEdits(AnnotationJournal &journal, AnnotationStore &store, int count, std::mt19937 &random)
+{
+    AnnotationStore cleared;
+    for (int i = 0; i < count; ++i) {
+        const int kind = int(random() % 100);
+        if (kind < 60 || store.size() == 0) {
+            const QLineF line = randomLine(random);
+            journal.appendAdd(store.add(line), line);
+        } else if (kind < 95) {
+            const AnnotationStore::Id id = store.idAt(int(random() % store.size()));
+            store.remove(id);
+            journal.appendRemove(id);
+        } else if (kind < 98) {
+            // Clear, kept aside like the undo history does
+            cleared.clear();
+            store.swap(cleared);
+            journal.appendClear();
+        } else {
+            store.swap(cleared);
+            journal.appendReset(store);
+        }
+    }
+}
+
+}
+
+class AnnotationJournalTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void roundTrip();
+    void styleRoundTrip();
+    void truncatedTail();
+    void corruptId();
+    void compaction();
+    void otherImage();
+};
+
+void AnnotationJournalTest::roundTrip()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath("image.ann");
+
+    std::mt19937 random(1);
+    AnnotationStore store;
+    AnnotationJournal::Style style;
+    {
+        AnnotationJournal journal;
+        QVERIFY(journal.open(path, "image", store, style));
+        randomEdits(journal, store, 800, random);
+    }
+
+    AnnotationJournal journal;
+    AnnotationStore replayed;
+    AnnotationJournal::Style replayedStyle;
+    QVERIFY(journal.open(path, "image", replayed, replayedStyle));
+    QVERIFY(sameLines(store, replayed));
+    QVERIFY(!replayedStyle.isSet);
+
+    // Appends after a replay continue the same journal
+    const QLineF line = randomLine(random);
+    const AnnotationStore::Id id = replayed.add(line);
+    QVERIFY(!store.contains(id));
+    journal.appendAdd(id, line);
+    store.restore(id, line);
+    journal.close();
+
+    QVERIFY(journal.open(path, "image", replayed, replayedStyle));
+    QVERIFY(sameLines(store, replayed));
+}
+
+void AnnotationJournalTest::styleRoundTrip()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("image.ann");
+
+    AnnotationStore store;
+    AnnotationJournal::Style style;
+    {
+        AnnotationJournal journal;
+        QVERIFY(journal.open(path, "image", store, style));
+        style.color = 0xFF00FF00u;
+        style.width = 3.5f;
+        style.isSet = true;
+        journal.appendStyle(style);
+    }
+
+    AnnotationJournal journal;
+    AnnotationJournal::Style replayed;
+    QVERIFY(journal.open(path, "image", store, replayed));
+    QVERIFY(replayed.isSet);
+    QCOMPARE(replayed.color, style.color);
+    QCOMPARE(replayed.width, style.width);
+}
+
+void AnnotationJournalTest::truncatedTail()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("image.ann");
+
+    std::mt19937 random(2);
+    AnnotationStore store;
+    AnnotationJournal::Style style;
+    QLineF last;
+    {
+        AnnotationJournal journal;
+        QVERIFY(journal.open(path, "image", store, style));
+        randomEdits(journal, store, 200, random);
+
+        // The record a crash tears: an add, 21 bytes
+        last = randomLine(random);
+        journal.appendAdd(store.nextId(), last);
+    }
+
+    // Every cut inside the last record drops just that record
+    const qint64 fullSize = QFileInfo(path).size();
+    for (qint64 cut = 1; cut < 21; cut += 4) {
+        QVERIFY(QFile::resize(path, fullSize - cut));
+
+        AnnotationJournal journal;
+        AnnotationStore replayed;
+        QVERIFY(journal.open(path, "image", replayed, style));
+        QVERIFY(sameLines(store, replayed));
+        QCOMPARE(QFileInfo(path).size(), fullSize - 21);
+
+        // Restores the full file for the next cut
+        journal.appendAdd(store.nextId(), last);
+        journal.close();
+        QCOMPARE(QFileInfo(path).size(), fullSize);
+    }
+
+    // The re-appended record replays like any other
+    store.restore(store.nextId(), last);
+    AnnotationJournal journal;
+    AnnotationStore replayed;
+    QVERIFY(journal.open(path, "image", replayed, style));
+    QVERIFY(sameLines(store, replayed));
+}
+
+void AnnotationJournalTest::corruptId()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("image.ann");
+
+    std::mt19937 random(5);
+    AnnotationStore store;
+    AnnotationJournal::Style style;
+    {
+        AnnotationJournal journal;
+        QVERIFY(journal.open(path, "image", store, style));
+        randomEdits(journal, store, 200, random);
+        journal.appendAdd(store.nextId(), randomLine(random));
+    }
+
+    // The id of that last add, 20 bytes from the end, turned into one near
+    // the top of the range
+    const qint64 fullSize = QFileInfo(path).size();
+    {
+        QFile file(path);
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QVERIFY(file.seek(fullSize - 20));
+        const char id[4] = {'\xf0', '\xff', '\xff', '\xff'};
+        QCOMPARE(file.write(id, 4), qint64(4));
+    }
+
+    // Dropped like a torn record instead of sizing the id table for it
+    AnnotationJournal journal;
+    AnnotationStore replayed;
+    QVERIFY(journal.open(path, "image", replayed, style));
+    QVERIFY(sameLines(store, replayed));
+    QCOMPARE(QFileInfo(path).size(), fullSize - 21);
+}
+
+void AnnotationJournalTest::compaction()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("image.ann");
+
+    std::mt19937 random(3);
+    AnnotationStore store;
+    AnnotationJournal::Style style;
+    qint64 recordsBefore = 0;
+    {
+        AnnotationJournal journal;
+        QVERIFY(journal.open(path, "image", store, style));
+
+        // Mostly dead records, then a compaction with edits made meanwhile
+        for (int i = 0; i < 3000; ++i) {
+            const QLineF line = randomLine(random);
+            const AnnotationStore::Id id = store.add(line);
+            journal.appendAdd(id, line);
+            if (i % 4 != 0) {
+                store.remove(id);
+                journal.appendRemove(id);
+            }
+        }
+        recordsBefore = journal.recordCount();
+        journal.compactIfNeeded(store, style);
+        randomEdits(journal, store, 100, random);
+    }
+
+    AnnotationJournal journal;
+    AnnotationStore replayed;
+    QVERIFY(journal.open(path, "image", replayed, style));
+    QVERIFY(sameLines(store, replayed));
+    QVERIFY(journal.recordCount() < recordsBefore);
+}
+
+void AnnotationJournalTest::otherImage()
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("image.ann");
+
+    std::mt19937 random(4);
+    AnnotationStore store;
+    AnnotationJournal::Style style;
+    {
+        AnnotationJournal journal;
+        QVERIFY(journal.open(path, "image", store, style));
+        randomEdits(journal, store, 50, random);
+    }
+
+    // A journal written for another key is not replayed
+    AnnotationJournal journal;
+    AnnotationStore replayed;
+    QVERIFY(journal.open(path, "other", replayed, style));
+    QCOMPARE(replayed.size(), 0);
+}
+
+QTEST_GUILESS_MAIN(AnnotationJournalTest)
+
+#include "annotationjournaltest.moc"
@@ -1,14 +1,52 @@
 #include "annotationmanager.h"
+#include "annotationitem.h"
 #include <QDebug>
 
+#include "measurement.h"
+#include "profiler.h"
+
 AnnotationManager::AnnotationManager(QGraphicsScene *scene, QObject *parent)
-    : QObject(parent), scene(scene), currentLine(nullptr), selectedLine(nullptr),
-    drawingMode(false), isDrawingActive(false)
+    : QObject(parent), scene(scene), linesItem(nullptr), currentLine(nullptr), currentLabel(nullptr),
+    selectedLine(AnnotationStore::invalidId), drawingMode(false), isDrawingActive(false),
+    spacingX(0.0), spacingY(0.0), rescaleSlope(1.0), rescaleIntercept(0.0), measurementRequest(0)
 {
+    measurementPool.setMaxThreadCount(1);
+
     // Set up line appearance
     normalLinePen = QPen(Qt::red, 2, Qt::SolidLine);
     selectedLinePen = QPen(Qt::yellow, 3, Qt::SolidLine);
     drawingLinePen = QPen(Qt::blue, 2, Qt::DashLine);
+
+    // All finished lines are drawn by this one item
+    linesItem = new AnnotationItem(&store);
+    linesItem->setPens(normalLinePen, selectedLinePen);
+    scene->addItem(linesItem);
+}
+
+void AnnotationManager::openDocument(const QString &journalPath, const QString &imageKey)
+{
+    PROFILE_SCOPE("AnnotationManager::openDocument");
+    cancelCurrentLine();
+    selectedLine = AnnotationStore::invalidId;
+
+    // Edits of the previous image can no longer be undone
+    history.clear();
+    emit historyChanged(false, false);
+
+    // Replays straight into the store, nothing is journaled again
+    AnnotationJournal::Style style;
+    journal.open(journalPath, imageKey, store, style);
+    if (style.isSet) {
+        normalLinePen.setColor(QColor::fromRgba(style.color));
+        normalLinePen.setWidthF(style.width);
+        selectedLinePen.setWidthF(style.width + 1);
+        updateLineAppearance();
+    }
+    linesItem->storeReset();
+
+    emit lineCountChanged(store.size());
+    emit lineSelected(false);
+    clearMeasurement();
 }
 
 void AnnotationManager::setDrawingMode(bool enabled)
@@ -37,6 +75,13 @@ void AnnotationManager::startLine(const QPointF &startPoint)
     currentLine = scene->addLine(startPoint.x(), startPoint.y(),
                                  startPoint.x(), startPoint.y(),
                                  drawingLinePen);
+    currentLine->setZValue(2);
+
+    // Live length next to the cursor, at screen size whatever the zoom
+    currentLabel = new QGraphicsSimpleTextItem(currentLine);
+    currentLabel->setFlag(QGraphicsItem::ItemIgnoresTransformations);
+    currentLabel->setBrush(drawingLinePen.color().lighter(160));
+    currentLabel->setPos(startPoint);
 
     isDrawingActive = true;
     qDebug() << "Started line at:" << startPoint;
@@ -44,28 +89,40 @@ void AnnotationManager::startLine(const QPointF &startPoint)
 
 void AnnotationManager::updateLine(const QPointF &currentPoint)
 {
+    PROFILE_SCOPE("AnnotationManager::updateLine");
     if (!drawingMode || !isDrawingActive || !currentLine) return;
 
     // Update the temporary line to show current mouse position
     currentLine->setLine(lineStartPoint.x(), lineStartPoint.y(),
                          currentPoint.x(), currentPoint.y());
+
+    // Only the length on every move, an ellipse ROI can cover most of a
+    // huge image
+    const QLineF line = currentLine->line();
+    currentLabel->setText(Measurement::lengthText(line, spacingX, spacingY));
+    currentLabel->setPos(currentPoint);
+    showMeasurement(line, false);
 }
 
 void AnnotationManager::finishLine(const QPointF &endPoint)
 {
     if (!drawingMode || !isDrawingActive || !currentLine) return;
 
-    // Convert temporary line to permanent annotation
-    currentLine->setPen(normalLinePen);
-    annotationLines.append(currentLine);
+    // The rubber band line is only for feedback, the store keeps the result
+    const QLineF line = currentLine->line();
+    scene->removeItem(currentLine);
+    delete currentLine;
+    addLine(line);
+
+    // The panel keeps showing the finished line until something is selected
+    showMeasurement(line, true);
 
     qDebug() << "Finished line from:" << lineStartPoint << "to:" << endPoint;
 
     // Reset state
     currentLine = nullptr;
+    currentLabel = nullptr;
     isDrawingActive = false;
-
-    emit lineCountChanged(annotationLines.size());
 }
 
 void AnnotationManager::cancelCurrentLine()
@@ -74,84 +131,338 @@ void AnnotationManager::cancelCurrentLine()
         scene->removeItem(currentLine);
         delete currentLine;
         currentLine = nullptr;
+        currentLabel = nullptr;
     }
     isDrawingActive = false;
 }
 
+AnnotationStore::Id AnnotationManager::addLine(const QLineF &line)
+{
+    const AnnotationStore::Id id = store.nextId();
+    insertLine(id, line);
+
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::Command::AddLine;
+    command.id = id;
+    command.line = line;
+    recordCommand(command);
+    return id;
+}
+
 void AnnotationManager::clearAllLines()
 {
-    // Remove all lines from scene and delete them
-    for (QGraphicsLineItem *line : annotationLines) {
-        scene->removeItem(line);
-        delete line;
-    }
-    annotationLines.clear();
-    selectedLine = nullptr;
+    // Swapped out in one step instead of deleting line by line, the history
+    // keeps the old store so undo swaps it back
+    auto cleared = std::make_shared<AnnotationStore>();
+    swapLines(*cleared);
+
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::Command::ClearAll;
+    command.cleared = cleared;
+    recordCommand(command);
 
     qDebug() << "Cleared all annotation lines";
-    emit lineCountChanged(0);
-    emit lineSelected(false);
 }
 
 void AnnotationManager::deleteSelectedLine()
 {
-    if (selectedLine) {
-        scene->removeItem(selectedLine);
-        annotationLines.removeOne(selectedLine);
-        delete selectedLine;
-        selectedLine = nullptr;
+    if (store.contains(selectedLine)) {
+        AnnotationHistory::Command command;
+        command.type = AnnotationHistory::Command::DeleteLine;
+        command.id = selectedLine;
+        command.line = store.line(selectedLine);
 
+        eraseLine(selectedLine);
+        recordCommand(command);
         qDebug() << "Deleted selected line";
-        emit lineCountChanged(annotationLines.size());
-        emit lineSelected(false);
     }
 }
 
-void AnnotationManager::selectLine(QGraphicsLineItem *line)
+void AnnotationManager::insertLine(AnnotationStore::Id id, const QLineF &line)
+{
+    store.restore(id, line);
+    journal.appendAdd(id, line);
+    linesItem->lineChanged(line);
+    emit lineCountChanged(store.size());
+}
+
+void AnnotationManager::eraseLine(AnnotationStore::Id id)
 {
-    // Deselect previous line
-    if (selectedLine) {
-        selectedLine->setPen(normalLinePen);
+    if (id == selectedLine) {
+        clearSelection();
+    }
+
+    const QLineF line = store.line(id);
+    store.remove(id);
+    journal.appendRemove(id);
+    journal.compactIfNeeded(store, currentStyle());
+    linesItem->lineChanged(line);
+    emit lineCountChanged(store.size());
+}
+
+void AnnotationManager::swapLines(AnnotationStore &other)
+{
+    PROFILE_SCOPE("AnnotationManager::swapLines");
+    store.swap(other);
+    journal.appendReset(store);
+    journal.compactIfNeeded(store, currentStyle());
+
+    // One item to reset instead of one scene item per line
+    selectedLine = AnnotationStore::invalidId;
+    linesItem->storeReset();
+    emit lineCountChanged(store.size());
+    emit lineSelected(false);
+}
+
+void AnnotationManager::applyStyle(const AnnotationJournal::Style &style)
+{
+    normalLinePen.setColor(QColor::fromRgba(style.color));
+    normalLinePen.setWidthF(style.width);
+    selectedLinePen.setWidthF(style.width + 1);
+    updateLineAppearance();
+    journal.appendStyle(style);
+}
+
+void AnnotationManager::recordCommand(AnnotationHistory::Command command)
+{
+    history.push(std::move(command));
+    emit historyChanged(history.canUndo(), history.canRedo());
+}
+
+bool AnnotationManager::canUndo() const
+{
+    return history.canUndo();
+}
+
+bool AnnotationManager::canRedo() const
+{
+    return history.canRedo();
+}
+
+void AnnotationManager::undo()
+{
+    if (!history.canUndo()) {
+        return;
+    }
+    cancelCurrentLine();
+
+    const AnnotationHistory::Command command = history.undo();
+    switch (command.type) {
+    case AnnotationHistory::Command::AddLine:
+        eraseLine(command.id);
+        break;
+    case AnnotationHistory::Command::DeleteLine:
+        insertLine(command.id, command.line);
+        break;
+    case AnnotationHistory::Command::ClearAll:
+        swapLines(*command.cleared);
+        break;
+    case AnnotationHistory::Command::ChangeStyle:
+        applyStyle(command.before);
+        break;
+    }
+    emit historyChanged(history.canUndo(), history.canRedo());
+}
+
+void AnnotationManager::redo()
+{
+    if (!history.canRedo()) {
+        return;
+    }
+    cancelCurrentLine();
+
+    const AnnotationHistory::Command command = history.redo();
+    switch (command.type) {
+    case AnnotationHistory::Command::AddLine:
+        insertLine(command.id, command.line);
+        break;
+    case AnnotationHistory::Command::DeleteLine:
+        eraseLine(command.id);
+        break;
+    case AnnotationHistory::Command::ClearAll:
+        swapLines(*command.cleared);
+        break;
+    case AnnotationHistory::Command::ChangeStyle:
+        applyStyle(command.after);
+        break;
     }
+    emit historyChanged(history.canUndo(), history.canRedo());
+}
+
+void AnnotationManager::setHistoryLimits(qint64 budgetBytes, int maxCommands)
+{
+    history.setLimits(budgetBytes, maxCommands);
+    emit historyChanged(history.canUndo(), history.canRedo());
+}
+
+bool AnnotationManager::selectLineAt(const QPointF &scenePos, qreal tolerance)
+{
+    // Picking goes through the grid, only lines near scenePos are measured
+    selectedLine = store.hitTest(scenePos, tolerance);
+    linesItem->setSelectedId(selectedLine);
 
-    // Select new line
-    selectedLine = line;
-    if (selectedLine) {
-        selectedLine->setPen(selectedLinePen);
-        emit lineSelected(true);
+    const bool hasSelection = selectedLine != AnnotationStore::invalidId;
+    emit lineSelected(hasSelection);
+    if (hasSelection) {
+        showMeasurement(store.line(selectedLine), true);
     } else {
-        emit lineSelected(false);
+        clearMeasurement();
     }
+    return hasSelection;
+}
+
+void AnnotationManager::clearSelection()
+{
+    selectedLine = AnnotationStore::invalidId;
+    linesItem->setSelectedId(selectedLine);
+    emit lineSelected(false);
+    clearMeasurement();
 }
 
 int AnnotationManager::getLineCount() const
 {
-    return annotationLines.size();
+    return store.size();
+}
+
+const AnnotationStore &AnnotationManager::lineStore() const
+{
+    return store;
+}
+
+void AnnotationManager::setLinesVisible(bool visible)
+{
+    if (!visible) {
+        cancelCurrentLine();
+        clearSelection();
+    }
+    linesItem->setVisible(visible);
 }
 
 void AnnotationManager::setLineColor(const QColor &color)
 {
-    normalLinePen.setColor(color);
-    updateLineAppearance();
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::Command::ChangeStyle;
+    command.before = currentStyle();
+    command.after = command.before;
+    command.after.color = color.rgba();
+
+    applyStyle(command.after);
+    recordCommand(command);
 }
 
 void AnnotationManager::setLineWidth(int width)
 {
-    normalLinePen.setWidth(width);
-    selectedLinePen.setWidth(width + 1);
-    updateLineAppearance();
+    AnnotationHistory::Command command;
+    command.type = AnnotationHistory::Command::ChangeStyle;
+    command.before = currentStyle();
+    command.after = command.before;
+    command.after.width = float(width);
+
+    applyStyle(command.after);
+    recordCommand(command);
 }
 
-void AnnotationManager::updateLineAppearance()
+void AnnotationManager::setMeasurementSource(const PixelBuffer &pixels,
+                                             const DicomLoader::DicomMetadata &metadata)
 {
-    // Update all existing lines with new appearance
-    for (QGraphicsLineItem *line : annotationLines) {
-        if (line != selectedLine) {
-            line->setPen(normalLinePen);
-        }
+    spacingX = metadata.pixelSpacingX;
+    spacingY = metadata.pixelSpacingY;
+    rescaleSlope = metadata.rescaleSlope;
+    rescaleIntercept = metadata.rescaleIntercept;
+    linesItem->setCalibration(spacingX, spacingY);
+    setMeasurementPixels(pixels);
+}
+
+void AnnotationManager::setMeasurementPixels(const PixelBuffer &pixels)
+{
+    measurementPixels = pixels;
+    if (store.contains(selectedLine)) {
+        showMeasurement(store.line(selectedLine), true);
     }
+}
+
+void AnnotationManager::setViewScale(qreal scale)
+{
+    linesItem->setViewScale(scale);
+}
 
-    if (selectedLine) {
-        selectedLine->setPen(selectedLinePen);
+void AnnotationManager::showMeasurement(const QLineF &line, bool withStatistics)
+{
+    // Every request makes results still in flight stale
+    const quint64 request = ++measurementRequest;
+    const QString length = lengthSummary(line);
+    emit measurementChanged(length);
+    if (!withStatistics || measurementPixels.isNull()) {
+        return;
     }
+
+    // Requests that have not started yet are superseded anyway
+    measurementPool.clear();
+    const PixelBuffer pixels = measurementPixels;
+    const double xSpacing = spacingX, ySpacing = spacingY, slope = rescaleSlope, intercept = rescaleIntercept;
+    measurementPool.start([this, request, line, length, pixels, xSpacing, ySpacing, slope, intercept]() {
+        const QString summary = length + statisticsSummary(line, pixels, xSpacing, ySpacing, slope, intercept);
+        QMetaObject::invokeMethod(this, [this, request, summary]() {
+            if (request == measurementRequest) {
+                emit measurementChanged(summary);
+            }
+        }, Qt::QueuedConnection);
+    });
+}
+
+void AnnotationManager::clearMeasurement()
+{
+    ++measurementRequest;
+    emit measurementChanged(QString());
+}
+
+QString AnnotationManager::lengthSummary(const QLineF &line) const
+{
+    return QString("Length: %1").arg(Measurement::lengthText(line, spacingX, spacingY));
+}
+
+QString AnnotationManager::statisticsSummary(const QLineF &line, const PixelBuffer &pixels, double xSpacing,
+                                             double ySpacing, double slope, double intercept)
+{
+    PROFILE_SCOPE("AnnotationManager::statisticsSummary");
+    auto statsText = [](const Measurement::Stats &stats) {
+        return QString("mean %1, SD %2\nmin %3, max %4")
+            .arg(stats.mean, 0, 'f', 1)
+            .arg(stats.stdDev, 0, 'f', 1)
+            .arg(stats.min, 0, 'f', 1)
+            .arg(stats.max, 0, 'f', 1);
+    };
+
+    QString summary;
+    const Measurement::Stats profile = Measurement::lineStats(pixels, line, slope, intercept);
+    if (profile.isValid()) {
+        summary += QString("\nProfile, %1 samples:\n%2").arg(profile.count).arg(statsText(profile));
+    }
+
+    // The line spans an elliptical ROI, the usual mean/SD region on images
+    const Measurement::Stats roi =
+        Measurement::ellipseStats(pixels, QRectF(line.p1(), line.p2()), slope, intercept);
+    if (roi.isValid()) {
+        QString area = QString("%1 px").arg(roi.count);
+        if (xSpacing > 0.0 && ySpacing > 0.0) {
+            area = QString("%1 mm²").arg(roi.count * xSpacing * ySpacing, 0, 'f', 1);
+        }
+        summary += QString("\nEllipse ROI, %1:\n%2").arg(area, statsText(roi));
+    }
+    return summary;
+}
+
+AnnotationJournal::Style AnnotationManager::currentStyle() const
+{
+    AnnotationJournal::Style style;
+    style.color = normalLinePen.color().rgba();
+    style.width = float(normalLinePen.widthF());
+    style.isSet = true;
+    return style;
+}
+
+void AnnotationManager::updateLineAppearance()
+{
+    // Every line shares the item's pens
+    linesItem->setPens(normalLinePen, selectedLinePen);
 }
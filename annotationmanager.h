@@ -3,11 +3,20 @@
 
 #include <QGraphicsScene>
 #include <QGraphicsLineItem>
+#include <QGraphicsSimpleTextItem>
 #include <QPointF>
 #include <QColor>
 #include <QPen>
 #include <QList>
 #include <QMouseEvent>
+#include <QThreadPool>
+
+#include "annotationhistory.h"
+#include "annotationjournal.h"
+#include "annotationstore.h"
+#include "dicomloader.h"
+
+class AnnotationItem;
 
 class AnnotationManager : public QObject
 {
@@ -16,6 +25,10 @@ class AnnotationManager : public QObject
 public:
     explicit AnnotationManager(QGraphicsScene *scene, QObject *parent = nullptr);
 
+    // Switches to the annotations saved for imageKey (SOP Instance UID or file
+    // path) in journalPath, edits are journaled there from now on
+    void openDocument(const QString &journalPath, const QString &imageKey);
+
     // Mode management
     void setDrawingMode(bool enabled);
     bool isDrawingMode() const;
@@ -27,25 +40,57 @@ public:
     void cancelCurrentLine();
 
     // Line management
+    AnnotationStore::Id addLine(const QLineF &line);
     void clearAllLines();
     void deleteSelectedLine();
-    void selectLine(QGraphicsLineItem *line);
+    // Selects the line closest to scenePos within tolerance, returns false
+    // and clears the selection when there is none
+    bool selectLineAt(const QPointF &scenePos, qreal tolerance);
+    void clearSelection();
     int getLineCount() const;
+    const AnnotationStore &lineStore() const;
+    // Hides the lines without touching them, e.g. while a preview of the
+    // next image is shown
+    void setLinesVisible(bool visible);
 
     //Line appearance
     void setLineColor(const QColor &color);
     void setLineWidth(int width);
 
+    // Full precision pixels and calibration that measurements are taken
+    // from. A null buffer leaves only the length.
+    void setMeasurementSource(const PixelBuffer &pixels, const DicomLoader::DicomMetadata &metadata);
+    // Same calibration, another slice of the volume
+    void setMeasurementPixels(const PixelBuffer &pixels);
+    // View zoom, keeps the length labels at screen size
+    void setViewScale(qreal scale);
+
+    // Edit history, covers finished, deleted and cleared lines and style
+    bool canUndo() const;
+    bool canRedo() const;
+    void undo();
+    void redo();
+    void setHistoryLimits(qint64 budgetBytes, int maxCommands);
+
 signals:
     void lineCountChanged(int count);
     void lineSelected(bool hasSelection);
+    void historyChanged(bool canUndo, bool canRedo);
+    // Length of the line being drawn, or length and statistics of the line
+    // just finished or selected, empty when there is none. Statistics come
+    // in a second emit once a worker has them.
+    void measurementChanged(const QString &summary);
 
 
 private:
     QGraphicsScene *scene;
-    QList<QGraphicsLineItem*> annotationLines;
+    AnnotationStore store;
+    AnnotationJournal journal;
+    AnnotationHistory history;
+    AnnotationItem *linesItem;  // owned by the scene
     QGraphicsLineItem *currentLine;
-    QGraphicsLineItem *selectedLine;
+    QGraphicsSimpleTextItem *currentLabel;  // child of currentLine
+    AnnotationStore::Id selectedLine;
 
     bool drawingMode;
     bool isDrawingActive;
@@ -56,7 +101,32 @@ private:
     QPen selectedLinePen;
     QPen drawingLinePen;
 
+    // measurement source
+    PixelBuffer measurementPixels;
+    double spacingX;
+    double spacingY;
+    double rescaleSlope;
+    double rescaleIntercept;
+    QThreadPool measurementPool;  // one thread, only the latest request counts
+    quint64 measurementRequest;
+
+    // Length only while drawing, statistics of finished or selected lines
+    // are computed on measurementPool
+    void showMeasurement(const QLineF &line, bool withStatistics);
+    void clearMeasurement();
+    QString lengthSummary(const QLineF &line) const;
+    static QString statisticsSummary(const QLineF &line, const PixelBuffer &pixels, double xSpacing,
+                                     double ySpacing, double slope, double intercept);
+
     void updateLineAppearance();
+    AnnotationJournal::Style currentStyle() const;
+
+    // Apply an edit to store, journal and scene without touching the history
+    void insertLine(AnnotationStore::Id id, const QLineF &line);
+    void eraseLine(AnnotationStore::Id id);
+    void swapLines(AnnotationStore &other);
+    void applyStyle(const AnnotationJournal::Style &style);
+    void recordCommand(AnnotationHistory::Command command);
 };
 
 
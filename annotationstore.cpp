@@ -0,0 +1,322 @@
+#include "annotationstore.h"
+#include <algorithm>
+#include <cmath>
+
+AnnotationStore::AnnotationStore(qreal cellSize)
+    : cellSize(cellSize > 0.0 ? cellSize : 64.0)
+    , visitStamp(0)
+{
+}
+
+quint64 AnnotationStore::cellKey(int x, int y)
+{
+    return (quint64(quint32(x)) << 32) | quint32(y);
+}
+
+QRectF AnnotationStore::boxOf(const QLineF &line)
+{
+    return QRectF(line.p1(), line.p2()).normalized();
+}
+
+AnnotationStore::CellRange AnnotationStore::cellsFor(const QRectF &rect) const
+{
+    return CellRange{int(std::floor(rect.left() / cellSize)), int(std::floor(rect.top() / cellSize)),
+                     int(std::floor(rect.right() / cellSize)), int(std::floor(rect.bottom() / cellSize))};
+}
+
+// Calls visit(x, y) for each cell the segment passes through, a row of cells
+// at a time with the x range of the part of the segment inside that row. The
+// small pad keeps rounding at cell borders from losing a cell, so a long
+// diagonal lands in about two cells per row instead of its whole box.
+template <typename Visit>
+void AnnotationStore::forCellsCrossed(const QLineF &line, Visit &&visit) const
+{
+    const qreal pad = cellSize * 1e-3;
+    QPointF a = line.p1();
+    QPointF b = line.p2();
+    if (a.y() > b.y()) {
+        std::swap(a, b);
+    }
+    const qreal height = b.y() - a.y();
+
+    const int row0 = int(std::floor((a.y() - pad) / cellSize));
+    const int row1 = int(std::floor((b.y() + pad) / cellSize));
+    for (int y = row0; y <= row1; ++y) {
+        qreal left = std::min(a.x(), b.x());
+        qreal right = std::max(a.x(), b.x());
+        if (height > 0.0) {
+            const qreal top = std::clamp(y * cellSize, a.y(), b.y());
+            const qreal bottom = std::clamp((y + 1) * cellSize, a.y(), b.y());
+            left = a.x() + (b.x() - a.x()) * (top - a.y()) / height;
+            right = a.x() + (b.x() - a.x()) * (bottom - a.y()) / height;
+            if (left > right) {
+                std::swap(left, right);
+            }
+        }
+        const int x1 = int(std::floor((right + pad) / cellSize));
+        for (int x = int(std::floor((left - pad) / cellSize)); x <= x1; ++x) {
+            visit(x, y);
+        }
+    }
+}
+
+AnnotationStore::Id AnnotationStore::add(const QLineF &line)
+{
+    const Id id = nextId();
+    indexOfId.push_back(-1);
+    insert(id, line);
+    return id;
+}
+
+bool AnnotationStore::restore(Id id, const QLineF &line)
+{
+    if (id == invalidId || contains(id)) {
+        return false;
+    }
+    if (id >= indexOfId.size()) {
+        indexOfId.resize(size_t(id) + 1, -1);
+    }
+    insert(id, line);
+    return true;
+}
+
+AnnotationStore::Id AnnotationStore::nextId() const
+{
+    return Id(indexOfId.size());
+}
+
+void AnnotationStore::insert(Id id, const QLineF &line)
+{
+    indexOfId[id] = int(ids.size());
+
+    x1s.push_back(float(line.x1()));
+    y1s.push_back(float(line.y1()));
+    x2s.push_back(float(line.x2()));
+    y2s.push_back(float(line.y2()));
+    ids.push_back(id);
+
+    // Registered in the cells the stored line crosses, the same float
+    // coordinates remove() walks again
+    forCellsCrossed(lineAt(indexOfId[id]), [&](int x, int y) {
+        grid[cellKey(x, y)].push_back(id);
+    });
+
+    const QRectF box = boxOf(line);
+
+    // A zero sized box still has to count, QRectF::united would skip it
+    if (extent.isNull()) {
+        extent = box;
+    } else {
+        extent.setLeft(std::min(extent.left(), box.left()));
+        extent.setTop(std::min(extent.top(), box.top()));
+        extent.setRight(std::max(extent.right(), box.right()));
+        extent.setBottom(std::max(extent.bottom(), box.bottom()));
+    }
+}
+
+bool AnnotationStore::remove(Id id)
+{
+    if (!contains(id)) {
+        return false;
+    }
+
+    const int index = indexOfId[id];
+    forCellsCrossed(lineAt(index), [&](int x, int y) {
+        auto cell = grid.find(cellKey(x, y));
+        if (cell == grid.end()) {
+            return;
+        }
+        std::vector<Id> &members = cell.value();
+        auto it = std::find(members.begin(), members.end(), id);
+        if (it != members.end()) {
+            *it = members.back();
+            members.pop_back();
+        }
+        if (members.empty()) {
+            grid.erase(cell);
+        }
+    });
+
+    // Move the last line into the hole
+    const int last = int(ids.size()) - 1;
+    if (index != last) {
+        x1s[index] = x1s[last];
+        y1s[index] = y1s[last];
+        x2s[index] = x2s[last];
+        y2s[index] = y2s[last];
+        ids[index] = ids[last];
+        indexOfId[ids[index]] = index;
+    }
+    x1s.pop_back();
+    y1s.pop_back();
+    x2s.pop_back();
+    y2s.pop_back();
+    ids.pop_back();
+    indexOfId[id] = -1;
+    return true;
+}
+
+void AnnotationStore::clear()
+{
+    x1s.clear();
+    y1s.clear();
+    x2s.clear();
+    y2s.clear();
+    ids.clear();
+    indexOfId.clear();
+    grid.clear();
+    extent = QRectF();
+    visitMark.clear();
+}
+
+void AnnotationStore::swap(AnnotationStore &other)
+{
+    std::swap(cellSize, other.cellSize);
+    x1s.swap(other.x1s);
+    y1s.swap(other.y1s);
+    x2s.swap(other.x2s);
+    y2s.swap(other.y2s);
+    ids.swap(other.ids);
+    indexOfId.swap(other.indexOfId);
+    grid.swap(other.grid);
+    std::swap(extent, other.extent);
+    visitMark.swap(other.visitMark);
+    std::swap(visitStamp, other.visitStamp);
+}
+
+qint64 AnnotationStore::memoryUsage() const
+{
+    // Coordinates and id, the id map, plus roughly one grid entry per line
+    return qint64(ids.capacity()) * (4 * sizeof(float) + sizeof(Id))
+           + qint64(indexOfId.capacity()) * sizeof(int)
+           + qint64(ids.size()) * (sizeof(Id) + 8)
+           + qint64(visitMark.capacity()) * sizeof(quint32);
+}
+
+int AnnotationStore::size() const
+{
+    return int(ids.size());
+}
+
+bool AnnotationStore::contains(Id id) const
+{
+    return id < indexOfId.size() && indexOfId[id] >= 0;
+}
+
+QLineF AnnotationStore::line(Id id) const
+{
+    return contains(id) ? lineAt(indexOfId[id]) : QLineF();
+}
+
+QLineF AnnotationStore::lineAt(int index) const
+{
+    return QLineF(x1s[index], y1s[index], x2s[index], y2s[index]);
+}
+
+AnnotationStore::Id AnnotationStore::idAt(int index) const
+{
+    return ids[index];
+}
+
+QRectF AnnotationStore::bounds() const
+{
+    return extent;
+}
+
+AnnotationStore::Id AnnotationStore::hitTest(const QPointF &point, qreal tolerance) const
+{
+    const QRectF area(point.x() - tolerance, point.y() - tolerance, 2 * tolerance, 2 * tolerance);
+    std::vector<Id> candidates;
+    query(area, candidates);
+
+    Id best = invalidId;
+    qreal bestDistance = tolerance * tolerance;
+    for (Id id : candidates) {
+        const int index = indexOfId[id];
+        const qreal ax = x1s[index];
+        const qreal ay = y1s[index];
+        const qreal dx = x2s[index] - ax;
+        const qreal dy = y2s[index] - ay;
+
+        // Squared distance from point to the segment
+        const qreal lengthSquared = dx * dx + dy * dy;
+        qreal t = 0.0;
+        if (lengthSquared > 0.0) {
+            t = std::clamp(((point.x() - ax) * dx + (point.y() - ay) * dy) / lengthSquared, 0.0, 1.0);
+        }
+        const qreal ex = ax + t * dx - point.x();
+        const qreal ey = ay + t * dy - point.y();
+        const qreal distance = ex * ex + ey * ey;
+        if (distance <= bestDistance) {
+            bestDistance = distance;
+            best = id;
+        }
+    }
+    return best;
+}
+
+void AnnotationStore::query(const QRectF &rect, std::vector<Id> &result) const
+{
+    result.clear();
+    if (ids.empty()) {
+        return;
+    }
+
+    // Nothing outside the extent, keeps huge rects from walking empty cells
+    const QRectF area = rect.normalized().intersected(extent.adjusted(-1, -1, 1, 1));
+    if (area.isEmpty()) {
+        return;
+    }
+
+    if (visitMark.size() < indexOfId.size()) {
+        visitMark.resize(indexOfId.size(), 0);
+    }
+    if (++visitStamp == 0) {
+        std::fill(visitMark.begin(), visitMark.end(), 0);
+        visitStamp = 1;
+    }
+
+    // A rect covering most of the store is faster as a plain scan
+    const CellRange cells = cellsFor(area);
+    const qint64 cellCount = qint64(cells.x1 - cells.x0 + 1) * (cells.y1 - cells.y0 + 1);
+    if (cellCount > grid.size()) {
+        for (auto cell = grid.cbegin(); cell != grid.cend(); ++cell) {
+            const int x = int(quint32(cell.key() >> 32));
+            const int y = int(quint32(cell.key()));
+            if (x < cells.x0 || x > cells.x1 || y < cells.y0 || y > cells.y1) {
+                continue;
+            }
+            for (Id id : cell.value()) {
+                if (visitMark[id] != visitStamp) {
+                    visitMark[id] = visitStamp;
+                    result.push_back(id);
+                }
+            }
+        }
+    } else {
+        for (int y = cells.y0; y <= cells.y1; ++y) {
+            for (int x = cells.x0; x <= cells.x1; ++x) {
+                auto cell = grid.constFind(cellKey(x, y));
+                if (cell == grid.cend()) {
+                    continue;
+                }
+                for (Id id : cell.value()) {
+                    if (visitMark[id] != visitStamp) {
+                        visitMark[id] = visitStamp;
+                        result.push_back(id);
+                    }
+                }
+            }
+        }
+    }
+
+    // Cells are coarse, drop lines whose own box misses the rect
+    result.erase(std::remove_if(result.begin(), result.end(), [&](Id id) {
+        const int index = indexOfId[id];
+        const float left = std::min(x1s[index], x2s[index]);
+        const float right = std::max(x1s[index], x2s[index]);
+        const float top = std::min(y1s[index], y2s[index]);
+        const float bottom = std::max(y1s[index], y2s[index]);
+        return right < area.left() || left > area.right() || bottom < area.top() || top > area.bottom();
+    }), result.end());
+}
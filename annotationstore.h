@@ -0,0 +1,94 @@
+#ifndef ANNOTATIONSTORE_H
+#define ANNOTATIONSTORE_H
+
+#include <QHash>
+#include <QLineF>
+#include <QPointF>
+#include <QRectF>
+#include <cstdint>
+#include <vector>
+
+// Line annotations kept as flat coordinate arrays plus a uniform grid index,
+// so adding, removing, picking and culling stay cheap with hundreds of
+// thousands of segments. Every line gets an id that stays valid until it is
+// removed. Removal swaps the last line into the freed slot, so the array
+// order is not the insertion order.
+class AnnotationStore
+{
+public:
+    using Id = quint32;
+    static const Id invalidId = 0xFFFFFFFFu;
+
+    explicit AnnotationStore(qreal cellSize = 64.0);
+
+    Id add(const QLineF &line);
+    bool remove(Id id);
+
+    // Adds a line under a known id, for replaying saved edits. Fails when the
+    // id is in use.
+    bool restore(Id id, const QLineF &line);
+
+    // Id the next add() will return
+    Id nextId() const;
+
+    void clear();
+
+    // Exchanges contents with other in constant time. Clearing becomes a
+    // swap with an empty store, which keeps the old lines around for undo.
+    void swap(AnnotationStore &other);
+
+    // Approximate heap memory held
+    qint64 memoryUsage() const;
+
+    int size() const;
+    bool contains(Id id) const;
+    QLineF line(Id id) const;
+
+    // Dense access, index in [0, size())
+    QLineF lineAt(int index) const;
+    Id idAt(int index) const;
+
+    // Box around every line added since the last clear, never shrinks on
+    // remove so it is safe to use as an item bounding rect
+    QRectF bounds() const;
+
+    // Closest line within tolerance of point, invalidId if there is none
+    Id hitTest(const QPointF &point, qreal tolerance) const;
+
+    // Ids of lines that pass through the grid cells rect covers and whose
+    // bounding box intersects rect, each once. Every line crossing rect is in.
+    void query(const QRectF &rect, std::vector<Id> &ids) const;
+
+private:
+    struct CellRange {
+        int x0, y0, x1, y1;
+    };
+
+    void insert(Id id, const QLineF &line);
+    CellRange cellsFor(const QRectF &rect) const;
+    template <typename Visit>
+    void forCellsCrossed(const QLineF &line, Visit &&visit) const;
+    static quint64 cellKey(int x, int y);
+    static QRectF boxOf(const QLineF &line);
+
+    qreal cellSize;
+
+    // Structure of arrays, one entry per live line
+    std::vector<float> x1s;
+    std::vector<float> y1s;
+    std::vector<float> x2s;
+    std::vector<float> y2s;
+    std::vector<Id> ids;
+
+    // Id to array index, -1 for removed ids
+    std::vector<int> indexOfId;
+
+    QHash<quint64, std::vector<Id>> grid;
+    QRectF extent;
+
+    // Marks ids already reported by the running query
+    mutable std::vector<quint32> visitMark;
+    mutable quint32 visitStamp;
+};
+
+#endif // ANNOTATIONSTORE_H
@@ -0,0 +1,157 @@
+#include "asyncimageloader.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QThread>
+
+#include "imagecache.h"
+#include "volumeloader.h"
+
+AsyncImageLoader::AsyncImageLoader(QObject *parent)
+    : QObject(parent)
+    , cache(nullptr)
+    , currentRequest(0)
+    , loading(false)
+{
+    // A dropped load may still be inside GDCM, so keep spare workers around
+    // to start the next one straight away
+    pool.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+}
+
+AsyncImageLoader::~AsyncImageLoader()
+{
+    // Workers post back to this object, they must be gone before it is
+    cancel();
+    pool.waitForDone();
+}
+
+quint64 AsyncImageLoader::load(const QString &fileName)
+{
+    // Drop whatever is still running, its result will be ignored
+    if (currentCancel) {
+        currentCancel->store(true);
+    }
+
+    const quint64 requestId = ++currentRequest;
+    auto cancelFlag = std::make_shared<std::atomic_bool>(false);
+    currentCancel = cancelFlag;
+    currentFileName = fileName;
+    loading = true;
+
+    qDebug() << "Queued background load" << requestId << ":" << fileName;
+    emit loadStarted(fileName);
+
+    pool.start([this, requestId, fileName, cancelFlag]() {
+        runLoad(requestId, fileName, cancelFlag);
+    });
+
+    return requestId;
+}
+
+void AsyncImageLoader::cancel()
+{
+    if (!loading) {
+        return;
+    }
+
+    if (currentCancel) {
+        currentCancel->store(true);
+    }
+
+    // Bump the id so a result already on its way is discarded
+    ++currentRequest;
+    loading = false;
+    emit loadCanceled(currentFileName);
+}
+
+void AsyncImageLoader::setCache(ImageCache *imageCache)
+{
+    cache = imageCache;
+}
+
+bool AsyncImageLoader::isLoading() const
+{
+    return loading;
+}
+
+bool AsyncImageLoader::isCurrent(quint64 requestId) const
+{
+    return loading && requestId == currentRequest;
+}
+
+void AsyncImageLoader::runLoad(quint64 requestId, const QString &fileName,
+                               std::shared_ptr<std::atomic_bool> cancelFlag)
+{
+    // Runs on a worker thread, everything that touches this object is posted
+    // back to the GUI thread
+    auto progress = [this, requestId, cancelFlag](int percent, const QString &stage) {
+        if (cancelFlag->load()) {
+            return false;
+        }
+        QMetaObject::invokeMethod(this, [this, requestId, percent, stage]() {
+            if (isCurrent(requestId)) {
+                emit progressChanged(percent, stage);
+            }
+        }, Qt::QueuedConnection);
+        return true;
+    };
+
+    DicomLoader::LoadResult result;
+    bool wasCanceled = false;
+
+    // A prefetch already decoding this file finishes sooner than a new decode
+    if (cache && !cache->waitForDecode(fileName, cancelFlag.get())) {
+        qDebug() << "Dropped background load" << requestId << ":" << fileName;
+        return;
+    }
+    const bool cached = cache && cache->lookup(fileName, result);
+
+    if (cached) {
+        // Already decoded and unchanged on disk
+        qDebug() << "Cache hit:" << fileName;
+        progress(100, "Cached");
+    } else if (QFileInfo(fileName).isDir()) {
+        // A directory is loaded as one series volume
+        VolumeLoader loader;
+        loader.setProgressCallback(progress);
+        result = loader.loadSeries(fileName);
+        wasCanceled = loader.wasCanceled();
+    } else {
+        DicomLoader loader;
+        loader.setProgressCallback(progress);
+        loader.setPreviewCallback([this, requestId, fileName, cancelFlag](const QImage &preview,
+                                                                         const QSize &fullSize) {
+            if (cancelFlag->load()) {
+                return;
+            }
+            QMetaObject::invokeMethod(this, [this, requestId, fileName, preview, fullSize]() {
+                if (isCurrent(requestId)) {
+                    emit previewReady(fileName, preview, fullSize);
+                }
+            }, Qt::QueuedConnection);
+        });
+        result = loader.loadFile(fileName);
+        wasCanceled = loader.wasCanceled();
+    }
+
+    if (wasCanceled || cancelFlag->load()) {
+        qDebug() << "Dropped background load" << requestId << ":" << fileName;
+        return;
+    }
+
+    if (cache && !cached && !result.isNull()) {
+        cache->insert(fileName, result);
+    }
+
+    QMetaObject::invokeMethod(this, [this, requestId, fileName, result]() {
+        if (!isCurrent(requestId)) {
+            return;
+        }
+        loading = false;
+
+        if (result.isNull()) {
+            emit loadFailed(fileName);
+        } else {
+            emit loadFinished(fileName, result);
+        }
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,58 @@
+#ifndef ASYNCIMAGELOADER_H
+#define ASYNCIMAGELOADER_H
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+
+#include "dicomloader.h"
+
+class ImageCache;
+
+// Decodes images on a worker pool so the GUI thread never blocks on GDCM.
+// Only the most recent request is delivered, starting a new load cancels the
+// previous one. Results carry a QImage, the QPixmap is left to the receiver
+// on the GUI thread.
+class AsyncImageLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AsyncImageLoader(QObject *parent = nullptr);
+    ~AsyncImageLoader();
+
+    // Starts loading fileName, a directory is loaded as a series volume.
+    // Returns the id of the request.
+    quint64 load(const QString &fileName);
+    void cancel();
+    bool isLoading() const;
+
+    // Decoded results are looked up in and added to cache, may be null
+    void setCache(ImageCache *cache);
+
+signals:
+    void loadStarted(const QString &fileName);
+    void progressChanged(int percent, const QString &stage);
+    // Reduced size image of a large file ahead of loadFinished, scaled up to
+    // fullSize it covers the same area as the final image
+    void previewReady(const QString &fileName, const QImage &preview, const QSize &fullSize);
+    void loadFinished(const QString &fileName, const DicomLoader::LoadResult &result);
+    void loadFailed(const QString &fileName);
+    void loadCanceled(const QString &fileName);
+
+private:
+    void runLoad(quint64 requestId, const QString &fileName,
+                 std::shared_ptr<std::atomic_bool> cancelFlag);
+    bool isCurrent(quint64 requestId) const;
+
+    QThreadPool pool;
+    ImageCache *cache;
+    quint64 currentRequest;
+    QString currentFileName;
+    std::shared_ptr<std::atomic_bool> currentCancel;
+    bool loading;
+};
+
+#endif // ASYNCIMAGELOADER_H
@@ -0,0 +1,82 @@
+#ifndef BENCHFIXTURES_H
+#define BENCHFIXTURES_H
+
+#include <QString>
+#include <QVector>
+
+// Synthetic DICOM files read by the bench target. makefixtures writes them at
+// build time, the benchmarks look them up by the same names, so both sides
+// share this table.
+namespace BenchFixtures
+{
+
+enum class Codec {
+    Uncompressed,  // explicit VR little endian, takes the memory mapped path
+    Rle,
+    JpegLs
+};
+
+struct Fixture {
+    int size;  // width and height
+    int bitsStored;
+    bool isSigned;
+    Codec codec;
+
+    int bitsAllocated() const { return bitsStored <= 8 ? 8 : 16; }
+
+    QString name() const
+    {
+        static const char *const codecs[] = {"raw", "rle", "jpegls"};
+        return QString("%1_%2%3_%4")
+            .arg(size)
+            .arg(bitsStored)
+            .arg(isSigned ? 's' : 'u')
+            .arg(codecs[int(codec)]);
+    }
+
+    QString fileName() const { return name() + ".dcm"; }
+};
+
+// Every pixel format at a moderate size, plus a size sweep of the common
+// 16-bit unsigned case up to 8k. The sweep skips RLE at 8k, it adds build
+// time without telling anything the 4k file does not.
+inline QVector<Fixture> all()
+{
+    QVector<Fixture> fixtures;
+    for (int bits : {8, 12, 16}) {
+        for (bool isSigned : {false, true}) {
+            for (Codec codec : {Codec::Uncompressed, Codec::Rle, Codec::JpegLs}) {
+                fixtures.append({512, bits, isSigned, codec});
+            }
+        }
+    }
+    for (int size : {256, 1024, 4096, 8192}) {
+        for (Codec codec : {Codec::Uncompressed, Codec::Rle, Codec::JpegLs}) {
+            if (size == 8192 && codec == Codec::Rle) {
+                continue;
+            }
+            fixtures.append({size, 16, false, codec});
+        }
+    }
+    return fixtures;
+}
+
+// A CT-like series of single frame files for the volume loader, each slice
+// an uncompressed 16-bit fixture positioned 1 mm further along z
+struct Series {
+    int size;
+    int slices;
+
+    Fixture slice() const { return {size, 16, false, Codec::Uncompressed}; }
+    QString directoryName() const { return QString("series_%1x%2").arg(slices).arg(size); }
+    QString sliceFileName(int index) const { return QString("slice_%1.dcm").arg(index, 3, 10, QChar('0')); }
+};
+
+inline Series series()
+{
+    return {512, 512};
+}
+
+}
+
+#endif // BENCHFIXTURES_H
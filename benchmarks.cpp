@@ -0,0 +1,679 @@
+// Google Benchmark suite for the decode, render, viewer and annotation paths.
+//
+//   cmake -DMEDICAL_IMAGE_BENCH=ON .. && cmake --build . --target bench_json
+//
+// bench_json runs everything and writes bench-results.json. Two of those
+// files compare with tools/compare.py from Google Benchmark:
+//
+//   compare.py benchmarks old.json new.json
+//
+// The DICOM fixtures are generated by makefixtures at build time. Load
+// timings read them from the page cache, so they measure parsing and
+// decoding, not the disk.
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QApplication>
+#include <QImage>
+#include <QPixmap>
+#include <QScrollBar>
+#include <QTemporaryDir>
+#include <QThread>
+#include <benchmark/benchmark.h>
+#include <climits>
+#include <cstdio>
+#include <random>
+#include <vector>
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#include "annotationjournal.h"
+#include "annotationstore.h"
+#include "benchfixtures.h"
+#include "dicomloader.h"
+#include "imagecache.h"
+#include "imageviewer.h"
+#include "measurement.h"
+#include "pixelconverter.h"
+#include "pixelpyramid.h"
+#include "volumeloader.h"
+#include "windowlevel.h"
+
+#ifndef BENCH_FIXTURE_DIR
+#define BENCH_FIXTURE_DIR "fixtures"
+#endif
+
+namespace {
+
+QString fixtureDir()
+{
+    const QString dir = qEnvironmentVariable("BENCH_FIXTURE_DIR");
+    return dir.isEmpty() ? QString(BENCH_FIXTURE_DIR) : dir;
+}
+
+void quietMessages(QtMsgType type, const QMessageLogContext &, const QString &message)
+{
+    // The loader logs every step with qDebug
+    if (type != QtDebugMsg && type != QtInfoMsg) {
+        fprintf(stderr, "%s\n", qPrintable(message));
+    }
+}
+
+// Starts a new peak memory measurement. Linux resets the high water mark
+// through clear_refs, elsewhere the peak stays the one of the whole process.
+void resetPeakResident()
+{
+    QFile clearRefs("/proc/self/clear_refs");
+    if (clearRefs.open(QIODevice::WriteOnly)) {
+        clearRefs.write("5");
+    }
+}
+
+// Peak resident set size since resetPeakResident, includes the pages of a
+// mapped file that were actually read
+double peakResidentMb()
+{
+    QFile status("/proc/self/status");
+    if (status.open(QIODevice::ReadOnly)) {
+        for (const QByteArray &line : status.readAll().split('\n')) {
+            if (line.startsWith("VmHWM:")) {
+                return line.mid(6).trimmed().split(' ').first().toLongLong() / 1024.0;
+            }
+        }
+    }
+#ifdef Q_OS_UNIX
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MACOS
+        return usage.ru_maxrss / (1024.0 * 1024.0);  // bytes
+#else
+        return usage.ru_maxrss / 1024.0;  // kilobytes
+#endif
+    }
+#endif
+    return 0.0;
+}
+
+PixelBuffer randomPixels(int width, int height, int bits, bool isSigned)
+{
+    std::mt19937 random(42);
+    auto *samples = new uint16_t[size_t(width) * size_t(height)];
+    const int range = 1 << bits;
+    const int low = isSigned ? -(range / 2) : 0;
+    for (size_t i = 0; i < size_t(width) * size_t(height); ++i) {
+        samples[i] = uint16_t(low + int(random() % range));
+    }
+
+    PixelBuffer pixels;
+    pixels.width = width;
+    pixels.height = height;
+    pixels.bitsStored = bits;
+    pixels.isSigned = isSigned;
+    pixels.minValue = low;
+    pixels.maxValue = low + range - 1;
+    pixels.data = std::shared_ptr<const uint16_t>(samples, std::default_delete<uint16_t[]>());
+    return pixels;
+}
+
+// ---- DICOM fixtures ----
+
+void loadFile(benchmark::State &state, const QString &path, qint64 pixelBytes)
+{
+    DicomLoader loader;
+    resetPeakResident();
+    for (auto _ : state) {
+        const DicomLoader::LoadResult result = loader.loadFile(path);
+        if (result.isNull()) {
+            state.SkipWithError("load failed");
+            break;
+        }
+        benchmark::DoNotOptimize(result.image.constBits());
+    }
+    state.SetBytesProcessed(state.iterations() * pixelBytes);
+    state.counters["peak_rss_mb"] = peakResidentMb();
+}
+
+void readHeader(benchmark::State &state, const QString &path)
+{
+    DicomLoader loader;
+    for (auto _ : state) {
+        const DicomLoader::DicomMetadata metadata = loader.extractMetadata(path);
+        benchmark::DoNotOptimize(metadata.imageWidth);
+    }
+}
+
+void detect(benchmark::State &state, const QString &path)
+{
+    DicomLoader loader;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(loader.isDicomFile(path));
+    }
+}
+
+void convertToQImage(benchmark::State &state, const QString &path)
+{
+    DicomLoader loader;
+    const DicomLoader::LoadResult result = loader.loadFile(path);
+    if (result.pixels.isNull()) {
+        state.SkipWithError("load failed");
+        return;
+    }
+    for (auto _ : state) {
+        const QImage image = loader.convertToQImage(result.pixels, result.metadata);
+        benchmark::DoNotOptimize(image.constBits());
+    }
+    state.SetItemsProcessed(state.iterations() * result.pixels.width * result.pixels.height);
+}
+
+void pixmapUpload(benchmark::State &state, const QString &path)
+{
+    DicomLoader loader;
+    const DicomLoader::LoadResult result = loader.loadFile(path);
+    if (result.isNull()) {
+        state.SkipWithError("load failed");
+        return;
+    }
+    for (auto _ : state) {
+        const QPixmap pixmap = QPixmap::fromImage(result.image);
+        benchmark::DoNotOptimize(pixmap.cacheKey());
+    }
+    state.SetBytesProcessed(state.iterations() * result.image.sizeInBytes());
+}
+
+void cacheHit(benchmark::State &state, const QString &path)
+{
+    DicomLoader loader;
+    ImageCache cache;
+    cache.insert(path, loader.loadFile(path));
+    DicomLoader::LoadResult result;
+    for (auto _ : state) {
+        if (!cache.lookup(path, result)) {
+            state.SkipWithError("cache miss");
+            break;
+        }
+        benchmark::DoNotOptimize(result.image.constBits());
+    }
+}
+
+void loadSeries(benchmark::State &state, const QString &directory, qint64 pixelBytes)
+{
+    for (auto _ : state) {
+        state.PauseTiming();
+        resetPeakResident();
+        state.ResumeTiming();
+
+        VolumeLoader loader;
+        const DicomLoader::LoadResult result = loader.loadSeries(directory);
+        if (result.volume == nullptr) {
+            state.SkipWithError("load failed");
+            break;
+        }
+        benchmark::DoNotOptimize(result.image.constBits());
+    }
+    state.SetBytesProcessed(state.iterations() * pixelBytes);
+    state.counters["peak_rss_mb"] = peakResidentMb();
+}
+
+// ---- viewer ----
+
+// Runs queued work such as pyramid levels and scheduled repaints
+void settle(int milliseconds)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.elapsed() < milliseconds) {
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+        QThread::msleep(1);
+    }
+}
+
+// A full HD viewer showing path at state.range(0) percent, 0 fits the image
+bool showInViewer(benchmark::State &state, ImageViewer &viewer, const QString &path)
+{
+    DicomLoader loader;
+    const DicomLoader::LoadResult result = loader.loadFile(path);
+    if (result.isNull()) {
+        state.SkipWithError("load failed");
+        return false;
+    }
+    viewer.resize(1920, 1080);
+    viewer.show();
+    viewer.displayImage(result);
+    settle(500);
+    if (state.range(0) > 0) {
+        const qreal scale = state.range(0) / 100.0;
+        viewer.setTransform(QTransform::fromScale(scale, scale));
+        viewer.centerOn(viewer.sceneRect().center());
+        settle(200);
+    }
+    return true;
+}
+
+// Repaint of the whole viewport with the image standing still
+void viewerPaint(benchmark::State &state, const QString &path)
+{
+    ImageViewer viewer;
+    if (!showInViewer(state, viewer, path)) {
+        return;
+    }
+    QImage target(viewer.viewport()->size(), QImage::Format_ARGB32_Premultiplied);
+    for (auto _ : state) {
+        viewer.viewport()->render(&target);
+        benchmark::DoNotOptimize(target.constBits());
+    }
+    state.SetItemsProcessed(state.iterations() * target.width() * target.height());
+}
+
+// A pan drag, 24 px per frame, sweeping across the image and back
+void viewerPan(benchmark::State &state, const QString &path)
+{
+    ImageViewer viewer;
+    if (!showInViewer(state, viewer, path)) {
+        return;
+    }
+    QScrollBar *scrollBar = viewer.horizontalScrollBar();
+    if (scrollBar->maximum() == scrollBar->minimum()) {
+        state.SkipWithError("image fits the viewport");
+        return;
+    }
+    QImage target(viewer.viewport()->size(), QImage::Format_ARGB32_Premultiplied);
+    int step = 24;
+    for (auto _ : state) {
+        int next = scrollBar->value() + step;
+        if (next < scrollBar->minimum() || next > scrollBar->maximum()) {
+            step = -step;
+            next = scrollBar->value() + step;
+        }
+        scrollBar->setValue(next);
+        viewer.viewport()->render(&target);
+        benchmark::DoNotOptimize(target.constBits());
+    }
+    state.SetItemsProcessed(state.iterations() * target.width() * target.height());
+}
+
+void registerFixtureBenchmarks()
+{
+    const QString dir = fixtureDir();
+    for (const BenchFixtures::Fixture &fixture : BenchFixtures::all()) {
+        const QString path = dir + "/" + fixture.fileName();
+        if (!QFileInfo::exists(path)) {
+            continue;
+        }
+        const std::string name = fixture.name().toStdString();
+        const qint64 pixelBytes = qint64(fixture.size) * fixture.size * (fixture.bitsAllocated() / 8);
+
+        benchmark::RegisterBenchmark(("Load/" + name).c_str(), loadFile, path, pixelBytes)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("ConvertToQImage/" + name).c_str(), convertToQImage, path)
+            ->Unit(benchmark::kMillisecond);
+
+        // Per file costs that do not depend on the pixel format
+        if (fixture.bitsStored == 16 && !fixture.isSigned && fixture.codec == BenchFixtures::Codec::Uncompressed) {
+            benchmark::RegisterBenchmark(("Detect/" + name).c_str(), detect, path);
+            benchmark::RegisterBenchmark(("ReadHeader/" + name).c_str(), readHeader, path);
+            benchmark::RegisterBenchmark(("PixmapUpload/" + name).c_str(), pixmapUpload, path)
+                ->Unit(benchmark::kMillisecond);
+            benchmark::RegisterBenchmark(("CacheHit/" + name).c_str(), cacheHit, path);
+        }
+
+        // The viewer at fit, 1:1 and 4x, the sizes a pyramid matters for
+        if (fixture.size >= 4096 && fixture.codec == BenchFixtures::Codec::Uncompressed) {
+            benchmark::RegisterBenchmark(("ViewerPaint/" + name).c_str(), viewerPaint, path)
+                ->Arg(0)->Arg(100)->Arg(400)->Unit(benchmark::kMillisecond);
+            benchmark::RegisterBenchmark(("ViewerPan/" + name).c_str(), viewerPan, path)
+                ->Arg(100)->Arg(400)->Unit(benchmark::kMillisecond);
+        }
+    }
+
+    const BenchFixtures::Series series = BenchFixtures::series();
+    const QString seriesDir = dir + "/" + series.directoryName();
+    if (QFileInfo::exists(seriesDir)) {
+        const qint64 pixelBytes = qint64(series.slices) * series.size * series.size * 2;
+        benchmark::RegisterBenchmark(("LoadSeries/" + series.directoryName()).toStdString().c_str(), loadSeries,
+                                     seriesDir, pixelBytes)
+            ->Unit(benchmark::kMillisecond);
+    }
+}
+
+// ---- pixel kernels, once per code path the CPU supports ----
+
+const size_t rowLength = 4096;
+
+template <typename Body>
+void onIsa(benchmark::State &state, PixelConverter::Isa isa, Body body)
+{
+    const PixelConverter::Isa previous = PixelConverter::activeIsa();
+    PixelConverter::setIsa(isa);
+    body(state);
+    PixelConverter::setIsa(previous);
+    state.SetItemsProcessed(state.iterations() * int64_t(rowLength));
+    state.counters["MP/s"] = benchmark::Counter(double(state.iterations()) * double(rowLength) / 1e6,
+                                                benchmark::Counter::kIsRate);
+}
+
+void convertRow8(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 1, 16, false);
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(pixels.constRow(0));
+    std::vector<uint8_t> out(rowLength);
+    for (auto _ : state) {
+        PixelConverter::convertRow8(src, out.data(), rowLength);
+        benchmark::ClobberMemory();
+    }
+}
+
+void convertRow12(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 1, 12, false);
+    std::vector<uint8_t> out(rowLength);
+    for (auto _ : state) {
+        PixelConverter::convertRow12(pixels.constRow(0), out.data(), rowLength);
+        benchmark::ClobberMemory();
+    }
+}
+
+void convertRow16(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 1, 16, false);
+    std::vector<uint8_t> out(rowLength);
+    for (auto _ : state) {
+        PixelConverter::convertRow16(pixels.constRow(0), out.data(), rowLength);
+        benchmark::ClobberMemory();
+    }
+}
+
+void rowMinMax(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 1, 16, true);
+    for (auto _ : state) {
+        int min = INT_MAX;
+        int max = INT_MIN;
+        PixelConverter::rowMinMax(pixels.constRow(0), rowLength, true, min, max);
+        benchmark::DoNotOptimize(min);
+        benchmark::DoNotOptimize(max);
+    }
+}
+
+void rowSums(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 1, 16, false);
+    for (auto _ : state) {
+        int64_t sum = 0;
+        uint64_t squares = 0;
+        PixelConverter::rowSums(pixels.constRow(0), rowLength, false, sum, squares);
+        benchmark::DoNotOptimize(sum);
+        benchmark::DoNotOptimize(squares);
+    }
+}
+
+void normalizeRow(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 1, 16, false);
+    std::vector<uint16_t> row(pixels.constRow(0), pixels.constRow(0) + rowLength);
+    for (auto _ : state) {
+        PixelConverter::normalizeRow(row.data(), rowLength, 12, true);
+        benchmark::ClobberMemory();
+    }
+}
+
+void downsampleRow2x(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 2, 16, false);
+    std::vector<uint16_t> out(rowLength / 2);
+    for (auto _ : state) {
+        PixelConverter::downsampleRow2x(pixels.constRow(0), pixels.constRow(1), rowLength, false, out.data());
+        benchmark::ClobberMemory();
+    }
+}
+
+void ybrRowToRgb32(benchmark::State &state)
+{
+    // Random 16-bit samples seen as bytes, enough for three per pixel
+    const PixelBuffer pixels = randomPixels(int(rowLength), 2, 16, false);
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(pixels.constRow(0));
+    std::vector<uint32_t> out(rowLength);
+    for (auto _ : state) {
+        PixelConverter::ybrRowToRgb32(src, out.data(), rowLength);
+        benchmark::ClobberMemory();
+    }
+}
+
+void ybr422RowToRgb32(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 1, 16, false);
+    const uint8_t *src = reinterpret_cast<const uint8_t *>(pixels.constRow(0));
+    std::vector<uint32_t> out(rowLength);
+    for (auto _ : state) {
+        PixelConverter::ybr422RowToRgb32(src, out.data(), rowLength);
+        benchmark::ClobberMemory();
+    }
+}
+
+void paletteRow16ToRgb32(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 1, 16, false);
+    std::vector<uint32_t> table(65536);
+    for (size_t i = 0; i < table.size(); ++i) {
+        table[i] = 0xff000000u | uint32_t(i * 2654435761u >> 8);
+    }
+    std::vector<uint32_t> out(rowLength);
+    for (auto _ : state) {
+        PixelConverter::paletteRow16ToRgb32(pixels.constRow(0), table.data(), out.data(), rowLength);
+        benchmark::ClobberMemory();
+    }
+}
+
+void registerKernelBenchmarks()
+{
+    using PixelConverter::Isa;
+    const std::pair<const char *, void (*)(benchmark::State &)> kernels[] = {
+        {"ConvertRow8", convertRow8},
+        {"ConvertRow12", convertRow12},
+        {"ConvertRow16", convertRow16},
+        {"RowMinMax", rowMinMax},
+        {"RowSums", rowSums},
+        {"NormalizeRow", normalizeRow},
+        {"DownsampleRow2x", downsampleRow2x},
+        {"YbrRowToRgb32", ybrRowToRgb32},
+        {"Ybr422RowToRgb32", ybr422RowToRgb32},
+        {"PaletteRow16ToRgb32", paletteRow16ToRgb32},
+    };
+    for (Isa isa : {Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::NEON}) {
+        if (!PixelConverter::isIsaSupported(isa)) {
+            continue;
+        }
+        for (const auto &kernel : kernels) {
+            const std::string name = std::string("Kernel/") + kernel.first + "/" + PixelConverter::isaName(isa);
+            auto body = kernel.second;
+            benchmark::RegisterBenchmark(name.c_str(), [isa, body](benchmark::State &state) {
+                onIsa(state, isa, body);
+            });
+        }
+    }
+}
+
+// ---- window/level and rendering ----
+
+void BM_WindowLevelRgb32(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(rowLength), 1, 12, false);
+    WindowLevelLut lut;
+    lut.setDataRange(pixels.minValue, pixels.maxValue);
+    lut.setWindow(2048, 1024);
+    std::vector<uint32_t> out(rowLength);
+    for (auto _ : state) {
+        lut.applyRowRgb32(pixels.constRow(0), out.data(), rowLength);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * int64_t(rowLength));
+}
+BENCHMARK(BM_WindowLevelRgb32);
+
+// A window drag moves the window a few units per event
+void BM_WindowLevelDrag(benchmark::State &state)
+{
+    WindowLevelLut lut;
+    lut.setPixelFormat(true, 1.0, -1024.0);
+    lut.setDataRange(-32768, 32767);
+    double center = 40.0;
+    for (auto _ : state) {
+        center += 3.0;
+        lut.setWindow(center, 400.0);
+        benchmark::DoNotOptimize(lut.lastRebuildCount());
+    }
+}
+BENCHMARK(BM_WindowLevelDrag);
+
+void BM_PyramidHalve(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(int(state.range(0)), int(state.range(0)), 16, false);
+    for (auto _ : state) {
+        const PixelBuffer half = PixelPyramid::halve(pixels);
+        benchmark::DoNotOptimize(half.data.get());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(0));
+}
+BENCHMARK(BM_PyramidHalve)->Arg(1024)->Arg(4096)->Unit(benchmark::kMillisecond);
+
+void BM_EllipseStats(benchmark::State &state)
+{
+    const PixelBuffer pixels = randomPixels(4096, 4096, 12, false);
+    const QRectF roi(0, 0, state.range(0), state.range(0));
+    for (auto _ : state) {
+        const Measurement::Stats stats = Measurement::ellipseStats(pixels, roi, 1.0, -1024.0);
+        benchmark::DoNotOptimize(stats.mean);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0) * state.range(0) * 785 / 1000);
+}
+BENCHMARK(BM_EllipseStats)->Arg(64)->Arg(512)->Arg(4096);
+
+// ---- annotations ----
+
+const int annotationCount = 100000;
+const qreal annotationExtent = 8192.0;
+
+QLineF randomLine(std::mt19937 &random)
+{
+    std::uniform_real_distribution<qreal> position(0.0, annotationExtent);
+    std::uniform_real_distribution<qreal> offset(-40.0, 40.0);
+    const QPointF start(position(random), position(random));
+    return QLineF(start, start + QPointF(offset(random), offset(random)));
+}
+
+AnnotationStore &filledStore()
+{
+    static AnnotationStore store;
+    if (store.size() == 0) {
+        std::mt19937 random(7);
+        for (int i = 0; i < annotationCount; ++i) {
+            store.add(randomLine(random));
+        }
+    }
+    return store;
+}
+
+void BM_AnnotationHitTest(benchmark::State &state)
+{
+    const AnnotationStore &store = filledStore();
+    std::mt19937 random(11);
+    std::uniform_real_distribution<qreal> position(0.0, annotationExtent);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(store.hitTest(QPointF(position(random), position(random)), 4.0));
+    }
+}
+BENCHMARK(BM_AnnotationHitTest);
+
+// Lines visible in a 1920x1080 viewport at 1:1
+void BM_AnnotationQuery(benchmark::State &state)
+{
+    const AnnotationStore &store = filledStore();
+    std::vector<AnnotationStore::Id> ids;
+    std::mt19937 random(13);
+    std::uniform_real_distribution<qreal> position(0.0, annotationExtent - 1920.0);
+    for (auto _ : state) {
+        store.query(QRectF(position(random), position(random), 1920.0, 1080.0), ids);
+        benchmark::DoNotOptimize(ids.data());
+    }
+}
+BENCHMARK(BM_AnnotationQuery);
+
+void BM_AnnotationAddRemove(benchmark::State &state)
+{
+    AnnotationStore store;
+    std::mt19937 random(17);
+    for (int i = 0; i < annotationCount; ++i) {
+        store.add(randomLine(random));
+    }
+    for (auto _ : state) {
+        store.remove(store.add(randomLine(random)));
+    }
+}
+BENCHMARK(BM_AnnotationAddRemove);
+
+void BM_JournalAppend(benchmark::State &state)
+{
+    QTemporaryDir dir;
+    AnnotationJournal journal;
+    AnnotationStore store;
+    AnnotationJournal::Style style;
+    journal.open(dir.filePath("bench.ann"), "bench", store, style);
+
+    std::mt19937 random(19);
+    AnnotationStore::Id id = 0;
+    for (auto _ : state) {
+        journal.appendAdd(id++, randomLine(random));
+    }
+    journal.close();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_JournalAppend);
+
+// Reopening an image with 100k saved lines
+void BM_JournalReplay(benchmark::State &state)
+{
+    QTemporaryDir dir;
+    const QString path = dir.filePath("bench.ann");
+    {
+        AnnotationJournal journal;
+        AnnotationStore store;
+        AnnotationJournal::Style style;
+        journal.open(path, "bench", store, style);
+        journal.appendReset(filledStore());
+    }
+
+    for (auto _ : state) {
+        AnnotationJournal journal;
+        AnnotationStore store;
+        AnnotationJournal::Style style;
+        journal.open(path, "bench", store, style);
+        benchmark::DoNotOptimize(store.size());
+    }
+    state.SetItemsProcessed(state.iterations() * annotationCount);
+}
+BENCHMARK(BM_JournalReplay)->Unit(benchmark::kMillisecond);
+
+}
+
+int main(int argc, char *argv[])
+{
+    // QPixmap and the viewer need an application, offscreen works without
+    // a display
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+    qInstallMessageHandler(quietMessages);
+
+    registerFixtureBenchmarks();
+    registerKernelBenchmarks();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,261 @@
+// Headless batch conversion of DICOM files to PNG/JPEG and thumbnails.
+//
+//   dicomconvert -o out/ -f jpg -t 256 -r /data/worklist
+//
+// Files are decoded with the same DicomLoader as the viewer, on every core or
+// -j threads, and per stage timings are printed at the end.
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QImage>
+#include <QSet>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <atomic>
+
+#include "dicomloader.h"
+#include "profiler.h"
+
+namespace {
+
+enum Stage { Read, Decompress, Convert, Encode, StageCount };
+
+const char *const stageNames[StageCount] = {"read", "decompress", "convert", "encode"};
+
+struct Job {
+    QString input;
+    QString output;
+};
+
+struct Totals {
+    std::atomic<qint64> stageNs[StageCount] = {};
+    std::atomic<int> converted{0};
+    std::atomic<int> failed{0};
+};
+
+bool verbose = false;
+
+void messageHandler(QtMsgType type, const QMessageLogContext &, const QString &message)
+{
+    // The loader logs every step with qDebug, too much for thousands of files
+    if (type == QtDebugMsg && !verbose) {
+        return;
+    }
+    QTextStream(stderr) << message << Qt::endl;
+}
+
+Stage stageFor(const QString &name)
+{
+    if (name == "Decompressing") {
+        return Decompress;
+    }
+    if (name == "Converting") {
+        return Convert;
+    }
+    return Read;
+}
+
+// Inputs with the same base name, or x.dcm next to x.dicom, would write the
+// same file. Later ones get a _2, _3, ... suffix.
+QString uniqueOutput(const QString &base, const QString &suffix, QSet<QString> &used)
+{
+    QString output = base + suffix;
+    for (int n = 2; used.contains(output.toLower()); ++n) {
+        output = base + '_' + QString::number(n) + suffix;
+    }
+    used.insert(output.toLower());
+    return output;
+}
+
+QList<Job> collectJobs(const QStringList &inputs, const QString &outputDir, const QString &suffix,
+                       bool recursive)
+{
+    DicomLoader loader;
+    QList<Job> jobs;
+    QSet<QString> used;
+
+    for (const QString &input : inputs) {
+        const QFileInfo info(input);
+        if (info.isFile()) {
+            jobs.append({info.absoluteFilePath(),
+                         uniqueOutput(QDir(outputDir).filePath(info.completeBaseName()), suffix, used)});
+            continue;
+        }
+
+        // Keep the folder layout below the input directory
+        const QDir root(info.absoluteFilePath());
+        QDirIterator it(root.absolutePath(), QDir::Files | QDir::Readable,
+                        recursive ? QDirIterator::Subdirectories : QDirIterator::NoIteratorFlags);
+        while (it.hasNext()) {
+            const QString fileName = it.next();
+            if (!loader.isDicomFile(fileName)) {
+                continue;
+            }
+            const QString relative = root.relativeFilePath(fileName);
+            const QFileInfo relativeInfo(relative);
+            const QString base =
+                QDir(outputDir).filePath(relativeInfo.path() + "/" + relativeInfo.completeBaseName());
+            jobs.append({fileName, uniqueOutput(base, suffix, used)});
+        }
+    }
+    return jobs;
+}
+
+bool convertFile(const Job &job, const char *format, int quality, int thumbnailSize, Totals &totals)
+{
+    DicomLoader loader;
+
+    // Progress stages double as timing points, each call ends the previous stage
+    QElapsedTimer timer;
+    timer.start();
+    Stage current = Read;
+    loader.setProgressCallback([&](int, const QString &name) {
+        const Stage next = stageFor(name);
+        if (next != current || name == "Done") {
+            totals.stageNs[current] += timer.nsecsElapsed();
+            timer.restart();
+            current = next;
+        }
+        return true;
+    });
+
+    // Thumbnails are reduced from the decoded pixels, without the full size image
+    QImage image;
+    if (thumbnailSize > 0) {
+        if (loader.isDicomFile(job.input)) {
+            image = loader.loadThumbnail(job.input, thumbnailSize);
+        }
+    } else {
+        const DicomLoader::LoadResult result = loader.loadFile(job.input);
+        if (result.isDicom) {
+            image = result.image;
+        }
+    }
+    // A thumbnail load ends without a "Done" stage
+    totals.stageNs[current] += timer.nsecsElapsed();
+    if (image.isNull()) {
+        return false;
+    }
+
+    timer.restart();
+    PROFILE_SCOPE("dicomconvert encode");
+
+    QDir().mkpath(QFileInfo(job.output).path());
+    const bool saved = image.save(job.output, format, quality);
+    totals.stageNs[Encode] += timer.nsecsElapsed();
+    return saved;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("dicomconvert");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts DICOM files to PNG or JPEG images and thumbnails.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("inputs", "DICOM files or directories.", "<inputs...>");
+
+    const QCommandLineOption outputOption({"o", "output"}, "Output directory.", "dir");
+    const QCommandLineOption formatOption({"f", "format"}, "png or jpg (default png).", "format", "png");
+    const QCommandLineOption qualityOption({"q", "quality"}, "JPEG quality 0-100 (default 90).", "n", "90");
+    const QCommandLineOption thumbnailOption({"t", "thumbnail"}, "Scale to fit size x size.", "size");
+    const QCommandLineOption jobsOption({"j", "jobs"}, "Worker threads (default: all cores).", "n");
+    const QCommandLineOption recursiveOption({"r", "recursive"}, "Descend into subdirectories.");
+    const QCommandLineOption verboseOption({"v", "verbose"}, "Show loader debug output.");
+    const QCommandLineOption traceOption("trace", "Write a Chrome trace of the run to file.", "file");
+    parser.addOptions({outputOption, formatOption, qualityOption, thumbnailOption, jobsOption,
+                       recursiveOption, verboseOption, traceOption});
+    parser.process(app);
+
+    verbose = parser.isSet(verboseOption);
+    if (parser.isSet(traceOption)) {
+        Profiler::setEnabled(true);
+    }
+    qInstallMessageHandler(messageHandler);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+
+    const QStringList inputs = parser.positionalArguments();
+    if (inputs.isEmpty() || !parser.isSet(outputOption)) {
+        parser.showHelp(1);
+    }
+
+    const QString formatName = parser.value(formatOption).toLower();
+    if (formatName != "png" && formatName != "jpg" && formatName != "jpeg") {
+        err << "Unsupported format: " << formatName << Qt::endl;
+        return 1;
+    }
+    const QByteArray format = formatName == "png" ? "PNG" : "JPEG";
+    const QString suffix = formatName == "png" ? ".png" : ".jpg";
+    const int quality = formatName == "png" ? -1 : parser.value(qualityOption).toInt();
+    const int thumbnailSize = parser.value(thumbnailOption).toInt();
+
+    // The calling thread is one of the workers and parallelFor inside the
+    // loader stays within the pool's count, so -j 1 runs on this thread alone
+    QThreadPool *pool = QThreadPool::globalInstance();
+    if (parser.isSet(jobsOption) && parser.value(jobsOption).toInt() > 0) {
+        pool->setMaxThreadCount(parser.value(jobsOption).toInt());
+    }
+    const int workers = pool->maxThreadCount();
+
+    QElapsedTimer wallTimer;
+    wallTimer.start();
+
+    const QList<Job> jobs = collectJobs(inputs, parser.value(outputOption), suffix,
+                                        parser.isSet(recursiveOption));
+    const qint64 scanMs = wallTimer.elapsed();
+    out << "Found " << jobs.size() << " DICOM files in " << scanMs << " ms" << Qt::endl;
+
+    // parallelFor would give each thread a fixed block of files, so one
+    // slow file would hold up the rest of its block. Every worker takes
+    // the next file from a shared counter instead.
+    Totals totals;
+    std::atomic<int> nextJob(0);
+    const auto work = [&]() {
+        int i;
+        while ((i = nextJob.fetch_add(1)) < jobs.size()) {
+            if (convertFile(jobs.at(i), format.constData(), quality, thumbnailSize, totals)) {
+                ++totals.converted;
+            } else {
+                ++totals.failed;
+                QTextStream(stderr) << "Failed: " << jobs.at(i).input << Qt::endl;
+            }
+        }
+    };
+    for (int i = 1; i < workers; ++i) {
+        pool->start(work);
+    }
+    work();
+    pool->waitForDone();
+
+    const double seconds = qMax<qint64>(1, wallTimer.elapsed() - scanMs) / 1000.0;
+    const int processed = totals.converted + totals.failed;
+    out << "Converted " << totals.converted << ", failed " << totals.failed
+        << " in " << QString::number(seconds, 'f', 2) << " s ("
+        << QString::number(processed / seconds, 'f', 1) << " files/s, "
+        << workers << " threads)" << Qt::endl;
+
+    // Summed over all threads, so these add up to more than the wall time
+    out << "Stage totals (avg per file):" << Qt::endl;
+    for (int stage = 0; stage < StageCount; ++stage) {
+        const double ms = totals.stageNs[stage] / 1e6;
+        out << "  " << QString(stageNames[stage]).leftJustified(11)
+            << QString::number(ms, 'f', 1).rightJustified(10) << " ms"
+            << "  (" << QString::number(processed ? ms / processed : 0.0, 'f', 2) << " ms)" << Qt::endl;
+    }
+
+    if (parser.isSet(traceOption) && !Profiler::writeChromeTrace(parser.value(traceOption))) {
+        err << "Cannot write trace: " << parser.value(traceOption) << Qt::endl;
+    }
+
+    return totals.failed == 0 ? 0 : 2;
+}
@@ -1,7 +1,15 @@
 #include "dicomloader.h"
+#include <QBuffer>
 #include <QDebug>
+#include <QFile>
 #include <QFileInfo>
 #include <QImage>
+#include <QImageReader>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <set>
 #include <vector>
 
 
@@ -9,52 +17,332 @@
 #include "gdcmImage.h"
 #include "gdcmPhotometricInterpretation.h"
 #include "gdcmPixelFormat.h"
+#include "gdcmReader.h"
+#include "gdcmSequenceOfFragments.h"
+#include "gdcmTransferSyntax.h"
+
+#if defined(MEDICAL_IMAGE_OPENJPEG)
+#include <openjpeg.h>
+#endif
+
+#include "parallelfor.h"
+#include "pixelconverter.h"
+#include "pixelpyramid.h"
+#include "profiler.h"
+#include "windowlevel.h"
+
+#if defined(MEDICAL_IMAGE_OPENJPEG)
+namespace {
+
+// OpenJPEG stream over a codestream held in memory
+struct MemoryStream {
+    const char *data;
+    OPJ_SIZE_T size;
+    OPJ_SIZE_T offset;
+};
+
+OPJ_SIZE_T readMemory(void *buffer, OPJ_SIZE_T count, void *user)
+{
+    MemoryStream *stream = static_cast<MemoryStream *>(user);
+    if (stream->offset >= stream->size) {
+        return OPJ_SIZE_T(-1);
+    }
+    count = std::min(count, stream->size - stream->offset);
+    std::memcpy(buffer, stream->data + stream->offset, count);
+    stream->offset += count;
+    return count;
+}
+
+OPJ_OFF_T skipMemory(OPJ_OFF_T count, void *user)
+{
+    MemoryStream *stream = static_cast<MemoryStream *>(user);
+    if (count < 0) {
+        const OPJ_OFF_T back = std::min<OPJ_OFF_T>(-count, OPJ_OFF_T(stream->offset));
+        stream->offset -= OPJ_SIZE_T(back);
+        return -back;
+    }
+    const OPJ_OFF_T forward = std::min<OPJ_OFF_T>(count, OPJ_OFF_T(stream->size - stream->offset));
+    stream->offset += OPJ_SIZE_T(forward);
+    return forward;
+}
+
+OPJ_BOOL seekMemory(OPJ_OFF_T position, void *user)
+{
+    MemoryStream *stream = static_cast<MemoryStream *>(user);
+    if (position < 0 || OPJ_SIZE_T(position) > stream->size) {
+        return OPJ_FALSE;
+    }
+    stream->offset = OPJ_SIZE_T(position);
+    return OPJ_TRUE;
+}
+
+} // namespace
+#endif
 
 DicomLoader::DicomLoader()
+    : canceled(false)
+    , previewSent(false)
+    , firstFrameOnly(false)
 {
     qDebug() << "DicomLoader intialized";
 
 }
 
+void DicomLoader::setProgressCallback(const ProgressCallback &callback)
+{
+    progressCallback = callback;
+}
+
+bool DicomLoader::wasCanceled() const
+{
+    return canceled;
+}
+
+void DicomLoader::setPreviewCallback(const PreviewCallback &callback)
+{
+    previewCallback = callback;
+}
+
+bool DicomLoader::wantsPreview(int width, int height) const
+{
+    return previewCallback && !previewSent && !canceled && qMax(width, height) > previewThreshold;
+}
+
+void DicomLoader::sendPreview(const PixelBuffer &pixels, const DicomMetadata &metadata, const QSize &fullSize)
+{
+    PROFILE_SCOPE("DicomLoader::sendPreview");
+    const QImage preview = pixels.isNull() ? QImage() : windowedImage(pixels, metadata);
+    if (preview.isNull()) {
+        return;
+    }
+    qDebug() << "Preview" << preview.width() << "x" << preview.height() << "of" << fullSize;
+    previewSent = true;
+    previewCallback(preview, fullSize);
+}
+
+bool DicomLoader::reportProgress(int percent, const QString &stage)
+{
+    if (!canceled && progressCallback && !progressCallback(percent, stage)) {
+        qDebug() << "Load canceled during:" << stage;
+        canceled = true;
+    }
+    return !canceled;
+}
+
 bool DicomLoader::isDicomFile(const QString &fileName)
 {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
 
-    QString lowerFileName = fileName.toLower();
-    if (lowerFileName.endsWith(".dcm") || lowerFileName.endsWith(".dicom")) {
+    // Part 10 files: 128 byte preamble followed by "DICM"
+    const QByteArray header = file.read(132);
+    if (header.size() == 132 && header.mid(128, 4) == "DICM") {
         return true;
     }
-    //TODO: Add DICOM header validation later
-    return false;
+    if (header.size() < 8) {
+        return false;
+    }
+
+    // Older files start straight with the data set, little endian. Accept it
+    // when the first element is in a group that opens a data set and is
+    // followed by either an explicit VR or a plausible implicit VR length.
+    const uchar *bytes = reinterpret_cast<const uchar *>(header.constData());
+    const quint16 group = quint16(bytes[0] | (bytes[1] << 8));
+    if (group != 0x0002 && group != 0x0008) {
+        return false;
+    }
+
+    if (bytes[4] >= 'A' && bytes[4] <= 'Z' && bytes[5] >= 'A' && bytes[5] <= 'Z') {
+        return true;
+    }
+
+    const quint32 length = quint32(bytes[4]) | (quint32(bytes[5]) << 8)
+                           | (quint32(bytes[6]) << 16) | (quint32(bytes[7]) << 24);
+    return length == 0xFFFFFFFFu || qint64(length) <= file.size() - 8;
 }
 
 QPixmap DicomLoader::loadDicomImage(const QString &fileName)
 {
     qDebug() << "Attempting to load DICOM:" << fileName;
 
+    LoadResult result;
+    if (!QFileInfo::exists(fileName) || !decodeDicom(fileName, result)) {
+        return QPixmap();
+    }
+    return QPixmap::fromImage(result.image);
+}
+
+DicomLoader::LoadResult DicomLoader::loadFile(const QString &fileName)
+{
+    PROFILE_SCOPE("DicomLoader::loadFile");
+    LoadResult result;
+    result.metadata = emptyMetadata();
+    canceled = false;
+    previewSent = false;
+
     if (!QFileInfo::exists(fileName)) {
         qDebug() << "File does not exist:" << fileName;
-        return QPixmap();
+        return result;
+    }
+
+    if (isDicomFile(fileName)) {
+        result.isDicom = true;
+        if (!decodeDicom(fileName, result)) {
+            result.image = QImage();
+        }
+        return result;
+    }
+
+    // Standard image, the decoded image already carries its dimensions
+    if (!reportProgress(0, "Decoding")) {
+        return result;
+    }
+
+    // Formats that decode at reduced scale (JPEG) get a preview first
+    QImageReader reader(fileName);
+    const QSize fullSize = reader.size();
+    if (fullSize.isValid() && wantsPreview(fullSize.width(), fullSize.height())
+        && reader.supportsOption(QImageIOHandler::ScaledSize)) {
+        reader.setScaledSize(fullSize.scaled(previewSize, previewSize, Qt::KeepAspectRatio));
+        const QImage preview = reader.read();
+        if (!preview.isNull()) {
+            previewSent = true;
+            previewCallback(preview, fullSize);
+        }
+    }
+    result.image = QImage(fileName);
+    result.metadata.imageWidth = result.image.width();
+    result.metadata.imageHeight = result.image.height();
+    result.metadata.bitsStored = result.image.depth();
+    if (!reportProgress(100, "Done")) {
+        result.image = QImage();
+    }
+    return result;
+}
+
+QImage DicomLoader::loadThumbnail(const QString &fileName, int size)
+{
+    PROFILE_SCOPE("DicomLoader::loadThumbnail");
+    canceled = false;
+    if (size <= 0 || !QFileInfo::exists(fileName)) {
+        return QImage();
+    }
+
+    if (!isDicomFile(fileName)) {
+        // JPEG decodes at reduced scale directly, other formats scale after
+        QImageReader reader(fileName);
+        const QSize fullSize = reader.size();
+        if (fullSize.isValid()) {
+            reader.setScaledSize(fullSize.scaled(size, size, Qt::KeepAspectRatio));
+        }
+        const QImage image = reader.read();
+        if (image.isNull()) {
+            return QImage();
+        }
+        // Colour stays colour, only gray images shrink to one byte per pixel
+        const QImage scaled = image.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+        return scaled.isGrayscale() ? scaled.convertToFormat(QImage::Format_Grayscale8) : scaled;
+    }
+
+    LoadResult result;
+    result.metadata = emptyMetadata();
+    firstFrameOnly = true;
+    const bool decoded = decodePixels(fileName, result);
+    firstFrameOnly = false;
+    if (!decoded) {
+        return QImage();
+    }
+
+    // Colour images are converted while decoding
+    if (result.pixels.isNull()) {
+        return result.image.isNull()
+                   ? QImage()
+                   : result.image.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    // Halved while twice the target or more, the last step is a smooth scale
+    PixelBuffer pixels = result.pixels;
+    while (pixels.width >= 2 * size && pixels.height >= 2 * size) {
+        pixels = PixelPyramid::halve(pixels);
+        if (pixels.isNull()) {
+            return QImage();
+        }
+    }
+
+    const QImage image = windowedImage(pixels, result.metadata);
+    if (image.isNull()) {
+        return QImage();
+    }
+    return image.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+}
+
+QImage DicomLoader::windowedImage(const PixelBuffer &pixels, const DicomMetadata &metadata)
+{
+    QImage image(pixels.width, pixels.height, QImage::Format_Grayscale8);
+    if (image.isNull()) {
+        return QImage();
+    }
+    WindowLevelLut lut;
+    configureWindowLevel(lut, pixels, metadata);
+    for (int y = 0; y < pixels.height; ++y) {
+        lut.applyRow(pixels.constRow(y), image.scanLine(y), pixels.width);
     }
-    return convertDicomToPixmap(fileName);
+    return image;
 }
 
-QPixmap DicomLoader::convertDicomToPixmap(const QString &fileName)
+bool DicomLoader::decodeDicom(const QString &fileName, LoadResult &result)
+{
+    if (!decodePixels(fileName, result)) {
+        return false;
+    }
+
+    // Codecs without a reduced decode only get a preview now, still ahead
+    // of the conversion
+    const PixelBuffer &pixels = result.pixels;
+    if (wantsPreview(pixels.width, pixels.height)) {
+        sendPreview(stridedPixels(pixels.constRow(0), pixels.width, pixels.height, 0, pixels.bitsStored,
+                                  pixels.isSigned),
+                    result.metadata, QSize(pixels.width, pixels.height));
+    }
+    return finishDecode(result);
+}
+
+bool DicomLoader::decodePixels(const QString &fileName, LoadResult &result)
 {
     qDebug() << "=== DICOM Loading Debug ===";
     qDebug() << "File:" << fileName;
 
+    // Uncompressed data is used in place, without GDCM reading it into memory
+    if (!reportProgress(0, "Reading")) {
+        return false;
+    }
+    if (mapPixelData(fileName, result)) {
+        qDebug() << "Using memory mapped pixel data";
+        return true;
+    }
+
     gdcm::ImageReader reader;
     reader.SetFileName(fileName.toStdString().c_str());
 
     qDebug() << "Attempting to read DICOM file...";
-    if (!reader.Read()) {
-        return QPixmap();
+    bool read;
+    {
+        PROFILE_SCOPE("gdcm::ImageReader::Read");
+        read = reader.Read();
+    }
+    if (!read) {
+        return false;
     }
 
     qDebug() << "GDCM successfully read the file!";
 
     const gdcm::Image &image = reader.GetImage();
 
+    // Metadata comes from the same read as the pixels
+    fillMetadata(reader.GetFile().GetDataSet(), image, result.metadata);
+
     // Get image dimensions
     const unsigned int *dims = image.GetDimensions();
     unsigned int width = dims[0];
@@ -67,107 +355,805 @@ QPixmap DicomLoader::convertDicomToPixmap(const QString &fileName)
     qDebug() << "Bits stored:" << pixelFormat.GetBitsStored();
     qDebug() << "Samples per pixel:" << pixelFormat.GetSamplesPerPixel();
 
-    // Check for reasonable dimensions
-    if (width == 0 || height == 0 || width > 10000 || height > 10000) {
+    // Large images are fine, the viewer draws them in tiles
+    if (width == 0 || height == 0) {
         qDebug() << "ERROR: Invalid dimensions detected";
-        return QPixmap();
+        return false;
     }
 
-    // Allocate buffer for pixel data
-    std::vector<char> buffer;
-    unsigned long bufferLength = image.GetBufferLength();
-    qDebug() << "Buffer length needed:" << bufferLength;
+    const bool isPalette = image.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::PALETTE_COLOR;
+    if (pixelFormat.GetSamplesPerPixel() == 3 || isPalette) {
+        if (!reportProgress(30, "Decompressing")) {
+            return false;
+        }
+        return extractColorPixels(image, reader.GetFile().GetDataSet(), result);
+    }
+
+    if (pixelFormat.GetSamplesPerPixel() != 1) {
+        qDebug() << "Unsupported samples per pixel:" << pixelFormat.GetSamplesPerPixel();
+        return false;
+    }
 
-    buffer.resize(bufferLength);
+    // JPEG and JPEG 2000 can decode a reduced resolution of the first frame
+    // for a fraction of the full decode
+    if (wantsPreview(int(width), int(height))) {
+        sendPreview(reducedPixels(image), result.metadata, QSize(int(width), int(height)));
+    }
 
     qDebug() << "Attempting to extract pixel buffer...";
-    if (!image.GetBuffer(buffer.data())) {
-        qDebug() << "ERROR: Failed to get pixel buffer from DICOM";
-        return QPixmap();
+    if (!reportProgress(30, "Decompressing")) {
+        return false;
     }
+    return extractPixels(image, result);
+}
 
-    // Convert to QImage first, then QPixmap
-    QImage qimage = convertToQImage(buffer, width, height, pixelFormat.GetBitsStored());
+bool DicomLoader::finishDecode(LoadResult &result)
+{
+    if (!reportProgress(70, "Converting")) {
+        return false;
+    }
+    // Colour frames are converted while decoding
+    if (!result.pixels.isNull()) {
+        result.image = convertToQImage(result.pixels, result.metadata);
+    }
 
-    if (qimage.isNull()) {
+    if (result.image.isNull() || !reportProgress(100, "Done")) {
         qDebug() << "ERROR: Failed to convert to QImage";
-        return QPixmap();
+        return false;
     }
 
-    return QPixmap::fromImage(qimage);
+    return true;
 }
 
-QImage DicomLoader::convertToQImage(const std::vector<char> &buffer, unsigned int width,
-                                    unsigned int height, int bitsStored)
+bool DicomLoader::mapPixelData(const QString &fileName, LoadResult &result)
 {
-    // Check if 8 bit
-    if (bitsStored == 8) {
-        QImage image(width, height, QImage::Format_Grayscale8);
+    PROFILE_SCOPE("DicomLoader::mapPixelData");
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    // With Pixel Data in the skip set the parser reads its tag, VR and
+    // length, then stops in front of the value without loading it
+    const gdcm::Tag pixelDataTag(0x7fe0, 0x0010);
+    gdcm::Reader reader;
+    reader.SetFileName(fileName.toStdString().c_str());
+    if (!reader.ReadUpToTag(pixelDataTag, std::set<gdcm::Tag>{pixelDataTag})) {
+        return false;
+    }
 
-        for (unsigned int y = 0; y < height; ++y) {
-            for (unsigned int x = 0; x < width; ++x) {
-                unsigned int index = y * width + x;
-                if (index < buffer.size()) {
-                    unsigned char pixel = static_cast<unsigned char>(buffer[index]);
-                    image.setPixel(x, y, qRgb(pixel, pixel, pixel));
-                }
+    // Only native little endian data can be handed to the kernels as is
+    const gdcm::TransferSyntax syntax = reader.GetFile().GetHeader().GetDataSetTransferSyntax();
+    const bool explicitVr = syntax == gdcm::TransferSyntax::ExplicitVRLittleEndian;
+    if (!explicitVr && syntax != gdcm::TransferSyntax::ImplicitVRLittleEndian) {
+        return false;
+    }
+
+    const gdcm::DataSet &dataset = reader.GetFile().GetDataSet();
+    const int width = extractUShort(dataset, gdcm::Tag(0x0028, 0x0011));
+    const int height = extractUShort(dataset, gdcm::Tag(0x0028, 0x0010));
+    const int bitsAllocated = extractUShort(dataset, gdcm::Tag(0x0028, 0x0100));
+    const int bitsStored = extractUShort(dataset, gdcm::Tag(0x0028, 0x0101));
+    const int highBit = extractUShort(dataset, gdcm::Tag(0x0028, 0x0102));
+    const int samplesPerPixel = qMax(1, extractUShort(dataset, gdcm::Tag(0x0028, 0x0002)));
+    const int frames = qMax(1, extractTag(dataset, gdcm::Tag(0x0028, 0x0008)).toInt());
+    const QString photometric = extractTag(dataset, gdcm::Tag(0x0028, 0x0004));
+    const bool isColor = samplesPerPixel == 3 || photometric == "PALETTE COLOR";
+
+    if (width == 0 || height == 0) {
+        return false;
+    }
+    if (!isColor && (bitsAllocated != 16 || samplesPerPixel != 1 || bitsStored < 1 || bitsStored > 16
+                     || highBit < bitsStored - 1 || !photometric.startsWith("MONOCHROME"))) {
+        return false;
+    }
+
+    // A mapping only lives as long as its QFile stays open, so the file is
+    // owned by the deleter of the sample pointer further down
+    auto file = std::make_shared<QFile>(fileName);
+    if (!file->open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    // The value starts where the parser stopped, its element header sits
+    // right in front: tag, VR, two reserved bytes and a 32-bit length for
+    // explicit VR, tag and length for implicit VR
+    const qint64 dataOffset = qint64(reader.GetStreamCurrentPosition());
+    const int headerSize = explicitVr ? 12 : 8;
+    if (dataOffset < headerSize || !file->seek(dataOffset - headerSize)) {
+        return false;
+    }
+    const QByteArray headerBytes = file->read(headerSize);
+    const char pixelDataBytes[] = {'\xe0', '\x7f', '\x10', '\x00'};
+    if (headerBytes.size() != headerSize || !headerBytes.startsWith(QByteArray(pixelDataBytes, 4))) {
+        qDebug() << "Pixel Data header not found at parser offset" << dataOffset;
+        return false;
+    }
+
+    const uchar *header = reinterpret_cast<const uchar *>(headerBytes.constData());
+    const uchar *lengthField = header + headerSize - 4;
+    if (explicitVr && !(header[4] == 'O' && (header[5] == 'W' || header[5] == 'B'))) {
+        return false;
+    }
+    const quint32 length = quint32(lengthField[0]) | (quint32(lengthField[1]) << 8)
+                           | (quint32(lengthField[2]) << 16) | (quint32(lengthField[3]) << 24);
+
+    // Undefined length would mean encapsulated (compressed) fragments
+    if (length == 0xFFFFFFFFu) {
+        return false;
+    }
+    ColorLayout layout;
+    layout.width = width;
+    layout.height = height;
+    layout.frames = frames;
+    if (isColor && !colorLayout(dataset, photometric, samplesPerPixel, bitsAllocated,
+                                extractUShort(dataset, gdcm::Tag(0x0028, 0x0006)), length, layout)) {
+        return false;
+    }
+    const qint64 byteCount = isColor ? qint64(layout.frameBytes()) * frames : qint64(width) * height * frames * 2;
+    if (qint64(length) < byteCount || dataOffset + byteCount > file->size()) {
+        return false;
+    }
+
+    // A colour thumbnail only converts frame 0, the other frames of a cine
+    // loop are not even mapped
+    if (isColor && firstFrameOnly) {
+        layout.frames = 1;
+    }
+    const qint64 mapBytes = isColor ? qint64(layout.frameBytes()) * layout.frames : byteCount;
+
+    // Private mapping: pages are shared with the page cache until written,
+    // and writes (normalisation) never reach the file
+    uchar *mapped = file->map(dataOffset, mapBytes, QFileDevice::MapPrivateOption);
+    if (!mapped) {
+        qDebug() << "Mapping pixel data failed:" << file->errorString();
+        return false;
+    }
+
+    // Colour is converted from the mapping, which is dropped right after
+    if (isColor) {
+        result.metadata = emptyMetadata();
+        fillMetadata(dataset, result.metadata);
+        const bool converted = convertColorFrames(mapped, layout, result);
+        file->unmap(mapped);
+        return converted;
+    }
+
+    auto volume = std::make_shared<VolumeData>();
+    volume->width = width;
+    volume->height = height;
+    volume->depth = frames;
+    volume->bitsStored = bitsStored;
+    volume->isSigned = extractUShort(dataset, gdcm::Tag(0x0028, 0x0103)) == 1;
+    volume->samples = std::shared_ptr<uint16_t>(reinterpret_cast<uint16_t *>(mapped),
+                                                [file](uint16_t *data) {
+        file->unmap(reinterpret_cast<uchar *>(data));
+    });
+
+    const QStringList pixelSpacing = extractTag(dataset, gdcm::Tag(0x0028, 0x0030)).split('\\');
+    if (pixelSpacing.size() == 2 && pixelSpacing[0].toDouble() > 0.0 && pixelSpacing[1].toDouble() > 0.0) {
+        volume->spacingY = pixelSpacing[0].toDouble();
+        volume->spacingX = pixelSpacing[1].toDouble();
+    }
+    const double sliceSpacing = extractTag(dataset, gdcm::Tag(0x0018, 0x0088)).toDouble();
+    volume->spacingZ = (frames > 1 && sliceSpacing > 0.0) ? sliceSpacing : 1.0;
+
+    const size_t sampleCount = volume->sliceSize() * size_t(frames);
+    uint16_t *samples = volume->sliceData(0);
+    const int lowBit = highBit + 1 - bitsStored;
+
+    result.metadata = emptyMetadata();
+    fillMetadata(dataset, result.metadata);
+
+    // Sampled straight from the mapping, before the passes below read in
+    // every page of the file
+    if (wantsPreview(width, height)) {
+        sendPreview(stridedPixels(samples, width, height, lowBit, bitsStored, volume->isSigned),
+                    result.metadata, QSize(width, height));
+    }
+
+    // Data below a High Bit other than Bits Stored - 1 is moved down first
+    if (lowBit > 0) {
+        for (size_t i = 0; i < sampleCount; ++i) {
+            samples[i] = uint16_t(samples[i] >> lowBit);
+        }
+    }
+
+    // Masking every sample would copy every page, most files already hold
+    // clean values in the stored range, so check with a read-only pass first
+    computeRange(*volume);
+    const int storedMin = volume->isSigned ? -(1 << (bitsStored - 1)) : 0;
+    const int storedMax = volume->isSigned ? (1 << (bitsStored - 1)) - 1 : (1 << bitsStored) - 1;
+    if (volume->minValue < storedMin || volume->maxValue > storedMax) {
+        PixelConverter::normalizeRow(samples, sampleCount, bitsStored, volume->isSigned);
+        computeRange(*volume);
+    }
+
+    result.pixels = volume->slice(0);
+    if (volume->depth > 1) {
+        result.volume = volume;
+    }
+    return true;
+#else
+    Q_UNUSED(fileName);
+    Q_UNUSED(result);
+    return false;
+#endif
+}
+
+bool DicomLoader::extractPixels(const gdcm::Image &image, LoadResult &result)
+{
+    PROFILE_SCOPE("DicomLoader::extractPixels");
+    const unsigned int *dims = image.GetDimensions();
+    const gdcm::PixelFormat pixelFormat = image.GetPixelFormat();
+
+    // Every frame goes into one slice-major volume, a single frame image is
+    // simply a volume of depth one
+    auto volume = std::make_shared<VolumeData>();
+    volume->width = dims[0];
+    volume->height = dims[1];
+    volume->depth = (image.GetNumberOfDimensions() > 2 && dims[2] > 1) ? dims[2] : 1;
+    volume->bitsStored = pixelFormat.GetBitsStored();
+    volume->isSigned = pixelFormat.GetPixelRepresentation() == 1;
+
+    const double *spacing = image.GetSpacing();
+    volume->spacingX = spacing[0];
+    volume->spacingY = spacing[1];
+    volume->spacingZ = (volume->depth > 1 && spacing[2] > 0.0) ? spacing[2] : 1.0;
+
+    qDebug() << "Buffer length needed:" << image.GetBufferLength() << "frames:" << volume->depth;
+
+    try {
+        volume->allocate();
+    } catch (const std::bad_alloc &) {
+        qDebug() << "ERROR: Not enough memory for" << volume->width << "x" << volume->height
+                 << "x" << volume->depth << "pixels";
+        return false;
+    }
+    const size_t sampleCount = volume->sliceSize() * size_t(volume->depth);
+    if (!readPixelData(image, volume->sliceData(0), sampleCount)) {
+        return false;
+    }
+
+    computeRange(*volume);
+    qDebug() << "Stored value range:" << volume->minValue << "to" << volume->maxValue;
+
+    result.pixels = volume->slice(0);
+    if (volume->depth > 1) {
+        result.volume = volume;
+    }
+    return true;
+}
+
+size_t DicomLoader::ColorLayout::frameBytes() const
+{
+    const size_t pixels = size_t(width) * size_t(height);
+    switch (model) {
+    case Ybr422:
+        return size_t((width + 1) / 2) * 4 * size_t(height);
+    case Palette:
+        return pixels * (wideIndices ? 2 : 1);
+    default:
+        return pixels * 3;
+    }
+}
+
+bool DicomLoader::colorLayout(const gdcm::DataSet &dataset, const QString &photometric, int samplesPerPixel,
+                              int bitsAllocated, int planarConfiguration, size_t dataBytes, ColorLayout &layout)
+{
+    layout.planar = planarConfiguration == 1;
+    if (photometric == "PALETTE COLOR" && samplesPerPixel == 1 && (bitsAllocated == 8 || bitsAllocated == 16)) {
+        layout.model = ColorLayout::Palette;
+        layout.planar = false;
+        layout.wideIndices = bitsAllocated == 16;
+        if (!readPalette(dataset, bitsAllocated, layout.palette)) {
+            return false;
+        }
+    } else if (samplesPerPixel == 3 && bitsAllocated == 8
+               && (photometric == "RGB" || photometric == "YBR_RCT" || photometric == "YBR_ICT")) {
+        // JPEG 2000 decoders have already undone the component transform
+        layout.model = ColorLayout::Rgb;
+    } else if (samplesPerPixel == 3 && bitsAllocated == 8 && photometric == "YBR_FULL") {
+        layout.model = ColorLayout::Ybr;
+    } else if (samplesPerPixel == 3 && bitsAllocated == 8 && photometric == "YBR_FULL_422") {
+        // Stored with chroma for every other pixel, JPEG decoders hand it
+        // back for every pixel
+        const size_t fullBytes = size_t(layout.width) * size_t(layout.height) * 3 * size_t(layout.frames);
+        layout.model = dataBytes >= fullBytes ? ColorLayout::Ybr : ColorLayout::Ybr422;
+        layout.planar = layout.planar && layout.model == ColorLayout::Ybr;
+    } else {
+        qDebug() << "Unsupported colour data:" << photometric << samplesPerPixel << "samples,"
+                 << bitsAllocated << "bits allocated";
+        return false;
+    }
+
+    if (dataBytes < layout.frameBytes() * size_t(layout.frames)) {
+        qDebug() << "ERROR: Colour pixel data too short:" << dataBytes << "bytes";
+        return false;
+    }
+    return true;
+}
+
+bool DicomLoader::readPalette(const gdcm::DataSet &dataset, int bitsAllocated, std::vector<uint32_t> &palette)
+{
+    // Red, green and blue tables, each with a descriptor of entry count (0
+    // for 65536), first mapped value and bits per entry
+    std::vector<uint8_t> channels[3];
+    int firstMapped[3];
+    for (int c = 0; c < 3; ++c) {
+        const gdcm::Tag descriptorTag(0x0028, uint16_t(0x1101 + c));
+        const gdcm::Tag dataTag(0x0028, uint16_t(0x1201 + c));
+        if (!dataset.FindDataElement(descriptorTag) || !dataset.FindDataElement(dataTag)) {
+            qDebug() << "Palette colour image without lookup table data";
+            return false;
+        }
+        const gdcm::ByteValue *descriptor = dataset.GetDataElement(descriptorTag).GetByteValue();
+        const gdcm::ByteValue *data = dataset.GetDataElement(dataTag).GetByteValue();
+        if (!descriptor || descriptor->GetLength() < 6 || !data) {
+            return false;
+        }
+        uint16_t values[3];
+        std::memcpy(values, descriptor->GetPointer(), sizeof(values));
+        const size_t entries = values[0] ? values[0] : 65536;
+        firstMapped[c] = values[1];
+
+        const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data->GetPointer());
+        channels[c].resize(entries);
+        if (data->GetLength() >= entries * 2) {
+            // 16-bit entries keep their high byte. Some writers store 8-bit
+            // entries one per word, those are taken as they are.
+            std::vector<uint16_t> words(entries);
+            std::memcpy(words.data(), bytes, entries * 2);
+            const bool narrow = values[2] == 8
+                                && std::all_of(words.begin(), words.end(), [](uint16_t w) { return w < 256; });
+            for (size_t i = 0; i < entries; ++i) {
+                channels[c][i] = uint8_t(narrow ? words[i] : words[i] >> 8);
             }
+        } else if (data->GetLength() >= entries) {
+            std::memcpy(channels[c].data(), bytes, entries);
+        } else {
+            qDebug() << "ERROR: Palette lookup table too short";
+            return false;
         }
-        return image;
     }
-    else if (bitsStored == 12) {
-        // 12-bit grayscale (common for medical X-rays, CR, DR)
-        QImage image(width, height, QImage::Format_Grayscale8);
 
-        const uint16_t *pixelData = reinterpret_cast<const uint16_t*>(buffer.data());
+    // Every value the container can hold gets an entry, values outside a
+    // table clamp to its ends, so the row kernels need no bounds checks
+    palette.resize(size_t(1) << bitsAllocated);
+    for (size_t value = 0; value < palette.size(); ++value) {
+        uint32_t rgb = 0xff000000u;
+        for (int c = 0; c < 3; ++c) {
+            const int last = int(channels[c].size()) - 1;
+            const int index = qBound(0, int(value) - firstMapped[c], last);
+            rgb |= uint32_t(channels[c][size_t(index)]) << (16 - 8 * c);
+        }
+        palette[value] = rgb;
+    }
+    return true;
+}
+
+bool DicomLoader::convertColorFrames(const uint8_t *data, const ColorLayout &layout, LoadResult &result)
+{
+    PROFILE_SCOPE("DicomLoader::convertColorFrames");
+    QVector<QImage> frames;
+    std::vector<uchar *> frameBits;
+    frames.reserve(layout.frames);
+    frameBits.reserve(size_t(layout.frames));
+    for (int f = 0; f < layout.frames; ++f) {
+        QImage frame(layout.width, layout.height, QImage::Format_RGB32);
+        if (frame.isNull()) {
+            qDebug() << "ERROR: Not enough memory for" << layout.frames << "colour frames of" << layout.width
+                     << "x" << layout.height;
+            return false;
+        }
+        // Detached here, the workers only write through the pointers
+        frameBits.push_back(frame.bits());
+        frames.append(frame);
+    }
 
-        for (unsigned int y = 0; y < height; ++y) {
-            for (unsigned int x = 0; x < width; ++x) {
-                unsigned int index = y * width + x;
-                if (index * 2 < buffer.size()) {
-                    // Get 12-bit pixel (stored in 16-bit container)
-                    uint16_t pixel12 = pixelData[index];
+    const size_t frameBytes = layout.frameBytes();
+    const size_t planeBytes = size_t(layout.width) * size_t(layout.height);
+    const size_t count = size_t(layout.width);
+    const size_t pairRowBytes = size_t((layout.width + 1) / 2) * 4;
+    const size_t bytesPerLine = size_t(frames.first().bytesPerLine());
 
-                    // Scale 12-bit (0-4095) to 8-bit (0-255)
-                    uint8_t pixel8 = pixel12 >> 4;  // Divide by 16 (2^4)
+    // Every row goes from the decoded data into its scanline in one kernel
+    // call, with no intermediate buffer
+    parallelFor(0, layout.frames * layout.height, [&](int first, int last) {
+        for (int row = first; row < last; ++row) {
+            const int f = row / layout.height;
+            const int y = row % layout.height;
+            const uint8_t *frame = data + size_t(f) * frameBytes;
+            uint32_t *dst = reinterpret_cast<uint32_t *>(frameBits[size_t(f)] + size_t(y) * bytesPerLine);
 
-                    image.setPixel(x, y, qRgb(pixel8, pixel8, pixel8));
+            switch (layout.model) {
+            case ColorLayout::Rgb:
+            case ColorLayout::Ybr:
+                if (layout.planar) {
+                    const uint8_t *c0 = frame + size_t(y) * count;
+                    const uint8_t *c1 = c0 + planeBytes;
+                    const uint8_t *c2 = c1 + planeBytes;
+                    if (layout.model == ColorLayout::Rgb) {
+                        PixelConverter::rgbPlanesToRgb32(c0, c1, c2, dst, count);
+                    } else {
+                        PixelConverter::ybrPlanesToRgb32(c0, c1, c2, dst, count);
+                    }
+                } else if (layout.model == ColorLayout::Rgb) {
+                    PixelConverter::rgbRowToRgb32(frame + size_t(y) * count * 3, dst, count);
+                } else {
+                    PixelConverter::ybrRowToRgb32(frame + size_t(y) * count * 3, dst, count);
                 }
+                break;
+            case ColorLayout::Ybr422:
+                PixelConverter::ybr422RowToRgb32(frame + size_t(y) * pairRowBytes, dst, count);
+                break;
+            case ColorLayout::Palette:
+                if (layout.wideIndices) {
+                    const uint16_t *indices = reinterpret_cast<const uint16_t *>(frame) + size_t(y) * count;
+                    PixelConverter::paletteRow16ToRgb32(indices, layout.palette.data(), dst, count);
+                } else {
+                    const uint8_t *indices = frame + size_t(y) * count;
+                    PixelConverter::paletteRow8ToRgb32(indices, layout.palette.data(), dst, count);
+                }
+                break;
             }
         }
-        return image;
+    }, 16);
+
+    result.image = frames.first();
+    if (frames.size() > 1) {
+        result.frames = frames;
+    }
+    return true;
+}
+
+bool DicomLoader::extractColorPixels(const gdcm::Image &image, const gdcm::DataSet &dataset, LoadResult &result)
+{
+    PROFILE_SCOPE("DicomLoader::extractColorPixels");
+    const unsigned int *dims = image.GetDimensions();
+    ColorLayout layout;
+    layout.width = int(dims[0]);
+    layout.height = int(dims[1]);
+    layout.frames = (image.GetNumberOfDimensions() > 2 && dims[2] > 1) ? int(dims[2]) : 1;
+
+    // The codec output, converted to RGB32 from there
+    std::vector<char> buffer;
+    try {
+        buffer.resize(image.GetBufferLength());
+    } catch (const std::bad_alloc &) {
+        qDebug() << "ERROR: Not enough memory for" << image.GetBufferLength() << "bytes of colour data";
+        return false;
+    }
+    if (!image.GetBuffer(buffer.data())) {
+        qDebug() << "ERROR: Failed to get pixel buffer from DICOM";
+        return false;
+    }
+    if (!reportProgress(60, "Converting")) {
+        return false;
+    }
+
+    // Asked after decoding, codecs may hand back another colour space or
+    // planar configuration than the file declares
+    const gdcm::PixelFormat pixelFormat = image.GetPixelFormat();
+    const QString photometric = QString::fromLatin1(image.GetPhotometricInterpretation().GetString()).trimmed();
+    if (!colorLayout(dataset, photometric, pixelFormat.GetSamplesPerPixel(), pixelFormat.GetBitsAllocated(),
+                     int(image.GetPlanarConfiguration()), buffer.size(), layout)) {
+        return false;
+    }
+    if (firstFrameOnly) {
+        layout.frames = 1;
+    }
+    return convertColorFrames(reinterpret_cast<const uint8_t *>(buffer.data()), layout, result);
+}
+
+bool DicomLoader::readPixelData(const gdcm::Image &image, uint16_t *dst, size_t sampleCount)
+{
+    const gdcm::PixelFormat pixelFormat = image.GetPixelFormat();
+    const unsigned long bufferLength = image.GetBufferLength();
+    const bool isSigned = pixelFormat.GetPixelRepresentation() == 1;
+
+    if (pixelFormat.GetBitsAllocated() == 16 && bufferLength == sampleCount * 2) {
+        // Decode straight into the full precision buffer, no staging copy
+        if (!image.GetBuffer(reinterpret_cast<char*>(dst))) {
+            qDebug() << "ERROR: Failed to get pixel buffer from DICOM";
+            return false;
+        }
+    } else if (pixelFormat.GetBitsAllocated() == 16 || pixelFormat.GetBitsAllocated() == 8) {
+        std::vector<char> buffer(bufferLength);
+        if (!image.GetBuffer(buffer.data())) {
+            qDebug() << "ERROR: Failed to get pixel buffer from DICOM";
+            return false;
+        }
+
+        // Missing samples stay black, extra ones are dropped
+        if (pixelFormat.GetBitsAllocated() == 8) {
+            buffer.resize(sampleCount, 0);
+            PixelConverter::widenRow8(reinterpret_cast<const uint8_t*>(buffer.data()),
+                                      dst, sampleCount, isSigned);
+        } else {
+            buffer.resize(sampleCount * 2, 0);
+            std::memcpy(dst, buffer.data(), sampleCount * 2);
+        }
+    } else {
+        qDebug() << "Unsupported pixel format:" << pixelFormat.GetBitsAllocated() << "bits allocated";
+        return false;
+    }
+
+    // Data stored below a High Bit other than Bits Stored - 1 is moved down first
+    const int lowBit = pixelFormat.GetHighBit() + 1 - pixelFormat.GetBitsStored();
+    if (lowBit > 0 && pixelFormat.GetBitsAllocated() == 16) {
+        for (size_t i = 0; i < sampleCount; ++i) {
+            dst[i] = uint16_t(dst[i] >> lowBit);
+        }
+    }
+
+    PixelConverter::normalizeRow(dst, sampleCount, pixelFormat.GetBitsStored(), isSigned);
+    return true;
+}
+
+PixelBuffer DicomLoader::stridedPixels(const uint16_t *samples, int width, int height, int lowBit,
+                                       int bitsStored, bool isSigned)
+{
+    // Nearest samples on a coarse grid, rows in between are never touched,
+    // so a memory mapped file only faults in the pages of sampled rows
+    const int step = (qMax(width, height) + previewSize - 1) / previewSize;
+    PixelBuffer pixels;
+    pixels.width = (width + step - 1) / step;
+    pixels.height = (height + step - 1) / step;
+    pixels.bitsStored = bitsStored;
+    pixels.isSigned = isSigned;
+
+    const size_t count = size_t(pixels.width) * size_t(pixels.height);
+    uint16_t *sampled = new (std::nothrow) uint16_t[count];
+    if (!sampled) {
+        return PixelBuffer();
+    }
+    pixels.data = std::shared_ptr<const uint16_t>(sampled, std::default_delete<uint16_t[]>());
+
+    for (int y = 0; y < pixels.height; ++y) {
+        const uint16_t *row = samples + size_t(y) * size_t(step) * size_t(width);
+        uint16_t *dst = sampled + size_t(y) * size_t(pixels.width);
+        for (int x = 0; x < pixels.width; ++x) {
+            dst[x] = uint16_t(row[size_t(x) * size_t(step)] >> lowBit);
+        }
+    }
+    PixelConverter::normalizeRow(sampled, count, bitsStored, isSigned);
+
+    pixels.minValue = std::numeric_limits<int>::max();
+    pixels.maxValue = std::numeric_limits<int>::min();
+    PixelConverter::rowMinMax(sampled, count, isSigned, pixels.minValue, pixels.maxValue);
+    return pixels;
+}
+
+PixelBuffer DicomLoader::reducedPixels(const gdcm::Image &image)
+{
+    PROFILE_SCOPE("DicomLoader::reducedPixels");
+    const gdcm::TransferSyntax syntax = image.GetTransferSyntax();
+    const bool isJpeg = syntax == gdcm::TransferSyntax::JPEGBaselineProcess1;
+    bool isJpeg2000 = syntax == gdcm::TransferSyntax::JPEG2000Lossless
+                      || syntax == gdcm::TransferSyntax::JPEG2000;
+#if !defined(MEDICAL_IMAGE_OPENJPEG)
+    isJpeg2000 = false;  // sampled from the full decode instead
+#endif
+    const gdcm::SequenceOfFragments *fragments = image.GetDataElement().GetSequenceOfFragments();
+    if ((!isJpeg && !isJpeg2000) || !fragments || fragments->GetNumberOfFragments() == 0) {
+        return PixelBuffer();
+    }
+
+    // Codestream of the first frame. Multi-frame data has one fragment per
+    // frame, a single frame may be split over several.
+    const unsigned int *dims = image.GetDimensions();
+    const int width = int(dims[0]);
+    const int height = int(dims[1]);
+    QByteArray stream;
+    if (image.GetNumberOfDimensions() > 2 && dims[2] > 1) {
+        const gdcm::ByteValue *value = fragments->GetFragment(0).GetByteValue();
+        if (!value) {
+            return PixelBuffer();
+        }
+        stream = QByteArray(value->GetPointer(), qsizetype(value->GetLength()));
+    } else {
+        stream.resize(qsizetype(fragments->ComputeByteLength()));
+        if (!fragments->GetBuffer(stream.data(), (unsigned long)stream.size())) {
+            return PixelBuffer();
+        }
+    }
+
+    const gdcm::PixelFormat pixelFormat = image.GetPixelFormat();
+    const bool isSigned = pixelFormat.GetPixelRepresentation() == 1;
+    PixelBuffer pixels;
+    if (isJpeg2000) {
+        pixels = reducedJpeg2000(stream, width, height);
+    } else {
+        // libjpeg scales while inverting the DCT, Qt asks for that through
+        // the scaled size
+        QBuffer buffer(&stream);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer, "jpeg");
+        reader.setScaledSize(QSize(width, height).scaled(previewSize, previewSize, Qt::KeepAspectRatio));
+        const QImage decoded = reader.read().convertToFormat(QImage::Format_Grayscale8);
+        if (decoded.isNull()) {
+            return PixelBuffer();
+        }
+
+        uint16_t *samples = new (std::nothrow) uint16_t[size_t(decoded.width()) * size_t(decoded.height())];
+        if (!samples) {
+            return PixelBuffer();
+        }
+        pixels.data = std::shared_ptr<const uint16_t>(samples, std::default_delete<uint16_t[]>());
+        pixels.width = decoded.width();
+        pixels.height = decoded.height();
+        for (int y = 0; y < pixels.height; ++y) {
+            PixelConverter::widenRow8(decoded.constScanLine(y), samples + size_t(y) * size_t(pixels.width),
+                                      size_t(pixels.width), isSigned);
+        }
+    }
+    if (pixels.isNull()) {
+        return PixelBuffer();
+    }
+
+    pixels.bitsStored = pixelFormat.GetBitsStored();
+    pixels.isSigned = isSigned;
+    pixels.minValue = std::numeric_limits<int>::max();
+    pixels.maxValue = std::numeric_limits<int>::min();
+    PixelConverter::rowMinMax(pixels.constRow(0), size_t(pixels.width) * size_t(pixels.height), isSigned,
+                              pixels.minValue, pixels.maxValue);
+    return pixels;
+}
+
+PixelBuffer DicomLoader::reducedJpeg2000(const QByteArray &stream, int width, int height)
+{
+#if defined(MEDICAL_IMAGE_OPENJPEG)
+    // DICOM usually holds a raw J2K codestream, some writers wrap it in JP2
+    const bool isJp2 = stream.size() > 8 && stream.mid(4, 4) == "jP  ";
+    opj_codec_t *codec = opj_create_decompress(isJp2 ? OPJ_CODEC_JP2 : OPJ_CODEC_J2K);
+    opj_dparameters_t parameters;
+    opj_set_default_decoder_parameters(&parameters);
+    if (!codec || !opj_setup_decoder(codec, &parameters)) {
+        if (codec) {
+            opj_destroy_codec(codec);
+        }
+        return PixelBuffer();
     }
-    else if (bitsStored == 16) {
-        // 16-bit grayscale
-        QImage image(width, height, QImage::Format_Grayscale8);
 
-        const uint16_t *pixelData = reinterpret_cast<const uint16_t*>(buffer.data());
+    MemoryStream memory = {stream.constData(), OPJ_SIZE_T(stream.size()), 0};
+    opj_stream_t *input = opj_stream_create(OPJ_J2K_STREAM_CHUNK_SIZE, OPJ_TRUE);
+    opj_stream_set_user_data(input, &memory, nullptr);
+    opj_stream_set_user_data_length(input, OPJ_UINT64(memory.size));
+    opj_stream_set_read_function(input, readMemory);
+    opj_stream_set_skip_function(input, skipMemory);
+    opj_stream_set_seek_function(input, seekMemory);
+
+    PixelBuffer pixels;
+    opj_image_t *decoded = nullptr;
+    if (opj_read_header(input, codec, &decoded)) {
+        // Each discarded resolution level halves both sides, the codestream
+        // decides how many there are
+        int available = 1;
+        if (opj_codestream_info_v2_t *info = opj_get_cstr_info(codec)) {
+            available = int(info->m_default_tile_info.tccp_info
+                                ? info->m_default_tile_info.tccp_info[0].numresolutions : 1);
+            opj_destroy_cstr_info(&info);
+        }
+        int reduce = 0;
+        while (reduce + 1 < available && (qMax(width, height) >> reduce) > previewSize) {
+            ++reduce;
+        }
 
-        for (unsigned int y = 0; y < height; ++y) {
-            for (unsigned int x = 0; x < width; ++x) {
-                unsigned int index = y * width + x;
-                if (index * 2 < buffer.size()) {
-                    // Scale 16-bit to 8-bit for display
-                    uint16_t pixel16 = pixelData[index];
-                    uint8_t pixel8 = pixel16 >> 8;  // Divide by 256
-                    image.setPixel(x, y, qRgb(pixel8, pixel8, pixel8));
+        if (opj_set_decoded_resolution_factor(codec, OPJ_UINT32(reduce))
+            && opj_decode(codec, input, decoded) && opj_end_decompress(codec, input)
+            && decoded->numcomps >= 1 && decoded->comps[0].data) {
+            const opj_image_comp_t &component = decoded->comps[0];
+            const size_t count = size_t(component.w) * size_t(component.h);
+            uint16_t *samples = new (std::nothrow) uint16_t[count];
+            if (samples && count > 0) {
+                // Signed values keep their two's complement bits
+                for (size_t i = 0; i < count; ++i) {
+                    samples[i] = uint16_t(component.data[i]);
                 }
+                pixels.data = std::shared_ptr<const uint16_t>(samples, std::default_delete<uint16_t[]>());
+                pixels.width = int(component.w);
+                pixels.height = int(component.h);
+            } else {
+                delete[] samples;
+            }
+            qDebug() << "JPEG 2000 preview at resolution level" << reduce << "of" << available;
+        }
+    }
+
+    if (decoded) {
+        opj_image_destroy(decoded);
+    }
+    opj_stream_destroy(input);
+    opj_destroy_codec(codec);
+    return pixels;
+#else
+    // Without OpenJPEG the preview is sampled from the full decode
+    Q_UNUSED(stream);
+    Q_UNUSED(width);
+    Q_UNUSED(height);
+    return PixelBuffer();
+#endif
+}
+
+void DicomLoader::computeRange(VolumeData &volume)
+{
+    volume.minValue = std::numeric_limits<int>::max();
+    volume.maxValue = std::numeric_limits<int>::min();
+    for (int z = 0; z < volume.depth; ++z) {
+        PixelConverter::rowMinMax(volume.sliceData(z), volume.sliceSize(), volume.isSigned,
+                                  volume.minValue, volume.maxValue);
+    }
+}
+
+void DicomLoader::configureWindowLevel(WindowLevelLut &lut, const PixelBuffer &pixels,
+                                       const DicomMetadata &metadata)
+{
+    lut.setPixelFormat(pixels.isSigned, metadata.rescaleSlope, metadata.rescaleIntercept);
+    lut.setDataRange(pixels.minValue, pixels.maxValue);
+    lut.setInverted(metadata.photometricInterpretation == "MONOCHROME1");
+
+    // First preset from the dataset, otherwise the full data range
+    double center, width;
+    if (!metadata.windowPresets.isEmpty()) {
+        center = metadata.windowPresets.first().center;
+        width = metadata.windowPresets.first().width;
+    } else {
+        lut.fullRangeWindow(center, width);
+    }
+    lut.setWindow(center, width);
+}
+
+QImage DicomLoader::convertToQImage(const PixelBuffer &pixels, const DicomMetadata &metadata)
+{
+    PROFILE_SCOPE("DicomLoader::convertToQImage");
+    if (pixels.isNull()) {
+        return QImage();
+    }
+
+    // Very large images get a subsampled preview, the viewer renders full
+    // resolution from pixels tile by tile
+    int step = 1;
+    while ((pixels.width + step - 1) / step > maxPreviewSize
+           || (pixels.height + step - 1) / step > maxPreviewSize) {
+        step *= 2;
+    }
+    const int width = (pixels.width + step - 1) / step;
+    const int height = (pixels.height + step - 1) / step;
+
+    QImage image(width, height, QImage::Format_Grayscale8);
+    if (image.isNull()) {
+        return QImage();
+    }
+
+    // Rendered through the default window, the viewer re-windows from pixels
+    WindowLevelLut lut;
+    configureWindowLevel(lut, pixels, metadata);
+
+    std::vector<uint16_t> sampled(step > 1 ? width : 0);
+    for (int y = 0; y < height; ++y) {
+        const uint16_t *row = pixels.constRow(y * step);
+        if (step > 1) {
+            for (int x = 0; x < width; ++x) {
+                sampled[x] = row[x * step];
             }
+            row = sampled.data();
+        }
+        lut.applyRow(row, image.scanLine(y), width);
+
+        // Give background loads a chance to bail out on large images
+        if ((y & 255) == 255 && !reportProgress(70 + int(29.0 * y / height), "Converting")) {
+            return QImage();
         }
-        return image;
     }
 
-    qDebug() << "Unsupported pixel format:" << bitsStored << "bits";
-    return QImage();
+    return image;
 }
 
 QString DicomLoader::extractTag(const gdcm::DataSet& dataset, const gdcm::Tag& tag)
 {
     if (dataset.FindDataElement(tag)) {
         const gdcm::DataElement& element = dataset.GetDataElement(tag);
-        if (!element.IsEmpty()) {
-            std::string value = std::string(element.GetByteValue()->GetPointer(),
-                                            element.GetByteValue()->GetLength());
+        const gdcm::ByteValue *bytes = element.GetByteValue();
+        // Sequences have no byte value, as seen when scanning mixed archives
+        if (!element.IsEmpty() && bytes) {
+            std::string value = std::string(bytes->GetPointer(), bytes->GetLength());
             // remove null terminators and whitespace
             value.erase(std::find(value.begin(), value.end(), '\0'), value.end());
             return QString::fromStdString(value).trimmed();
@@ -177,7 +1163,7 @@ QString DicomLoader::extractTag(const gdcm::DataSet& dataset, const gdcm::Tag& t
 }
 
 
-DicomLoader::DicomMetadata DicomLoader::extractMetadata(const QString &fileName)
+DicomLoader::DicomMetadata DicomLoader::emptyMetadata()
 {
     DicomMetadata metadata;
 
@@ -191,21 +1177,34 @@ DicomLoader::DicomMetadata DicomLoader::extractMetadata(const QString &fileName)
     metadata.imageWidth = 0;
     metadata.imageHeight = 0;
     metadata.bitsStored = 0;
+    metadata.numberOfFrames = 1;
     metadata.acquisitionDate = "Unknown";
+    metadata.sopInstanceUID = QString();
+    metadata.pixelSpacingX = 0.0;
+    metadata.pixelSpacingY = 0.0;
+    metadata.photometricInterpretation = "Unknown";
+    metadata.rescaleSlope = 1.0;
+    metadata.rescaleIntercept = 0.0;
 
-    if (!isDicomFile(fileName)) {
-        qDebug() << "Not a DICOM file, returning empty metadata";
-        return metadata;
-    }
-    gdcm::ImageReader reader;
-    reader.SetFileName(fileName.toStdString().c_str());
+    return metadata;
+}
 
-    if (!reader.Read()) {
-        qDebug() << "Failed to read DICOM for metadata extraction";
-        return metadata;
+int DicomLoader::extractUShort(const gdcm::DataSet& dataset, const gdcm::Tag& tag)
+{
+    // US values are binary, little endian in every transfer syntax we load
+    if (dataset.FindDataElement(tag)) {
+        const gdcm::ByteValue *value = dataset.GetDataElement(tag).GetByteValue();
+        if (value && value->GetLength() == 2) {
+            uint16_t result;
+            std::memcpy(&result, value->GetPointer(), 2);
+            return result;
+        }
     }
-    const gdcm::DataSet& dataset = reader.GetFile().GetDataSet();
+    return 0;
+}
 
+void DicomLoader::fillMetadata(const gdcm::DataSet& dataset, DicomMetadata &metadata)
+{
     // Extract standard DICOM tags
     metadata.patientName = extractTag(dataset, gdcm::Tag(0x0010, 0x0010));
     metadata.patientID = extractTag(dataset, gdcm::Tag(0x0010, 0x0020));
@@ -214,15 +1213,110 @@ DicomLoader::DicomMetadata DicomLoader::extractMetadata(const QString &fileName)
     metadata.institutionName = extractTag(dataset, gdcm::Tag(0x0008, 0x0080));
     metadata.studyDescription = extractTag(dataset, gdcm::Tag(0x0008, 0x1030));
     metadata.acquisitionDate = extractTag(dataset, gdcm::Tag(0x0008, 0x0022));
+    const QString sopInstanceUID = extractTag(dataset, gdcm::Tag(0x0008, 0x0018));
+    metadata.sopInstanceUID = sopInstanceUID == "N/A" ? QString() : sopInstanceUID;
 
-    // Get image dimensions
-    const gdcm::Image &image = reader.GetImage();
+    // Image attributes as stored in the header
+    metadata.imageWidth = extractUShort(dataset, gdcm::Tag(0x0028, 0x0011));
+    metadata.imageHeight = extractUShort(dataset, gdcm::Tag(0x0028, 0x0010));
+    metadata.bitsStored = extractUShort(dataset, gdcm::Tag(0x0028, 0x0101));
+    metadata.numberOfFrames = qMax(1, extractTag(dataset, gdcm::Tag(0x0028, 0x0008)).toInt());
+
+    // Row spacing comes first. Projection radiographs often only carry the
+    // spacing at the detector, which is still better than pixels.
+    for (const gdcm::Tag &tag : {gdcm::Tag(0x0028, 0x0030), gdcm::Tag(0x0018, 0x1164)}) {
+        const QStringList spacing = extractTag(dataset, tag).split('\\');
+        if (spacing.size() == 2 && spacing[0].toDouble() > 0.0 && spacing[1].toDouble() > 0.0) {
+            metadata.pixelSpacingY = spacing[0].toDouble();
+            metadata.pixelSpacingX = spacing[1].toDouble();
+            break;
+        }
+    }
+
+    const QString photometric = extractTag(dataset, gdcm::Tag(0x0028, 0x0004));
+    if (photometric != "N/A") {
+        metadata.photometricInterpretation = photometric;
+    }
+
+    bool ok = false;
+    const double slope = extractTag(dataset, gdcm::Tag(0x0028, 0x1053)).toDouble(&ok);
+    metadata.rescaleSlope = (ok && slope != 0.0) ? slope : 1.0;
+    const double intercept = extractTag(dataset, gdcm::Tag(0x0028, 0x1052)).toDouble(&ok);
+    metadata.rescaleIntercept = ok ? intercept : 0.0;
+
+    metadata.windowPresets = extractWindowPresets(dataset);
+}
+
+void DicomLoader::fillMetadata(const gdcm::DataSet& dataset, const gdcm::Image& image,
+                               DicomMetadata &metadata)
+{
+    fillMetadata(dataset, metadata);
+
+    // The decoded image is authoritative, e.g. for defaults GDCM fills in
     const unsigned int *dims = image.GetDimensions();
     metadata.imageWidth = dims[0];
     metadata.imageHeight = dims[1];
     metadata.bitsStored = image.GetPixelFormat().GetBitsStored();
+    metadata.numberOfFrames = (image.GetNumberOfDimensions() > 2 && dims[2] > 1) ? dims[2] : 1;
+
+    // Display related attributes
+    metadata.photometricInterpretation =
+        QString::fromLatin1(image.GetPhotometricInterpretation().GetString()).trimmed();
+    metadata.rescaleSlope = image.GetSlope();
+    metadata.rescaleIntercept = image.GetIntercept();
+}
+
+QVector<DicomLoader::WindowPreset> DicomLoader::extractWindowPresets(const gdcm::DataSet& dataset)
+{
+    QVector<WindowPreset> presets;
+
+    // Window Center, Window Width and the explanation are multi-valued,
+    // e.g. centers "40\300" and widths "400\1500" for a two preset CT
+    const QStringList centers = extractTag(dataset, gdcm::Tag(0x0028, 0x1050)).split('\\');
+    const QStringList widths = extractTag(dataset, gdcm::Tag(0x0028, 0x1051)).split('\\');
+    const QStringList names = extractTag(dataset, gdcm::Tag(0x0028, 0x1055)).split('\\');
+
+    for (int i = 0; i < centers.size() && i < widths.size(); ++i) {
+        bool centerOk = false;
+        bool widthOk = false;
+        WindowPreset preset;
+        preset.center = centers[i].trimmed().toDouble(&centerOk);
+        preset.width = widths[i].trimmed().toDouble(&widthOk);
+        if (!centerOk || !widthOk || preset.width < 1.0) {
+            continue;
+        }
+        preset.name = (i < names.size() && names[i] != "N/A" && !names[i].isEmpty())
+                          ? names[i].trimmed()
+                          : QString("Preset %1").arg(i + 1);
+        presets.append(preset);
+    }
+
+    return presets;
+}
+
+DicomLoader::DicomMetadata DicomLoader::extractMetadata(const QString &fileName)
+{
+    PROFILE_SCOPE("DicomLoader::extractMetadata");
+    DicomMetadata metadata = emptyMetadata();
+
+    if (!isDicomFile(fileName)) {
+        qDebug() << "Not a DICOM file, returning empty metadata";
+        return metadata;
+    }
+
+    // With Pixel Data in the skip set the parser stops in front of its value,
+    // the pixels are neither read nor decoded
+    const gdcm::Tag pixelDataTag(0x7fe0, 0x0010);
+    gdcm::Reader reader;
+    reader.SetFileName(fileName.toStdString().c_str());
+
+    if (!reader.ReadUpToTag(pixelDataTag, std::set<gdcm::Tag>{pixelDataTag})) {
+        qDebug() << "Failed to read DICOM header for metadata extraction";
+        return metadata;
+    }
+
+    fillMetadata(reader.GetFile().GetDataSet(), metadata);
 
     qDebug() << "Extracted metadata for:" << metadata.patientName;
     return metadata;
 }
-
@@ -4,21 +4,40 @@
 #include <QString>
 #include <QPixmap>
 #include <QImage>
+#include <QSize>
+#include <QVector>
+#include <functional>
 #include <vector>
 
 #include "gdcmTag.h"
 #include "gdcmDataSet.h"
 
+#include "pixelbuffer.h"
+#include "volumedata.h"
+
+class WindowLevelLut;
+
+namespace gdcm { class Image; }
+
 
 class DicomLoader
 {
 public:
     DicomLoader();
 
-    // Main functions for DICOM handling
+    // Main functions for DICOM handling. Detection looks at the file content,
+    // a "DICM" prefix after the 128 byte preamble or a bare implicit/explicit
+    // VR data set, so files without an extension are found too.
     bool isDicomFile(const QString &fileName);
     QPixmap loadDicomImage(const QString &fileName);
 
+    // Window Center/Width pair stored in the dataset
+    struct WindowPreset {
+        double center;
+        double width;
+        QString name;
+    };
+
     struct DicomMetadata {
         QString patientName;
         QString patientID;
@@ -29,19 +48,131 @@ public:
         int imageWidth;
         int imageHeight;
         int bitsStored;
+        int numberOfFrames;
         QString acquisitionDate;
+        QString sopInstanceUID;
+
+        // Physical size of a pixel in mm, 0 when the file is not calibrated
+        double pixelSpacingX;
+        double pixelSpacingY;
+
+        // Display related attributes
+        QString photometricInterpretation;
+        double rescaleSlope;
+        double rescaleIntercept;
+        QVector<WindowPreset> windowPresets;
+    };
+
+    // Decoded pixels plus metadata, produced from a single read of the file
+    struct LoadResult {
+        QImage image;  // DICOM images larger than maxPreviewSize get a subsampled preview
+        PixelBuffer pixels;  // full precision grayscale, empty for standard and colour images
+        std::shared_ptr<VolumeData> volume;  // set for multi-frame files and series, pixels is slice 0
+        QVector<QImage> frames;  // RGB32 frames of colour multi-frame files, image is frame 0
+        DicomMetadata metadata;
+        bool isDicom = false;
+
+        bool isNull() const { return image.isNull(); }
     };
 
+    // Loads DICOM and standard image files, reading each file only once
+    LoadResult loadFile(const QString &fileName);
+
+    // Image fitting size x size for thumbnails, grayscale unless the source is
+    // in colour. Pixels are area averaged down from the decoded data without
+    // building the full size QImage, standard images use the reader's scaled
+    // decode. Null on failure.
+    QImage loadThumbnail(const QString &fileName, int size);
+
+    // Called between load stages with a 0-100 percentage, returning false
+    // cancels the load. Used by background loads to report progress.
+    using ProgressCallback = std::function<bool(int percent, const QString &stage)>;
+    void setProgressCallback(const ProgressCallback &callback);
+    bool wasCanceled() const;
+
+    // Called once by loadFile for images larger than previewThreshold, with
+    // a quickly decoded image of about previewSize pixels shown until the
+    // full decode finishes. fullSize is the size of the final image. Runs on
+    // the loading thread.
+    using PreviewCallback = std::function<void(const QImage &preview, const QSize &fullSize)>;
+    void setPreviewCallback(const PreviewCallback &callback);
+    static const int previewThreshold = 2048;
+    static const int previewSize = 1024;
+
+    // Reads the header only, parsing stops at Pixel Data so nothing is
+    // decoded. Cheap enough for scanning large directories.
     DicomMetadata extractMetadata(const QString &fileName);
 
+    // Decodes sampleCount full precision samples (all frames) of image into dst
+    static bool readPixelData(const gdcm::Image &image, uint16_t *dst, size_t sampleCount);
+    static void computeRange(VolumeData &volume);
+
+    // Shared with VolumeLoader, which assembles series from single files
+    QString extractTag(const gdcm::DataSet& dataset, const gdcm::Tag& tag);
+    static int extractUShort(const gdcm::DataSet& dataset, const gdcm::Tag& tag);
+    void fillMetadata(const gdcm::DataSet& dataset, DicomMetadata &metadata);
+    void fillMetadata(const gdcm::DataSet& dataset, const gdcm::Image& image,
+                      DicomMetadata &metadata);
+    static DicomMetadata emptyMetadata();
+    QImage convertToQImage(const PixelBuffer &pixels, const DicomMetadata &metadata);
+
+    // Longest side of LoadResult::image for DICOM data
+    static const int maxPreviewSize = 8192;
+
+    // Sets up a LUT for the pixel format, rescale and default window of an image
+    static void configureWindowLevel(WindowLevelLut &lut, const PixelBuffer &pixels,
+                                     const DicomMetadata &metadata);
 
 
 private:
     // Internal helper functions
-    QPixmap convertDicomToPixmap(const QString &fileName);
-    QImage convertToQImage(const std::vector<char> &buffer, unsigned int width,
-                           unsigned int height, int bitsStored);
-    QString extractTag(const gdcm::DataSet& dataset, const gdcm::Tag& tag);
+    bool decodeDicom(const QString &fileName, LoadResult &result);
+    bool decodePixels(const QString &fileName, LoadResult &result);
+    bool mapPixelData(const QString &fileName, LoadResult &result);
+    bool finishDecode(LoadResult &result);
+    bool extractPixels(const gdcm::Image &image, LoadResult &result);
+
+    // Colour data (RGB, YBR_FULL, YBR_FULL_422, PALETTE COLOR) is converted
+    // straight into RGB32 frames, rows in parallel
+    struct ColorLayout {
+        enum Model {
+            Rgb,
+            Ybr,
+            Ybr422,
+            Palette
+        };
+        Model model = Rgb;
+        int width = 0;
+        int height = 0;
+        int frames = 1;
+        bool planar = false;  // one plane per sample rather than interleaved
+        bool wideIndices = false;  // 16-bit palette indices
+        std::vector<uint32_t> palette;  // RGB32 entry for every index value
+
+        size_t frameBytes() const;
+    };
+    static bool colorLayout(const gdcm::DataSet &dataset, const QString &photometric, int samplesPerPixel,
+                            int bitsAllocated, int planarConfiguration, size_t dataBytes, ColorLayout &layout);
+    static bool readPalette(const gdcm::DataSet &dataset, int bitsAllocated, std::vector<uint32_t> &palette);
+    static bool convertColorFrames(const uint8_t *data, const ColorLayout &layout, LoadResult &result);
+    bool extractColorPixels(const gdcm::Image &image, const gdcm::DataSet &dataset, LoadResult &result);
+    QVector<WindowPreset> extractWindowPresets(const gdcm::DataSet& dataset);
+    bool reportProgress(int percent, const QString &stage);
+
+    // Progressive display, see setPreviewCallback
+    bool wantsPreview(int width, int height) const;
+    void sendPreview(const PixelBuffer &pixels, const DicomMetadata &metadata, const QSize &fullSize);
+    static PixelBuffer reducedPixels(const gdcm::Image &image);
+    static PixelBuffer reducedJpeg2000(const QByteArray &stream, int width, int height);
+    static PixelBuffer stridedPixels(const uint16_t *samples, int width, int height, int lowBit,
+                                     int bitsStored, bool isSigned);
+    static QImage windowedImage(const PixelBuffer &pixels, const DicomMetadata &metadata);
+
+    ProgressCallback progressCallback;
+    PreviewCallback previewCallback;
+    bool canceled;
+    bool previewSent;
+    bool firstFrameOnly;  // set by loadThumbnail, colour frames after 0 are skipped
 };
 
 #endif // DICOMLOADER_H
@@ -0,0 +1,78 @@
+#include "frametimehistogram.h"
+#include <algorithm>
+
+FrameTimeHistogram::FrameTimeHistogram(int window, int bucketCount)
+    : samples(size_t(qMax(1, window)), 0)
+    , buckets(size_t(qMax(2, bucketCount)), 0)
+    , next(0)
+    , filled(0)
+{
+}
+
+int FrameTimeHistogram::bucketFor(qint64 nanoseconds, int count)
+{
+    return int(qBound<qint64>(0, nanoseconds / 1000000, count - 1));
+}
+
+void FrameTimeHistogram::record(qint64 nanoseconds)
+{
+    const int count = int(buckets.size());
+
+    // The oldest frame leaves its bucket once the window is full
+    if (filled == int(samples.size())) {
+        --buckets[bucketFor(samples[next], count)];
+    } else {
+        ++filled;
+    }
+    samples[next] = nanoseconds;
+    ++buckets[bucketFor(nanoseconds, count)];
+    next = (next + 1) % int(samples.size());
+}
+
+void FrameTimeHistogram::reset()
+{
+    std::fill(buckets.begin(), buckets.end(), 0);
+    next = 0;
+    filled = 0;
+}
+
+int FrameTimeHistogram::frameCount() const
+{
+    return filled;
+}
+
+int FrameTimeHistogram::bucketCount() const
+{
+    return int(buckets.size());
+}
+
+int FrameTimeHistogram::bucket(int index) const
+{
+    return buckets[index];
+}
+
+int FrameTimeHistogram::largestBucket() const
+{
+    return *std::max_element(buckets.begin(), buckets.end());
+}
+
+double FrameTimeHistogram::percentileMs(double fraction) const
+{
+    if (filled == 0) {
+        return 0.0;
+    }
+
+    // Exact, the window is small enough to sort a copy on demand
+    std::vector<qint64> sorted(samples.begin(), samples.begin() + filled);
+    const size_t rank = size_t(qBound(0.0, fraction, 1.0) * (filled - 1) + 0.5);
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    return sorted[rank] / 1e6;
+}
+
+double FrameTimeHistogram::maxMs() const
+{
+    if (filled == 0) {
+        return 0.0;
+    }
+    return *std::max_element(samples.begin(), samples.begin() + filled) / 1e6;
+}
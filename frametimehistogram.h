@@ -0,0 +1,37 @@
+#ifndef FRAMETIMEHISTOGRAM_H
+#define FRAMETIMEHISTOGRAM_H
+
+#include <QtGlobal>
+#include <vector>
+
+// Histogram of the most recent frame times in 1 ms buckets. Old frames drop
+// out as new ones arrive, so it shows how the view behaves right now rather
+// than since startup.
+class FrameTimeHistogram
+{
+public:
+    // Frames kept, and buckets before the last one that takes everything longer
+    explicit FrameTimeHistogram(int window = 600, int bucketCount = 34);
+
+    void record(qint64 nanoseconds);
+    void reset();
+
+    int frameCount() const;
+    int bucketCount() const;
+    int bucket(int index) const;
+    int largestBucket() const;
+
+    // Frame time in ms that fraction (0-1) of the recorded frames stay under
+    double percentileMs(double fraction) const;
+    double maxMs() const;
+
+private:
+    static int bucketFor(qint64 nanoseconds, int count);
+
+    std::vector<qint64> samples;  // ring buffer
+    std::vector<int> buckets;
+    int next;
+    int filled;
+};
+
+#endif // FRAMETIMEHISTOGRAM_H
@@ -0,0 +1,165 @@
+#include "imagecache.h"
+#include <QDateTime>
+#include <QDebug>
+#include <QFileInfo>
+
+ImageCache::ImageCache(qint64 budgetBytes)
+    : budgetBytes(budgetBytes)
+{
+}
+
+QString ImageCache::makeKey(const QString &fileName)
+{
+    // Size and mtime make a rewritten file miss instead of serving stale pixels
+    const QFileInfo info(fileName);
+    return QString("%1|%2|%3")
+        .arg(info.absoluteFilePath())
+        .arg(info.size())
+        .arg(info.lastModified().toMSecsSinceEpoch());
+}
+
+qint64 ImageCache::costOf(const DicomLoader::LoadResult &result)
+{
+    qint64 cost = result.image.sizeInBytes();
+
+    // Pixels of a volume alias its storage, count the storage once
+    if (result.volume && !result.volume->isNull()) {
+        cost += qint64(result.volume->sliceSize()) * result.volume->depth * sizeof(uint16_t);
+    } else if (!result.pixels.isNull()) {
+        cost += qint64(result.pixels.width) * result.pixels.height * sizeof(uint16_t);
+    }
+
+    // Colour frames, the first shares its data with image
+    for (int i = 1; i < result.frames.size(); ++i) {
+        cost += result.frames[i].sizeInBytes();
+    }
+    return cost;
+}
+
+bool ImageCache::lookup(const QString &fileName, DicomLoader::LoadResult &result)
+{
+    const QString key = makeKey(fileName);
+
+    QMutexLocker locker(&mutex);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        ++counters.misses;
+        return false;
+    }
+
+    // Move to the front, iterators into a std::list stay valid
+    entries.splice(entries.begin(), entries, it.value());
+    result = entries.front().result;
+    ++counters.hits;
+    return true;
+}
+
+bool ImageCache::contains(const QString &fileName) const
+{
+    const QString key = makeKey(fileName);
+
+    QMutexLocker locker(&mutex);
+    return index.contains(key);
+}
+
+void ImageCache::beginDecode(const QString &fileName)
+{
+    QMutexLocker locker(&mutex);
+    ++decoding[fileName];
+}
+
+void ImageCache::endDecode(const QString &fileName)
+{
+    QMutexLocker locker(&mutex);
+    auto it = decoding.find(fileName);
+    if (it != decoding.end() && --it.value() == 0) {
+        decoding.erase(it);
+    }
+    decodeFinished.wakeAll();
+}
+
+bool ImageCache::waitForDecode(const QString &fileName, const std::atomic_bool *canceled)
+{
+    QMutexLocker locker(&mutex);
+    while (decoding.contains(fileName)) {
+        if (canceled && canceled->load()) {
+            return false;
+        }
+        // Wakes up now and then to notice a cancel
+        decodeFinished.wait(&mutex, 50);
+    }
+    return true;
+}
+
+void ImageCache::insert(const QString &fileName, const DicomLoader::LoadResult &result)
+{
+    if (result.isNull()) {
+        return;
+    }
+
+    const QString key = makeKey(fileName);
+    const qint64 cost = costOf(result);
+
+    QMutexLocker locker(&mutex);
+
+    // Something larger than the whole budget would only flush the cache
+    if (cost > budgetBytes) {
+        qDebug() << "Image too large for cache:" << fileName << cost << "bytes";
+        return;
+    }
+
+    auto existing = index.find(key);
+    if (existing != index.end()) {
+        counters.bytesUsed -= existing.value()->cost;
+        entries.erase(existing.value());
+        index.erase(existing);
+    }
+
+    entries.push_front(Entry{key, result, cost});
+    index.insert(key, entries.begin());
+    counters.bytesUsed += cost;
+    ++counters.insertions;
+
+    evictToBudget();
+}
+
+void ImageCache::evictToBudget()
+{
+    while (counters.bytesUsed > budgetBytes && !entries.empty()) {
+        const Entry &victim = entries.back();
+        counters.bytesUsed -= victim.cost;
+        index.remove(victim.key);
+        entries.pop_back();
+        ++counters.evictions;
+    }
+}
+
+void ImageCache::setBudget(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    budgetBytes = qMax<qint64>(0, bytes);
+    evictToBudget();
+}
+
+qint64 ImageCache::budget() const
+{
+    QMutexLocker locker(&mutex);
+    return budgetBytes;
+}
+
+void ImageCache::clear()
+{
+    QMutexLocker locker(&mutex);
+    entries.clear();
+    index.clear();
+    counters.bytesUsed = 0;
+}
+
+ImageCache::Stats ImageCache::stats() const
+{
+    QMutexLocker locker(&mutex);
+    Stats snapshot = counters;
+    snapshot.budgetBytes = budgetBytes;
+    snapshot.entries = int(entries.size());
+    return snapshot;
+}
@@ -0,0 +1,73 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <atomic>
+#include <list>
+
+#include "dicomloader.h"
+
+// In-process LRU cache of decoded images and their metadata. Entries are keyed
+// by path, file size and modification time, so an edited file is decoded
+// again. Memory is capped by a byte budget, the least recently used entries
+// are evicted first. Safe to use from loader threads.
+class ImageCache
+{
+public:
+    struct Stats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        quint64 evictions = 0;
+        quint64 insertions = 0;
+        qint64 bytesUsed = 0;
+        qint64 budgetBytes = 0;
+        int entries = 0;
+    };
+
+    explicit ImageCache(qint64 budgetBytes = 1024LL * 1024 * 1024);
+
+    // Returns true and fills result when fileName is cached and unchanged
+    bool lookup(const QString &fileName, DicomLoader::LoadResult &result);
+    void insert(const QString &fileName, const DicomLoader::LoadResult &result);
+    bool contains(const QString &fileName) const;
+
+    // Marks fileName as being decoded for the cache, so a second loader
+    // waits for that decode instead of running its own
+    void beginDecode(const QString &fileName);
+    void endDecode(const QString &fileName);
+    // Blocks while fileName is being decoded, returns false if canceled was
+    // set meanwhile. A lookup afterwards finds the result unless it failed.
+    bool waitForDecode(const QString &fileName, const std::atomic_bool *canceled = nullptr);
+
+    void setBudget(qint64 budgetBytes);
+    qint64 budget() const;
+    void clear();
+    Stats stats() const;
+
+    // Approximate memory held by a decoded image
+    static qint64 costOf(const DicomLoader::LoadResult &result);
+
+private:
+    struct Entry {
+        QString key;
+        DicomLoader::LoadResult result;
+        qint64 cost;
+    };
+    using EntryList = std::list<Entry>;
+
+    static QString makeKey(const QString &fileName);
+    void evictToBudget();
+
+    mutable QMutex mutex;
+    EntryList entries;  // most recently used first
+    QHash<QString, EntryList::iterator> index;
+    QHash<QString, int> decoding;  // file name to number of decodes
+    QWaitCondition decodeFinished;
+    qint64 budgetBytes;
+    Stats counters;
+};
+
+#endif // IMAGECACHE_H
@@ -0,0 +1,238 @@
+#include "imageitem.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QDebug>
+#include <cmath>
+
+#include "profiler.h"
+
+namespace {
+
+quint64 tileKey(int level, int tileX, int tileY)
+{
+    return (quint64(level) << 48) | (quint64(tileY) << 24) | quint64(tileX);
+}
+
+}
+
+ImageItem::ImageItem(const PixelBuffer &pixels, const DicomLoader::DicomMetadata &metadata,
+                     QGraphicsItem *parent)
+    : QGraphicsItem(parent)
+    , pixels(pixels)
+{
+    // exposedRect is only filled in with the extended style option
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+
+    DicomLoader::configureWindowLevel(lut, pixels, metadata);
+    setTileBudget(192LL * 1024 * 1024);
+
+    // Delivered on the GUI thread, the pyramid is destroyed with the item
+    QObject::connect(&pyramid, &PixelPyramid::levelReady, [this](int level) { levelReady(level); });
+    pyramid.build(pixels, tileSize);
+}
+
+QRectF ImageItem::boundingRect() const
+{
+    return QRectF(0, 0, pixels.width, pixels.height);
+}
+
+int ImageItem::levelCount() const
+{
+    // Down to the level where the whole image fits in a single tile
+    int levels = 1;
+    while (qMax(pixels.width, pixels.height) > (tileSize << (levels - 1))) {
+        ++levels;
+    }
+    return levels;
+}
+
+int ImageItem::levelForScale(qreal scale) const
+{
+    if (scale >= 1.0 || scale <= 0.0) {
+        return 0;
+    }
+
+    // Finest level that still has at least one source pixel per screen pixel
+    const int level = int(std::floor(std::log2(1.0 / scale)));
+    return qBound(0, level, levelCount() - 1);
+}
+
+void ImageItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+                      QWidget *widget)
+{
+    PROFILE_SCOPE("ImageItem::paint");
+    Q_UNUSED(widget);
+
+    if (pixels.isNull()) {
+        return;
+    }
+
+    const QRect bounds(0, 0, pixels.width, pixels.height);
+    const QRect exposed = option->exposedRect.toAlignedRect() & bounds;
+    if (exposed.isEmpty()) {
+        return;
+    }
+
+    const qreal scale = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+    const int level = levelForScale(scale);
+    const int factor = 1 << level;
+    const int span = tileSize * factor;  // item pixels covered by one tile
+
+    // Only tiles intersecting the exposed area are drawn, or built
+    const int firstX = exposed.left() / span;
+    const int lastX = exposed.right() / span;
+    const int firstY = exposed.top() / span;
+    const int lastY = exposed.bottom() / span;
+
+    for (int tileY = firstY; tileY <= lastY; ++tileY) {
+        for (int tileX = firstX; tileX <= lastX; ++tileX) {
+            const QImage *image = tile(level, tileX, tileY);
+            if (!image) {
+                continue;
+            }
+
+            // Edge tiles are cropped to the image, not stretched past it
+            const QRectF target(tileX * span, tileY * span,
+                                qMin(span, pixels.width - tileX * span),
+                                qMin(span, pixels.height - tileY * span));
+            const QRectF source(0, 0, target.width() / factor, target.height() / factor);
+            painter->drawImage(target, *image, source);
+        }
+    }
+}
+
+const QImage *ImageItem::tile(int level, int tileX, int tileY)
+{
+    const quint64 key = tileKey(level, tileX, tileY);
+    if (const QImage *cached = tiles.object(key)) {
+        return cached;
+    }
+
+    QImage *image = new QImage(renderTile(level, tileX, tileY));
+    if (image->isNull()) {
+        delete image;
+        return nullptr;
+    }
+
+    // insert() takes ownership, and deletes right away if over budget
+    const qsizetype cost = qMax<qsizetype>(1, image->sizeInBytes() / 1024);
+    if (!tiles.insert(key, image, cost)) {
+        return nullptr;
+    }
+    return tiles.object(key);
+}
+
+QImage ImageItem::renderTile(int level, int tileX, int tileY) const
+{
+    PROFILE_SCOPE("ImageItem::renderTile");
+    Profiler::count("tiles rendered");
+    const int factor = 1 << level;
+    const int levelWidth = (pixels.width + factor - 1) / factor;
+    const int levelHeight = (pixels.height + factor - 1) / factor;
+
+    const int x0 = tileX * tileSize;
+    const int y0 = tileY * tileSize;
+    const int width = qMin(tileSize, levelWidth - x0);
+    const int height = qMin(tileSize, levelHeight - y0);
+    if (width <= 0 || height <= 0) {
+        return QImage();
+    }
+
+    // The level itself once it is built, else the closest finer one
+    int sourceLevel = level;
+    PixelBuffer source = pyramid.level(sourceLevel);
+    while (source.isNull() && sourceLevel > 0) {
+        source = pyramid.level(--sourceLevel);
+    }
+    if (source.isNull()) {
+        source = pixels;
+        sourceLevel = 0;
+    }
+
+    QImage image(width, height, QImage::Format_RGB32);
+
+    // A finer level is sampled at the centre of each step x step block
+    const int step = 1 << (level - sourceLevel);
+    const int offset = step / 2;
+    for (int y = 0; y < height; ++y) {
+        const int sourceY = qMin((y0 + y) * step + offset, source.height - 1);
+        const int sourceX = qMin(x0 * step + offset, source.width - 1);
+        const int count = qMin(width, (source.width - 1 - sourceX) / step + 1);
+
+        uint32_t *line = reinterpret_cast<uint32_t*>(image.scanLine(y));
+        if (step == 1) {
+            lut.applyRowRgb32(source.constRow(sourceY) + sourceX, line, count);
+        } else {
+            lut.applyStridedRgb32(source.constRow(sourceY) + sourceX, step, line, count);
+        }
+
+        // Repeat the last column when the edge block is partial
+        for (int x = count; x < width; ++x) {
+            line[x] = line[count - 1];
+        }
+    }
+
+    return image;
+}
+
+void ImageItem::levelReady(int level)
+{
+    // Tiles of this level were sampled from a finer one, redo them averaged
+    const QList<quint64> keys = tiles.keys();
+    for (quint64 key : keys) {
+        if (int(key >> 48) == level) {
+            tiles.remove(key);
+        }
+    }
+    update();
+}
+
+void ImageItem::invalidateTiles()
+{
+    // Everything rendered so far is stale, paint() rebuilds the visible tiles
+    tiles.clear();
+    update();
+}
+
+void ImageItem::setTileBudget(qint64 bytes)
+{
+    tiles.setMaxCost(qMax<qint64>(1, bytes / 1024));
+}
+
+void ImageItem::setWindow(double center, double width)
+{
+    lut.setWindow(center, width);
+    invalidateTiles();
+}
+
+double ImageItem::windowCenter() const
+{
+    return lut.center();
+}
+
+double ImageItem::windowWidth() const
+{
+    return lut.width();
+}
+
+void ImageItem::fullRangeWindow(double &center, double &width) const
+{
+    lut.fullRangeWindow(center, width);
+}
+
+void ImageItem::setPixels(const PixelBuffer &newPixels)
+{
+    if (newPixels.width != pixels.width || newPixels.height != pixels.height) {
+        prepareGeometryChange();
+    }
+    pixels = newPixels;
+    pyramid.build(pixels, tileSize);
+
+    // No file I/O and no full conversion, only the visible tiles are redone
+    invalidateTiles();
+}
+
+const PixelBuffer &ImageItem::pixelBuffer() const
+{
+    return pixels;
+}
@@ -0,0 +1,64 @@
+#ifndef IMAGEITEM_H
+#define IMAGEITEM_H
+
+#include <QCache>
+#include <QGraphicsItem>
+#include <QImage>
+
+#include "dicomloader.h"
+#include "pixelbuffer.h"
+#include "pixelpyramid.h"
+#include "windowlevel.h"
+
+// Scene item that displays a full precision grayscale image through a
+// window/level LUT. The image is drawn from a pyramid of fixed size tiles at
+// power-of-two downsample levels. Tiles are built on demand for the level
+// matching the view scale and only where they intersect the exposed area, and
+// they live in a bounded cache, so very large images never exist as one
+// rendered bitmap. Coarse tiles come from area averaged pixel levels built in
+// the background, until a level is ready its tiles sample a finer one.
+class ImageItem : public QGraphicsItem
+{
+public:
+    ImageItem(const PixelBuffer &pixels, const DicomLoader::DicomMetadata &metadata,
+              QGraphicsItem *parent = nullptr);
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+               QWidget *widget) override;
+
+    void setWindow(double center, double width);
+    double windowCenter() const;
+    double windowWidth() const;
+
+    // Window spanning the whole stored range, in modality units
+    void fullRangeWindow(double &center, double &width) const;
+
+    // Swaps in another buffer of the same pixel format, e.g. the next slice
+    // of a volume. The window is kept.
+    void setPixels(const PixelBuffer &newPixels);
+    const PixelBuffer &pixelBuffer() const;
+
+    // Memory allowed for rendered tiles
+    void setTileBudget(qint64 bytes);
+
+    static const int tileSize = 256;
+
+private:
+    int levelCount() const;
+    int levelForScale(qreal scale) const;
+    const QImage *tile(int level, int tileX, int tileY);
+    QImage renderTile(int level, int tileX, int tileY) const;
+    void invalidateTiles();
+    void levelReady(int level);
+
+    PixelBuffer pixels;
+    PixelPyramid pyramid;
+    WindowLevelLut lut;
+
+    // Keyed by level and tile position, cost in KB. RGB32 is the raster
+    // engine's fast path for drawImage.
+    QCache<quint64, QImage> tiles;
+};
+
+#endif // IMAGEITEM_H
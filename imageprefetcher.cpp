@@ -0,0 +1,151 @@
+#include "imageprefetcher.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QThread>
+
+#include "dicomloader.h"
+#include "imagecache.h"
+#include "profiler.h"
+
+ImagePrefetcher::ImagePrefetcher(ImageCache *cache, QObject *parent)
+    : QObject(parent)
+    , cache(cache)
+    , current(-1)
+    , direction(1)
+    , prefetchRadius(4)
+{
+    // Half the cores, the foreground load and the GUI keep the rest
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    // Decodes post back to this object
+    cancel();
+    pool.waitForDone();
+}
+
+void ImagePrefetcher::setRadius(int radius)
+{
+    prefetchRadius = qMax(0, radius);
+    schedule();
+}
+
+int ImagePrefetcher::radius() const
+{
+    return prefetchRadius;
+}
+
+void ImagePrefetcher::setSequence(const QStringList &fileNames)
+{
+    if (fileNames == sequence) {
+        return;
+    }
+    sequence = fileNames;
+    current = -1;
+    direction = 1;
+}
+
+void ImagePrefetcher::setCurrent(int index)
+{
+    if (index >= 0 && current >= 0 && index != current) {
+        direction = index > current ? 1 : -1;
+    }
+    current = index;
+    schedule();
+}
+
+void ImagePrefetcher::cancel()
+{
+    pool.clear();
+    for (const auto &task : std::as_const(running)) {
+        task->canceled = true;
+    }
+    running.clear();
+}
+
+void ImagePrefetcher::schedule()
+{
+    // Nothing queued survives a move, what is still wanted is queued again
+    pool.clear();
+
+    QHash<QString, int> wanted;
+    if (cache && current >= 0 && current < sequence.size()) {
+        for (int distance = 1; distance <= prefetchRadius; ++distance) {
+            // Higher priority runs first, ahead beats behind at equal distance
+            const int priority = 2 * (prefetchRadius - distance) + 1;
+            const int ahead = current + direction * distance;
+            const int behind = current - direction * distance;
+            if (ahead >= 0 && ahead < sequence.size()) {
+                wanted.insert(sequence.at(ahead), priority);
+            }
+            if (behind >= 0 && behind < sequence.size()) {
+                wanted.insert(sequence.at(behind), priority - 1);
+            }
+        }
+    }
+
+    // Decodes that left the window are stopped. One already running for the
+    // image now on screen goes on, the foreground loader waits for it in the
+    // cache rather than decoding the file again. Cleared tasks that never
+    // started are forgotten.
+    const QString onScreen = current >= 0 && current < sequence.size() ? sequence.at(current) : QString();
+    for (auto it = running.begin(); it != running.end();) {
+        const bool keep = wanted.contains(it.key()) || it.key() == onScreen;
+        if (!keep || !it.value()->started) {
+            it.value()->canceled = true;
+            it = running.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto it = wanted.cbegin(); it != wanted.cend(); ++it) {
+        const QString fileName = it.key();
+        if (running.contains(fileName) || cache->contains(fileName)) {
+            continue;
+        }
+        auto task = std::make_shared<Task>();
+        running.insert(fileName, task);
+        pool.start([this, fileName, task]() {
+            runDecode(fileName, task);
+        }, it.value());
+    }
+}
+
+void ImagePrefetcher::runDecode(const QString &fileName, std::shared_ptr<Task> task)
+{
+    // Registered before started is set, a foreground load of a task schedule()
+    // kept always finds the decode
+    cache->beginDecode(fileName);
+    task->started = true;
+    if (task->canceled) {
+        cache->endDecode(fileName);
+        return;
+    }
+    PROFILE_SCOPE("ImagePrefetcher::decode");
+
+    DicomLoader loader;
+    loader.setProgressCallback([task](int, const QString &) {
+        return !task->canceled;
+    });
+    const DicomLoader::LoadResult result = loader.loadFile(fileName);
+
+    const bool decoded = !loader.wasCanceled() && !task->canceled && !result.isNull();
+    if (decoded) {
+        cache->insert(fileName, result);
+        Profiler::count("images prefetched");
+    }
+    cache->endDecode(fileName);
+
+    QMetaObject::invokeMethod(this, [this, fileName, task, decoded]() {
+        // A newer decode of the same file may have replaced this one
+        auto it = running.find(fileName);
+        if (it != running.end() && it.value() == task) {
+            running.erase(it);
+        }
+        if (decoded) {
+            emit prefetched(fileName);
+        }
+    }, Qt::QueuedConnection);
+}
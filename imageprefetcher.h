@@ -0,0 +1,60 @@
+#ifndef IMAGEPREFETCHER_H
+#define IMAGEPREFETCHER_H
+
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+
+class ImageCache;
+
+// Decodes the images around the one on screen into the ImageCache, so
+// stepping to a neighbour is a cache hit. Nearer images are decoded first
+// and the direction the user is stepping in wins ties. Moving the current
+// image drops queued work and cancels decodes that left the window, except
+// one already decoding the new current image, which the foreground load
+// waits for through the cache.
+// Everything except the decode itself runs on the GUI thread.
+class ImagePrefetcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ImagePrefetcher(ImageCache *cache, QObject *parent = nullptr);
+    ~ImagePrefetcher();
+
+    // Images prefetched on each side of the current one
+    void setRadius(int radius);
+    int radius() const;
+
+    // Ordered images the user steps through, usually one series
+    void setSequence(const QStringList &fileNames);
+    // Index into the sequence of the image on screen, -1 for none
+    void setCurrent(int index);
+    void cancel();
+
+signals:
+    void prefetched(const QString &fileName);
+
+private:
+    struct Task {
+        std::atomic_bool canceled{false};
+        std::atomic_bool started{false};
+    };
+
+    void schedule();
+    void runDecode(const QString &fileName, std::shared_ptr<Task> task);
+
+    ImageCache *cache;
+    QThreadPool pool;
+    QStringList sequence;
+    int current;
+    int direction;  // +1 or -1, last step taken
+    int prefetchRadius;
+    QHash<QString, std::shared_ptr<Task>> running;  // queued or decoding
+};
+
+#endif // IMAGEPREFETCHER_H
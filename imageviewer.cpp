@@ -1,21 +1,82 @@
 #include "imageviewer.h"
 #include "annotationmanager.h"
+#include "imageitem.h"
+#include "profiler.h"
 #include <QtWidgets/qscrollbar.h>
+#include <QGraphicsPixmapItem>
+#include <QPainter>
+#include <QScreen>
+#include <QtMath>
+#include <cmath>
+
+namespace {
+
+// Overlay geometry in viewport pixels
+const int statsBarWidth = 6;
+const int statsHeight = 80;
+const int statsMargin = 8;
+const int hudScopeRows = 10;
+
+}
 
 ImageViewer::ImageViewer(QWidget *parent)
     : QGraphicsView(parent)
     , scene(nullptr)
     , pixmapItem(nullptr)
     , isPanning(false)
+    , isWindowing(false)
+    , imageItem(nullptr)
+    , previewShown(false)
+    , sliceScrollBar(nullptr)
+    , slabMode(SlabProjector::Maximum)
+    , slabThickness(1)
     , drawingMode(false)
     , annotationManager(nullptr)
+    , lastInputApplyNs(0)
+    , hasPendingLine(false)
+    , inputEventCount(0)
+    , inputApplyCount(0)
+    , crosshairEnabled(false)
+    , isMovingCrosshair(false)
+    , isRotatingCrosshair(false)
+    , hasPendingCrosshair(false)
+    , pendingRotation(0.0)
+    , lastRotateAngle(0.0)
+    , zoomTarget(1.0)
+    , showFrameStats(false)
+    , hudRefreshPending(false)
 {
     setupScene();
 
     setDragMode(QGraphicsView::NoDrag);
     setRenderHint(QPainter::Antialiasing);
-    setTransformationAnchor(QGraphicsView::AnchorUnderMouse);
+    // Zoom anchors itself, see applyZoom
+    setTransformationAnchor(QGraphicsView::NoAnchor);
     setResizeAnchor(QGraphicsView::AnchorUnderMouse);
+
+    // Slice bar sits in a viewport margin on the right, shown for volumes only
+    sliceScrollBar = new QScrollBar(Qt::Vertical, this);
+    sliceScrollBar->setVisible(false);
+    connect(sliceScrollBar, &QScrollBar::valueChanged, this, &ImageViewer::setSlice);
+
+    zoomAnimation.setDuration(120);
+    zoomAnimation.setEasingCurve(QEasingCurve::OutCubic);
+    connect(&zoomAnimation, &QVariantAnimation::valueChanged, this, [this](const QVariant &value) {
+        applyZoom(value.toReal());
+    });
+
+    inputTimer.setSingleShot(true);
+    inputTimer.setTimerType(Qt::PreciseTimer);
+    connect(&inputTimer, &QTimer::timeout, this, &ImageViewer::applyPendingInput);
+    inputClock.start();
+
+    // The overlay is refreshed on its own, not from paintEvent, so showing it
+    // does not keep the view repainting
+    frameStatsTimer.setInterval(250);
+    connect(&frameStatsTimer, &QTimer::timeout, this, [this]() {
+        hudRefreshPending = true;
+        viewport()->update(hudRect);
+    });
 }
 
 void ImageViewer::setupScene()
@@ -36,6 +97,418 @@ void ImageViewer::setAnnotationManager(AnnotationManager *manager)
     annotationManager = manager;
 }
 
+void ImageViewer::displayImage(const DicomLoader::LoadResult &result)
+{
+    PROFILE_SCOPE("ImageViewer::displayImage");
+    QGraphicsScene *actualScene = QGraphicsView::scene();
+    if (!actualScene) {
+        return;
+    }
+
+    // Only the image is replaced, the annotation layer stays in the scene
+    delete imageItem;
+    delete pixmapItem;
+    imageItem = nullptr;
+    pixmapItem = nullptr;
+    volume = result.volume;
+    slabProjector.setVolume(volume);
+    colorFrames = result.frames;
+
+    QRectF imageRect;
+    if (!result.pixels.isNull()) {
+        // Full precision data is windowed on the fly
+        imageItem = new ImageItem(result.pixels, result.metadata);
+        actualScene->addItem(imageItem);
+        imageRect = imageItem->boundingRect();
+        emit windowLevelChanged(imageItem->windowCenter(), imageItem->windowWidth());
+    } else {
+        QPixmap pixmap;
+        {
+            PROFILE_SCOPE("QPixmap::fromImage");
+            pixmap = QPixmap::fromImage(result.image);
+        }
+        pixmapItem = actualScene->addPixmap(pixmap);
+        imageRect = pixmapItem->boundingRect();
+    }
+
+    // Slices are switched from memory, the bar only appears for volumes and
+    // colour multi-frame files
+    const bool hasSlices = sliceCount() > 1;
+    sliceScrollBar->blockSignals(true);
+    sliceScrollBar->setRange(0, sliceCount() - 1);
+    sliceScrollBar->setValue(0);
+    sliceScrollBar->setPageStep(qMax(1, sliceCount() / 10));
+    sliceScrollBar->blockSignals(false);
+    sliceScrollBar->setVisible(hasSlices);
+    setViewportMargins(0, 0, hasSlices ? sliceScrollBar->sizeHint().width() : 0, 0);
+    layoutSliceScrollBar();
+    emit sliceChanged(0, sliceCount());
+
+    // A slab chosen for the previous volume carries over
+    if (hasSlices && imageItem && slabThickness > 1) {
+        imageItem->setPixels(slicePixels(0));
+    }
+
+    // Measurements use the full precision pixels when there are any
+    if (annotationManager) {
+        annotationManager->setMeasurementSource(imageItem ? imageItem->pixelBuffer() : result.pixels,
+                                                result.metadata);
+    }
+
+    // The preview already covered the same area, zoom and pan carry over
+    const bool keepView = previewShown && actualScene->sceneRect() == imageRect;
+    previewShown = false;
+    if (annotationManager) {
+        annotationManager->setLinesVisible(true);
+    }
+
+    actualScene->setSceneRect(imageRect);
+    if (!keepView) {
+        fitImageInView();
+    }
+}
+
+void ImageViewer::displayPreview(const QImage &preview, const QSize &fullSize)
+{
+    PROFILE_SCOPE("ImageViewer::displayPreview");
+    QGraphicsScene *actualScene = QGraphicsView::scene();
+    if (!actualScene || preview.isNull() || fullSize.isEmpty()) {
+        return;
+    }
+
+    delete imageItem;
+    delete pixmapItem;
+    imageItem = nullptr;
+    volume.reset();
+    slabProjector.setVolume(volume);
+    colorFrames.clear();
+
+    // Stretched over the full size, so the final image lands on the same
+    // scene rect and replaces it without the view moving
+    pixmapItem = actualScene->addPixmap(QPixmap::fromImage(preview));
+    pixmapItem->setTransformationMode(Qt::SmoothTransformation);
+    pixmapItem->setTransform(QTransform::fromScale(double(fullSize.width()) / preview.width(),
+                                                   double(fullSize.height()) / preview.height()));
+
+    sliceScrollBar->setVisible(false);
+    setViewportMargins(0, 0, 0, 0);
+    emit sliceChanged(0, sliceCount());
+
+    // The lines still belong to the previous image
+    if (annotationManager) {
+        annotationManager->setLinesVisible(false);
+        annotationManager->setMeasurementSource(PixelBuffer(), DicomLoader::emptyMetadata());
+    }
+
+    previewShown = true;
+    actualScene->setSceneRect(QRectF(QPointF(0, 0), QSizeF(fullSize)));
+    fitImageInView();
+}
+
+bool ImageViewer::isShowingPreview() const
+{
+    return previewShown;
+}
+
+void ImageViewer::updatePixels(const PixelBuffer &pixels)
+{
+    if (!imageItem || pixels.isNull()) {
+        return;
+    }
+    const QSize oldSize(imageItem->pixelBuffer().width, imageItem->pixelBuffer().height);
+    imageItem->setPixels(pixels);
+    if (oldSize != QSize(pixels.width, pixels.height) && QGraphicsView::scene()) {
+        QGraphicsView::scene()->setSceneRect(imageItem->boundingRect());
+    }
+}
+
+void ImageViewer::setCrosshairEnabled(bool enabled)
+{
+    crosshairEnabled = enabled;
+    viewport()->update();
+}
+
+void ImageViewer::setCrosshair(const QPointF &scenePos, const QColor &horizontal, const QColor &vertical)
+{
+    crosshairPoint = scenePos;
+    crosshairHorizontal = horizontal;
+    crosshairVertical = vertical;
+    viewport()->update();
+}
+
+void ImageViewer::drawForeground(QPainter *painter, const QRectF &rect)
+{
+    Q_UNUSED(rect);
+    if (!crosshairEnabled || !QGraphicsView::scene()) {
+        return;
+    }
+
+    // Cosmetic pens, one screen pixel at any zoom
+    const QRectF bounds = QGraphicsView::scene()->sceneRect();
+    painter->save();
+    painter->setRenderHint(QPainter::Antialiasing, false);
+    painter->setPen(QPen(crosshairHorizontal, 0));
+    painter->drawLine(QPointF(bounds.left(), crosshairPoint.y()), QPointF(bounds.right(), crosshairPoint.y()));
+    painter->setPen(QPen(crosshairVertical, 0));
+    painter->drawLine(QPointF(crosshairPoint.x(), bounds.top()), QPointF(crosshairPoint.x(), bounds.bottom()));
+    painter->restore();
+}
+
+double ImageViewer::angleAround(const QPointF &scenePos) const
+{
+    const QPointF offset = scenePos - crosshairPoint;
+    return qRadiansToDegrees(std::atan2(offset.y(), offset.x()));
+}
+
+void ImageViewer::fitImageInView()
+{
+    PROFILE_SCOPE("ImageViewer::fitInView");
+    zoomAnimation.stop();
+    if (QGraphicsView::scene()) {
+        fitInView(QGraphicsView::scene()->sceneRect(), Qt::KeepAspectRatio);
+    }
+    if (annotationManager) {
+        annotationManager->setViewScale(transform().m11());
+    }
+}
+
+int ImageViewer::sliceCount() const
+{
+    if (volume) {
+        return volume->depth;
+    }
+    return qMax(1, int(colorFrames.size()));
+}
+
+int ImageViewer::currentSlice() const
+{
+    return sliceCount() > 1 ? sliceScrollBar->value() : 0;
+}
+
+void ImageViewer::setSlice(int index)
+{
+    const bool hasFrames = !volume && pixmapItem && colorFrames.size() > 1;
+    if (!(volume && imageItem) && !hasFrames) {
+        return;
+    }
+    if (index < 0 || index >= sliceCount()) {
+        return;
+    }
+
+    if (sliceScrollBar->value() != index) {
+        // Comes back through valueChanged
+        sliceScrollBar->setValue(index);
+        return;
+    }
+
+    PROFILE_SCOPE("ImageViewer::setSlice");
+    if (hasFrames) {
+        // Colour frames were converted to RGB32 while loading
+        pixmapItem->setPixmap(QPixmap::fromImage(colorFrames[index]));
+        emit sliceChanged(index, sliceCount());
+        return;
+    }
+
+    const PixelBuffer pixels = slicePixels(index);
+    imageItem->setPixels(pixels);
+    if (annotationManager) {
+        annotationManager->setMeasurementPixels(pixels);
+    }
+    emit sliceChanged(index, volume->depth);
+}
+
+void ImageViewer::setSlab(SlabProjector::Mode mode, int thickness)
+{
+    slabMode = mode;
+    slabThickness = qMax(1, thickness);
+    if (!volume || !imageItem || volume->depth < 2) {
+        return;
+    }
+
+    const PixelBuffer pixels = slicePixels(currentSlice());
+    imageItem->setPixels(pixels);
+    if (annotationManager) {
+        annotationManager->setMeasurementPixels(pixels);
+    }
+}
+
+PixelBuffer ImageViewer::slicePixels(int index)
+{
+    if (slabThickness <= 1) {
+        return volume->slice(index);
+    }
+    // Kept inside the volume at the ends rather than thinned
+    const int first = qBound(0, index - (slabThickness - 1) / 2, qMax(0, volume->depth - slabThickness));
+    const PixelBuffer pixels = slabProjector.project(slabMode, first, first + slabThickness - 1);
+    return pixels.isNull() ? volume->slice(index) : pixels;
+}
+
+void ImageViewer::setFrameStatsVisible(bool visible)
+{
+    showFrameStats = visible;
+    frameTimes.reset();
+    inputEventCount = 0;
+    inputApplyCount = 0;
+    if (visible) {
+        frameStatsTimer.start();
+    } else {
+        frameStatsTimer.stop();
+    }
+    viewport()->update();
+}
+
+bool ImageViewer::isFrameStatsVisible() const
+{
+    return showFrameStats;
+}
+
+void ImageViewer::paintEvent(QPaintEvent *event)
+{
+    if (!showFrameStats) {
+        PROFILE_SCOPE("ImageViewer::paintEvent");
+        QGraphicsView::paintEvent(event);
+        return;
+    }
+
+    // Refreshes of just the overlay would pile up cheap frames in the
+    // histogram, a repaint that reaches beyond it counts as a frame
+    const bool overlayOnly = hudRefreshPending && hudRect.contains(event->region().boundingRect());
+    hudRefreshPending = false;
+
+    QElapsedTimer timer;
+    timer.start();
+    {
+        PROFILE_SCOPE("ImageViewer::paintEvent");
+        QGraphicsView::paintEvent(event);
+    }
+    if (!overlayOnly) {
+        frameTimes.record(timer.nsecsElapsed());
+    }
+
+    QPainter painter(viewport());
+    drawFrameStats(painter);
+}
+
+void ImageViewer::drawFrameStats(QPainter &painter)
+{
+    const int buckets = frameTimes.bucketCount();
+    const int lineHeight = painter.fontMetrics().height();
+
+    const double interval = frameIntervalNs() / 1e6;
+    QStringList lines = {
+        QString("%1 frames, budget %2 ms").arg(frameTimes.frameCount()).arg(interval, 0, 'f', 1),
+        QString("p50 %1  p95 %2 ms").arg(frameTimes.percentileMs(0.5), 0, 'f', 1)
+            .arg(frameTimes.percentileMs(0.95), 0, 'f', 1),
+        QString("p99 %1  max %2 ms").arg(frameTimes.percentileMs(0.99), 0, 'f', 1)
+            .arg(frameTimes.maxMs(), 0, 'f', 1),
+        QString("input %1 events -> %2 updates").arg(inputEventCount).arg(inputApplyCount),
+    };
+
+    // Profiler totals, the most expensive scopes first
+    if (Profiler::isEnabled()) {
+        lines << QString("scope  calls  avg / max / last ms");
+        const QVector<Profiler::ScopeSummary> scopes = Profiler::scopeSummaries();
+        for (int i = 0; i < qMin(int(scopes.size()), hudScopeRows); ++i) {
+            const Profiler::ScopeSummary &scope = scopes.at(i);
+            lines << QString("%1  %2  %3 / %4 / %5")
+                         .arg(QString::fromUtf8(scope.name))
+                         .arg(scope.calls)
+                         .arg(scope.totalNs / 1e6 / scope.calls, 0, 'f', 2)
+                         .arg(scope.maxNs / 1e6, 0, 'f', 2)
+                         .arg(scope.lastNs / 1e6, 0, 'f', 2);
+        }
+        for (const Profiler::CounterValue &counter : Profiler::counterValues()) {
+            lines << QString("%1: %2").arg(QString::fromUtf8(counter.name)).arg(counter.value);
+        }
+    } else {
+        lines << QString("timings off");
+    }
+
+    int textWidth = buckets * statsBarWidth;
+    for (const QString &line : lines) {
+        textWidth = qMax(textWidth, painter.fontMetrics().horizontalAdvance(line));
+    }
+    const QRect panel(statsMargin, statsMargin, textWidth + 2 * statsMargin,
+                      statsHeight + (int(lines.size()) + 1) * lineHeight);
+    painter.fillRect(panel, QColor(0, 0, 0, 180));
+
+    // The refresh timer repaints this area, it follows the panel's size
+    hudRect = panel;
+
+    // One bar per millisecond, the last one collects everything slower.
+    // Bars that end within the display's frame interval are green.
+    const int baseline = panel.top() + statsMargin + statsHeight;
+    const int tallest = qMax(1, frameTimes.largestBucket());
+    for (int i = 0; i < buckets; ++i) {
+        const int height = frameTimes.bucket(i) * statsHeight / tallest;
+        const QColor color = i + 1 <= interval ? QColor(80, 200, 80) : QColor(230, 70, 60);
+        painter.fillRect(panel.left() + statsMargin + i * statsBarWidth, baseline - height,
+                         statsBarWidth - 1, height, color);
+    }
+
+    // Budget marker at the measured frame interval
+    painter.setPen(QColor(255, 255, 255, 160));
+    const int budgetOffset = qMin(qRound(interval * statsBarWidth), buckets * statsBarWidth);
+    const int budgetX = panel.left() + statsMargin + budgetOffset - 1;
+    painter.drawLine(budgetX, baseline - statsHeight, budgetX, baseline);
+
+    int y = baseline + lineHeight;
+    for (const QString &line : lines) {
+        painter.drawText(panel.left() + statsMargin, y, line);
+        y += lineHeight;
+    }
+}
+
+void ImageViewer::resizeEvent(QResizeEvent *event)
+{
+    QGraphicsView::resizeEvent(event);
+    layoutSliceScrollBar();
+}
+
+void ImageViewer::layoutSliceScrollBar()
+{
+    // Right of the viewport, inside the margin reserved in displayImage
+    const QRect area = viewport()->geometry();
+    const int width = sliceScrollBar->sizeHint().width();
+    sliceScrollBar->setGeometry(area.right() + 1, area.top(), width, area.height());
+}
+
+bool ImageViewer::hasWindowLevel() const
+{
+    return imageItem != nullptr;
+}
+
+double ImageViewer::windowCenter() const
+{
+    return imageItem ? imageItem->windowCenter() : 0.0;
+}
+
+double ImageViewer::windowWidth() const
+{
+    return imageItem ? imageItem->windowWidth() : 0.0;
+}
+
+void ImageViewer::setWindowLevel(double center, double width)
+{
+    if (!imageItem) {
+        return;
+    }
+
+    imageItem->setWindow(center, width);
+    emit windowLevelChanged(imageItem->windowCenter(), imageItem->windowWidth());
+}
+
+void ImageViewer::resetWindowLevel()
+{
+    if (!imageItem) {
+        return;
+    }
+
+    double center, width;
+    imageItem->fullRangeWindow(center, width);
+    setWindowLevel(center, width);
+}
+
 void ImageViewer::setDrawingMode(bool enabled)
 {
     drawingMode = enabled;
@@ -49,6 +522,45 @@ void ImageViewer::setDrawingMode(bool enabled)
 
 void ImageViewer::keyPressEvent(QKeyEvent *event)
 {
+    if (sliceCount() > 1) {
+        // Arrow keys step one slice, page keys jump a tenth of the volume
+        switch (event->key()) {
+        case Qt::Key_Up:
+            setSlice(currentSlice() - 1);
+            return;
+        case Qt::Key_Down:
+            setSlice(currentSlice() + 1);
+            return;
+        case Qt::Key_PageUp:
+            setSlice(qMax(0, currentSlice() - sliceScrollBar->pageStep()));
+            return;
+        case Qt::Key_PageDown:
+            setSlice(qMin(sliceCount() - 1, currentSlice() + sliceScrollBar->pageStep()));
+            return;
+        default:
+            break;
+        }
+    }
+
+    if (crosshairEnabled) {
+        switch (event->key()) {
+        case Qt::Key_Up:
+            emit planeStepRequested(-1);
+            return;
+        case Qt::Key_Down:
+            emit planeStepRequested(1);
+            return;
+        case Qt::Key_PageUp:
+            emit planeStepRequested(-10);
+            return;
+        case Qt::Key_PageDown:
+            emit planeStepRequested(10);
+            return;
+        default:
+            break;
+        }
+    }
+
     if (event->key() == Qt::Key_Delete && annotationManager) {
         annotationManager->deleteSelectedLine();
         qDebug() << "Deleted selected line via keyboard";
@@ -59,39 +571,59 @@ void ImageViewer::keyPressEvent(QKeyEvent *event)
 
 void ImageViewer::mousePressEvent(QMouseEvent *event)
 {
+    if (event->button() == Qt::RightButton && imageItem) {
+        // Right drag adjusts window/level in either mode
+        isWindowing = true;
+        lastWindowPoint = event->pos();
+        event->accept();
+        return;
+    }
+
+    if (event->button() == Qt::MiddleButton) {
+        isPanning = true;
+        lastPanPoint = event->pos();
+        setCursor(Qt::ClosedHandCursor);
+        event->accept();
+        return;
+    }
+
+    if (crosshairEnabled && event->button() == Qt::LeftButton) {
+        const QPointF scenePos = mapToScene(event->pos());
+        if (event->modifiers() & Qt::ShiftModifier) {
+            isRotatingCrosshair = true;
+            lastRotateAngle = angleAround(scenePos);
+        } else {
+            isMovingCrosshair = true;
+            pendingCrosshair = scenePos;
+            hasPendingCrosshair = true;
+            scheduleInput();
+        }
+        event->accept();
+        return;
+    }
+
     if (!annotationManager) {
         QGraphicsView::mousePressEvent(event);
         return;
     }
 
     if (drawingMode && event->button() == Qt::LeftButton) {
-        // Drawing mode start a new line
+        // Drawing mode start a new line, not on a preview
         QPointF scenePos = mapToScene(event->pos());
-        annotationManager->startLine(scenePos);
+        if (!previewShown) {
+            annotationManager->startLine(scenePos);
+        }
     } else if (!drawingMode && event->button() == Qt::LeftButton) {
         // View mode check for line selection or start panning
         QPointF scenePos = mapToScene(event->pos());
         QGraphicsScene *actualScene = QGraphicsView::scene();
 
         if (actualScene) {
-            // Check for line items at click position
-            QRectF clickArea(scenePos.x() - 3, scenePos.y() - 3, 6, 6);
-            QList<QGraphicsItem*> items = actualScene->items(clickArea);
-
-            QGraphicsLineItem *clickedLine = nullptr;
-            for (QGraphicsItem *item : items) {
-                if (QGraphicsLineItem *lineItem = qgraphicsitem_cast<QGraphicsLineItem*>(item)) {
-                    clickedLine = lineItem;
-                    break;
-                }
-            }
+            // Half the pen width plus about three screen pixels
+            const qreal tolerance = 1.5 + 3.0 / qMax(transform().m11(), 1e-6);
 
-            if (clickedLine) {
-                // Line clicked select it
-                annotationManager->selectLine(clickedLine);
-            } else {
-                // Empty space clicked deselect and start panning
-                annotationManager->selectLine(nullptr);
+            if (previewShown || !annotationManager->selectLineAt(scenePos, tolerance)) {
+                // Empty space clicked start panning
                 isPanning = true;
                 lastPanPoint = event->pos();
                 setCursor(Qt::ClosedHandCursor);
@@ -104,27 +636,141 @@ void ImageViewer::mousePressEvent(QMouseEvent *event)
 
 void ImageViewer::mouseMoveEvent(QMouseEvent *event)
 {
-    if (drawingMode && annotationManager) {
+    if (isWindowing && (event->buttons() & Qt::RightButton)) {
+        pendingWindow += event->pos() - lastWindowPoint;
+        lastWindowPoint = event->pos();
+        scheduleInput();
+        event->accept();
+        return;
+    }
+
+    if (isMovingCrosshair && (event->buttons() & Qt::LeftButton)) {
+        pendingCrosshair = mapToScene(event->pos());
+        hasPendingCrosshair = true;
+        scheduleInput();
+        event->accept();
+        return;
+    }
+
+    if (isRotatingCrosshair && (event->buttons() & Qt::LeftButton)) {
+        // Accumulated across the wrap at +-180 degrees
+        const double angle = angleAround(mapToScene(event->pos()));
+        pendingRotation += std::remainder(angle - lastRotateAngle, 360.0);
+        lastRotateAngle = angle;
+        scheduleInput();
+        event->accept();
+        return;
+    }
+
+    if (drawingMode && annotationManager && (event->buttons() & Qt::LeftButton)) {
         // Drawing mode
-        QPointF scenePos = mapToScene(event->pos());
-        annotationManager->updateLine(scenePos);
-    } else if (isPanning && (event->buttons() & Qt::LeftButton)) {
+        pendingLinePoint = mapToScene(event->pos());
+        hasPendingLine = true;
+        scheduleInput();
+    } else if (isPanning && (event->buttons() & (Qt::LeftButton | Qt::MiddleButton))) {
         // View mode
-        QPoint delta = event->pos() - lastPanPoint;
+        pendingPan += event->pos() - lastPanPoint;
         lastPanPoint = event->pos();
-
-        horizontalScrollBar()->setValue(horizontalScrollBar()->value() - delta.x());
-        verticalScrollBar()->setValue(verticalScrollBar()->value() - delta.y());
+        scheduleInput();
     }
 
     QGraphicsView::mouseMoveEvent(event);
 }
 
+qint64 ImageViewer::frameIntervalNs() const
+{
+    const QScreen *current = screen();
+    const qreal rate = current ? current->refreshRate() : 60.0;
+    return qint64(1e9 / qBound(24.0, rate, 480.0));
+}
+
+void ImageViewer::scheduleInput()
+{
+    ++inputEventCount;
+    if (inputTimer.isActive()) {
+        return;
+    }
+
+    // Right away if a frame has passed since the last update, otherwise at
+    // the start of the next one. Either way after the queued events.
+    const qint64 wait = frameIntervalNs() - (inputClock.nsecsElapsed() - lastInputApplyNs);
+    inputTimer.start(int(qMax<qint64>(0, wait / 1000000)));
+}
+
+void ImageViewer::applyPendingInput()
+{
+    PROFILE_SCOPE("ImageViewer::applyPendingInput");
+    inputTimer.stop();
+    lastInputApplyNs = inputClock.nsecsElapsed();
+
+    if (!pendingWindow.isNull() && imageItem) {
+        // Scale the drag to the data range so CT and 8-bit data feel the same
+        double fullCenter, fullWidth;
+        imageItem->fullRangeWindow(fullCenter, fullWidth);
+        const double step = qMax(1.0, fullWidth / 1024.0);
+
+        setWindowLevel(imageItem->windowCenter() + pendingWindow.y() * step,
+                       qMax(1.0, imageItem->windowWidth() + pendingWindow.x() * step));
+        ++inputApplyCount;
+    }
+    pendingWindow = QPoint();
+
+    if (!pendingPan.isNull()) {
+        horizontalScrollBar()->setValue(horizontalScrollBar()->value() - pendingPan.x());
+        verticalScrollBar()->setValue(verticalScrollBar()->value() - pendingPan.y());
+        pendingPan = QPoint();
+        ++inputApplyCount;
+    }
+
+    if (hasPendingLine && annotationManager) {
+        annotationManager->updateLine(pendingLinePoint);
+        ++inputApplyCount;
+    }
+    hasPendingLine = false;
+
+    if (hasPendingCrosshair) {
+        hasPendingCrosshair = false;
+        emit crosshairMoved(pendingCrosshair);
+        ++inputApplyCount;
+    }
+
+    if (pendingRotation != 0.0) {
+        const double degrees = pendingRotation;
+        pendingRotation = 0.0;
+        emit crosshairRotated(degrees);
+        ++inputApplyCount;
+    }
+}
+
 void ImageViewer::mouseReleaseEvent(QMouseEvent *event)
 {
+    // The last moves land before the drag ends
+    applyPendingInput();
+
+    if (event->button() == Qt::RightButton && isWindowing) {
+        isWindowing = false;
+        event->accept();
+        return;
+    }
+
+    if (event->button() == Qt::MiddleButton && isPanning) {
+        isPanning = false;
+        setCursor(drawingMode ? Qt::CrossCursor : Qt::ArrowCursor);
+        event->accept();
+        return;
+    }
+
+    if (event->button() == Qt::LeftButton && (isMovingCrosshair || isRotatingCrosshair)) {
+        isMovingCrosshair = false;
+        isRotatingCrosshair = false;
+        event->accept();
+        return;
+    }
+
     if (drawingMode && annotationManager && event->button() == Qt::LeftButton) {
         // Drawing mode finish the line
         QPointF scenePos = mapToScene(event->pos());
+        annotationManager->updateLine(scenePos);
         annotationManager->finishLine(scenePos);
         qDebug() << "Finished line at scene position:" << scenePos;
     } else if (event->button() == Qt::LeftButton) {
@@ -140,14 +786,41 @@ void ImageViewer::wheelEvent(QWheelEvent *event)
 {
     const double scaleFactor = 1.15;
 
-    if (event->angleDelta().y() > 0) {
-        if (transform().m11() < 10.0) {
-            scale(scaleFactor, scaleFactor);
-        }
-    } else {
-        if (transform().m11() > 0.1) {
-            scale(1.0 / scaleFactor, 1.0 / scaleFactor);
-        }
+    // Notches arriving mid animation extend the target, the animation restarts
+    // from where it is so zooming stays continuous
+    const qreal current = transform().m11();
+    const qreal base = zoomAnimation.state() == QAbstractAnimation::Running ? zoomTarget : current;
+    const qreal notches = event->angleDelta().y() / 120.0;
+    if (notches == 0.0) {
+        event->accept();
+        return;
     }
+
+    // Zoom stops past 0.1 and 10 but never jumps into that range. A huge
+    // image fits below 0.1, zooming out from there just does nothing.
+    const qreal zoomed = base * std::pow(scaleFactor, notches);
+    zoomTarget = qBound(qMin(0.1, base), zoomed, qMax(10.0, base));
+
+    zoomAnchorView = event->position();
+    zoomAnchorScene = mapToScene(event->position().toPoint());
+
+    zoomAnimation.stop();
+    zoomAnimation.setStartValue(current);
+    zoomAnimation.setEndValue(zoomTarget);
+    zoomAnimation.start();
     event->accept();
 }
+
+void ImageViewer::applyZoom(qreal scale)
+{
+    setTransform(QTransform::fromScale(scale, scale));
+
+    // Scroll so the anchor lands back under the cursor
+    const QPointF drift = QPointF(mapFromScene(zoomAnchorScene)) - zoomAnchorView;
+    horizontalScrollBar()->setValue(horizontalScrollBar()->value() + qRound(drift.x()));
+    verticalScrollBar()->setValue(verticalScrollBar()->value() + qRound(drift.y()));
+
+    if (annotationManager) {
+        annotationManager->setViewScale(scale);
+    }
+}
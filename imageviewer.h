@@ -3,8 +3,18 @@
 
 #include <QGraphicsView>
 #include <QMouseEvent>
+#include <QScrollBar>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QVariantAnimation>
+#include <memory>
+
+#include "dicomloader.h"
+#include "frametimehistogram.h"
+#include "slabprojector.h"
 
 class AnnotationManager;
+class ImageItem;
 
 class ImageViewer : public QGraphicsView
 {
@@ -16,12 +26,62 @@ public:
     void setDrawingMode(bool enabled);
     void setAnnotationManager(AnnotationManager *manager);
 
+    // Replaces the scene contents with a loaded image and fits it in view.
+    // After a preview of the same size the view is left as it is.
+    void displayImage(const DicomLoader::LoadResult &result);
+
+    // Shows a reduced size image stretched to fullSize until displayImage
+    // replaces it. Lines are hidden and cannot be edited meanwhile.
+    void displayPreview(const QImage &preview, const QSize &fullSize);
+    bool isShowingPreview() const;
+
+    // Window/level of full precision images, ignored for standard images
+    bool hasWindowLevel() const;
+    double windowCenter() const;
+    double windowWidth() const;
+    void setWindowLevel(double center, double width);
+    void resetWindowLevel();
+
+    // Slice navigation for multi-frame files and series
+    int sliceCount() const;
+    int currentSlice() const;
+    void setSlice(int index);
+
+    // Maximum, minimum or average projection over thickness slices centred
+    // on the current one. A thickness of 1 shows the plain slice.
+    void setSlab(SlabProjector::Mode mode, int thickness);
+
+    // Swaps in new pixels of the same format, e.g. a plane resampled while
+    // the user drags. Window, zoom and scroll position are kept.
+    void updatePixels(const PixelBuffer &pixels);
+
+    // MPR crosshair drawn over the image. While enabled, left drag moves it,
+    // shift + left drag turns the image around it, the arrow and page keys
+    // step through planes and the middle button pans.
+    void setCrosshairEnabled(bool enabled);
+    void setCrosshair(const QPointF &scenePos, const QColor &horizontal, const QColor &vertical);
+
+    // Performance HUD: frame time histogram, input coalescing and, while the
+    // profiler records, the most expensive scopes
+    void setFrameStatsVisible(bool visible);
+    bool isFrameStatsVisible() const;
+
+signals:
+    void windowLevelChanged(double center, double width);
+    void sliceChanged(int index, int count);
+    void crosshairMoved(const QPointF &scenePos);
+    void crosshairRotated(double degrees);  // clockwise on screen
+    void planeStepRequested(int steps);
+
 protected:
     void mousePressEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
     void wheelEvent(QWheelEvent *event) override;
     void keyPressEvent(QKeyEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void paintEvent(QPaintEvent *event) override;
+    void drawForeground(QPainter *painter, const QRectF &rect) override;
 
 private:
     void setupScene();
@@ -34,9 +94,69 @@ private:
     bool isPanning;
     QPoint lastPanPoint;
 
+    // window/level drag with the right button
+    bool isWindowing;
+    QPoint lastWindowPoint;
+    ImageItem *imageItem;
+    bool previewShown;
+
+    // slices of the current volume, if any
+    std::shared_ptr<VolumeData> volume;
+    QVector<QImage> colorFrames;  // frames of colour multi-frame files instead
+    QScrollBar *sliceScrollBar;
+    void layoutSliceScrollBar();
+    SlabProjector slabProjector;
+    SlabProjector::Mode slabMode;
+    int slabThickness;
+    PixelBuffer slicePixels(int index);
+
     // drawing
     bool drawingMode;
     AnnotationManager *annotationManager;
+
+    // Drag input is collected per event and applied at most once per display
+    // frame, high rate mice and tablets send far more events than that
+    QTimer inputTimer;
+    QElapsedTimer inputClock;
+    qint64 lastInputApplyNs;
+    bool hasPendingLine;
+    QPointF pendingLinePoint;
+    QPoint pendingPan;
+    QPoint pendingWindow;
+    int inputEventCount;
+    int inputApplyCount;
+    void scheduleInput();
+    void applyPendingInput();
+    qint64 frameIntervalNs() const;
+
+    // MPR crosshair, moves and turns are coalesced like the other drags
+    bool crosshairEnabled;
+    bool isMovingCrosshair;
+    bool isRotatingCrosshair;
+    QPointF crosshairPoint;
+    QColor crosshairHorizontal;
+    QColor crosshairVertical;
+    bool hasPendingCrosshair;
+    QPointF pendingCrosshair;
+    double pendingRotation;
+    double lastRotateAngle;
+    double angleAround(const QPointF &scenePos) const;
+
+    // Wheel zoom eases towards zoomTarget, keeping the scene point that was
+    // under the cursor in place
+    QVariantAnimation zoomAnimation;
+    qreal zoomTarget;
+    QPointF zoomAnchorScene;
+    QPointF zoomAnchorView;
+    void applyZoom(qreal scale);
+
+    // performance HUD
+    bool showFrameStats;
+    FrameTimeHistogram frameTimes;
+    QTimer frameStatsTimer;
+    QRect hudRect;  // area the HUD covered when last drawn
+    bool hudRefreshPending;  // set by frameStatsTimer, its repaints are not frames
+    void drawFrameStats(QPainter &painter);
 };
 
 #endif // IMAGEVIEWER_H
@@ -5,6 +5,11 @@
 #include <QPixmap>
 #include <QGraphicsPixmapItem>
 #include <QMessageBox>
+#include <QInputDialog>
+#include <QSettings>
+#include <QStandardPaths>
+
+#include "profiler.h"
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent), isCurrentImageDicom(false), isDrawingMode(false)
@@ -17,8 +22,31 @@ MainWindow::MainWindow(QWidget *parent)
     // Create DICOM loader
     dicomLoader = new DicomLoader();
 
-    // Create annotation manager
+    // Background loading keeps decoding off the GUI thread
+    imageLoader = new AsyncImageLoader(this);
+    stallMonitor = new UiStallMonitor(this);
+
+    // Decoded images are kept for re-opening, budget persists between runs
+    QSettings settings("MedicalImageViewer", "MedicalImageViewer");
+    const qint64 budgetMB = settings.value("imageCache/budgetMB", 1024).toLongLong();
+    imageCache = new ImageCache(budgetMB * 1024 * 1024);
+    imageLoader->setCache(imageCache);
+
+    // Neighbours of the browsed image are decoded ahead into the same cache
+    prefetcher = new ImagePrefetcher(imageCache, this);
+    prefetcher->setRadius(settings.value("prefetch/radius", 4).toInt());
+
+    connect(imageLoader, &AsyncImageLoader::loadStarted, this, &MainWindow::onLoadStarted);
+    connect(imageLoader, &AsyncImageLoader::progressChanged, this, &MainWindow::onLoadProgress);
+    connect(imageLoader, &AsyncImageLoader::previewReady, this, &MainWindow::onPreviewReady);
+    connect(imageLoader, &AsyncImageLoader::loadFinished, this, &MainWindow::onImageLoaded);
+    connect(imageLoader, &AsyncImageLoader::loadFailed, this, &MainWindow::onLoadFailed);
+    connect(imageLoader, &AsyncImageLoader::loadCanceled, this, &MainWindow::onLoadCanceled);
+
+    // Create annotation manager, the undo history is bounded by settings
     annotationManager = new AnnotationManager(scene, this);
+    annotationManager->setHistoryLimits(settings.value("annotations/historyMB", 64).toLongLong() * 1024 * 1024,
+                                        settings.value("annotations/historyCommands", 10000).toInt());
 
     // Connect annotation manager to image viewer
     imageView->setAnnotationManager(annotationManager);
@@ -35,24 +63,62 @@ MainWindow::MainWindow(QWidget *parent)
     metadataDisplay->setReadOnly(true);
     metadataDisplay->setFont(QFont("Arial", 13));
 
-    // Create annotation controls
+    // Create annotation and window/level controls
     createAnnotationControls();
+    createWindowLevelControls();
 
     // Create right panel with metadata and controls
     QWidget *rightPanel = new QWidget(this);
     QVBoxLayout *rightLayout = new QVBoxLayout(rightPanel);
     rightLayout->addWidget(metadataDisplay);
+    rightLayout->addWidget(windowLevelGroup);
     rightLayout->addWidget(annotationGroup);
     rightLayout->addStretch();
 
+    // Thumbnails of the current folder sit under the image
+    thumbnailStrip = new ThumbnailStrip(this);
+    thumbnailStrip->setVisible(false);
+    connect(thumbnailStrip, &ThumbnailStrip::imageActivated, this, &MainWindow::showBrowsedImage);
+
+    // Volumes can be switched to reformatted planes in place of the image
+    mprView = new MprView(this);
+    connect(mprView, &MprView::windowLevelChanged, this, &MainWindow::updateWindowLevelStatus);
+    connect(imageView, &ImageViewer::windowLevelChanged, mprView, &MprView::setWindowLevel);
+    volumeView = new VolumeView(this);
+    volumeView->setVisible(false);
+    connect(imageView, &ImageViewer::windowLevelChanged, volumeView, &VolumeView::setWindowLevel);
+    imageSplitter = new QSplitter(Qt::Horizontal, this);
+    imageSplitter->addWidget(imageView);
+    imageSplitter->addWidget(volumeView);
+
+    viewStack = new QStackedWidget(this);
+    viewStack->addWidget(imageSplitter);
+    viewStack->addWidget(mprView);
+
+    viewerSplitter = new QSplitter(Qt::Vertical, this);
+    viewerSplitter->addWidget(viewStack);
+    viewerSplitter->addWidget(thumbnailStrip);
+    viewerSplitter->setStretchFactor(0, 1);
+    viewerSplitter->setStretchFactor(1, 0);
+
     // Create splitter
     mainSplitter = new QSplitter(Qt::Horizontal, this);
-    mainSplitter->addWidget(imageView);
+    mainSplitter->addWidget(viewerSplitter);
     mainSplitter->addWidget(rightPanel);
     mainSplitter->setSizes({750, 250});
 
     setCentralWidget(mainSplitter);
+
+    // Study browser, shown once a folder is opened
+    studyBrowser = new StudyBrowser(this);
+    browserDock = new QDockWidget("Study Browser", this);
+    browserDock->setWidget(studyBrowser);
+    browserDock->setVisible(false);
+    addDockWidget(Qt::LeftDockWidgetArea, browserDock);
+    connect(studyBrowser, &StudyBrowser::imageActivated, this, &MainWindow::showBrowsedImage);
+
     createMenuBar();
+    createStatusBar();
 
     setWindowTitle("Medical Image Annotation Tool");
     resize(1000, 700);
@@ -62,7 +128,11 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
-
+    // Loader workers use the cache, stop them before it goes away
+    delete prefetcher;
+    delete imageLoader;
+    delete imageCache;
+    delete dicomLoader;
 }
 
 void MainWindow::createMenuBar()
@@ -72,7 +142,131 @@ void MainWindow::createMenuBar()
 
     connect(openAction, &QAction::triggered, this, &MainWindow::openImage);
 
+    QAction *openSeriesAction = new QAction("Open Series Folder...", this);
+    connect(openSeriesAction, &QAction::triggered, this, &MainWindow::openSeries);
+
+    QAction *openFolderAction = new QAction("Open Folder...", this);
+    connect(openFolderAction, &QAction::triggered, this, &MainWindow::openFolder);
+
+    // Steps through the series selected in the study browser
+    QAction *nextImageAction = new QAction("Next Image", this);
+    QAction *previousImageAction = new QAction("Previous Image", this);
+    nextImageAction->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_Down));
+    previousImageAction->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_Up));
+    connect(nextImageAction, &QAction::triggered, studyBrowser, &StudyBrowser::selectNext);
+    connect(previousImageAction, &QAction::triggered, studyBrowser, &StudyBrowser::selectPrevious);
+
     fileMenu->addAction(openAction);
+    fileMenu->addAction(openSeriesAction);
+    fileMenu->addAction(openFolderAction);
+    fileMenu->addSeparator();
+    fileMenu->addAction(nextImageAction);
+    fileMenu->addAction(previousImageAction);
+    fileMenu->addAction(browserDock->toggleViewAction());
+
+    QMenu *editMenu = menuBar()->addMenu("Edit");
+    QAction *undoAction = new QAction("Undo", this);
+    QAction *redoAction = new QAction("Redo", this);
+    undoAction->setShortcut(QKeySequence::Undo);
+    redoAction->setShortcut(QKeySequence::Redo);
+    undoAction->setEnabled(annotationManager->canUndo());
+    redoAction->setEnabled(annotationManager->canRedo());
+
+    connect(undoAction, &QAction::triggered, annotationManager, &AnnotationManager::undo);
+    connect(redoAction, &QAction::triggered, annotationManager, &AnnotationManager::redo);
+    connect(annotationManager, &AnnotationManager::historyChanged, this,
+            [undoAction, redoAction](bool canUndo, bool canRedo) {
+        undoAction->setEnabled(canUndo);
+        redoAction->setEnabled(canRedo);
+    });
+
+    editMenu->addAction(undoAction);
+    editMenu->addAction(redoAction);
+
+    QMenu *viewMenu = menuBar()->addMenu("View");
+    mprAction = new QAction("MPR", this);
+    mprAction->setCheckable(true);
+    mprAction->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_M));
+    mprAction->setEnabled(false);
+    resetMprAction = new QAction("Reset MPR Orientation", this);
+    resetMprAction->setEnabled(false);
+
+    connect(mprAction, &QAction::toggled, this, &MainWindow::setMprVisible);
+    connect(resetMprAction, &QAction::triggered, mprView, &MprView::resetOrientation);
+
+    volumeViewAction = new QAction("3D Volume", this);
+    volumeViewAction->setCheckable(true);
+    volumeViewAction->setShortcut(QKeySequence(Qt::CTRL | Qt::Key_3));
+    volumeViewAction->setEnabled(false);
+    connect(volumeViewAction, &QAction::toggled, this, &MainWindow::setVolumeViewVisible);
+
+    viewMenu->addAction(mprAction);
+    viewMenu->addAction(resetMprAction);
+    viewMenu->addSeparator();
+    viewMenu->addAction(volumeViewAction);
+
+    QMenu *cacheMenu = menuBar()->addMenu("Cache");
+    QAction *statsAction = new QAction("Cache Statistics...", this);
+    QAction *budgetAction = new QAction("Set Cache Budget...", this);
+    QAction *clearAction = new QAction("Clear Cache", this);
+
+    connect(statsAction, &QAction::triggered, this, &MainWindow::showCacheStatistics);
+    connect(budgetAction, &QAction::triggered, this, &MainWindow::setCacheBudget);
+    connect(clearAction, &QAction::triggered, this, [this]() { imageCache->clear(); });
+
+    cacheMenu->addAction(statsAction);
+    cacheMenu->addAction(budgetAction);
+    cacheMenu->addAction(clearAction);
+
+    // Timings are only recorded while switched on, the HUD works either way
+    QMenu *performanceMenu = menuBar()->addMenu("Performance");
+    QAction *hudAction = new QAction("Show HUD", this);
+    hudAction->setCheckable(true);
+    hudAction->setShortcut(QKeySequence(Qt::Key_F12));
+    QAction *recordAction = new QAction("Record Timings", this);
+    recordAction->setCheckable(true);
+    recordAction->setChecked(Profiler::isEnabled());
+    QAction *exportTraceAction = new QAction("Export Trace...", this);
+    QAction *resetTimingsAction = new QAction("Reset Timings", this);
+
+    connect(hudAction, &QAction::toggled, imageView, &ImageViewer::setFrameStatsVisible);
+    connect(recordAction, &QAction::toggled, this, [](bool enabled) { Profiler::setEnabled(enabled); });
+    connect(exportTraceAction, &QAction::triggered, this, &MainWindow::exportTrace);
+    connect(resetTimingsAction, &QAction::triggered, this, []() { Profiler::reset(); });
+
+    performanceMenu->addAction(hudAction);
+    performanceMenu->addAction(recordAction);
+    performanceMenu->addAction(exportTraceAction);
+    performanceMenu->addAction(resetTimingsAction);
+}
+
+void MainWindow::exportTrace()
+{
+    const QString fileName = QFileDialog::getSaveFileName(this, "Export Trace", "trace.json",
+                                                          "Chrome Trace (*.json)");
+    if (fileName.isEmpty()) {
+        return;
+    }
+    if (!Profiler::writeChromeTrace(fileName)) {
+        QMessageBox::warning(this, "Export Trace", "Could not write " + fileName);
+    }
+}
+
+void MainWindow::createStatusBar()
+{
+    loadStatusLabel = new QLabel(this);
+    loadProgressBar = new QProgressBar(this);
+    loadProgressBar->setRange(0, 100);
+    loadProgressBar->setMaximumWidth(200);
+    loadProgressBar->setVisible(false);
+
+    cancelLoadBtn = new QPushButton("Cancel", this);
+    cancelLoadBtn->setVisible(false);
+    connect(cancelLoadBtn, &QPushButton::clicked, imageLoader, &AsyncImageLoader::cancel);
+
+    statusBar()->addWidget(loadStatusLabel, 1);
+    statusBar()->addPermanentWidget(loadProgressBar);
+    statusBar()->addPermanentWidget(cancelLoadBtn);
 }
 
 void MainWindow::openImage()
@@ -81,41 +275,206 @@ void MainWindow::openImage()
         this,
         "Open Medical Image",
         "",
-        "Image Files (*.png *.PNG *.jpg *.JPG *.jpeg *.JPEG *.bmp *.BMP *.dcm *.DCM *.dicom *.DICOM)"
+        "Image Files (*.png *.PNG *.jpg *.JPG *.jpeg *.JPEG *.bmp *.BMP *.dcm *.DCM *.dicom *.DICOM);;All Files (*)"
     );
 
     if (!fileName.isEmpty()) {
-        QPixmap pixmap;
-
-        if (dicomLoader->isDicomFile(fileName)) {
-            qDebug() << "Loading DICOM file:" << fileName;
-            pixmap = dicomLoader->loadDicomImage(fileName);
-        } else {
-            qDebug() << "Loading standard image:" << fileName;
-            pixmap = QPixmap(fileName);
-        }
+        qDebug() << "Loading image:" << fileName;
 
-        if (!pixmap.isNull()) {
-            scene->clear();
-            scene->addPixmap(pixmap);
-            imageView->fitInView(scene->itemsBoundingRect(), Qt::KeepAspectRatio);
+        // Decoding happens on the worker pool, a newer request replaces this one
+        imageLoader->load(fileName);
+    }
+}
 
-            updateMetadataDisplay(fileName);
+void MainWindow::openSeries()
+{
+    QString directory = QFileDialog::getExistingDirectory(this, "Open Series Folder");
+
+    if (!directory.isEmpty()) {
+        qDebug() << "Loading series:" << directory;
+        imageLoader->load(directory);
+    }
+}
 
-            qDebug() << "Loaded image:" << fileName;
-        } else {
-            QMessageBox::warning(this, "Error", "Failed to load image: " + fileName);
-            clearMetadataDisplay();
-            qDebug() << "Failed to load image:" << fileName;
+void MainWindow::openFolder()
+{
+    QString directory = QFileDialog::getExistingDirectory(this, "Open Folder");
+
+    if (!directory.isEmpty()) {
+        qDebug() << "Browsing folder:" << directory;
+        browserDock->setVisible(true);
+        studyBrowser->openDirectory(directory);
+    }
+}
+
+void MainWindow::showBrowsedImage(const QString &fileName, const QStringList &seriesFiles, int index)
+{
+    // A jump out of the prefetch window cancels the work queued for the old one
+    prefetcher->setSequence(seriesFiles);
+    prefetcher->setCurrent(index);
+    imageLoader->load(fileName);
+}
+
+void MainWindow::showCacheStatistics()
+{
+    ImageCache::Stats stats = imageCache->stats();
+    const quint64 lookups = stats.hits + stats.misses;
+
+    QString text;
+    text += QString("Entries: %1\n").arg(stats.entries);
+    text += QString("Memory: %1 / %2 MB\n").arg(stats.bytesUsed / (1024 * 1024)).arg(stats.budgetBytes / (1024 * 1024));
+    text += QString("Hits: %1\n").arg(stats.hits);
+    text += QString("Misses: %1\n").arg(stats.misses);
+    text += QString("Hit Rate: %1%\n").arg(lookups ? 100.0 * stats.hits / lookups : 0.0, 0, 'f', 1);
+    text += QString("Insertions: %1\n").arg(stats.insertions);
+    text += QString("Evictions: %1\n").arg(stats.evictions);
+
+    QMessageBox::information(this, "Image Cache", text);
+}
+
+void MainWindow::setCacheBudget()
+{
+    bool ok = false;
+    const int budgetMB = QInputDialog::getInt(this, "Image Cache", "Memory budget (MB):",
+                                              int(imageCache->budget() / (1024 * 1024)),
+                                              0, 1024 * 1024, 256, &ok);
+    if (ok) {
+        imageCache->setBudget(qint64(budgetMB) * 1024 * 1024);
+        QSettings("MedicalImageViewer", "MedicalImageViewer").setValue("imageCache/budgetMB", budgetMB);
+    }
+}
+
+void MainWindow::onLoadStarted(const QString &fileName)
+{
+    loadStatusLabel->setText("Loading " + QFileInfo(fileName).fileName() + "...");
+    loadProgressBar->setValue(0);
+    loadProgressBar->setVisible(true);
+    cancelLoadBtn->setVisible(true);
+
+    if (!stallMonitor->isRunning()) {
+        stallMonitor->start();
+    }
+}
+
+void MainWindow::onLoadProgress(int percent, const QString &stage)
+{
+    loadProgressBar->setValue(percent);
+    loadProgressBar->setFormat(stage + " %p%");
+}
+
+void MainWindow::onPreviewReady(const QString &fileName, const QImage &preview, const QSize &fullSize)
+{
+    // Stands in for the image until onImageLoaded, which keeps the view
+    imageView->displayPreview(preview, fullSize);
+    loadStatusLabel->setText(QString("Loading %1 (%2 x %3), showing preview...")
+                             .arg(QFileInfo(fileName).fileName())
+                             .arg(fullSize.width())
+                             .arg(fullSize.height()));
+}
+
+void MainWindow::onImageLoaded(const QString &fileName, const DicomLoader::LoadResult &result)
+{
+    PROFILE_SCOPE("MainWindow::onImageLoaded");
+    if (!result.isNull()) {
+        // Lines are saved per image, by SOP Instance UID where there is one
+        const QString imageKey = result.metadata.sopInstanceUID.isEmpty()
+                                     ? QFileInfo(fileName).absoluteFilePath()
+                                     : result.metadata.sopInstanceUID;
+        const QString journalDir =
+            QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/annotations";
+        annotationManager->openDocument(AnnotationJournal::pathFor(journalDir, imageKey), imageKey);
+
+        // Any QPixmap is created here, on the GUI thread
+        imageView->displayImage(result);
+
+        // The strip follows the folder of single images, not of series
+        const QFileInfo info(fileName);
+        if (info.isFile()) {
+            if (thumbnailStrip->directory() != info.absolutePath()) {
+                thumbnailStrip->setDirectory(info.absolutePath());
+            }
+            thumbnailStrip->setVisible(true);
+            thumbnailStrip->setCurrentFile(info.absoluteFilePath());
+        }
+
+        // Reformats are only built while MPR is shown
+        currentResult = result;
+        const bool hasVolume = result.volume && result.volume->depth > 1;
+        mprAction->setEnabled(hasVolume);
+        if (mprAction->isChecked()) {
+            if (hasVolume) {
+                setMprVisible(true);
+            } else {
+                mprAction->setChecked(false);
+            }
         }
+        volumeViewAction->setEnabled(hasVolume);
+        if (volumeViewAction->isChecked()) {
+            if (hasVolume) {
+                setVolumeViewVisible(true);
+            } else {
+                volumeViewAction->setChecked(false);
+            }
+        }
+
+        isCurrentImageDicom = result.isDicom;
+        currentFileName = fileName;
+        updateMetadataDisplay(fileName, result);
+        updateWindowPresets(result);
+        updateSlabControls(result);
+
+        qDebug() << "Loaded image:" << fileName;
+        finishLoadMonitoring();
+    } else {
+        onLoadFailed(fileName);
     }
 }
 
-void MainWindow::updateMetadataDisplay(const QString &fileName)
+void MainWindow::onLoadFailed(const QString &fileName)
+{
+    finishLoadMonitoring();
+    restoreAfterPreview();
+    QMessageBox::warning(this, "Error", "Failed to load image: " + fileName);
+    clearMetadataDisplay();
+    qDebug() << "Failed to load image:" << fileName;
+}
+
+void MainWindow::onLoadCanceled(const QString &fileName)
+{
+    finishLoadMonitoring();
+    restoreAfterPreview();
+    loadStatusLabel->setText("Canceled loading " + QFileInfo(fileName).fileName());
+}
+
+void MainWindow::restoreAfterPreview()
+{
+    // A preview of a load that never finished gives way to the image that
+    // was shown before
+    if (imageView->isShowingPreview()) {
+        imageView->displayImage(currentResult);
+    }
+}
+
+void MainWindow::finishLoadMonitoring()
+{
+    loadProgressBar->setVisible(false);
+    cancelLoadBtn->setVisible(false);
+
+    // Report how responsive the GUI thread stayed while the load ran
+    UiStallMonitor::Stats stats = stallMonitor->stop();
+    loadStatusLabel->setText(QString("Load took %1 ms, UI max stall %2 ms (%3 stalls)")
+                             .arg(stats.monitoredMs)
+                             .arg(stats.maxStallMs)
+                             .arg(stats.stallCount));
+    qDebug() << "UI stall during load - total:" << stats.totalStallMs
+             << "ms max:" << stats.maxStallMs << "ms count:" << stats.stallCount;
+}
+
+void MainWindow::updateMetadataDisplay(const QString &fileName, const DicomLoader::LoadResult &result)
 {
-    if (dicomLoader->isDicomFile(fileName)) {
-        DicomLoader::DicomMetadata metadata = dicomLoader->extractMetadata(fileName);
+    const DicomLoader::DicomMetadata &metadata = result.metadata;
 
+    if (result.isDicom) {
         QString displayText;
         displayText += "=== DICOM METADATA ===\n\n";
         displayText += QString("Patient Name: %1\n").arg(metadata.patientName);
@@ -129,6 +488,7 @@ void MainWindow::updateMetadataDisplay(const QString &fileName)
         displayText += "=== IMAGE PROPERTIES ===\n\n";
         displayText += QString("Dimensions: %1 x %2\n").arg(metadata.imageWidth).arg(metadata.imageHeight);
         displayText += QString("Bits Stored: %1\n").arg(metadata.bitsStored);
+        displayText += QString("Frames: %1\n").arg(metadata.numberOfFrames);
         displayText += QString("Total Pixels: %1\n").arg(metadata.imageWidth * metadata.imageHeight);
 
         displayText += "\n=== FILE INFO ===\n\n";
@@ -137,10 +497,9 @@ void MainWindow::updateMetadataDisplay(const QString &fileName)
 
         metadataDisplay->setPlainText(displayText);
     } else {
-        QPixmap pixmap(fileName);
         QString displayText;
         displayText += "=== STANDARD IMAGE ===\n\n";
-        displayText += QString("Dimensions: %1 x %2\n").arg(pixmap.width()).arg(pixmap.height());
+        displayText += QString("Dimensions: %1 x %2\n").arg(metadata.imageWidth).arg(metadata.imageHeight);
         displayText += QString("Format: %1\n").arg(QFileInfo(fileName).suffix().toUpper());
         displayText += QString("File Name: %1\n").arg(QFileInfo(fileName).fileName());
         displayText += QString("File Size: %1 KB\n").arg(QFileInfo(fileName).size() / 1024);
@@ -196,6 +555,12 @@ void MainWindow::createAnnotationControls()
     lineCountLabel->setStyleSheet("QLabel { font-weight: bold; }");
     layout->addWidget(lineCountLabel);
 
+    // Length and statistics of the line being drawn or selected
+    measurementLabel = new QLabel(this);
+    measurementLabel->setWordWrap(true);
+    measurementLabel->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    layout->addWidget(measurementLabel);
+
     // Instructions
     instructionsLabel = new QLabel(
         "View Mode:\n"
@@ -224,6 +589,143 @@ void MainWindow::createAnnotationControls()
     connect(drawModeBtn, &QPushButton::clicked, this, &MainWindow::toggleDrawingMode);
     connect(clearAllBtn, &QPushButton::clicked, this, &MainWindow::clearAllAnnotations);
     connect(deleteSelectedBtn, &QPushButton::clicked, this, &MainWindow::deleteSelectedAnnotation);
+    connect(annotationManager, &AnnotationManager::measurementChanged, measurementLabel, &QLabel::setText);
+}
+
+void MainWindow::createWindowLevelControls()
+{
+    windowLevelGroup = new QGroupBox("Window / Level", this);
+    QVBoxLayout *layout = new QVBoxLayout(windowLevelGroup);
+
+    windowPresetCombo = new QComboBox(this);
+    windowPresetCombo->setEnabled(false);
+    layout->addWidget(windowPresetCombo);
+
+    windowLevelLabel = new QLabel("C: - W: -", this);
+    windowLevelLabel->setStyleSheet("QLabel { font-weight: bold; }");
+    layout->addWidget(windowLevelLabel);
+
+    sliceLabel = new QLabel(this);
+    sliceLabel->setVisible(false);
+    layout->addWidget(sliceLabel);
+
+    // Projection over a slab of slices around the current one
+    QHBoxLayout *slabLayout = new QHBoxLayout();
+    slabModeCombo = new QComboBox(this);
+    slabModeCombo->addItem("Single Slice");
+    slabModeCombo->addItem("MIP", SlabProjector::Maximum);
+    slabModeCombo->addItem("MinIP", SlabProjector::Minimum);
+    slabModeCombo->addItem("Average", SlabProjector::Average);
+    slabThicknessSpin = new QSpinBox(this);
+    slabThicknessSpin->setRange(1, 9999);
+    slabThicknessSpin->setValue(10);
+    slabThicknessSpin->setSuffix(" slices");
+    slabLayout->addWidget(slabModeCombo, 1);
+    slabLayout->addWidget(slabThicknessSpin);
+    layout->addLayout(slabLayout);
+    slabModeCombo->setEnabled(false);
+    slabThicknessSpin->setEnabled(false);
+
+    QLabel *hintLabel = new QLabel("Right drag: horizontal = width, vertical = center", this);
+    hintLabel->setWordWrap(true);
+    hintLabel->setStyleSheet("QLabel { font-size: 10px; color: gray; }");
+    layout->addWidget(hintLabel);
+
+    connect(windowPresetCombo, &QComboBox::activated, this, &MainWindow::applyWindowPreset);
+    connect(imageView, &ImageViewer::windowLevelChanged, this, &MainWindow::updateWindowLevelStatus);
+    connect(imageView, &ImageViewer::sliceChanged, this, &MainWindow::updateSliceStatus);
+    connect(slabModeCombo, &QComboBox::currentIndexChanged, this, &MainWindow::applySlab);
+    connect(slabThicknessSpin, &QSpinBox::valueChanged, this, &MainWindow::applySlab);
+}
+
+void MainWindow::updateWindowPresets(const DicomLoader::LoadResult &result)
+{
+    windowPresets = result.metadata.windowPresets;
+
+    windowPresetCombo->clear();
+    for (const DicomLoader::WindowPreset &preset : windowPresets) {
+        windowPresetCombo->addItem(QString("%1 (C %2 / W %3)")
+                                   .arg(preset.name).arg(preset.center).arg(preset.width));
+    }
+    windowPresetCombo->addItem("Full Range");
+    windowPresetCombo->setEnabled(imageView->hasWindowLevel());
+
+    if (!imageView->hasWindowLevel()) {
+        windowLevelLabel->setText("C: - W: -");
+    }
+}
+
+void MainWindow::setMprVisible(bool visible)
+{
+    if (visible && mprView->setVolume(currentResult)) {
+        if (imageView->hasWindowLevel()) {
+            mprView->setWindowLevel(imageView->windowCenter(), imageView->windowWidth());
+        }
+        viewStack->setCurrentWidget(mprView);
+        resetMprAction->setEnabled(true);
+    } else {
+        // The volume is dropped with the planes, the image view holds its own
+        mprView->clear();
+        viewStack->setCurrentWidget(imageView);
+        resetMprAction->setEnabled(false);
+    }
+}
+
+void MainWindow::setVolumeViewVisible(bool visible)
+{
+    if (visible) {
+        if (imageView->hasWindowLevel()) {
+            volumeView->setWindowLevel(imageView->windowCenter(), imageView->windowWidth());
+        }
+        volumeView->setVolume(currentResult);
+        volumeView->setVisible(true);
+        imageSplitter->setSizes({1, 1});
+    } else {
+        volumeView->clear();
+        volumeView->setVisible(false);
+    }
+}
+
+void MainWindow::applyWindowPreset(int index)
+{
+    if (index >= 0 && index < windowPresets.size()) {
+        imageView->setWindowLevel(windowPresets[index].center, windowPresets[index].width);
+    } else {
+        imageView->resetWindowLevel();
+    }
+}
+
+void MainWindow::updateSlabControls(const DicomLoader::LoadResult &result)
+{
+    const int depth = result.volume ? result.volume->depth : 1;
+    slabThicknessSpin->blockSignals(true);
+    slabThicknessSpin->setRange(1, qMax(1, depth));
+    slabThicknessSpin->blockSignals(false);
+    slabModeCombo->setEnabled(depth > 1);
+    slabThicknessSpin->setEnabled(depth > 1 && slabModeCombo->currentIndex() > 0);
+}
+
+void MainWindow::applySlab()
+{
+    // Thickness changes update the projection incrementally
+    const QVariant mode = slabModeCombo->currentData();
+    slabThicknessSpin->setEnabled(slabModeCombo->isEnabled() && mode.isValid());
+    if (mode.isValid()) {
+        imageView->setSlab(SlabProjector::Mode(mode.toInt()), slabThicknessSpin->value());
+    } else {
+        imageView->setSlab(SlabProjector::Maximum, 1);
+    }
+}
+
+void MainWindow::updateSliceStatus(int index, int count)
+{
+    sliceLabel->setVisible(count > 1);
+    sliceLabel->setText(QString("Slice: %1 / %2").arg(index + 1).arg(count));
+}
+
+void MainWindow::updateWindowLevelStatus(double center, double width)
+{
+    windowLevelLabel->setText(QString("C: %1 W: %2").arg(center, 0, 'f', 0).arg(width, 0, 'f', 0));
 }
 
 void MainWindow::toggleDrawingMode()
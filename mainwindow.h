@@ -17,9 +17,23 @@
 #include <QPushButton>
 #include <QGroupBox>
 #include <QGridLayout>
+#include <QProgressBar>
+#include <QStatusBar>
+#include <QComboBox>
+#include <QSpinBox>
+#include <QDockWidget>
+#include <QStackedWidget>
 #include "imageviewer.h"
 #include "dicomloader.h"
 #include "annotationmanager.h"
+#include "asyncimageloader.h"
+#include "uistallmonitor.h"
+#include "imagecache.h"
+#include "imageprefetcher.h"
+#include "studybrowser.h"
+#include "thumbnailstrip.h"
+#include "mprview.h"
+#include "volumeview.h"
 
 
 class MainWindow : public QMainWindow
@@ -32,10 +46,34 @@ public:
 
 private:
     void createMenuBar();
+    void createStatusBar();
     void openImage();
-    void updateMetadataDisplay(const QString &fileName);
+    void openSeries();
+    void openFolder();
+    void showBrowsedImage(const QString &fileName, const QStringList &seriesFiles, int index);
+    void showCacheStatistics();
+    void setCacheBudget();
+    void exportTrace();
+    void onLoadStarted(const QString &fileName);
+    void onLoadProgress(int percent, const QString &stage);
+    void onPreviewReady(const QString &fileName, const QImage &preview, const QSize &fullSize);
+    void onImageLoaded(const QString &fileName, const DicomLoader::LoadResult &result);
+    void onLoadFailed(const QString &fileName);
+    void onLoadCanceled(const QString &fileName);
+    void finishLoadMonitoring();
+    void restoreAfterPreview();
+    void updateMetadataDisplay(const QString &fileName, const DicomLoader::LoadResult &result);
     void clearMetadataDisplay();
     void createAnnotationControls();
+    void createWindowLevelControls();
+    void updateWindowPresets(const DicomLoader::LoadResult &result);
+    void applyWindowPreset(int index);
+    void updateWindowLevelStatus(double center, double width);
+    void updateSliceStatus(int index, int count);
+    void updateSlabControls(const DicomLoader::LoadResult &result);
+    void applySlab();
+    void setMprVisible(bool visible);
+    void setVolumeViewVisible(bool visible);
     void toggleDrawingMode();
     void clearAllAnnotations();
     void deleteSelectedAnnotation();
@@ -46,12 +84,50 @@ private:
     ImageViewer *imageView;
     QGraphicsScene *scene;
     DicomLoader *dicomLoader;
+    AsyncImageLoader *imageLoader;
+    UiStallMonitor *stallMonitor;
+    ImageCache *imageCache;
+    ImagePrefetcher *prefetcher;
     AnnotationManager *annotationManager;
 
+    // Background load status
+    QLabel *loadStatusLabel;
+    QProgressBar *loadProgressBar;
+    QPushButton *cancelLoadBtn;
+
+    // Folder browser, stepping through it is served by the prefetcher
+    QDockWidget *browserDock;
+    StudyBrowser *studyBrowser;
+
+    // Filmstrip of the folder of the image on screen
+    ThumbnailStrip *thumbnailStrip;
+
+    // Single image view or the three MPR panes of the loaded volume. The 3D
+    // view sits next to the image view.
+    QStackedWidget *viewStack;
+    QSplitter *imageSplitter;
+    MprView *mprView;
+    VolumeView *volumeView;
+    QAction *mprAction;
+    QAction *resetMprAction;
+    QAction *volumeViewAction;
+
     // display split and metadata
     QSplitter *mainSplitter;
+    QSplitter *viewerSplitter;
     QTextEdit *metadataDisplay;
 
+    // Window/level controls
+    QGroupBox *windowLevelGroup;
+    QComboBox *windowPresetCombo;
+    QLabel *windowLevelLabel;
+    QLabel *sliceLabel;
+
+    // Thick slab projection of volumes
+    QComboBox *slabModeCombo;
+    QSpinBox *slabThicknessSpin;
+    QVector<DicomLoader::WindowPreset> windowPresets;
+
     // Annotation controls
     QGroupBox *annotationGroup;
     QPushButton *drawModeBtn;
@@ -61,9 +137,11 @@ private:
     QLabel *currentModeLabel;
     QLabel *instructionsLabel;
     QLabel *lineCountLabel;
+    QLabel *measurementLabel;
 
     // Current image data
     QString currentFileName;
+    DicomLoader::LoadResult currentResult;
     bool isCurrentImageDicom;
     bool isDrawingMode;
 
@@ -0,0 +1,201 @@
+// Writes the synthetic DICOM files used by the bench target.
+//
+//   makefixtures <output directory>
+//
+// Pixel data is a smooth ramp with a few discs and low amplitude noise, so
+// lossless codecs see something closer to anatomy than to a constant image.
+// Files that already exist are kept, the 8k ones take a while to encode.
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <cstring>
+#include <vector>
+
+#include "gdcmAttribute.h"
+#include "gdcmImageChangeTransferSyntax.h"
+#include "gdcmImageWriter.h"
+#include "gdcmUIDGenerator.h"
+
+#include "benchfixtures.h"
+
+namespace {
+
+using BenchFixtures::Codec;
+using BenchFixtures::Fixture;
+
+std::vector<char> makePixels(const Fixture &fixture)
+{
+    const int size = fixture.size;
+    const int bits = fixture.bitsStored;
+    const int range = 1 << bits;
+    const int low = fixture.isSigned ? -(range / 2) : 0;
+    const int bytes = fixture.bitsAllocated() / 8;
+
+    std::vector<char> pixels(size_t(size) * size_t(size) * size_t(bytes));
+    quint32 noise = 0x12345678u;
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            // Diagonal ramp over half the range, discs on top of it
+            double value = 0.5 * range * (x + y) / (2.0 * size);
+            for (int disc = 1; disc <= 3; ++disc) {
+                const double cx = size * disc / 4.0;
+                const double dx = x - cx;
+                const double dy = y - size / 2.0;
+                if (dx * dx + dy * dy < (size / 10.0) * (size / 10.0)) {
+                    value += range * 0.15 * disc;
+                }
+            }
+            noise = noise * 1664525u + 1013904223u;
+            value += (int(noise >> 24) - 128) * range / 4096.0;
+
+            const int stored = qBound(low, low + int(value), low + range - 1);
+            char *out = pixels.data() + (size_t(y) * size + x) * bytes;
+            if (bytes == 1) {
+                out[0] = char(stored);
+            } else {
+                const quint16 raw = quint16(stored);
+                std::memcpy(out, &raw, 2);
+            }
+        }
+    }
+    return pixels;
+}
+
+template <quint16 Group, quint16 Element>
+void setString(gdcm::DataSet &dataSet, const char *value)
+{
+    gdcm::Attribute<Group, Element> attribute;
+    attribute.SetValue(value);
+    dataSet.Replace(attribute.GetAsDataElement());
+}
+
+// IS and DS values, written as text without going through Attribute's
+// numeric types
+void setText(gdcm::DataSet &dataSet, const gdcm::Tag &tag, const gdcm::VR &vr, QByteArray value)
+{
+    if (value.size() % 2 != 0) {
+        value.append(' ');
+    }
+    gdcm::DataElement element(tag);
+    element.SetVR(vr);
+    element.SetByteValue(value.constData(), quint32(value.size()));
+    dataSet.Replace(element);
+}
+
+// seriesUid is set for the slices of a series, slice is then their index
+bool writeFixture(const Fixture &fixture, const QString &path, const char *seriesUid = nullptr, int slice = 0)
+{
+    gdcm::SmartPointer<gdcm::Image> image = new gdcm::Image;
+    image->SetNumberOfDimensions(2);
+    image->SetDimension(0, fixture.size);
+    image->SetDimension(1, fixture.size);
+
+    gdcm::PixelFormat format(fixture.bitsAllocated() == 8
+                                 ? (fixture.isSigned ? gdcm::PixelFormat::INT8 : gdcm::PixelFormat::UINT8)
+                                 : (fixture.isSigned ? gdcm::PixelFormat::INT16 : gdcm::PixelFormat::UINT16));
+    format.SetBitsStored(quint16(fixture.bitsStored));
+    format.SetHighBit(quint16(fixture.bitsStored - 1));
+    image->SetPixelFormat(format);
+    image->SetPhotometricInterpretation(gdcm::PhotometricInterpretation::MONOCHROME2);
+    image->SetTransferSyntax(gdcm::TransferSyntax::ExplicitVRLittleEndian);
+
+    const std::vector<char> pixels = makePixels(fixture);
+    gdcm::DataElement pixelData(gdcm::Tag(0x7fe0, 0x0010));
+    pixelData.SetByteValue(pixels.data(), quint32(pixels.size()));
+    image->SetDataElement(pixelData);
+
+    gdcm::ImageWriter writer;
+    if (fixture.codec == Codec::Uncompressed) {
+        writer.SetImage(*image);
+    } else {
+        gdcm::ImageChangeTransferSyntax change;
+        change.SetTransferSyntax(fixture.codec == Codec::Rle ? gdcm::TransferSyntax::RLELossless
+                                                             : gdcm::TransferSyntax::JPEGLSLossless);
+        change.SetInput(*image);
+        if (!change.Change()) {
+            return false;
+        }
+        writer.SetImage(change.GetOutput());
+    }
+
+    // Secondary Capture, enough for the loader and for other viewers
+    gdcm::DataSet &dataSet = writer.GetFile().GetDataSet();
+    gdcm::UIDGenerator uids;
+    setString<0x0008, 0x0016>(dataSet, "1.2.840.10008.5.1.4.1.1.7");
+    setString<0x0008, 0x0018>(dataSet, uids.Generate());
+    setString<0x0008, 0x0060>(dataSet, "OT");
+    setString<0x0010, 0x0010>(dataSet, "Bench^Synthetic");
+    setString<0x0010, 0x0020>(dataSet, "BENCH");
+    if (seriesUid != nullptr) {
+        setString<0x0020, 0x000e>(dataSet, seriesUid);
+        setText(dataSet, gdcm::Tag(0x0020, 0x0013), gdcm::VR::IS, QByteArray::number(slice + 1));
+        setText(dataSet, gdcm::Tag(0x0020, 0x0032), gdcm::VR::DS, "0\\0\\" + QByteArray::number(slice));
+        setText(dataSet, gdcm::Tag(0x0020, 0x0037), gdcm::VR::DS, "1\\0\\0\\0\\1\\0");
+    }
+
+    writer.SetFileName(path.toStdString().c_str());
+    return writer.Write();
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTextStream err(stderr);
+
+    const QStringList args = app.arguments();
+    if (args.size() != 2) {
+        err << "usage: makefixtures <output directory>" << Qt::endl;
+        return 1;
+    }
+
+    const QDir dir(args.at(1));
+    QDir().mkpath(dir.absolutePath());
+
+    for (const Fixture &fixture : BenchFixtures::all()) {
+        const QString path = dir.filePath(fixture.fileName());
+        if (QFileInfo::exists(path)) {
+            continue;
+        }
+        // A codec missing from the GDCM build only costs its benchmarks, the
+        // build goes on and bench skips the file
+        if (!writeFixture(fixture, path)) {
+            err << "Could not write " << fixture.fileName() << Qt::endl;
+        }
+    }
+
+    // Slices keep their series UID across runs that only add missing files
+    const BenchFixtures::Series series = BenchFixtures::series();
+    const QDir seriesDir(dir.filePath(series.directoryName()));
+    QDir().mkpath(seriesDir.absolutePath());
+    const QString uidPath = seriesDir.filePath("series.uid");
+    QByteArray seriesUid;
+    QFile uidFile(uidPath);
+    if (uidFile.open(QIODevice::ReadOnly)) {
+        seriesUid = uidFile.readAll().trimmed();
+        uidFile.close();
+    }
+    if (seriesUid.isEmpty()) {
+        gdcm::UIDGenerator uids;
+        seriesUid = uids.Generate();
+        if (uidFile.open(QIODevice::WriteOnly)) {
+            uidFile.write(seriesUid);
+            uidFile.close();
+        }
+    }
+    for (int slice = 0; slice < series.slices; ++slice) {
+        const QString path = seriesDir.filePath(series.sliceFileName(slice));
+        if (QFileInfo::exists(path)) {
+            continue;
+        }
+        if (!writeFixture(series.slice(), path, seriesUid.constData(), slice)) {
+            err << "Could not write " << series.directoryName() << "/" << series.sliceFileName(slice) << Qt::endl;
+            break;
+        }
+    }
+    return 0;
+}
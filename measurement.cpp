@@ -0,0 +1,190 @@
+#include "measurement.h"
+#include <QMutex>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#include "parallelfor.h"
+#include "pixelconverter.h"
+
+namespace Measurement
+{
+
+namespace
+{
+
+// Exact integer moments, converted to doubles only at the end
+struct Accumulator {
+    qint64 count = 0;
+    int64_t sum = 0;
+    uint64_t sumSquares = 0;
+    int min = INT_MAX;
+    int max = INT_MIN;
+
+    void addRow(const uint16_t *row, size_t length, bool isSigned)
+    {
+        if (length == 0) {
+            return;
+        }
+        PixelConverter::rowMinMax(row, length, isSigned, min, max);
+        PixelConverter::rowSums(row, length, isSigned, sum, sumSquares);
+        count += qint64(length);
+    }
+
+    void merge(const Accumulator &other)
+    {
+        count += other.count;
+        sum += other.sum;
+        sumSquares += other.sumSquares;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+Stats finish(const Accumulator &acc, double slope, double intercept)
+{
+    Stats stats;
+    if (acc.count == 0) {
+        return stats;
+    }
+
+    const double n = double(acc.count);
+    const double mean = double(acc.sum) / n;
+    const double variance = std::max(0.0, double(acc.sumSquares) / n - mean * mean);
+
+    stats.count = acc.count;
+    stats.mean = slope * mean + intercept;
+    stats.stdDev = std::abs(slope) * std::sqrt(variance);
+    stats.min = slope * acc.min + intercept;
+    stats.max = slope * acc.max + intercept;
+    if (slope < 0.0) {
+        std::swap(stats.min, stats.max);
+    }
+    return stats;
+}
+
+// Span [x0, x1) of pixel centres inside the region on row y
+using SpanFunction = void (*)(const QRectF &rect, int y, int &x0, int &x1);
+
+void rectSpan(const QRectF &rect, int, int &x0, int &x1)
+{
+    x0 = int(std::ceil(rect.left() - 0.5));
+    x1 = int(std::floor(rect.right() - 0.5)) + 1;
+}
+
+void ellipseSpan(const QRectF &rect, int y, int &x0, int &x1)
+{
+    const double rx = rect.width() / 2.0;
+    const double ry = rect.height() / 2.0;
+    const double dy = (y + 0.5 - rect.center().y()) / ry;
+    if (rx <= 0.0 || ry <= 0.0 || dy * dy > 1.0) {
+        x0 = x1 = 0;
+        return;
+    }
+    const double halfWidth = rx * std::sqrt(1.0 - dy * dy);
+    x0 = int(std::ceil(rect.center().x() - halfWidth - 0.5));
+    x1 = int(std::floor(rect.center().x() + halfWidth - 0.5)) + 1;
+}
+
+Stats regionStats(const PixelBuffer &pixels, const QRectF &area, SpanFunction span,
+                  double slope, double intercept)
+{
+    if (pixels.isNull()) {
+        return Stats();
+    }
+
+    const QRectF rect = area.normalized();
+    const int y0 = std::max(0, int(std::ceil(rect.top() - 0.5)));
+    const int y1 = std::min(pixels.height, int(std::floor(rect.bottom() - 0.5)) + 1);
+    if (y0 >= y1) {
+        return Stats();
+    }
+
+    // Each chunk of rows sums privately, chunks are merged once at the end.
+    // Small regions (the interactive case) stay on this thread.
+    Accumulator total;
+    QMutex mutex;
+    const int grain = std::max(1, int((1 << 18) / std::max(1.0, rect.width())));
+    parallelFor(y0, y1, [&](int begin, int end) {
+        Accumulator acc;
+        for (int y = begin; y < end; ++y) {
+            int x0, x1;
+            span(rect, y, x0, x1);
+            x0 = std::max(0, x0);
+            x1 = std::min(pixels.width, x1);
+            if (x0 < x1) {
+                acc.addRow(pixels.constRow(y) + x0, size_t(x1 - x0), pixels.isSigned);
+            }
+        }
+        QMutexLocker locker(&mutex);
+        total.merge(acc);
+    }, grain);
+
+    return finish(total, slope, intercept);
+}
+
+}
+
+double lineLength(const QLineF &line, double spacingX, double spacingY)
+{
+    if (spacingX <= 0.0 || spacingY <= 0.0) {
+        return line.length();
+    }
+    return std::hypot(line.dx() * spacingX, line.dy() * spacingY);
+}
+
+QString lengthText(const QLineF &line, double spacingX, double spacingY)
+{
+    const double length = lineLength(line, spacingX, spacingY);
+    if (spacingX <= 0.0 || spacingY <= 0.0) {
+        return QString("%1 px").arg(length, 0, 'f', 0);
+    }
+    return QString("%1 mm").arg(length, 0, 'f', length < 10.0 ? 2 : 1);
+}
+
+void lineProfile(const PixelBuffer &pixels, const QLineF &line, std::vector<int> &values)
+{
+    values.clear();
+    if (pixels.isNull()) {
+        return;
+    }
+
+    const int steps = std::max(1, int(std::ceil(line.length())));
+    values.reserve(size_t(steps) + 1);
+    for (int i = 0; i <= steps; ++i) {
+        const QPointF p = line.pointAt(double(i) / steps);
+        const int x = int(std::floor(p.x()));
+        const int y = int(std::floor(p.y()));
+        if (x >= 0 && y >= 0 && x < pixels.width && y < pixels.height) {
+            values.push_back(pixels.valueAt(x, y));
+        }
+    }
+}
+
+Stats lineStats(const PixelBuffer &pixels, const QLineF &line, double slope, double intercept)
+{
+    std::vector<int> values;
+    lineProfile(pixels, line, values);
+
+    Accumulator acc;
+    for (int value : values) {
+        acc.sum += value;
+        acc.sumSquares += uint64_t(int64_t(value) * value);
+        acc.min = std::min(acc.min, value);
+        acc.max = std::max(acc.max, value);
+    }
+    acc.count = qint64(values.size());
+    return finish(acc, slope, intercept);
+}
+
+Stats rectStats(const PixelBuffer &pixels, const QRectF &rect, double slope, double intercept)
+{
+    return regionStats(pixels, rect, rectSpan, slope, intercept);
+}
+
+Stats ellipseStats(const PixelBuffer &pixels, const QRectF &rect, double slope, double intercept)
+{
+    return regionStats(pixels, rect, ellipseSpan, slope, intercept);
+}
+
+}
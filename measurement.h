@@ -0,0 +1,45 @@
+#ifndef MEASUREMENT_H
+#define MEASUREMENT_H
+
+#include <QLineF>
+#include <QRectF>
+#include <QString>
+#include <vector>
+
+#include "pixelbuffer.h"
+
+// Calibrated lengths and intensity statistics on the full precision pixels,
+// never on the 8-bit display image. Statistics are reported in modality
+// units (rescale slope/intercept applied), lengths in mm when the pixel
+// spacing is known and in pixels otherwise.
+namespace Measurement
+{
+
+struct Stats {
+    qint64 count = 0;
+    double mean = 0.0;
+    double stdDev = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+
+    bool isValid() const { return count > 0; }
+};
+
+// Length of line in mm, in pixels when a spacing is 0
+double lineLength(const QLineF &line, double spacingX, double spacingY);
+// Length with its unit, e.g. "12.4 mm" or "87 px"
+QString lengthText(const QLineF &line, double spacingX, double spacingY);
+
+// Stored values sampled once per pixel of length along line, clipped to the
+// image. Nearest neighbour, so every value exists in the image.
+void lineProfile(const PixelBuffer &pixels, const QLineF &line, std::vector<int> &values);
+
+Stats lineStats(const PixelBuffer &pixels, const QLineF &line, double slope, double intercept);
+
+// Pixels whose centres lie in rect or in the ellipse inscribed in it
+Stats rectStats(const PixelBuffer &pixels, const QRectF &rect, double slope, double intercept);
+Stats ellipseStats(const PixelBuffer &pixels, const QRectF &rect, double slope, double intercept);
+
+}
+
+#endif // MEASUREMENT_H
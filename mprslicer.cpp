@@ -0,0 +1,214 @@
+#include "mprslicer.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <new>
+
+#include "parallelfor.h"
+#include "pixelconverter.h"
+#include "profiler.h"
+
+MprSlicer::MprSlicer()
+{
+}
+
+void MprSlicer::setVolume(const std::shared_ptr<const VolumeData> &newVolume)
+{
+    volume = newVolume;
+    orientation = QQuaternion();
+    centerPoint = extent() / 2.0f;
+}
+
+bool MprSlicer::isNull() const
+{
+    return !volume || volume->isNull();
+}
+
+QVector3D MprSlicer::extent() const
+{
+    if (isNull()) {
+        return QVector3D();
+    }
+    // Voxel centres span (size - 1) spacings on each axis
+    return QVector3D(float((volume->width - 1) * volume->spacingX),
+                     float((volume->height - 1) * volume->spacingY),
+                     float((volume->depth - 1) * volume->spacingZ));
+}
+
+void MprSlicer::setCenter(const QVector3D &point)
+{
+    const QVector3D box = extent();
+    centerPoint = QVector3D(qBound(0.0f, point.x(), box.x()),
+                            qBound(0.0f, point.y(), box.y()),
+                            qBound(0.0f, point.z(), box.z()));
+}
+
+QVector3D MprSlicer::center() const
+{
+    return centerPoint;
+}
+
+void MprSlicer::axes(Plane plane, QVector3D &right, QVector3D &down, QVector3D &normal) const
+{
+    // Volume axes after rotation. Coronal and sagittal put the last slice on
+    // top, which is the head for series sorted feet first.
+    const QVector3D a0 = orientation.rotatedVector(QVector3D(1, 0, 0));
+    const QVector3D a1 = orientation.rotatedVector(QVector3D(0, 1, 0));
+    const QVector3D a2 = orientation.rotatedVector(QVector3D(0, 0, 1));
+
+    switch (plane) {
+    case Axial:
+        right = a0;
+        down = a1;
+        break;
+    case Coronal:
+        right = a0;
+        down = -a2;
+        break;
+    case Sagittal:
+        right = a1;
+        down = -a2;
+        break;
+    }
+    normal = QVector3D::crossProduct(right, down);
+}
+
+void MprSlicer::rotate(Plane plane, double degrees)
+{
+    QVector3D right, down, normal;
+    axes(plane, right, down, normal);
+    orientation = (QQuaternion::fromAxisAndAngle(normal, float(degrees)) * orientation).normalized();
+}
+
+void MprSlicer::resetOrientation()
+{
+    orientation = QQuaternion();
+}
+
+bool MprSlicer::isOblique() const
+{
+    return !qFuzzyCompare(std::abs(orientation.scalar()), 1.0f);
+}
+
+void MprSlicer::step(Plane plane, int steps)
+{
+    if (isNull()) {
+        return;
+    }
+    QVector3D right, down, normal;
+    axes(plane, right, down, normal);
+
+    // One slice along a volume axis, a blend of spacings when oblique
+    const double distance = std::abs(normal.x()) * volume->spacingX + std::abs(normal.y()) * volume->spacingY
+                            + std::abs(normal.z()) * volume->spacingZ;
+    setCenter(centerPoint + normal * float(distance * steps));
+}
+
+double MprSlicer::pixelSpacing() const
+{
+    if (isNull()) {
+        return 1.0;
+    }
+    return std::min(volume->spacingX, volume->spacingY);
+}
+
+MprSlicer::Grid MprSlicer::gridFor(Plane plane) const
+{
+    Grid grid;
+    if (isNull()) {
+        return grid;
+    }
+
+    QVector3D right, down, normal;
+    axes(plane, right, down, normal);
+
+    // The volume box projected onto the plane axes, independent of the centre
+    const QVector3D box = extent();
+    float minU = 0.0f, maxU = 0.0f, minV = 0.0f, maxV = 0.0f;
+    for (int corner = 0; corner < 8; ++corner) {
+        const QVector3D point((corner & 1) ? box.x() : 0.0f, (corner & 2) ? box.y() : 0.0f,
+                              (corner & 4) ? box.z() : 0.0f);
+        const float u = QVector3D::dotProduct(point, right);
+        const float v = QVector3D::dotProduct(point, down);
+        minU = corner ? std::min(minU, u) : u;
+        maxU = corner ? std::max(maxU, u) : u;
+        minV = corner ? std::min(minV, v) : v;
+        maxV = corner ? std::max(maxV, v) : v;
+    }
+
+    const double spacing = pixelSpacing();
+    grid.origin = right * minU + down * minV;
+    grid.width = int(std::floor((maxU - minU) / spacing + 1e-3)) + 1;
+    grid.height = int(std::floor((maxV - minV) / spacing + 1e-3)) + 1;
+    return grid;
+}
+
+QPointF MprSlicer::toPixel(Plane plane, const QVector3D &point) const
+{
+    QVector3D right, down, normal;
+    axes(plane, right, down, normal);
+    const QVector3D offset = point - gridFor(plane).origin;
+    const double spacing = pixelSpacing();
+    return QPointF(QVector3D::dotProduct(offset, right) / spacing, QVector3D::dotProduct(offset, down) / spacing);
+}
+
+QVector3D MprSlicer::fromPixel(Plane plane, const QPointF &pixel) const
+{
+    QVector3D right, down, normal;
+    axes(plane, right, down, normal);
+    const Grid grid = gridFor(plane);
+    const float spacing = float(pixelSpacing());
+
+    // The origin has no normal component, the centre supplies it
+    return normal * QVector3D::dotProduct(centerPoint, normal) + grid.origin
+           + right * float(pixel.x() * spacing) + down * float(pixel.y() * spacing);
+}
+
+PixelBuffer MprSlicer::render(Plane plane) const
+{
+    PROFILE_SCOPE("MprSlicer::render");
+    const Grid grid = gridFor(plane);
+    if (grid.width <= 0 || grid.height <= 0) {
+        return PixelBuffer();
+    }
+
+    PixelBuffer pixels;
+    pixels.width = grid.width;
+    pixels.height = grid.height;
+    pixels.bitsStored = volume->bitsStored;
+    pixels.isSigned = volume->isSigned;
+    pixels.minValue = volume->minValue;
+    pixels.maxValue = volume->maxValue;
+
+    uint16_t *samples = new (std::nothrow) uint16_t[size_t(grid.width) * size_t(grid.height)];
+    if (!samples) {
+        qDebug() << "Not enough memory for reformat" << grid.width << "x" << grid.height;
+        return PixelBuffer();
+    }
+    pixels.data = std::shared_ptr<const uint16_t>(samples, std::default_delete<uint16_t[]>());
+
+    QVector3D right, down, normal;
+    axes(plane, right, down, normal);
+    const float spacing = float(pixelSpacing());
+    const QVector3D toVoxel(float(1.0 / volume->spacingX), float(1.0 / volume->spacingY),
+                            float(1.0 / volume->spacingZ));
+
+    // Rows are straight lines through the volume, one kernel call each
+    const QVector3D rowOrigin = normal * QVector3D::dotProduct(centerPoint, normal) + grid.origin;
+    const QVector3D step = right * spacing * toVoxel;
+    const float stepVoxel[3] = {step.x(), step.y(), step.z()};
+    const uint16_t outside = uint16_t(volume->minValue);
+    const VolumeData &source = *volume;
+
+    parallelFor(0, grid.height, [&](int first, int last) {
+        for (int y = first; y < last; ++y) {
+            const QVector3D start = (rowOrigin + down * (spacing * float(y))) * toVoxel;
+            const float startVoxel[3] = {start.x(), start.y(), start.z()};
+            PixelConverter::sampleTrilinear(source.sliceData(0), source.width, source.height, source.depth,
+                                            source.isSigned, startVoxel, stepVoxel, size_t(grid.width),
+                                            outside, samples + size_t(y) * size_t(grid.width));
+        }
+    }, 16);
+
+    return pixels;
+}
@@ -0,0 +1,75 @@
+#ifndef MPRSLICER_H
+#define MPRSLICER_H
+
+#include <QPointF>
+#include <QQuaternion>
+#include <QVector3D>
+#include <memory>
+
+#include "pixelbuffer.h"
+#include "volumedata.h"
+
+// Multi-planar reformatting of a volume. Three mutually orthogonal planes
+// pass through a shared centre point, all positions are in millimetres with
+// voxel (0, 0, 0) at the origin. The planes start aligned with the volume
+// axes and can be rotated together for oblique reformats. Each plane is
+// resampled with trilinear interpolation on a grid of square pixels, rows
+// split across cores.
+class MprSlicer
+{
+public:
+    enum Plane {
+        Axial,
+        Coronal,
+        Sagittal
+    };
+    static const int planeCount = 3;
+
+    MprSlicer();
+
+    void setVolume(const std::shared_ptr<const VolumeData> &volume);
+    bool isNull() const;
+
+    // Crosshair point, clamped to the volume box. Starts at its centre.
+    void setCenter(const QVector3D &point);
+    QVector3D center() const;
+
+    // Turns all planes by degrees about the normal of plane, so the image
+    // of plane spins and the other two tilt into oblique reformats
+    void rotate(Plane plane, double degrees);
+    void resetOrientation();
+    bool isOblique() const;
+
+    // Moves the centre along the normal of plane by steps pixels
+    void step(Plane plane, int steps);
+
+    // Resampled image of plane through the current centre. Its size only
+    // changes with the orientation, moving the centre keeps pixel positions.
+    PixelBuffer render(Plane plane) const;
+
+    // Pixel position in the image of plane of a point, and back. fromPixel
+    // returns the point of the plane through the current centre.
+    QPointF toPixel(Plane plane, const QVector3D &point) const;
+    QVector3D fromPixel(Plane plane, const QPointF &pixel) const;
+
+    // Millimetres per output pixel, the finest in-plane spacing
+    double pixelSpacing() const;
+
+    // Screen axes and normal of plane, right, down and into the screen
+    void axes(Plane plane, QVector3D &right, QVector3D &down, QVector3D &normal) const;
+
+private:
+    struct Grid {
+        QVector3D origin;  // point at pixel (0, 0) for a centre at the origin
+        int width = 0;
+        int height = 0;
+    };
+    Grid gridFor(Plane plane) const;
+    QVector3D extent() const;
+
+    std::shared_ptr<const VolumeData> volume;
+    QVector3D centerPoint;
+    QQuaternion orientation;
+};
+
+#endif // MPRSLICER_H
@@ -0,0 +1,239 @@
+#include "mprview.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QGridLayout>
+#include <cmath>
+
+#include "profiler.h"
+
+namespace {
+
+const char *const planeNames[MprSlicer::planeCount] = {"Axial", "Coronal", "Sagittal"};
+const QColor planeColors[MprSlicer::planeCount] = {QColor(230, 80, 80), QColor(80, 200, 80),
+                                                   QColor(90, 140, 255)};
+
+}
+
+MprView::MprView(QWidget *parent)
+    : QWidget(parent)
+    , syncingWindow(false)
+{
+    QGridLayout *layout = new QGridLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->setSpacing(2);
+
+    for (int i = 0; i < MprSlicer::planeCount; ++i) {
+        const MprSlicer::Plane plane = MprSlicer::Plane(i);
+        ImageViewer *pane = new ImageViewer(this);
+        pane->setCrosshairEnabled(true);
+        pane->setToolTip(QString("%1: drag to move the crosshair, shift drag to rotate, "
+                                 "arrow keys to step").arg(planeNames[i]));
+        connect(pane, &ImageViewer::crosshairMoved, this,
+                [this, plane](const QPointF &scenePos) { onCrosshairMoved(plane, scenePos); });
+        connect(pane, &ImageViewer::crosshairRotated, this,
+                [this, plane](double degrees) { onCrosshairRotated(plane, degrees); });
+        connect(pane, &ImageViewer::planeStepRequested, this,
+                [this, plane](int steps) { onPlaneStep(plane, steps); });
+        connect(pane, &ImageViewer::windowLevelChanged, this, &MprView::onPaneWindowLevelChanged);
+        panes[i] = pane;
+        renderedOffset[i] = 0.0;
+        renderedValid[i] = false;
+    }
+
+    infoLabel = new QLabel(this);
+    infoLabel->setAlignment(Qt::AlignLeft | Qt::AlignTop);
+    infoLabel->setMargin(8);
+    infoLabel->setTextFormat(Qt::RichText);
+
+    layout->addWidget(panes[MprSlicer::Axial], 0, 0);
+    layout->addWidget(panes[MprSlicer::Coronal], 0, 1);
+    layout->addWidget(panes[MprSlicer::Sagittal], 1, 0);
+    layout->addWidget(infoLabel, 1, 1);
+}
+
+bool MprView::setVolume(const DicomLoader::LoadResult &result)
+{
+    if (!result.volume || result.volume->isNull() || result.volume->depth < 2) {
+        clear();
+        return false;
+    }
+
+    slicer.setVolume(result.volume);
+    metadata = result.metadata;
+
+    // The first render goes through displayImage to set up the window
+    for (int i = 0; i < MprSlicer::planeCount; ++i) {
+        renderedValid[i] = false;
+    }
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < MprSlicer::planeCount; ++i) {
+        const MprSlicer::Plane plane = MprSlicer::Plane(i);
+        DicomLoader::LoadResult planeResult;
+        planeResult.pixels = slicer.render(plane);
+        planeResult.metadata = metadata;
+        planeResult.isDicom = true;
+        panes[i]->displayImage(planeResult);
+        renderedOffset[i] = offsetOf(plane);
+        renderedValid[i] = true;
+    }
+    updateInfo(timer.nsecsElapsed() / 1e6, MprSlicer::planeCount);
+    updateCrosshairs();
+    return true;
+}
+
+void MprView::clear()
+{
+    slicer.setVolume(nullptr);
+    for (int i = 0; i < MprSlicer::planeCount; ++i) {
+        panes[i]->displayImage(DicomLoader::LoadResult());
+        renderedValid[i] = false;
+    }
+    infoLabel->clear();
+}
+
+bool MprView::isNull() const
+{
+    return slicer.isNull();
+}
+
+double MprView::offsetOf(MprSlicer::Plane plane) const
+{
+    QVector3D right, down, normal;
+    slicer.axes(plane, right, down, normal);
+    return QVector3D::dotProduct(slicer.center(), normal);
+}
+
+void MprView::renderPlanes()
+{
+    PROFILE_SCOPE("MprView::renderPlanes");
+    if (slicer.isNull()) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    int rendered = 0;
+    for (int i = 0; i < MprSlicer::planeCount; ++i) {
+        const MprSlicer::Plane plane = MprSlicer::Plane(i);
+        const double offset = offsetOf(plane);
+        if (renderedValid[i] && std::abs(offset - renderedOffset[i]) < 1e-4) {
+            continue;
+        }
+        panes[i]->updatePixels(slicer.render(plane));
+        renderedOffset[i] = offset;
+        renderedValid[i] = true;
+        ++rendered;
+    }
+
+    updateCrosshairs();
+    if (rendered > 0) {
+        updateInfo(timer.nsecsElapsed() / 1e6, rendered);
+    }
+}
+
+void MprView::updateCrosshairs()
+{
+    // Each pane shows the other two planes as its lines, in their colours
+    static const MprSlicer::Plane horizontalPlane[MprSlicer::planeCount] = {
+        MprSlicer::Coronal, MprSlicer::Axial, MprSlicer::Axial};
+    static const MprSlicer::Plane verticalPlane[MprSlicer::planeCount] = {
+        MprSlicer::Sagittal, MprSlicer::Sagittal, MprSlicer::Coronal};
+
+    for (int i = 0; i < MprSlicer::planeCount; ++i) {
+        const MprSlicer::Plane plane = MprSlicer::Plane(i);
+        panes[i]->setCrosshair(slicer.toPixel(plane, slicer.center()), planeColors[horizontalPlane[i]],
+                               planeColors[verticalPlane[i]]);
+    }
+}
+
+void MprView::updateInfo(double renderMs, int planesRendered)
+{
+    const QVector3D point = slicer.center();
+    QString text;
+    for (int i = 0; i < MprSlicer::planeCount; ++i) {
+        text += QString("<span style=\"color:%1\">%2</span> %3 mm<br>")
+                    .arg(planeColors[i].name(), planeNames[i])
+                    .arg(offsetOf(MprSlicer::Plane(i)), 0, 'f', 1);
+    }
+    text += QString("<br>Crosshair (%1, %2, %3) mm<br>")
+                .arg(point.x(), 0, 'f', 1)
+                .arg(point.y(), 0, 'f', 1)
+                .arg(point.z(), 0, 'f', 1);
+    text += slicer.isOblique() ? "Oblique<br>" : "Orthogonal<br>";
+    text += QString("%1 plane%2 in %3 ms")
+                .arg(planesRendered)
+                .arg(planesRendered == 1 ? "" : "s")
+                .arg(renderMs, 0, 'f', 1);
+    infoLabel->setText(text);
+}
+
+void MprView::onCrosshairMoved(MprSlicer::Plane plane, const QPointF &scenePos)
+{
+    if (slicer.isNull()) {
+        return;
+    }
+    slicer.setCenter(slicer.fromPixel(plane, scenePos));
+    renderPlanes();
+}
+
+void MprView::onCrosshairRotated(MprSlicer::Plane plane, double degrees)
+{
+    if (slicer.isNull()) {
+        return;
+    }
+    // Turning the sampling axes one way turns the image the other, so the
+    // image follows the drag
+    slicer.rotate(plane, -degrees);
+    for (int i = 0; i < MprSlicer::planeCount; ++i) {
+        renderedValid[i] = false;
+    }
+    renderPlanes();
+}
+
+void MprView::onPlaneStep(MprSlicer::Plane plane, int steps)
+{
+    if (slicer.isNull()) {
+        return;
+    }
+    slicer.step(plane, steps);
+    renderPlanes();
+}
+
+void MprView::resetOrientation()
+{
+    if (slicer.isNull()) {
+        return;
+    }
+    slicer.resetOrientation();
+    for (int i = 0; i < MprSlicer::planeCount; ++i) {
+        renderedValid[i] = false;
+    }
+    renderPlanes();
+}
+
+void MprView::setWindowLevel(double center, double width)
+{
+    // Set from outside, nothing to pass on
+    syncingWindow = true;
+    for (ImageViewer *pane : panes) {
+        pane->setWindowLevel(center, width);
+    }
+    syncingWindow = false;
+}
+
+void MprView::onPaneWindowLevelChanged(double center, double width)
+{
+    if (syncingWindow) {
+        return;
+    }
+    syncingWindow = true;
+    ImageViewer *source = qobject_cast<ImageViewer *>(sender());
+    for (ImageViewer *pane : panes) {
+        if (pane != source) {
+            pane->setWindowLevel(center, width);
+        }
+    }
+    syncingWindow = false;
+    emit windowLevelChanged(center, width);
+}
@@ -0,0 +1,54 @@
+#ifndef MPRVIEW_H
+#define MPRVIEW_H
+
+#include <QLabel>
+#include <QWidget>
+
+#include "dicomloader.h"
+#include "imageviewer.h"
+#include "mprslicer.h"
+
+// Axial, coronal and sagittal reformats of a volume side by side, sharing
+// one crosshair and one window. Dragging the crosshair in a pane moves the
+// other two planes, shift dragging turns the planes for oblique views. Only
+// planes whose position or orientation changed are resampled.
+class MprView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit MprView(QWidget *parent = nullptr);
+
+    // False when the result has no volume of more than one slice
+    bool setVolume(const DicomLoader::LoadResult &result);
+    void clear();
+    bool isNull() const;
+
+    void resetOrientation();
+    void setWindowLevel(double center, double width);
+
+signals:
+    void windowLevelChanged(double center, double width);
+
+private:
+    void renderPlanes();
+    void updateCrosshairs();
+    void updateInfo(double renderMs, int planesRendered);
+    void onCrosshairMoved(MprSlicer::Plane plane, const QPointF &scenePos);
+    void onCrosshairRotated(MprSlicer::Plane plane, double degrees);
+    void onPlaneStep(MprSlicer::Plane plane, int steps);
+    void onPaneWindowLevelChanged(double center, double width);
+    double offsetOf(MprSlicer::Plane plane) const;
+
+    MprSlicer slicer;
+    ImageViewer *panes[MprSlicer::planeCount];
+    QLabel *infoLabel;
+    DicomLoader::DicomMetadata metadata;
+
+    // Position along its normal each plane was last rendered at
+    double renderedOffset[MprSlicer::planeCount];
+    bool renderedValid[MprSlicer::planeCount];
+    bool syncingWindow;
+};
+
+#endif // MPRVIEW_H
@@ -0,0 +1,64 @@
+#include "parallelfor.h"
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace {
+
+struct ChunkState
+{
+    std::atomic<int> nextChunk{0};
+    std::atomic<int> finishedChunks{0};
+    QSemaphore allDone;
+};
+
+}
+
+void parallelFor(int begin, int end, const std::function<void(int, int)> &body, int grain)
+{
+    const int count = end - begin;
+    if (count <= 0) {
+        return;
+    }
+
+    grain = std::max(grain, 1);
+    const int threads =
+        std::max(std::min(QThread::idealThreadCount(), QThreadPool::globalInstance()->maxThreadCount()), 1);
+
+    // A few chunks per thread evens out uneven work
+    const int chunks = std::min(threads * 4, (count + grain - 1) / grain);
+    if (chunks <= 1 || threads == 1) {
+        body(begin, end);
+        return;
+    }
+
+    const int chunkSize = (count + chunks - 1) / chunks;
+    auto state = std::make_shared<ChunkState>();
+
+    // body is copied into every helper, helpers that start after all chunks
+    // are taken return without touching it
+    auto work = [state, body, begin, end, chunks, chunkSize]() {
+        int chunk;
+        while ((chunk = state->nextChunk.fetch_add(1)) < chunks) {
+            const int chunkBegin = begin + chunk * chunkSize;
+            const int chunkEnd = std::min(end, chunkBegin + chunkSize);
+            if (chunkBegin < chunkEnd) {
+                body(chunkBegin, chunkEnd);
+            }
+            if (state->finishedChunks.fetch_add(1) + 1 == chunks) {
+                state->allDone.release();
+            }
+        }
+    };
+
+    const int helpers = std::min(threads - 1, chunks - 1);
+    for (int i = 0; i < helpers; ++i) {
+        QThreadPool::globalInstance()->start(work);
+    }
+
+    work();
+    state->allDone.acquire();
+}
@@ -0,0 +1,14 @@
+#ifndef PARALLELFOR_H
+#define PARALLELFOR_H
+
+#include <functional>
+
+// Splits [begin, end) into chunks of at least grain items and runs body on
+// them using the global QThreadPool. The calling thread works on chunks too,
+// so this is safe to call from a pool thread and returns once every chunk has
+// been processed. At most the pool's maxThreadCount threads work on them,
+// the calling thread included.
+void parallelFor(int begin, int end, const std::function<void(int chunkBegin, int chunkEnd)> &body,
+                 int grain = 1);
+
+#endif // PARALLELFOR_H
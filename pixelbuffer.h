@@ -0,0 +1,43 @@
+#ifndef PIXELBUFFER_H
+#define PIXELBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Full precision grayscale pixels kept alongside the displayed image.
+// Values are the stored pixel values widened to 16 bits, signed data is kept
+// as two's complement so a row can be reinterpreted as int16_t. The samples
+// may be owned by something larger, e.g. a slice of a VolumeData.
+struct PixelBuffer
+{
+    int width = 0;
+    int height = 0;
+    int bitsStored = 0;
+    bool isSigned = false;
+
+    // Smallest and largest stored value, used to size the window/level LUT
+    int minValue = 0;
+    int maxValue = 0;
+
+    std::shared_ptr<const uint16_t> data;
+
+    bool isNull() const
+    {
+        return !data || width <= 0 || height <= 0;
+    }
+
+    const uint16_t *constRow(int y) const
+    {
+        return data.get() + size_t(y) * size_t(width);
+    }
+
+    // Stored value as a signed integer, whatever the pixel representation
+    int valueAt(int x, int y) const
+    {
+        const uint16_t raw = constRow(y)[x];
+        return isSigned ? int(int16_t(raw)) : int(raw);
+    }
+};
+
+#endif // PIXELBUFFER_H
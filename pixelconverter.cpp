@@ -0,0 +1,1256 @@
+#include "pixelconverter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXELCONVERTER_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define PIXELCONVERTER_NEON 1
+#include <arm_neon.h>
+#endif
+
+// AVX2 kernels are compiled with a per-function target so the rest of the
+// binary keeps running on CPUs without it
+#if defined(PIXELCONVERTER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define PIXELCONVERTER_AVX2 1
+#define PIXELCONVERTER_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+namespace PixelConverter
+{
+
+namespace
+{
+
+using ShiftKernel = void (*)(const uint16_t *, uint8_t *, size_t, int);
+
+// Scalar reference, matches the old per-pixel (pixel >> shift) truncation
+void shiftRowScalar(const uint16_t *src, uint8_t *dst, size_t count, int shift)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = static_cast<uint8_t>(src[i] >> shift);
+    }
+}
+
+#if defined(PIXELCONVERTER_X86)
+void shiftRowSSE2(const uint16_t *src, uint8_t *dst, size_t count, int shift)
+{
+    const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + 8));
+
+        // Keep only the low byte so packus never saturates
+        a = _mm_and_si128(_mm_srl_epi16(a, shiftCount), lowByte);
+        b = _mm_and_si128(_mm_srl_epi16(b, shiftCount), lowByte);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(a, b));
+    }
+    shiftRowScalar(src + i, dst + i, count - i, shift);
+}
+#endif
+
+#if defined(PIXELCONVERTER_AVX2)
+PIXELCONVERTER_AVX2_TARGET
+void shiftRowAVX2(const uint16_t *src, uint8_t *dst, size_t count, int shift)
+{
+    const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+    const __m256i lowByte = _mm256_set1_epi16(0x00FF);
+
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + 16));
+
+        a = _mm256_and_si256(_mm256_srl_epi16(a, shiftCount), lowByte);
+        b = _mm256_and_si256(_mm256_srl_epi16(b, shiftCount), lowByte);
+
+        // packus works per 128-bit lane, put the qwords back in order
+        __m256i packed = _mm256_packus_epi16(a, b);
+        packed = _mm256_permute4x64_epi64(packed, 0xD8);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), packed);
+    }
+    shiftRowSSE2(src + i, dst + i, count - i, shift);
+}
+#endif
+
+#if defined(PIXELCONVERTER_NEON)
+void shiftRowNEON(const uint16_t *src, uint8_t *dst, size_t count, int shift)
+{
+    const int16x8_t shiftCount = vdupq_n_s16(static_cast<int16_t>(-shift));
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint16x8_t a = vshlq_u16(vld1q_u16(src + i), shiftCount);
+        uint16x8_t b = vshlq_u16(vld1q_u16(src + i + 8), shiftCount);
+
+        // vmovn keeps the low byte, same as the scalar cast
+        vst1q_u8(dst + i, vcombine_u8(vmovn_u16(a), vmovn_u16(b)));
+    }
+    shiftRowScalar(src + i, dst + i, count - i, shift);
+}
+#endif
+
+void normalizeRowScalar(uint16_t *row, size_t count, int bitsStored, bool isSigned)
+{
+    const int unused = 16 - bitsStored;
+    if (isSigned) {
+        for (size_t i = 0; i < count; ++i) {
+            row[i] = uint16_t(int16_t(uint16_t(row[i] << unused)) >> unused);
+        }
+    } else {
+        const uint16_t mask = uint16_t((1u << bitsStored) - 1u);
+        for (size_t i = 0; i < count; ++i) {
+            row[i] &= mask;
+        }
+    }
+}
+
+void rowMinMaxScalar(const uint16_t *row, size_t count, bool isSigned, int &min, int &max)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const int value = isSigned ? int(int16_t(row[i])) : int(row[i]);
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+}
+
+void rowSumsScalar(const uint16_t *row, size_t count, bool isSigned, int64_t &sum, uint64_t &sumSquares)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const int64_t value = isSigned ? int64_t(int16_t(row[i])) : int64_t(row[i]);
+        sum += value;
+        sumSquares += uint64_t(value * value);
+    }
+}
+
+void downsampleRow2xScalar(const uint16_t *row0, const uint16_t *row1, size_t srcCount, bool isSigned,
+                           uint16_t *dst, size_t first)
+{
+    auto value = [isSigned](uint16_t raw) { return isSigned ? int(int16_t(raw)) : int(raw); };
+
+    size_t i = first;
+    for (; 2 * i + 1 < srcCount; ++i) {
+        const int sum = value(row0[2 * i]) + value(row0[2 * i + 1]) + value(row1[2 * i]) + value(row1[2 * i + 1]);
+        dst[i] = uint16_t((sum + 2) >> 2);
+    }
+    if (2 * i < srcCount) {
+        dst[i] = uint16_t((value(row0[2 * i]) + value(row1[2 * i]) + 1) >> 1);
+    }
+}
+
+// Bounds and neighbour steps shared by the trilinear kernels. The lower
+// corner is clamped one short of the last sample so the upper corner stays
+// inside, a point on the far face then gets a weight of 1.
+struct TrilinearGrid
+{
+    TrilinearGrid(int width, int height, int depth)
+        : maxX(float(width - 1)), maxY(float(height - 1)), maxZ(float(depth - 1))
+        , lastX(float(std::max(width - 2, 0))), lastY(float(std::max(height - 2, 0)))
+        , lastZ(float(std::max(depth - 2, 0)))
+        , sliceSize(size_t(width) * size_t(height))
+        , dx(width > 1 ? 1 : 0), dy(height > 1 ? size_t(width) : 0), dz(depth > 1 ? sliceSize : 0)
+    {
+    }
+
+    float maxX, maxY, maxZ;
+    float lastX, lastY, lastZ;
+    size_t sliceSize;
+    size_t dx, dy, dz;
+};
+
+inline float trilinearValue(uint16_t raw, bool isSigned)
+{
+    return isSigned ? float(int16_t(raw)) : float(raw);
+}
+
+// Every step is a float operation in the same order as the SIMD kernels, so
+// all paths give identical samples
+void sampleTrilinearScalar(const uint16_t *volume, int width, int height, int depth, bool isSigned,
+                           const float *start, const float *step, size_t count, uint16_t outside,
+                           uint16_t *dst, size_t first)
+{
+    const TrilinearGrid grid(width, height, depth);
+    auto lerp = [](float a, float b, float t) { return a + t * (b - a); };
+
+    for (size_t i = first; i < count; ++i) {
+        const float index = float(int(i));
+        const float x = start[0] + index * step[0];
+        const float y = start[1] + index * step[1];
+        const float z = start[2] + index * step[2];
+        if (!(x >= 0.0f && x <= grid.maxX && y >= 0.0f && y <= grid.maxY && z >= 0.0f && z <= grid.maxZ)) {
+            dst[i] = outside;
+            continue;
+        }
+
+        const int x0 = int(std::min(x, grid.lastX));
+        const int y0 = int(std::min(y, grid.lastY));
+        const int z0 = int(std::min(z, grid.lastZ));
+        const float fx = x - float(x0);
+        const float fy = y - float(y0);
+        const float fz = z - float(z0);
+
+        const uint16_t *p = volume + size_t(z0) * grid.sliceSize + size_t(y0) * size_t(width) + x0;
+        const uint16_t *q[4] = {p, p + grid.dy, p + grid.dz, p + grid.dy + grid.dz};
+        float rows[4];
+        for (int c = 0; c < 4; ++c) {
+            rows[c] = lerp(trilinearValue(q[c][0], isSigned), trilinearValue(q[c][grid.dx], isSigned), fx);
+        }
+        const float value = lerp(lerp(rows[0], rows[1], fy), lerp(rows[2], rows[3], fy), fz);
+        dst[i] = uint16_t(int(std::nearbyint(value)));
+    }
+}
+
+void extremeRowScalar(uint16_t *acc, const uint16_t *src, size_t count, bool isSigned, bool maximum)
+{
+    // Compared in the signed or unsigned order, stored back as raw bits
+    for (size_t i = 0; i < count; ++i) {
+        const int a = isSigned ? int(int16_t(acc[i])) : int(acc[i]);
+        const int b = isSigned ? int(int16_t(src[i])) : int(src[i]);
+        acc[i] = uint16_t(maximum ? std::max(a, b) : std::min(a, b));
+    }
+}
+
+void accumulateRowScalar(int32_t *sums, const uint16_t *src, size_t count, bool isSigned, bool subtract)
+{
+    for (size_t i = 0; i < count; ++i) {
+        const int32_t value = isSigned ? int32_t(int16_t(src[i])) : int32_t(src[i]);
+        sums[i] += subtract ? -value : value;
+    }
+}
+
+// Same float operations as the SSE2 kernel, rounded half to even
+void averageRowScalar(const int32_t *sums, size_t count, int n, uint16_t *dst, size_t first)
+{
+    const float scale = 1.0f / float(n);
+    for (size_t i = first; i < count; ++i) {
+        dst[i] = uint16_t(int(std::nearbyint(float(sums[i]) * scale)));
+    }
+}
+
+// Full range BT.601 YCbCr (YBR_FULL) to RGB in fixed point with 14
+// fractional bits. Integer only, so the SIMD kernels match it exactly.
+const int ybrCrToR = 22970;   // 1.402
+const int ybrCbToG = -5638;   // -0.344136
+const int ybrCrToG = -11700;  // -0.714136
+const int ybrCbToB = 29032;   // 1.772
+
+inline uint32_t packRgb32(int r, int g, int b)
+{
+    return 0xff000000u | (uint32_t(r) << 16) | (uint32_t(g) << 8) | uint32_t(b);
+}
+
+inline uint32_t ybrToRgb32(int y, int cb, int cr)
+{
+    cb -= 128;
+    cr -= 128;
+    const int r = y + ((ybrCrToR * cr + 8192) >> 14);
+    const int g = y + ((ybrCbToG * cb + ybrCrToG * cr + 8192) >> 14);
+    const int b = y + ((ybrCbToB * cb + 8192) >> 14);
+    return packRgb32(std::clamp(r, 0, 255), std::clamp(g, 0, 255), std::clamp(b, 0, 255));
+}
+
+void rgbRowToRgb32Scalar(const uint8_t *src, uint32_t *dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = packRgb32(src[3 * i], src[3 * i + 1], src[3 * i + 2]);
+    }
+}
+
+void rgbPlanesToRgb32Scalar(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint32_t *dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = packRgb32(r[i], g[i], b[i]);
+    }
+}
+
+void ybrRowToRgb32Scalar(const uint8_t *src, uint32_t *dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = ybrToRgb32(src[3 * i], src[3 * i + 1], src[3 * i + 2]);
+    }
+}
+
+void ybrPlanesToRgb32Scalar(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint32_t *dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = ybrToRgb32(y[i], cb[i], cr[i]);
+    }
+}
+
+void ybr422RowToRgb32Scalar(const uint8_t *src, uint32_t *dst, size_t count)
+{
+    // Both pixels of a pair share its chroma
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *pair = src + (i / 2) * 4;
+        dst[i] = ybrToRgb32(pair[i & 1], pair[2], pair[3]);
+    }
+}
+
+template <typename Index>
+void paletteRowToRgb32Scalar(const Index *src, const uint32_t *table, uint32_t *dst, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = table[src[i]];
+    }
+}
+
+#if defined(PIXELCONVERTER_X86)
+void normalizeRowSSE2(uint16_t *row, size_t count, int bitsStored, bool isSigned)
+{
+    const __m128i unused = _mm_cvtsi32_si128(16 - bitsStored);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        v = _mm_sll_epi16(v, unused);
+        v = isSigned ? _mm_sra_epi16(v, unused) : _mm_srl_epi16(v, unused);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(row + i), v);
+    }
+    normalizeRowScalar(row + i, count - i, bitsStored, isSigned);
+}
+
+void rowMinMaxSSE2(const uint16_t *row, size_t count, bool isSigned, int &min, int &max)
+{
+    // SSE2 only has signed 16-bit min/max, bias unsigned data into that range
+    const __m128i bias = _mm_set1_epi16(isSigned ? 0 : int16_t(0x8000));
+    __m128i vmin = _mm_set1_epi16(0x7FFF);
+    __m128i vmax = _mm_set1_epi16(int16_t(0x8000));
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+        v = _mm_xor_si128(v, bias);
+        vmin = _mm_min_epi16(vmin, v);
+        vmax = _mm_max_epi16(vmax, v);
+    }
+
+    if (i > 0) {
+        alignas(16) int16_t mins[8];
+        alignas(16) int16_t maxs[8];
+        _mm_store_si128(reinterpret_cast<__m128i *>(mins), vmin);
+        _mm_store_si128(reinterpret_cast<__m128i *>(maxs), vmax);
+        const int offset = isSigned ? 0 : 32768;
+        for (int lane = 0; lane < 8; ++lane) {
+            min = std::min(min, mins[lane] + offset);
+            max = std::max(max, maxs[lane] + offset);
+        }
+    }
+    rowMinMaxScalar(row + i, count - i, isSigned, min, max);
+}
+
+void rowSumsSSE2(const uint16_t *row, size_t count, bool isSigned, int64_t &sum, uint64_t &sumSquares)
+{
+    // Unsigned data is biased into int16 for madd and corrected at the end:
+    // v = b + 32768, so sum(v) = sum(b) + 32768 n and
+    // sum(v^2) = sum(b^2) + 65536 sum(b) + 2^30 n
+    const __m128i bias = _mm_set1_epi16(isSigned ? 0 : int16_t(0x8000));
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+
+    int64_t biasedSum = 0;
+    uint64_t biasedSquares = 0;
+    __m128i squares64 = _mm_setzero_si128();
+
+    size_t i = 0;
+    while (i + 8 <= count) {
+        // Pair sums are at most 65536 in magnitude, 16384 blocks of 8 stay
+        // well inside int32 before they are folded into 64 bits
+        __m128i sums32 = _mm_setzero_si128();
+        const size_t blockEnd = std::min(count - (count - i) % 8, i + size_t(8) * 16384);
+        for (; i < blockEnd; i += 8) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+            v = _mm_xor_si128(v, bias);
+            sums32 = _mm_add_epi32(sums32, _mm_madd_epi16(v, ones));
+
+            // b^2 + b'^2 is at most 2^31, exact when read as unsigned
+            const __m128i sq = _mm_madd_epi16(v, v);
+            squares64 = _mm_add_epi64(squares64, _mm_unpacklo_epi32(sq, zero));
+            squares64 = _mm_add_epi64(squares64, _mm_unpackhi_epi32(sq, zero));
+        }
+
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sums32);
+        biasedSum += int64_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    alignas(16) uint64_t squareLanes[2];
+    _mm_store_si128(reinterpret_cast<__m128i *>(squareLanes), squares64);
+    biasedSquares = squareLanes[0] + squareLanes[1];
+
+    const int64_t n = int64_t(i);
+    if (isSigned) {
+        sum += biasedSum;
+        sumSquares += biasedSquares;
+    } else {
+        sum += biasedSum + 32768 * n;
+        sumSquares += biasedSquares + uint64_t(65536 * biasedSum) + uint64_t(n) * (uint64_t(1) << 30);
+    }
+    rowSumsScalar(row + i, count - i, isSigned, sum, sumSquares);
+}
+
+void downsampleRow2xSSE2(const uint16_t *row0, const uint16_t *row1, size_t srcCount, bool isSigned,
+                         uint16_t *dst)
+{
+    // Horizontal pairs are summed by madd, unsigned data biased into int16
+    // first. The bias of the four samples is added back before the shift and
+    // the result rebiased so packs_epi32 saturates nothing.
+    const __m128i bias = _mm_set1_epi16(isSigned ? 0 : int16_t(0x8000));
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i round = _mm_set1_epi32(isSigned ? 2 : 2 + 4 * 32768);
+    const __m128i rebias = _mm_set1_epi32(isSigned ? 0 : 32768);
+
+    auto blockSums = [&](const uint16_t *a, const uint16_t *b) {
+        const __m128i top = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a)), bias);
+        const __m128i bottom = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(b)), bias);
+        const __m128i sums = _mm_add_epi32(_mm_madd_epi16(top, ones), _mm_madd_epi16(bottom, ones));
+        return _mm_sub_epi32(_mm_srai_epi32(_mm_add_epi32(sums, round), 2), rebias);
+    };
+
+    size_t i = 0;
+    for (; 2 * i + 16 <= srcCount; i += 8) {
+        const __m128i lo = blockSums(row0 + 2 * i, row1 + 2 * i);
+        const __m128i hi = blockSums(row0 + 2 * i + 8, row1 + 2 * i + 8);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(_mm_packs_epi32(lo, hi), bias));
+    }
+    downsampleRow2xScalar(row0, row1, srcCount, isSigned, dst, i);
+}
+
+void sampleTrilinearSSE2(const uint16_t *volume, int width, int height, int depth, bool isSigned,
+                         const float *start, const float *step, size_t count, uint16_t outside,
+                         uint16_t *dst)
+{
+    // Positions, weights and the blend are four points at a time, the eight
+    // corner loads per point are scalar
+    const TrilinearGrid grid(width, height, depth);
+    const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128 zero = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 index = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(int(i)), lane));
+        const __m128 x = _mm_add_ps(_mm_set1_ps(start[0]), _mm_mul_ps(index, _mm_set1_ps(step[0])));
+        const __m128 y = _mm_add_ps(_mm_set1_ps(start[1]), _mm_mul_ps(index, _mm_set1_ps(step[1])));
+        const __m128 z = _mm_add_ps(_mm_set1_ps(start[2]), _mm_mul_ps(index, _mm_set1_ps(step[2])));
+
+        const __m128 inside = _mm_and_ps(
+            _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x, zero), _mm_cmple_ps(x, _mm_set1_ps(grid.maxX))),
+                       _mm_and_ps(_mm_cmpge_ps(y, zero), _mm_cmple_ps(y, _mm_set1_ps(grid.maxY)))),
+            _mm_and_ps(_mm_cmpge_ps(z, zero), _mm_cmple_ps(z, _mm_set1_ps(grid.maxZ))));
+        const int insideBits = _mm_movemask_ps(inside);
+        if (insideBits == 0) {
+            for (int k = 0; k < 4; ++k) {
+                dst[i + k] = outside;
+            }
+            continue;
+        }
+
+        // Clamped so the upper corner stays inside, the weight may reach 1
+        const __m128i x0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(x, zero), _mm_set1_ps(grid.lastX)));
+        const __m128i y0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(y, zero), _mm_set1_ps(grid.lastY)));
+        const __m128i z0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(z, zero), _mm_set1_ps(grid.lastZ)));
+        const __m128 fx = _mm_sub_ps(x, _mm_cvtepi32_ps(x0));
+        const __m128 fy = _mm_sub_ps(y, _mm_cvtepi32_ps(y0));
+        const __m128 fz = _mm_sub_ps(z, _mm_cvtepi32_ps(z0));
+
+        alignas(16) int xs[4], ys[4], zs[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(xs), x0);
+        _mm_store_si128(reinterpret_cast<__m128i *>(ys), y0);
+        _mm_store_si128(reinterpret_cast<__m128i *>(zs), z0);
+
+        alignas(16) float corners[8][4];
+        for (int k = 0; k < 4; ++k) {
+            if (!(insideBits & (1 << k))) {
+                for (int c = 0; c < 8; ++c) {
+                    corners[c][k] = 0.0f;
+                }
+                continue;
+            }
+            const uint16_t *p = volume + size_t(zs[k]) * grid.sliceSize + size_t(ys[k]) * size_t(width) + xs[k];
+            const uint16_t *q[4] = {p, p + grid.dy, p + grid.dz, p + grid.dy + grid.dz};
+            for (int c = 0; c < 4; ++c) {
+                corners[2 * c][k] = trilinearValue(q[c][0], isSigned);
+                corners[2 * c + 1][k] = trilinearValue(q[c][grid.dx], isSigned);
+            }
+        }
+
+        auto lerp = [](__m128 a, __m128 b, __m128 t) { return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a))); };
+        auto row = [&](int c) { return lerp(_mm_load_ps(corners[2 * c]), _mm_load_ps(corners[2 * c + 1]), fx); };
+        const __m128 c0 = lerp(row(0), row(1), fy);
+        const __m128 c1 = lerp(row(2), row(3), fy);
+
+        alignas(16) int values[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(values), _mm_cvtps_epi32(lerp(c0, c1, fz)));
+        for (int k = 0; k < 4; ++k) {
+            dst[i + k] = (insideBits & (1 << k)) ? uint16_t(values[k]) : outside;
+        }
+    }
+    sampleTrilinearScalar(volume, width, height, depth, isSigned, start, step, count, outside, dst, i);
+}
+void extremeRowSSE2(uint16_t *acc, const uint16_t *src, size_t count, bool isSigned, bool maximum)
+{
+    // Signed 16-bit min/max only, unsigned data is biased like in rowMinMax
+    const __m128i bias = _mm_set1_epi16(isSigned ? 0 : int16_t(0x8000));
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i a = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + i)), bias);
+        const __m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)), bias);
+        const __m128i v = maximum ? _mm_max_epi16(a, b) : _mm_min_epi16(a, b);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + i), _mm_xor_si128(v, bias));
+    }
+    extremeRowScalar(acc + i, src + i, count - i, isSigned, maximum);
+}
+
+void accumulateRowSSE2(int32_t *sums, const uint16_t *src, size_t count, bool isSigned, bool subtract)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i extension = isSigned ? _mm_srai_epi16(v, 15) : zero;
+        const __m128i low = _mm_unpacklo_epi16(v, extension);
+        const __m128i high = _mm_unpackhi_epi16(v, extension);
+        __m128i *out = reinterpret_cast<__m128i *>(sums + i);
+        const __m128i sumLow = _mm_loadu_si128(out);
+        const __m128i sumHigh = _mm_loadu_si128(out + 1);
+        _mm_storeu_si128(out, subtract ? _mm_sub_epi32(sumLow, low) : _mm_add_epi32(sumLow, low));
+        _mm_storeu_si128(out + 1, subtract ? _mm_sub_epi32(sumHigh, high) : _mm_add_epi32(sumHigh, high));
+    }
+    accumulateRowScalar(sums + i, src + i, count - i, isSigned, subtract);
+}
+
+void averageRowSSE2(const int32_t *sums, size_t count, int n, bool isSigned, uint16_t *dst)
+{
+    // Averages of unsigned data can exceed int16, packed biased by 32768
+    const __m128 scale = _mm_set1_ps(1.0f / float(n));
+    const __m128i bias32 = _mm_set1_epi32(isSigned ? 0 : 32768);
+    const __m128i bias16 = _mm_set1_epi16(isSigned ? 0 : int16_t(0x8000));
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i *in = reinterpret_cast<const __m128i *>(sums + i);
+        const __m128i low = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(in)), scale));
+        const __m128i high = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(in + 1)), scale));
+        const __m128i packed = _mm_packs_epi32(_mm_sub_epi32(low, bias32), _mm_sub_epi32(high, bias32));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(packed, bias16));
+    }
+    averageRowScalar(sums, count, n, dst, i);
+}
+
+// Splits 16 pixels of three interleaved samples into one register per
+// sample, SSE2 has no byte shuffle so bytes are unpacked step by step
+inline void deinterleave3SSE2(const uint8_t *src, __m128i &a, __m128i &b, __m128i &c)
+{
+    const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+    const __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32));
+
+    const __m128i t10 = _mm_unpacklo_epi8(v0, _mm_unpackhi_epi64(v1, v1));
+    const __m128i t11 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(v0, v0), v2);
+    const __m128i t12 = _mm_unpacklo_epi8(v1, _mm_unpackhi_epi64(v2, v2));
+
+    const __m128i t20 = _mm_unpacklo_epi8(t10, _mm_unpackhi_epi64(t11, t11));
+    const __m128i t21 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t10, t10), t12);
+    const __m128i t22 = _mm_unpacklo_epi8(t11, _mm_unpackhi_epi64(t12, t12));
+
+    const __m128i t30 = _mm_unpacklo_epi8(t20, _mm_unpackhi_epi64(t21, t21));
+    const __m128i t31 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t20, t20), t22);
+    const __m128i t32 = _mm_unpacklo_epi8(t21, _mm_unpackhi_epi64(t22, t22));
+
+    a = _mm_unpacklo_epi8(t30, _mm_unpackhi_epi64(t31, t31));
+    b = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t30, t30), t32);
+    c = _mm_unpacklo_epi8(t31, _mm_unpackhi_epi64(t32, t32));
+}
+
+// 16 pixels, one register per channel, written as 0xffRRGGBB
+inline void storeRgb32SSE2(__m128i r, __m128i g, __m128i b, uint32_t *dst)
+{
+    const __m128i alpha = _mm_set1_epi8(char(0xff));
+    const __m128i bgLow = _mm_unpacklo_epi8(b, g);
+    const __m128i bgHigh = _mm_unpackhi_epi8(b, g);
+    const __m128i raLow = _mm_unpacklo_epi8(r, alpha);
+    const __m128i raHigh = _mm_unpackhi_epi8(r, alpha);
+    __m128i *out = reinterpret_cast<__m128i *>(dst);
+    _mm_storeu_si128(out, _mm_unpacklo_epi16(bgLow, raLow));
+    _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(bgLow, raLow));
+    _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(bgHigh, raHigh));
+    _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(bgHigh, raHigh));
+}
+
+// Cb and Cr coefficients of one channel, multiplied with (cb, cr) pairs
+inline __m128i chromaPairSSE2(int cb, int cr)
+{
+    return _mm_set1_epi32(int((uint32_t(cr) << 16) | (uint32_t(cb) & 0xffff)));
+}
+
+// Rounded chroma term of 8 pixels as 16-bit lanes
+inline __m128i chromaTermSSE2(__m128i pairsLow, __m128i pairsHigh, __m128i coefficients)
+{
+    const __m128i round = _mm_set1_epi32(1 << 13);
+    const __m128i low = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(pairsLow, coefficients), round), 14);
+    const __m128i high = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(pairsHigh, coefficients), round), 14);
+    return _mm_packs_epi32(low, high);
+}
+
+// 8 pixels of 16-bit Y, Cb and Cr to unclamped 16-bit R, G and B
+inline void ybrToRgbSSE2(__m128i y, __m128i cb, __m128i cr, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i bias = _mm_set1_epi16(128);
+    cb = _mm_sub_epi16(cb, bias);
+    cr = _mm_sub_epi16(cr, bias);
+    const __m128i pairsLow = _mm_unpacklo_epi16(cb, cr);
+    const __m128i pairsHigh = _mm_unpackhi_epi16(cb, cr);
+    r = _mm_add_epi16(y, chromaTermSSE2(pairsLow, pairsHigh, chromaPairSSE2(0, ybrCrToR)));
+    g = _mm_add_epi16(y, chromaTermSSE2(pairsLow, pairsHigh, chromaPairSSE2(ybrCbToG, ybrCrToG)));
+    b = _mm_add_epi16(y, chromaTermSSE2(pairsLow, pairsHigh, chromaPairSSE2(ybrCbToB, 0)));
+}
+
+// 16 pixels of 8-bit Y, Cb and Cr, clamped by the unsigned pack
+inline void ybrToRgb32SSE2(__m128i y, __m128i cb, __m128i cr, uint32_t *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i rLow, gLow, bLow, rHigh, gHigh, bHigh;
+    ybrToRgbSSE2(_mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi8(cb, zero), _mm_unpacklo_epi8(cr, zero),
+                 rLow, gLow, bLow);
+    ybrToRgbSSE2(_mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi8(cb, zero), _mm_unpackhi_epi8(cr, zero),
+                 rHigh, gHigh, bHigh);
+    storeRgb32SSE2(_mm_packus_epi16(rLow, rHigh), _mm_packus_epi16(gLow, gHigh),
+                   _mm_packus_epi16(bLow, bHigh), dst);
+}
+
+void rgbRowToRgb32SSE2(const uint8_t *src, uint32_t *dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i r, g, b;
+        deinterleave3SSE2(src + 3 * i, r, g, b);
+        storeRgb32SSE2(r, g, b, dst + i);
+    }
+    rgbRowToRgb32Scalar(src + 3 * i, dst + i, count - i);
+}
+
+void rgbPlanesToRgb32SSE2(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint32_t *dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        storeRgb32SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i)),
+                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(g + i)),
+                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)), dst + i);
+    }
+    rgbPlanesToRgb32Scalar(r + i, g + i, b + i, dst + i, count - i);
+}
+
+void ybrRowToRgb32SSE2(const uint8_t *src, uint32_t *dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i y, cb, cr;
+        deinterleave3SSE2(src + 3 * i, y, cb, cr);
+        ybrToRgb32SSE2(y, cb, cr, dst + i);
+    }
+    ybrRowToRgb32Scalar(src + 3 * i, dst + i, count - i);
+}
+
+void ybrPlanesToRgb32SSE2(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint32_t *dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        ybrToRgb32SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y + i)),
+                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(cb + i)),
+                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(cr + i)), dst + i);
+    }
+    ybrPlanesToRgb32Scalar(y + i, cb + i, cr + i, dst + i, count - i);
+}
+
+void ybr422RowToRgb32SSE2(const uint8_t *src, uint32_t *dst, size_t count)
+{
+    const __m128i lowByte = _mm_set1_epi16(0xff);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        // Y0 Y1 Cb Cr in each 32-bit word. The low halves, packed, are the
+        // luma in pixel order, the high halves the chroma of each pair.
+        const __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * i));
+        const __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 2 * i + 16));
+        const __m128i y = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(v0, 16), 16),
+                                          _mm_srai_epi32(_mm_slli_epi32(v1, 16), 16));
+        const __m128i chroma = _mm_packs_epi32(_mm_srai_epi32(v0, 16), _mm_srai_epi32(v1, 16));
+
+        // Each chroma byte doubled, once for either pixel of its pair
+        const __m128i cb = _mm_and_si128(chroma, lowByte);
+        const __m128i cr = _mm_srli_epi16(chroma, 8);
+        ybrToRgb32SSE2(y, _mm_or_si128(cb, _mm_slli_epi16(cb, 8)), _mm_or_si128(cr, _mm_slli_epi16(cr, 8)),
+                       dst + i);
+    }
+    ybr422RowToRgb32Scalar(src + 2 * i, dst + i, count - i);
+}
+#endif
+
+#if defined(PIXELCONVERTER_AVX2)
+// Helpers are functions, not lambdas, lambdas would not inherit the target
+PIXELCONVERTER_AVX2_TARGET
+inline __m256 lerpAVX2(__m256 a, __m256 b, __m256 t)
+{
+    return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+// Gathers the sample pairs at offsets and interpolates each pair by fx
+PIXELCONVERTER_AVX2_TARGET
+inline __m256 pairLerpAVX2(const int *base, __m256i offsets, __m256 fx, bool isSigned)
+{
+    const __m256i pair = _mm256_i32gather_epi32(base, offsets, 2);
+    const __m256i low = isSigned ? _mm256_srai_epi32(_mm256_slli_epi32(pair, 16), 16)
+                                 : _mm256_and_si256(pair, _mm256_set1_epi32(0xFFFF));
+    const __m256i high = isSigned ? _mm256_srai_epi32(pair, 16) : _mm256_srli_epi32(pair, 16);
+    return lerpAVX2(_mm256_cvtepi32_ps(low), _mm256_cvtepi32_ps(high), fx);
+}
+
+PIXELCONVERTER_AVX2_TARGET
+void sampleTrilinearAVX2(const uint16_t *volume, int width, int height, int depth, bool isSigned,
+                         const float *start, const float *step, size_t count, uint16_t outside,
+                         uint16_t *dst)
+{
+    // Eight points at a time. Each gather fetches a 32-bit pair, the sample
+    // at x0 in the low half and its right neighbour in the high half, so four
+    // gathers give all eight corners. Needs width >= 2 and offsets that fit
+    // an int, the caller checks.
+    const TrilinearGrid grid(width, height, depth);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i rowStride = _mm256_set1_epi32(width);
+    const __m256i sliceStride = _mm256_set1_epi32(int(grid.sliceSize));
+    const __m256i dy = _mm256_set1_epi32(int(grid.dy));
+    const __m256i dz = _mm256_set1_epi32(int(grid.dz));
+    const __m256i outsideValue = _mm256_set1_epi32(isSigned ? int(int16_t(outside)) : int(outside));
+    const int *base = reinterpret_cast<const int *>(volume);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256 index = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(int(i)), lane));
+        const __m256 x = _mm256_add_ps(_mm256_set1_ps(start[0]), _mm256_mul_ps(index, _mm256_set1_ps(step[0])));
+        const __m256 y = _mm256_add_ps(_mm256_set1_ps(start[1]), _mm256_mul_ps(index, _mm256_set1_ps(step[1])));
+        const __m256 z = _mm256_add_ps(_mm256_set1_ps(start[2]), _mm256_mul_ps(index, _mm256_set1_ps(step[2])));
+
+        const __m256 inside = _mm256_and_ps(
+            _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(x, zero, _CMP_GE_OQ),
+                                        _mm256_cmp_ps(x, _mm256_set1_ps(grid.maxX), _CMP_LE_OQ)),
+                          _mm256_and_ps(_mm256_cmp_ps(y, zero, _CMP_GE_OQ),
+                                        _mm256_cmp_ps(y, _mm256_set1_ps(grid.maxY), _CMP_LE_OQ))),
+            _mm256_and_ps(_mm256_cmp_ps(z, zero, _CMP_GE_OQ),
+                          _mm256_cmp_ps(z, _mm256_set1_ps(grid.maxZ), _CMP_LE_OQ)));
+        if (_mm256_movemask_ps(inside) == 0) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_set1_epi16(int16_t(outside)));
+            continue;
+        }
+
+        const __m256i x0 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(x, zero), _mm256_set1_ps(grid.lastX)));
+        const __m256i y0 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(y, zero), _mm256_set1_ps(grid.lastY)));
+        const __m256i z0 = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(z, zero), _mm256_set1_ps(grid.lastZ)));
+        const __m256 fx = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x0));
+        const __m256 fy = _mm256_sub_ps(y, _mm256_cvtepi32_ps(y0));
+        const __m256 fz = _mm256_sub_ps(z, _mm256_cvtepi32_ps(z0));
+
+        // Points outside read sample 0, their result is replaced below
+        const __m256i insideLanes = _mm256_castps_si256(inside);
+        const __m256i offset = _mm256_and_si256(insideLanes, _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_mullo_epi32(z0, sliceStride), _mm256_mullo_epi32(y0, rowStride)), x0));
+        const __m256i offsetY = _mm256_and_si256(insideLanes, _mm256_add_epi32(offset, dy));
+        const __m256i offsetZ = _mm256_and_si256(insideLanes, _mm256_add_epi32(offset, dz));
+        const __m256i offsetYZ = _mm256_and_si256(insideLanes, _mm256_add_epi32(offsetY, dz));
+
+        const __m256 c0 = lerpAVX2(pairLerpAVX2(base, offset, fx, isSigned),
+                                   pairLerpAVX2(base, offsetY, fx, isSigned), fy);
+        const __m256 c1 = lerpAVX2(pairLerpAVX2(base, offsetZ, fx, isSigned),
+                                   pairLerpAVX2(base, offsetYZ, fx, isSigned), fy);
+        const __m256i values = _mm256_blendv_epi8(outsideValue, _mm256_cvtps_epi32(lerpAVX2(c0, c1, fz)),
+                                                  insideLanes);
+
+        const __m128i low = _mm256_castsi256_si128(values);
+        const __m128i high = _mm256_extracti128_si256(values, 1);
+        const __m128i packed = isSigned ? _mm_packs_epi32(low, high) : _mm_packus_epi32(low, high);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+    }
+    sampleTrilinearScalar(volume, width, height, depth, isSigned, start, step, count, outside, dst, i);
+}
+PIXELCONVERTER_AVX2_TARGET
+void extremeRowAVX2(uint16_t *acc, const uint16_t *src, size_t count, bool isSigned, bool maximum)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc + i));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        __m256i v;
+        if (isSigned) {
+            v = maximum ? _mm256_max_epi16(a, b) : _mm256_min_epi16(a, b);
+        } else {
+            v = maximum ? _mm256_max_epu16(a, b) : _mm256_min_epu16(a, b);
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc + i), v);
+    }
+    extremeRowScalar(acc + i, src + i, count - i, isSigned, maximum);
+}
+
+PIXELCONVERTER_AVX2_TARGET
+void accumulateRowAVX2(int32_t *sums, const uint16_t *src, size_t count, bool isSigned, bool subtract)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m256i wide = isSigned ? _mm256_cvtepi16_epi32(v) : _mm256_cvtepu16_epi32(v);
+        __m256i *out = reinterpret_cast<__m256i *>(sums + i);
+        const __m256i sum = _mm256_loadu_si256(out);
+        _mm256_storeu_si256(out, subtract ? _mm256_sub_epi32(sum, wide) : _mm256_add_epi32(sum, wide));
+    }
+    accumulateRowScalar(sums + i, src + i, count - i, isSigned, subtract);
+}
+
+PIXELCONVERTER_AVX2_TARGET
+inline __m256i chromaTermAVX2(__m256i pairsLow, __m256i pairsHigh, int cb, int cr)
+{
+    const __m256i coefficients = _mm256_set1_epi32(int((uint32_t(cr) << 16) | (uint32_t(cb) & 0xffff)));
+    const __m256i round = _mm256_set1_epi32(1 << 13);
+    const __m256i low = _mm256_add_epi32(_mm256_madd_epi16(pairsLow, coefficients), round);
+    const __m256i high = _mm256_add_epi32(_mm256_madd_epi16(pairsHigh, coefficients), round);
+    return _mm256_packs_epi32(_mm256_srai_epi32(low, 14), _mm256_srai_epi32(high, 14));
+}
+
+// Same arithmetic as ybrToRgb32SSE2 on all 16 pixels at once. Unpacks and
+// packs stay within 128-bit lanes, so pixels 0-7 and 8-15 are put back in
+// order only when stored.
+PIXELCONVERTER_AVX2_TARGET
+inline void ybrToRgb32AVX2(__m128i y8, __m128i cb8, __m128i cr8, uint32_t *dst)
+{
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i y = _mm256_cvtepu8_epi16(y8);
+    const __m256i cb = _mm256_sub_epi16(_mm256_cvtepu8_epi16(cb8), bias);
+    const __m256i cr = _mm256_sub_epi16(_mm256_cvtepu8_epi16(cr8), bias);
+    const __m256i pairsLow = _mm256_unpacklo_epi16(cb, cr);
+    const __m256i pairsHigh = _mm256_unpackhi_epi16(cb, cr);
+
+    const __m256i r = _mm256_add_epi16(y, chromaTermAVX2(pairsLow, pairsHigh, 0, ybrCrToR));
+    const __m256i g = _mm256_add_epi16(y, chromaTermAVX2(pairsLow, pairsHigh, ybrCbToG, ybrCrToG));
+    const __m256i b = _mm256_add_epi16(y, chromaTermAVX2(pairsLow, pairsHigh, ybrCbToB, 0));
+
+    const __m256i alpha = _mm256_set1_epi8(char(0xff));
+    const __m256i bg = _mm256_unpacklo_epi8(_mm256_packus_epi16(b, b), _mm256_packus_epi16(g, g));
+    const __m256i ra = _mm256_unpacklo_epi8(_mm256_packus_epi16(r, r), alpha);
+    const __m256i low = _mm256_unpacklo_epi16(bg, ra);   // pixels 0-3 and 8-11
+    const __m256i high = _mm256_unpackhi_epi16(bg, ra);  // pixels 4-7 and 12-15
+    __m256i *out = reinterpret_cast<__m256i *>(dst);
+    _mm256_storeu_si256(out, _mm256_permute2x128_si256(low, high, 0x20));
+    _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(low, high, 0x31));
+}
+
+PIXELCONVERTER_AVX2_TARGET
+void ybrRowToRgb32AVX2(const uint8_t *src, uint32_t *dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i y, cb, cr;
+        deinterleave3SSE2(src + 3 * i, y, cb, cr);
+        ybrToRgb32AVX2(y, cb, cr, dst + i);
+    }
+    ybrRowToRgb32Scalar(src + 3 * i, dst + i, count - i);
+}
+
+PIXELCONVERTER_AVX2_TARGET
+void ybrPlanesToRgb32AVX2(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint32_t *dst, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        ybrToRgb32AVX2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(y + i)),
+                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(cb + i)),
+                       _mm_loadu_si128(reinterpret_cast<const __m128i *>(cr + i)), dst + i);
+    }
+    ybrPlanesToRgb32Scalar(y + i, cb + i, cr + i, dst + i, count - i);
+}
+
+// Table lookups as 8-wide gathers
+PIXELCONVERTER_AVX2_TARGET
+void paletteRow8ToRgb32AVX2(const uint8_t *src, const uint32_t *table, uint32_t *dst, size_t count)
+{
+    const int *entries = reinterpret_cast<const int *>(table);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_i32gather_epi32(entries, indices, 4));
+    }
+    paletteRowToRgb32Scalar(src + i, table, dst + i, count - i);
+}
+
+PIXELCONVERTER_AVX2_TARGET
+void paletteRow16ToRgb32AVX2(const uint16_t *src, const uint32_t *table, uint32_t *dst, size_t count)
+{
+    const int *entries = reinterpret_cast<const int *>(table);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m256i indices = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_i32gather_epi32(entries, indices, 4));
+    }
+    paletteRowToRgb32Scalar(src + i, table, dst + i, count - i);
+}
+#endif
+
+Isa detectIsa()
+{
+#if defined(PIXELCONVERTER_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return Isa::AVX2;
+    }
+#endif
+#if defined(PIXELCONVERTER_X86)
+    return Isa::SSE2;
+#elif defined(PIXELCONVERTER_NEON)
+    return Isa::NEON;
+#else
+    return Isa::Scalar;
+#endif
+}
+
+std::atomic<int> &currentIsa()
+{
+    static std::atomic<int> isa(static_cast<int>(detectIsa()));
+    return isa;
+}
+
+ShiftKernel shiftKernel()
+{
+    switch (static_cast<Isa>(currentIsa().load(std::memory_order_relaxed))) {
+#if defined(PIXELCONVERTER_AVX2)
+    case Isa::AVX2:
+        return shiftRowAVX2;
+#endif
+#if defined(PIXELCONVERTER_X86)
+    case Isa::SSE2:
+        return shiftRowSSE2;
+#endif
+#if defined(PIXELCONVERTER_NEON)
+    case Isa::NEON:
+        return shiftRowNEON;
+#endif
+    default:
+        return shiftRowScalar;
+    }
+}
+
+} // namespace
+
+Isa activeIsa()
+{
+    return static_cast<Isa>(currentIsa().load(std::memory_order_relaxed));
+}
+
+const char *isaName(Isa isa)
+{
+    switch (isa) {
+    case Isa::SSE2:
+        return "SSE2";
+    case Isa::AVX2:
+        return "AVX2";
+    case Isa::NEON:
+        return "NEON";
+    default:
+        return "Scalar";
+    }
+}
+
+bool isIsaSupported(Isa isa)
+{
+    switch (isa) {
+    case Isa::Scalar:
+        return true;
+    case Isa::SSE2:
+#if defined(PIXELCONVERTER_X86)
+        return true;
+#else
+        return false;
+#endif
+    case Isa::AVX2:
+        return detectIsa() == Isa::AVX2;
+    case Isa::NEON:
+#if defined(PIXELCONVERTER_NEON)
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+void setIsa(Isa isa)
+{
+    if (!isIsaSupported(isa)) {
+        isa = detectIsa();
+    }
+    currentIsa().store(static_cast<int>(isa), std::memory_order_relaxed);
+}
+
+void convertRow8(const uint8_t *src, uint8_t *dst, size_t count)
+{
+    // Grayscale8 scanlines already match the stored layout
+    std::memcpy(dst, src, count);
+}
+
+void widenRow8(const uint8_t *src, uint16_t *dst, size_t count, bool isSigned)
+{
+    // Plain loop, compilers vectorise the widening on every target
+    if (isSigned) {
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = uint16_t(int16_t(int8_t(src[i])));
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            dst[i] = src[i];
+        }
+    }
+}
+
+void normalizeRow(uint16_t *row, size_t count, int bitsStored, bool isSigned)
+{
+    if (bitsStored <= 0 || bitsStored >= 16) {
+        return;
+    }
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        normalizeRowSSE2(row, count, bitsStored, isSigned);
+        return;
+    }
+#endif
+    normalizeRowScalar(row, count, bitsStored, isSigned);
+}
+
+void rowMinMax(const uint16_t *row, size_t count, bool isSigned, int &min, int &max)
+{
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        rowMinMaxSSE2(row, count, isSigned, min, max);
+        return;
+    }
+#endif
+    rowMinMaxScalar(row, count, isSigned, min, max);
+}
+
+void rowSums(const uint16_t *row, size_t count, bool isSigned, int64_t &sum, uint64_t &sumSquares)
+{
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        rowSumsSSE2(row, count, isSigned, sum, sumSquares);
+        return;
+    }
+#endif
+    rowSumsScalar(row, count, isSigned, sum, sumSquares);
+}
+
+void downsampleRow2x(const uint16_t *row0, const uint16_t *row1, size_t srcCount, bool isSigned,
+                     uint16_t *dst)
+{
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        downsampleRow2xSSE2(row0, row1, srcCount, isSigned, dst);
+        return;
+    }
+#endif
+    downsampleRow2xScalar(row0, row1, srcCount, isSigned, dst, 0);
+}
+
+void sampleTrilinear(const uint16_t *volume, int width, int height, int depth, bool isSigned,
+                     const float start[3], const float step[3], size_t count, uint16_t outside,
+                     uint16_t *dst)
+{
+    if (width <= 0 || height <= 0 || depth <= 0) {
+        std::fill(dst, dst + count, outside);
+        return;
+    }
+#if defined(PIXELCONVERTER_AVX2)
+    // Gather offsets are ints and read sample pairs along x
+    const bool gatherFits = width >= 2 && uint64_t(width) * uint64_t(height) * uint64_t(depth) < (1ULL << 31);
+    if (activeIsa() == Isa::AVX2 && gatherFits) {
+        sampleTrilinearAVX2(volume, width, height, depth, isSigned, start, step, count, outside, dst);
+        return;
+    }
+#endif
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        sampleTrilinearSSE2(volume, width, height, depth, isSigned, start, step, count, outside, dst);
+        return;
+    }
+#endif
+    sampleTrilinearScalar(volume, width, height, depth, isSigned, start, step, count, outside, dst, 0);
+}
+
+void maxRow(uint16_t *acc, const uint16_t *src, size_t count, bool isSigned)
+{
+#if defined(PIXELCONVERTER_AVX2)
+    if (activeIsa() == Isa::AVX2) {
+        extremeRowAVX2(acc, src, count, isSigned, true);
+        return;
+    }
+#endif
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        extremeRowSSE2(acc, src, count, isSigned, true);
+        return;
+    }
+#endif
+    extremeRowScalar(acc, src, count, isSigned, true);
+}
+
+void minRow(uint16_t *acc, const uint16_t *src, size_t count, bool isSigned)
+{
+#if defined(PIXELCONVERTER_AVX2)
+    if (activeIsa() == Isa::AVX2) {
+        extremeRowAVX2(acc, src, count, isSigned, false);
+        return;
+    }
+#endif
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        extremeRowSSE2(acc, src, count, isSigned, false);
+        return;
+    }
+#endif
+    extremeRowScalar(acc, src, count, isSigned, false);
+}
+
+void accumulateRow(int32_t *sums, const uint16_t *src, size_t count, bool isSigned, bool subtract)
+{
+#if defined(PIXELCONVERTER_AVX2)
+    if (activeIsa() == Isa::AVX2) {
+        accumulateRowAVX2(sums, src, count, isSigned, subtract);
+        return;
+    }
+#endif
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        accumulateRowSSE2(sums, src, count, isSigned, subtract);
+        return;
+    }
+#endif
+    accumulateRowScalar(sums, src, count, isSigned, subtract);
+}
+
+void averageRow(const int32_t *sums, size_t count, int n, bool isSigned, uint16_t *dst)
+{
+    if (n <= 0) {
+        return;
+    }
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        averageRowSSE2(sums, count, n, isSigned, dst);
+        return;
+    }
+#endif
+    averageRowScalar(sums, count, n, dst, 0);
+}
+
+void rgbRowToRgb32(const uint8_t *src, uint32_t *dst, size_t count)
+{
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        rgbRowToRgb32SSE2(src, dst, count);
+        return;
+    }
+#endif
+    rgbRowToRgb32Scalar(src, dst, count);
+}
+
+void rgbPlanesToRgb32(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint32_t *dst, size_t count)
+{
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        rgbPlanesToRgb32SSE2(r, g, b, dst, count);
+        return;
+    }
+#endif
+    rgbPlanesToRgb32Scalar(r, g, b, dst, count);
+}
+
+void ybrRowToRgb32(const uint8_t *src, uint32_t *dst, size_t count)
+{
+#if defined(PIXELCONVERTER_AVX2)
+    if (activeIsa() == Isa::AVX2) {
+        ybrRowToRgb32AVX2(src, dst, count);
+        return;
+    }
+#endif
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        ybrRowToRgb32SSE2(src, dst, count);
+        return;
+    }
+#endif
+    ybrRowToRgb32Scalar(src, dst, count);
+}
+
+void ybrPlanesToRgb32(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint32_t *dst, size_t count)
+{
+#if defined(PIXELCONVERTER_AVX2)
+    if (activeIsa() == Isa::AVX2) {
+        ybrPlanesToRgb32AVX2(y, cb, cr, dst, count);
+        return;
+    }
+#endif
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        ybrPlanesToRgb32SSE2(y, cb, cr, dst, count);
+        return;
+    }
+#endif
+    ybrPlanesToRgb32Scalar(y, cb, cr, dst, count);
+}
+
+void ybr422RowToRgb32(const uint8_t *src, uint32_t *dst, size_t count)
+{
+#if defined(PIXELCONVERTER_X86)
+    if (activeIsa() != Isa::Scalar) {
+        ybr422RowToRgb32SSE2(src, dst, count);
+        return;
+    }
+#endif
+    ybr422RowToRgb32Scalar(src, dst, count);
+}
+
+void paletteRow8ToRgb32(const uint8_t *src, const uint32_t *table, uint32_t *dst, size_t count)
+{
+#if defined(PIXELCONVERTER_AVX2)
+    if (activeIsa() == Isa::AVX2) {
+        paletteRow8ToRgb32AVX2(src, table, dst, count);
+        return;
+    }
+#endif
+    paletteRowToRgb32Scalar(src, table, dst, count);
+}
+
+void paletteRow16ToRgb32(const uint16_t *src, const uint32_t *table, uint32_t *dst, size_t count)
+{
+#if defined(PIXELCONVERTER_AVX2)
+    if (activeIsa() == Isa::AVX2) {
+        paletteRow16ToRgb32AVX2(src, table, dst, count);
+        return;
+    }
+#endif
+    paletteRowToRgb32Scalar(src, table, dst, count);
+}
+
+void convertRow12(const uint16_t *src, uint8_t *dst, size_t count)
+{
+    shiftKernel()(src, dst, count, 4);
+}
+
+void convertRow16(const uint16_t *src, uint8_t *dst, size_t count)
+{
+    shiftKernel()(src, dst, count, 8);
+}
+
+}
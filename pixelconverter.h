@@ -0,0 +1,99 @@
+#ifndef PIXELCONVERTER_H
+#define PIXELCONVERTER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Row based kernels that turn decoded DICOM pixel data into 8-bit grayscale
+// or RGB32 scanlines. The fastest code path for the running CPU is picked once at
+// runtime, every path produces exactly the same bytes.
+namespace PixelConverter
+{
+
+enum class Isa {
+    Scalar,
+    SSE2,
+    AVX2,
+    NEON
+};
+
+// Code path currently in use and a printable name for it
+Isa activeIsa();
+const char *isaName(Isa isa);
+
+// Force a code path (falls back to the best supported one if unavailable),
+// mainly useful for comparing paths in benchmarks
+void setIsa(Isa isa);
+bool isIsaSupported(Isa isa);
+
+// 8-bit stored pixels, copied as is
+void convertRow8(const uint8_t *src, uint8_t *dst, size_t count);
+
+// 12-bit pixels in a 16-bit container, scaled with >> 4
+void convertRow12(const uint16_t *src, uint8_t *dst, size_t count);
+
+// 16-bit pixels, scaled with >> 8
+void convertRow16(const uint16_t *src, uint8_t *dst, size_t count);
+
+// 8-bit stored pixels widened to the 16-bit full precision layout
+void widenRow8(const uint8_t *src, uint16_t *dst, size_t count, bool isSigned);
+
+// Clears the unused high bits of bitsStored-bit pixels, or sign extends
+// them for signed data, in place
+void normalizeRow(uint16_t *row, size_t count, int bitsStored, bool isSigned);
+
+// Smallest and largest value of a row, folded into min/max
+void rowMinMax(const uint16_t *row, size_t count, bool isSigned, int &min, int &max);
+
+// Sum and sum of squares of a row, added to sum/sumSquares. Exact for any
+// row length a 2D image can have.
+void rowSums(const uint16_t *row, size_t count, bool isSigned, int64_t &sum, uint64_t &sumSquares);
+
+// Area average of the 2x2 blocks of two source rows of srcCount samples into
+// (srcCount + 1) / 2 samples, rounded half up. An odd last column averages
+// its two samples. Pass row0 twice for an odd last row.
+void downsampleRow2x(const uint16_t *row0, const uint16_t *row1, size_t srcCount, bool isSigned,
+                     uint16_t *dst);
+
+// Trilinear samples of a slice-major volume (index (z * height + y) * width
+// + x) at the count points start + i * step, in voxel coordinates. Rounded
+// to nearest, points outside the volume get outside. Used for reformatting
+// volumes along arbitrary planes.
+void sampleTrilinear(const uint16_t *volume, int width, int height, int depth, bool isSigned,
+                     const float start[3], const float step[3], size_t count, uint16_t outside,
+                     uint16_t *dst);
+
+// Element-wise maximum or minimum of src folded into acc, in the signed or
+// unsigned order of the data. Used for slab projections.
+void maxRow(uint16_t *acc, const uint16_t *src, size_t count, bool isSigned);
+void minRow(uint16_t *acc, const uint16_t *src, size_t count, bool isSigned);
+
+// Adds src to, or subtracts it from, 32-bit running sums. Exact for up to
+// 32768 rows.
+void accumulateRow(int32_t *sums, const uint16_t *src, size_t count, bool isSigned, bool subtract);
+
+// Sums divided by n and rounded to nearest, as stored pixel values
+void averageRow(const int32_t *sums, size_t count, int n, bool isSigned, uint16_t *dst);
+
+// 8-bit colour pixels to 0xffRRGGBB words, the layout of QImage::Format_RGB32.
+// Rows hold the samples of each pixel together (Planar Configuration 0),
+// planes one channel each (Planar Configuration 1).
+void rgbRowToRgb32(const uint8_t *src, uint32_t *dst, size_t count);
+void rgbPlanesToRgb32(const uint8_t *r, const uint8_t *g, const uint8_t *b, uint32_t *dst, size_t count);
+
+// YBR_FULL, full range BT.601 YCbCr, in the same two layouts. Fixed point,
+// every path gives the same bytes.
+void ybrRowToRgb32(const uint8_t *src, uint32_t *dst, size_t count);
+void ybrPlanesToRgb32(const uint8_t *y, const uint8_t *cb, const uint8_t *cr, uint32_t *dst, size_t count);
+
+// YBR_FULL_422, Y0 Y1 Cb Cr for each pair of pixels
+void ybr422RowToRgb32(const uint8_t *src, uint32_t *dst, size_t count);
+
+// PALETTE COLOR, stored values looked up in a table with an entry for every
+// value of the container (256 or 65536)
+void paletteRow8ToRgb32(const uint8_t *src, const uint32_t *table, uint32_t *dst, size_t count);
+void paletteRow16ToRgb32(const uint16_t *src, const uint32_t *table, uint32_t *dst, size_t count);
+
+}
+
+#endif // PIXELCONVERTER_H
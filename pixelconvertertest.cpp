@@ -0,0 +1,258 @@
+// Checks every code path of the pixel kernels the CPU supports against the
+// plain conversions they replace, and the colour kernels against their
+// scalar path. Rows are random, with lengths around the vector widths so
+// every tail length is covered.
+
+#include <QString>
+#include <QTest>
+#include <random>
+#include <vector>
+
+#include "pixelconverter.h"
+
+using PixelConverter::Isa;
+
+namespace {
+
+const size_t rowLengths[] = {0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 47, 63, 64, 65, 1000, 4099};
+
+std::vector<Isa> supportedIsas()
+{
+    std::vector<Isa> isas;
+    for (Isa isa : {Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::NEON}) {
+        if (PixelConverter::isIsaSupported(isa)) {
+            isas.push_back(isa);
+        }
+    }
+    return isas;
+}
+
+template <typename T>
+std::vector<T> randomRow(size_t count, std::mt19937 &random)
+{
+    std::vector<T> row(count);
+    for (T &value : row) {
+        value = T(random());
+    }
+    return row;
+}
+
+// Index of the first difference, -1 when the rows match
+template <typename T>
+long firstMismatch(const std::vector<T> &a, const std::vector<T> &b)
+{
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i] != b[i]) {
+            return long(i);
+        }
+    }
+    return -1;
+}
+
+QString describe(Isa isa, size_t count, long mismatch)
+{
+    return QString("%1 differs at %2 of %3").arg(PixelConverter::isaName(isa)).arg(mismatch).arg(count);
+}
+
+// RGB32 entries for a palette, opaque like the ones readPalette builds
+std::vector<uint32_t> randomTable(size_t entries, std::mt19937 &random)
+{
+    std::vector<uint32_t> table(entries);
+    for (uint32_t &entry : table) {
+        entry = 0xff000000u | (uint32_t(random()) & 0xffffffu);
+    }
+    return table;
+}
+
+// Random source rows through every code path, compared with the scalar
+// result. srcBytes is the input size of a row of count pixels, convert
+// reads it as the kernel's layout.
+template <typename Convert>
+void checkColour(uint32_t seed, size_t (*srcBytes)(size_t), Convert convert)
+{
+    std::mt19937 random(seed);
+    for (size_t count : rowLengths) {
+        const std::vector<uint8_t> src = randomRow<uint8_t>(srcBytes(count), random);
+        std::vector<uint32_t> expected(count);
+        PixelConverter::setIsa(Isa::Scalar);
+        convert(src.data(), expected.data(), count);
+
+        for (Isa isa : supportedIsas()) {
+            if (isa == Isa::Scalar) {
+                continue;
+            }
+            PixelConverter::setIsa(isa);
+            // Zeroed, the kernels write opaque pixels, so a skipped one shows
+            std::vector<uint32_t> dst(count, 0u);
+            convert(src.data(), dst.data(), count);
+            const long mismatch = firstMismatch(dst, expected);
+            QVERIFY2(mismatch < 0, qPrintable(describe(isa, count, mismatch)));
+        }
+    }
+}
+
+size_t interleavedBytes(size_t count)
+{
+    return count * 3;
+}
+
+// Y0 Y1 Cb Cr per pair, an odd row ends in half a pair
+size_t pairBytes(size_t count)
+{
+    return (count + 1) / 2 * 4;
+}
+
+size_t indexBytes8(size_t count)
+{
+    return count;
+}
+
+size_t indexBytes16(size_t count)
+{
+    return count * 2;
+}
+
+}
+
+class PixelConverterTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void convertRow8();
+    void convertRow12();
+    void convertRow16();
+
+    void rgbRowToRgb32();
+    void rgbPlanesToRgb32();
+    void ybrRowToRgb32();
+    void ybrPlanesToRgb32();
+    void ybr422RowToRgb32();
+    void paletteRow8ToRgb32();
+    void paletteRow16ToRgb32();
+
+private:
+    void checkShift(int shift, void (*convert)(const uint16_t *, uint8_t *, size_t));
+
+    Isa initialIsa = Isa::Scalar;
+};
+
+void PixelConverterTest::initTestCase()
+{
+    initialIsa = PixelConverter::activeIsa();
+    qInfo() << "Code paths:" << supportedIsas().size() << "best" << PixelConverter::isaName(initialIsa);
+}
+
+void PixelConverterTest::cleanupTestCase()
+{
+    PixelConverter::setIsa(initialIsa);
+}
+
+void PixelConverterTest::convertRow8()
+{
+    std::mt19937 random(1);
+    for (Isa isa : supportedIsas()) {
+        PixelConverter::setIsa(isa);
+        for (size_t count : rowLengths) {
+            const std::vector<uint8_t> src = randomRow<uint8_t>(count, random);
+            std::vector<uint8_t> dst(count);
+            PixelConverter::convertRow8(src.data(), dst.data(), count);
+            const long mismatch = firstMismatch(dst, src);
+            QVERIFY2(mismatch < 0, qPrintable(describe(isa, count, mismatch)));
+        }
+    }
+}
+
+// Every 16-bit value, not just the stored bits, so stray high bits are
+// truncated the same way as by the old >> conversion
+void PixelConverterTest::checkShift(int shift, void (*convert)(const uint16_t *, uint8_t *, size_t))
+{
+    std::mt19937 random(static_cast<uint32_t>(shift));
+    for (Isa isa : supportedIsas()) {
+        PixelConverter::setIsa(isa);
+        for (size_t count : rowLengths) {
+            const std::vector<uint16_t> src = randomRow<uint16_t>(count, random);
+            std::vector<uint8_t> expected(count);
+            for (size_t i = 0; i < count; ++i) {
+                expected[i] = static_cast<uint8_t>(src[i] >> shift);
+            }
+            std::vector<uint8_t> dst(count);
+            convert(src.data(), dst.data(), count);
+            const long mismatch = firstMismatch(dst, expected);
+            QVERIFY2(mismatch < 0, qPrintable(describe(isa, count, mismatch)));
+        }
+    }
+}
+
+void PixelConverterTest::convertRow12()
+{
+    checkShift(4, PixelConverter::convertRow12);
+}
+
+void PixelConverterTest::convertRow16()
+{
+    checkShift(8, PixelConverter::convertRow16);
+}
+
+void PixelConverterTest::rgbRowToRgb32()
+{
+    checkColour(11, interleavedBytes, [](const uint8_t *src, uint32_t *dst, size_t count) {
+        PixelConverter::rgbRowToRgb32(src, dst, count);
+    });
+}
+
+// The three planes sit one after another in the source row
+void PixelConverterTest::rgbPlanesToRgb32()
+{
+    checkColour(12, interleavedBytes, [](const uint8_t *src, uint32_t *dst, size_t count) {
+        PixelConverter::rgbPlanesToRgb32(src, src + count, src + 2 * count, dst, count);
+    });
+}
+
+void PixelConverterTest::ybrRowToRgb32()
+{
+    checkColour(13, interleavedBytes, [](const uint8_t *src, uint32_t *dst, size_t count) {
+        PixelConverter::ybrRowToRgb32(src, dst, count);
+    });
+}
+
+void PixelConverterTest::ybrPlanesToRgb32()
+{
+    checkColour(14, interleavedBytes, [](const uint8_t *src, uint32_t *dst, size_t count) {
+        PixelConverter::ybrPlanesToRgb32(src, src + count, src + 2 * count, dst, count);
+    });
+}
+
+void PixelConverterTest::ybr422RowToRgb32()
+{
+    checkColour(15, pairBytes, [](const uint8_t *src, uint32_t *dst, size_t count) {
+        PixelConverter::ybr422RowToRgb32(src, dst, count);
+    });
+}
+
+void PixelConverterTest::paletteRow8ToRgb32()
+{
+    std::mt19937 random(16);
+    const std::vector<uint32_t> table = randomTable(256, random);
+    checkColour(17, indexBytes8, [&table](const uint8_t *src, uint32_t *dst, size_t count) {
+        PixelConverter::paletteRow8ToRgb32(src, table.data(), dst, count);
+    });
+}
+
+// Every 16-bit index, the table has an entry for each
+void PixelConverterTest::paletteRow16ToRgb32()
+{
+    std::mt19937 random(18);
+    const std::vector<uint32_t> table = randomTable(65536, random);
+    checkColour(19, indexBytes16, [&table](const uint8_t *src, uint32_t *dst, size_t count) {
+        const uint16_t *indices = reinterpret_cast<const uint16_t *>(src);
+        PixelConverter::paletteRow16ToRgb32(indices, table.data(), dst, count);
+    });
+}
+
+QTEST_APPLESS_MAIN(PixelConverterTest)
+
+#include "pixelconvertertest.moc"
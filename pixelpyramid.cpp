@@ -0,0 +1,125 @@
+#include "pixelpyramid.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <new>
+
+#include "parallelfor.h"
+#include "pixelconverter.h"
+#include "profiler.h"
+
+PixelPyramid::PixelPyramid(QObject *parent)
+    : QObject(parent)
+{
+    pool.setMaxThreadCount(1);
+}
+
+PixelPyramid::~PixelPyramid()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+void PixelPyramid::cancel()
+{
+    if (currentCancel) {
+        *currentCancel = true;
+        currentCancel.reset();
+    }
+}
+
+void PixelPyramid::build(const PixelBuffer &base, int smallestSize)
+{
+    cancel();
+
+    int count = 1;
+    if (!base.isNull()) {
+        while (qMax(base.width, base.height) > (qMax(1, smallestSize) << (count - 1))) {
+            ++count;
+        }
+    }
+
+    {
+        QMutexLocker locker(&mutex);
+        levels.assign(size_t(count), PixelBuffer());
+        levels[0] = base;
+    }
+    if (count == 1) {
+        return;
+    }
+
+    auto cancelFlag = std::make_shared<std::atomic_bool>(false);
+    currentCancel = cancelFlag;
+
+    pool.start([this, base, count, cancelFlag]() {
+        QElapsedTimer timer;
+        timer.start();
+
+        PixelBuffer previous = base;
+        for (int index = 1; index < count && !*cancelFlag; ++index) {
+            previous = halve(previous);
+            if (previous.isNull()) {
+                return;
+            }
+
+            {
+                // Checked under the lock, a new build may have replaced levels
+                QMutexLocker locker(&mutex);
+                if (*cancelFlag) {
+                    return;
+                }
+                levels[size_t(index)] = previous;
+            }
+            QMetaObject::invokeMethod(this, [this, index, cancelFlag]() {
+                if (!*cancelFlag) {
+                    emit levelReady(index);
+                }
+            });
+        }
+        qDebug() << "Built" << count - 1 << "pyramid levels in" << timer.elapsed() << "ms";
+    });
+}
+
+PixelBuffer PixelPyramid::level(int index) const
+{
+    QMutexLocker locker(&mutex);
+    if (index < 0 || index >= int(levels.size())) {
+        return PixelBuffer();
+    }
+    return levels[size_t(index)];
+}
+
+int PixelPyramid::levelCount() const
+{
+    QMutexLocker locker(&mutex);
+    return int(levels.size());
+}
+
+PixelBuffer PixelPyramid::halve(const PixelBuffer &source)
+{
+    PROFILE_SCOPE("PixelPyramid::halve");
+    if (source.isNull()) {
+        return PixelBuffer();
+    }
+
+    PixelBuffer result = source;
+    result.width = (source.width + 1) / 2;
+    result.height = (source.height + 1) / 2;
+
+    uint16_t *samples = new (std::nothrow) uint16_t[size_t(result.width) * size_t(result.height)];
+    if (!samples) {
+        qDebug() << "Not enough memory for pyramid level" << result.width << "x" << result.height;
+        return PixelBuffer();
+    }
+    result.data = std::shared_ptr<const uint16_t>(samples, std::default_delete<uint16_t[]>());
+
+    // Averages stay inside the source range, minValue/maxValue carry over
+    parallelFor(0, result.height, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const uint16_t *row0 = source.constRow(2 * y);
+            const uint16_t *row1 = 2 * y + 1 < source.height ? source.constRow(2 * y + 1) : row0;
+            PixelConverter::downsampleRow2x(row0, row1, size_t(source.width), source.isSigned,
+                                            samples + size_t(y) * size_t(result.width));
+        }
+    }, 64);
+    return result;
+}
@@ -0,0 +1,46 @@
+#ifndef PIXELPYRAMID_H
+#define PIXELPYRAMID_H
+
+#include <QMutex>
+#include <QObject>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "pixelbuffer.h"
+
+// Power-of-two downsampled copies of a PixelBuffer, each level the 2x2 area
+// average of the one above. Levels are built on a worker thread, coarse
+// views fall back to sampling a finer level until theirs is ready.
+class PixelPyramid : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PixelPyramid(QObject *parent = nullptr);
+    ~PixelPyramid();
+
+    // Starts building levels of base until the longest side is at most
+    // smallestSize. A build still running for the previous base is dropped.
+    void build(const PixelBuffer &base, int smallestSize);
+    void cancel();
+
+    // Level 0 is the base, a level not built yet is a null buffer
+    PixelBuffer level(int index) const;
+    int levelCount() const;
+
+    // Area averaged half size copy of source
+    static PixelBuffer halve(const PixelBuffer &source);
+
+signals:
+    void levelReady(int level);
+
+private:
+    QThreadPool pool;  // one thread, levels depend on each other anyway
+    mutable QMutex mutex;  // guards levels
+    std::vector<PixelBuffer> levels;
+    std::shared_ptr<std::atomic_bool> currentCancel;
+};
+
+#endif // PIXELPYRAMID_H
@@ -0,0 +1,219 @@
+#include "profiler.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <vector>
+
+namespace Profiler
+{
+
+namespace
+{
+
+// About 4 MB of events, a few minutes of interactive use
+const int maxEvents = 131072;
+
+struct Event {
+    const char *name;
+    qint64 startNs;
+    qint64 durationNs;  // -1 for counter samples
+    qint64 value;
+    int thread;
+};
+
+struct State {
+    QMutex mutex;
+    std::vector<Event> events;  // ring buffer once full
+    size_t nextEvent = 0;
+    QHash<const char *, ScopeSummary> scopes;
+    QHash<const char *, qint64> counters;
+    QHash<Qt::HANDLE, int> threads;
+    QElapsedTimer clock;
+
+    State()
+    {
+        clock.start();
+        events.reserve(4096);
+    }
+};
+
+State &state()
+{
+    static State instance;
+    return instance;
+}
+
+bool enabledFromEnvironment()
+{
+    return qEnvironmentVariableIsSet("MIV_PROFILE");
+}
+
+// Small stable ids read better in trace viewers than thread handles
+int threadId(State &s)
+{
+    const Qt::HANDLE handle = QThread::currentThreadId();
+    auto it = s.threads.constFind(handle);
+    if (it != s.threads.constEnd()) {
+        return it.value();
+    }
+    const int id = int(s.threads.size()) + 1;
+    s.threads.insert(handle, id);
+    return id;
+}
+
+void append(State &s, const Event &event)
+{
+    if (s.events.size() < size_t(maxEvents)) {
+        s.events.push_back(event);
+    } else {
+        s.events[s.nextEvent] = event;
+        s.nextEvent = (s.nextEvent + 1) % s.events.size();
+    }
+}
+
+QString jsonString(const char *text)
+{
+    QString escaped = QString::fromUtf8(text);
+    escaped.replace('\\', "\\\\");
+    escaped.replace('"', "\\\"");
+    return '"' + escaped + '"';
+}
+
+}
+
+std::atomic<bool> enabledFlag(enabledFromEnvironment());
+
+void setEnabled(bool enabled)
+{
+    enabledFlag.store(enabled, std::memory_order_relaxed);
+}
+
+qint64 nowNs()
+{
+    return state().clock.nsecsElapsed();
+}
+
+void recordScope(const char *name, qint64 startNs, qint64 durationNs)
+{
+    State &s = state();
+    QMutexLocker locker(&s.mutex);
+    append(s, Event{name, startNs, durationNs, 0, threadId(s)});
+
+    ScopeSummary &summary = s.scopes[name];
+    summary.name = name;
+    ++summary.calls;
+    summary.totalNs += durationNs;
+    summary.maxNs = std::max(summary.maxNs, durationNs);
+    summary.lastNs = durationNs;
+}
+
+void count(const char *name, qint64 delta)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    State &s = state();
+    const qint64 now = s.clock.nsecsElapsed();
+    QMutexLocker locker(&s.mutex);
+    const qint64 value = (s.counters[name] += delta);
+    append(s, Event{name, now, -1, value, threadId(s)});
+}
+
+QVector<ScopeSummary> scopeSummaries()
+{
+    State &s = state();
+    QMutexLocker locker(&s.mutex);
+    QVector<ScopeSummary> result;
+    result.reserve(s.scopes.size());
+    for (auto it = s.scopes.cbegin(); it != s.scopes.cend(); ++it) {
+        result.append(it.value());
+    }
+    locker.unlock();
+
+    std::sort(result.begin(), result.end(), [](const ScopeSummary &a, const ScopeSummary &b) {
+        return a.totalNs > b.totalNs;
+    });
+    return result;
+}
+
+QVector<CounterValue> counterValues()
+{
+    State &s = state();
+    QMutexLocker locker(&s.mutex);
+    QVector<CounterValue> result;
+    for (auto it = s.counters.cbegin(); it != s.counters.cend(); ++it) {
+        result.append(CounterValue{it.key(), it.value()});
+    }
+    locker.unlock();
+
+    std::sort(result.begin(), result.end(), [](const CounterValue &a, const CounterValue &b) {
+        return qstrcmp(a.name, b.name) < 0;
+    });
+    return result;
+}
+
+void reset()
+{
+    State &s = state();
+    QMutexLocker locker(&s.mutex);
+    s.events.clear();
+    s.nextEvent = 0;
+    s.scopes.clear();
+    s.counters.clear();
+}
+
+bool writeChromeTrace(const QString &fileName)
+{
+    // Copied out so the lock is not held while writing
+    std::vector<Event> events;
+    {
+        State &s = state();
+        QMutexLocker locker(&s.mutex);
+        events.reserve(s.events.size());
+        events.insert(events.end(), s.events.begin() + s.nextEvent, s.events.end());
+        events.insert(events.end(), s.events.begin(), s.events.begin() + s.nextEvent);
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qDebug() << "Cannot write trace:" << fileName << file.errorString();
+        return false;
+    }
+
+    // Complete ("X") events for scopes, counter ("C") events for counters.
+    // Timestamps and durations are in microseconds.
+    QTextStream out(&file);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const Event &event : events) {
+        if (!first) {
+            out << ",\n";
+        }
+        first = false;
+
+        out << "{\"name\":" << jsonString(event.name) << ",\"pid\":1,\"tid\":" << event.thread
+            << ",\"ts\":" << QString::number(event.startNs / 1000.0, 'f', 3);
+        if (event.durationNs >= 0) {
+            out << ",\"ph\":\"X\",\"dur\":" << QString::number(event.durationNs / 1000.0, 'f', 3) << "}";
+        } else {
+            out << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+        }
+    }
+    out << "\n]}\n";
+    out.flush();
+
+    if (!file.commit()) {
+        qDebug() << "Cannot write trace:" << fileName << file.errorString();
+        return false;
+    }
+    qDebug() << "Wrote" << events.size() << "trace events to" << fileName;
+    return true;
+}
+
+}
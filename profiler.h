@@ -0,0 +1,89 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QString>
+#include <QVector>
+#include <atomic>
+
+// Scoped timers and counters for the load and render paths. Disabled, a
+// timer is one relaxed atomic load. Enabled, every scope is kept as a trace
+// event (up to a fixed number, the oldest are dropped) and folded into
+// per name totals for the HUD. Names must be string literals, only the
+// pointer is stored.
+//
+//   void ImageItem::paint(...)
+//   {
+//       PROFILE_SCOPE("ImageItem::paint");
+//       ...
+//       Profiler::count("tiles rendered");
+namespace Profiler
+{
+
+struct ScopeSummary {
+    const char *name = nullptr;
+    int calls = 0;
+    qint64 totalNs = 0;
+    qint64 maxNs = 0;
+    qint64 lastNs = 0;
+};
+
+struct CounterValue {
+    const char *name;
+    qint64 value;
+};
+
+extern std::atomic<bool> enabledFlag;
+
+inline bool isEnabled()
+{
+    return enabledFlag.load(std::memory_order_relaxed);
+}
+
+// Also on when the MIV_PROFILE environment variable is set at startup
+void setEnabled(bool enabled);
+
+// Monotonic clock shared by all threads
+qint64 nowNs();
+
+void recordScope(const char *name, qint64 startNs, qint64 durationNs);
+void count(const char *name, qint64 delta = 1);
+
+// Totals since the last reset, scopes sorted by total time
+QVector<ScopeSummary> scopeSummaries();
+QVector<CounterValue> counterValues();
+void reset();
+
+// Chrome trace event format, opens in chrome://tracing and Perfetto
+bool writeChromeTrace(const QString &fileName);
+
+}
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const char *name)
+        : name(Profiler::isEnabled() ? name : nullptr)
+        , start(this->name ? Profiler::nowNs() : 0)
+    {
+    }
+
+    ~ScopedTimer()
+    {
+        if (name) {
+            Profiler::recordScope(name, start, Profiler::nowNs() - start);
+        }
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    const char *name;
+    qint64 start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ScopedTimer PROFILE_CONCAT(profileScope, __LINE__)(name)
+
+#endif // PROFILER_H
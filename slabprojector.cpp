@@ -0,0 +1,255 @@
+#include "slabprojector.h"
+#include <QDebug>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "parallelfor.h"
+#include "pixelconverter.h"
+#include "profiler.h"
+
+namespace {
+
+// Rows per band, about 32 KB of 16-bit samples so a band of the result
+// stays in L1/L2 while the slices stream past it
+int bandRows(int width)
+{
+    return std::max(1, 16384 / std::max(1, width));
+}
+
+}
+
+SlabProjector::SlabProjector()
+    : sumFirst(-1)
+    , sumLast(-1)
+    , foldCount(0)
+{
+}
+
+void SlabProjector::setVolume(const std::shared_ptr<const VolumeData> &newVolume)
+{
+    if (newVolume == volume) {
+        return;
+    }
+    volume = newVolume;
+    maxima = Extreme();
+    minima = Extreme();
+    maxBlocks.clear();
+    minBlocks.clear();
+    sums.clear();
+    sums.shrink_to_fit();
+    sumFirst = -1;
+    sumLast = -1;
+}
+
+bool SlabProjector::isNull() const
+{
+    return !volume || volume->isNull();
+}
+
+int SlabProjector::lastFoldCount() const
+{
+    return foldCount;
+}
+
+PixelBuffer SlabProjector::project(Mode mode, int first, int last)
+{
+    PROFILE_SCOPE("SlabProjector::project");
+    foldCount = 0;
+    if (isNull()) {
+        return PixelBuffer();
+    }
+    first = qBound(0, first, volume->depth - 1);
+    last = qBound(first, last, volume->depth - 1);
+
+    PixelBuffer result;
+    switch (mode) {
+    case Maximum:
+        result = projectExtreme(true, first, last);
+        break;
+    case Minimum:
+        result = projectExtreme(false, first, last);
+        break;
+    case Average:
+        result = projectAverage(first, last);
+        break;
+    }
+    Profiler::count("slab slices folded", foldCount);
+    return result;
+}
+
+PixelBuffer SlabProjector::makeBuffer(uint16_t *&samples) const
+{
+    PixelBuffer pixels;
+    samples = new (std::nothrow) uint16_t[volume->sliceSize()];
+    if (!samples) {
+        qDebug() << "Not enough memory for slab projection";
+        return pixels;
+    }
+    pixels.width = volume->width;
+    pixels.height = volume->height;
+    pixels.bitsStored = volume->bitsStored;
+    pixels.isSigned = volume->isSigned;
+    pixels.minValue = volume->minValue;
+    pixels.maxValue = volume->maxValue;
+    pixels.data = std::shared_ptr<const uint16_t>(samples, std::default_delete<uint16_t[]>());
+    return pixels;
+}
+
+void SlabProjector::foldExtremes(uint16_t *values, const std::vector<const uint16_t *> &sources, bool maximum,
+                                 bool startFromFirst)
+{
+    if (sources.empty()) {
+        return;
+    }
+    const int width = volume->width;
+    const int rows = bandRows(width);
+    const bool isSigned = volume->isSigned;
+
+    parallelFor(0, volume->height, [&](int chunkBegin, int chunkEnd) {
+        for (int y = chunkBegin; y < chunkEnd; y += rows) {
+            const size_t offset = size_t(y) * size_t(width);
+            const size_t count = size_t(std::min(rows, chunkEnd - y)) * size_t(width);
+            size_t i = 0;
+            if (startFromFirst) {
+                std::memcpy(values + offset, sources[0] + offset, count * sizeof(uint16_t));
+                i = 1;
+            }
+            for (; i < sources.size(); ++i) {
+                if (maximum) {
+                    PixelConverter::maxRow(values + offset, sources[i] + offset, count, isSigned);
+                } else {
+                    PixelConverter::minRow(values + offset, sources[i] + offset, count, isSigned);
+                }
+            }
+        }
+    }, rows);
+    foldCount += int(sources.size());
+}
+
+const uint16_t *SlabProjector::blockProjection(bool maximum, int block)
+{
+    std::vector<Samples> &blocks = maximum ? maxBlocks : minBlocks;
+    if (blocks.empty()) {
+        blocks.resize(size_t(volume->depth / blockSlices));
+    }
+
+    Samples &samples = blocks[size_t(block)];
+    if (samples.empty()) {
+        samples.resize(volume->sliceSize());
+        std::vector<const uint16_t *> sources;
+        for (int z = block * blockSlices; z < (block + 1) * blockSlices; ++z) {
+            sources.push_back(volume->sliceData(z));
+        }
+        foldExtremes(samples.data(), sources, maximum, true);
+    }
+    return samples.data();
+}
+
+PixelBuffer SlabProjector::projectExtreme(bool maximum, int first, int last)
+{
+    Extreme &state = maximum ? maxima : minima;
+    if (state.values.empty()) {
+        state.values.resize(volume->sliceSize());
+        state.first = -1;
+    }
+
+    std::vector<const uint16_t *> sources;
+    bool startFromFirst = false;
+    if (state.first >= 0 && first <= state.first && last >= state.last) {
+        // Grown or unchanged, only the new slices are folded in
+        for (int z = first; z < state.first; ++z) {
+            sources.push_back(volume->sliceData(z));
+        }
+        for (int z = state.last + 1; z <= last; ++z) {
+            sources.push_back(volume->sliceData(z));
+        }
+    } else {
+        // Max and min cannot take slices back out, rebuild from whole blocks
+        // and the loose slices at both ends
+        int z = first;
+        while (z <= last) {
+            if (z % blockSlices == 0 && z + blockSlices - 1 <= last) {
+                sources.push_back(blockProjection(maximum, z / blockSlices));
+                z += blockSlices;
+            } else {
+                sources.push_back(volume->sliceData(z));
+                ++z;
+            }
+        }
+        startFromFirst = true;
+    }
+    foldExtremes(state.values.data(), sources, maximum, startFromFirst);
+    state.first = first;
+    state.last = last;
+
+    uint16_t *samples = nullptr;
+    PixelBuffer pixels = makeBuffer(samples);
+    if (samples) {
+        std::memcpy(samples, state.values.data(), volume->sliceSize() * sizeof(uint16_t));
+    }
+    return pixels;
+}
+
+PixelBuffer SlabProjector::projectAverage(int first, int last)
+{
+    // Slices entering the slab are added and leaving ones subtracted, unless
+    // starting over touches fewer slices
+    std::vector<std::pair<const uint16_t *, bool>> folds;
+    bool reset = sums.empty() || sumFirst < 0;
+    if (!reset) {
+        const int changed = std::abs(first - sumFirst) + std::abs(last - sumLast);
+        reset = changed >= last - first + 1 || first > sumLast || last < sumFirst;
+    }
+
+    if (reset) {
+        sums.assign(volume->sliceSize(), 0);
+        for (int z = first; z <= last; ++z) {
+            folds.emplace_back(volume->sliceData(z), false);
+        }
+    } else {
+        for (int z = first; z < sumFirst; ++z) {
+            folds.emplace_back(volume->sliceData(z), false);
+        }
+        for (int z = sumFirst; z < first; ++z) {
+            folds.emplace_back(volume->sliceData(z), true);
+        }
+        for (int z = sumLast + 1; z <= last; ++z) {
+            folds.emplace_back(volume->sliceData(z), false);
+        }
+        for (int z = last + 1; z <= sumLast; ++z) {
+            folds.emplace_back(volume->sliceData(z), true);
+        }
+    }
+    sumFirst = first;
+    sumLast = last;
+
+    uint16_t *samples = nullptr;
+    PixelBuffer pixels = makeBuffer(samples);
+    if (!samples) {
+        sumFirst = -1;
+        return pixels;
+    }
+
+    // 32-bit sums take twice the room, half the rows per band
+    const int width = volume->width;
+    const int rows = std::max(1, bandRows(width) / 2);
+    const bool isSigned = volume->isSigned;
+    const int count = last - first + 1;
+    int32_t *sumData = sums.data();
+
+    parallelFor(0, volume->height, [&](int chunkBegin, int chunkEnd) {
+        for (int y = chunkBegin; y < chunkEnd; y += rows) {
+            const size_t offset = size_t(y) * size_t(width);
+            const size_t bandCount = size_t(std::min(rows, chunkEnd - y)) * size_t(width);
+            for (const auto &fold : folds) {
+                PixelConverter::accumulateRow(sumData + offset, fold.first + offset, bandCount, isSigned,
+                                              fold.second);
+            }
+            PixelConverter::averageRow(sumData + offset, bandCount, count, isSigned, samples + offset);
+        }
+    }, rows);
+    foldCount += int(folds.size());
+    return pixels;
+}
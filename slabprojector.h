@@ -0,0 +1,71 @@
+#ifndef SLABPROJECTOR_H
+#define SLABPROJECTOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "pixelbuffer.h"
+#include "volumedata.h"
+
+// Maximum, minimum and average intensity projections over a slab of slices
+// of a volume. Slices are folded in bands of rows that stay in cache, bands
+// split across cores. Each mode keeps its last result and updates it when
+// the slab changes: averages add the slices entering and subtract the ones
+// leaving, maxima and minima fold in the slices a grown slab adds and
+// otherwise combine per-block projections of eight slices built on demand.
+class SlabProjector
+{
+public:
+    enum Mode {
+        Maximum,
+        Minimum,
+        Average
+    };
+
+    SlabProjector();
+
+    void setVolume(const std::shared_ptr<const VolumeData> &volume);
+    bool isNull() const;
+
+    // Projection of slices first to last inclusive, clamped to the volume.
+    // Null without a volume.
+    PixelBuffer project(Mode mode, int first, int last);
+
+    // Slice sized images the last project() call folded, a measure of how
+    // much the incremental update saved
+    int lastFoldCount() const;
+
+private:
+    static const int blockSlices = 8;
+
+    using Samples = std::vector<uint16_t, AlignedAllocator<uint16_t, 64>>;
+
+    struct Extreme {
+        Samples values;
+        int first = -1;
+        int last = -1;
+    };
+
+    PixelBuffer projectExtreme(bool maximum, int first, int last);
+    PixelBuffer projectAverage(int first, int last);
+    const uint16_t *blockProjection(bool maximum, int block);
+    void foldExtremes(uint16_t *values, const std::vector<const uint16_t *> &sources, bool maximum,
+                      bool startFromFirst);
+    PixelBuffer makeBuffer(uint16_t *&samples) const;
+
+    std::shared_ptr<const VolumeData> volume;
+    Extreme maxima;
+    Extreme minima;
+    std::vector<Samples> maxBlocks;
+    std::vector<Samples> minBlocks;
+
+    // Running sums of the average slab
+    std::vector<int32_t> sums;
+    int sumFirst;
+    int sumLast;
+
+    int foldCount;
+};
+
+#endif // SLABPROJECTOR_H
@@ -0,0 +1,200 @@
+#include "studybrowser.h"
+#include <QDebug>
+#include <QFileInfo>
+#include <QHeaderView>
+#include <QSet>
+#include <QVBoxLayout>
+#include <algorithm>
+
+namespace {
+
+const int fileNameRole = Qt::UserRole;
+const int seriesRole = Qt::UserRole + 1;
+const int seriesNumberRole = Qt::UserRole + 2;
+
+QString joined(const QStringList &parts)
+{
+    QStringList present;
+    for (const QString &part : parts) {
+        if (!part.isEmpty()) {
+            present.append(part);
+        }
+    }
+    return present.join("  ");
+}
+
+}
+
+StudyBrowser::StudyBrowser(QWidget *parent)
+    : QWidget(parent)
+    , imageCount(0)
+{
+    indexer = new StudyIndexer(this);
+
+    tree = new QTreeWidget(this);
+    tree->setHeaderHidden(true);
+    tree->setUniformRowHeights(true);
+    tree->header()->setSectionResizeMode(QHeaderView::ResizeToContents);
+
+    statusLabel = new QLabel("No folder open", this);
+    statusLabel->setStyleSheet("QLabel { font-size: 10px; color: gray; }");
+
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(0, 0, 0, 0);
+    layout->addWidget(tree);
+    layout->addWidget(statusLabel);
+
+    connect(indexer, &StudyIndexer::entriesFound, this, &StudyBrowser::addEntries);
+    connect(indexer, &StudyIndexer::scanFinished, this, &StudyBrowser::onScanFinished);
+    connect(tree, &QTreeWidget::currentItemChanged, this, &StudyBrowser::onCurrentItemChanged);
+}
+
+void StudyBrowser::openDirectory(const QString &directory)
+{
+    tree->clear();
+    studies.clear();
+    series.clear();
+    imageCount = 0;
+
+    statusLabel->setText("Indexing " + QFileInfo(directory).fileName() + "...");
+    indexer->scan(directory);
+}
+
+QTreeWidgetItem *StudyBrowser::studyItem(const StudyIndexer::Entry &entry)
+{
+    QTreeWidgetItem *&item = studies[entry.studyUid];
+    if (!item) {
+        item = new QTreeWidgetItem(tree);
+        item->setText(0, joined({entry.patientName, entry.studyDate, entry.studyDescription}));
+        if (item->text(0).isEmpty()) {
+            item->setText(0, "Study");
+        }
+        item->setToolTip(0, entry.studyUid);
+        item->setExpanded(true);
+    }
+    return item;
+}
+
+StudyBrowser::Series &StudyBrowser::seriesFor(const StudyIndexer::Entry &entry)
+{
+    Series &found = series[entry.seriesUid];
+    if (!found.item) {
+        // Series of a study are listed by Series Number
+        QTreeWidgetItem *study = studyItem(entry);
+        int position = 0;
+        while (position < study->childCount()
+               && study->child(position)->data(0, seriesNumberRole).toInt() <= entry.seriesNumber) {
+            ++position;
+        }
+
+        found.item = new QTreeWidgetItem();
+        found.item->setData(0, seriesRole, entry.seriesUid);
+        found.item->setData(0, seriesNumberRole, entry.seriesNumber);
+        found.item->setToolTip(0, entry.seriesUid);
+        study->insertChild(position, found.item);
+    }
+    return found;
+}
+
+void StudyBrowser::addEntries(const QVector<StudyIndexer::Entry> &entries)
+{
+    QSet<QString> touched;
+    for (const StudyIndexer::Entry &entry : entries) {
+        Series &target = seriesFor(entry);
+
+        // Kept sorted as batches arrive. A late image pushes the rows after it
+        // down, the current item is tracked by the view and stays selected.
+        auto position = std::upper_bound(target.entries.begin(), target.entries.end(), entry,
+                                         StudyIndexer::lessInSeries);
+        const int index = int(position - target.entries.begin());
+        target.entries.insert(position, entry);
+
+        QTreeWidgetItem *item = new QTreeWidgetItem();
+        const QString name = QFileInfo(entry.fileName).fileName();
+        item->setText(0, entry.isDicom ? QString("%1  %2").arg(entry.instanceNumber).arg(name) : name);
+        if (entry.frames > 1) {
+            item->setText(0, item->text(0) + QString("  (%1 frames)").arg(entry.frames));
+        }
+        item->setToolTip(0, entry.fileName);
+        item->setData(0, fileNameRole, entry.fileName);
+        item->setData(0, seriesRole, entry.seriesUid);
+        target.item->insertChild(index, item);
+
+        touched.insert(entry.seriesUid);
+        ++imageCount;
+    }
+
+    for (const QString &uid : std::as_const(touched)) {
+        const Series &changed = series[uid];
+        const StudyIndexer::Entry &first = changed.entries.first();
+        const QString number = first.isDicom ? QString("S%1").arg(first.seriesNumber) : QString();
+        changed.item->setText(0, joined({number, first.modality, first.seriesDescription,
+                                         QString("(%1)").arg(changed.entries.size())}));
+    }
+
+    statusLabel->setText(QString("Indexing... %1 images").arg(imageCount));
+}
+
+void StudyBrowser::onScanFinished(const QString &directory, int count)
+{
+    statusLabel->setText(QString("%1 images in %2 series").arg(count).arg(series.size()));
+    qDebug() << "Study browser ready:" << directory;
+
+    // Start on the first image when nothing was picked while scanning
+    if (!tree->currentItem() && tree->topLevelItemCount() > 0) {
+        QTreeWidgetItem *study = tree->topLevelItem(0);
+        if (study->childCount() > 0 && study->child(0)->childCount() > 0) {
+            tree->setCurrentItem(study->child(0)->child(0));
+        }
+    }
+}
+
+QStringList StudyBrowser::filesOf(const Series &series)
+{
+    QStringList files;
+    files.reserve(series.entries.size());
+    for (const StudyIndexer::Entry &entry : series.entries) {
+        files.append(entry.fileName);
+    }
+    return files;
+}
+
+void StudyBrowser::onCurrentItemChanged(QTreeWidgetItem *current)
+{
+    if (!current || current->data(0, fileNameRole).isNull()) {
+        return;
+    }
+
+    const auto found = series.constFind(current->data(0, seriesRole).toString());
+    if (found == series.cend()) {
+        return;
+    }
+    emit imageActivated(current->data(0, fileNameRole).toString(), filesOf(found.value()),
+                        current->parent()->indexOfChild(current));
+}
+
+bool StudyBrowser::step(int delta)
+{
+    QTreeWidgetItem *current = tree->currentItem();
+    if (!current || !current->parent() || current->data(0, fileNameRole).isNull()) {
+        return false;
+    }
+
+    QTreeWidgetItem *parent = current->parent();
+    const int index = parent->indexOfChild(current) + delta;
+    if (index < 0 || index >= parent->childCount()) {
+        return false;
+    }
+    tree->setCurrentItem(parent->child(index));
+    return true;
+}
+
+bool StudyBrowser::selectNext()
+{
+    return step(1);
+}
+
+bool StudyBrowser::selectPrevious()
+{
+    return step(-1);
+}
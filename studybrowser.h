@@ -0,0 +1,54 @@
+#ifndef STUDYBROWSER_H
+#define STUDYBROWSER_H
+
+#include <QHash>
+#include <QLabel>
+#include <QStringList>
+#include <QTreeWidget>
+#include <QVector>
+#include <QWidget>
+
+#include "studyindexer.h"
+
+// Study / series / image tree of a folder, filled in by a StudyIndexer while
+// it scans. Selecting an image asks for it to be shown, along with the
+// ordered images of its series so neighbours can be prefetched.
+class StudyBrowser : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit StudyBrowser(QWidget *parent = nullptr);
+
+    void openDirectory(const QString &directory);
+
+    // Moves the selection within the current series, false at either end
+    bool selectNext();
+    bool selectPrevious();
+
+signals:
+    void imageActivated(const QString &fileName, const QStringList &seriesFiles, int index);
+
+private:
+    struct Series {
+        QTreeWidgetItem *item = nullptr;
+        QVector<StudyIndexer::Entry> entries;  // in display order, one per child
+    };
+
+    void addEntries(const QVector<StudyIndexer::Entry> &entries);
+    void onScanFinished(const QString &directory, int imageCount);
+    void onCurrentItemChanged(QTreeWidgetItem *current);
+    bool step(int delta);
+    QTreeWidgetItem *studyItem(const StudyIndexer::Entry &entry);
+    Series &seriesFor(const StudyIndexer::Entry &entry);
+    static QStringList filesOf(const Series &series);
+
+    StudyIndexer *indexer;
+    QTreeWidget *tree;
+    QLabel *statusLabel;
+    QHash<QString, QTreeWidgetItem *> studies;
+    QHash<QString, Series> series;
+    int imageCount;
+};
+
+#endif // STUDYBROWSER_H
@@ -0,0 +1,202 @@
+#include "studyindexer.h"
+#include <QDebug>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <set>
+#include <vector>
+
+#include "gdcmReader.h"
+
+#include "dicomloader.h"
+#include "parallelfor.h"
+#include "profiler.h"
+
+namespace {
+
+// Headers read per batch, small enough that the browser fills in steadily
+const int batchSize = 256;
+
+QString tagOrEmpty(DicomLoader &loader, const gdcm::DataSet &dataset, const gdcm::Tag &tag)
+{
+    const QString value = loader.extractTag(dataset, tag);
+    return value == "N/A" ? QString() : value;
+}
+
+bool isStandardImage(const QString &fileName)
+{
+    static const QStringList suffixes = {"png", "jpg", "jpeg", "bmp"};
+    return suffixes.contains(QFileInfo(fileName).suffix().toLower());
+}
+
+}
+
+StudyIndexer::StudyIndexer(QObject *parent)
+    : QObject(parent)
+    , currentRequest(0)
+    , scanning(false)
+{
+    qRegisterMetaType<StudyIndexer::Entry>();
+    pool.setMaxThreadCount(1);
+}
+
+StudyIndexer::~StudyIndexer()
+{
+    // The scan posts back to this object
+    cancel();
+    pool.waitForDone();
+}
+
+void StudyIndexer::scan(const QString &directory)
+{
+    if (currentCancel) {
+        currentCancel->store(true);
+    }
+
+    const quint64 requestId = ++currentRequest;
+    auto cancelFlag = std::make_shared<std::atomic_bool>(false);
+    currentCancel = cancelFlag;
+    scanning = true;
+
+    pool.start([this, requestId, directory, cancelFlag]() {
+        runScan(requestId, directory, cancelFlag);
+    });
+}
+
+void StudyIndexer::cancel()
+{
+    if (currentCancel) {
+        currentCancel->store(true);
+    }
+    ++currentRequest;
+    scanning = false;
+}
+
+bool StudyIndexer::isScanning() const
+{
+    return scanning;
+}
+
+bool StudyIndexer::lessInSeries(const Entry &a, const Entry &b)
+{
+    if (a.instanceNumber != b.instanceNumber) {
+        return a.instanceNumber < b.instanceNumber;
+    }
+    return a.fileName < b.fileName;
+}
+
+bool StudyIndexer::readEntry(const QString &fileName, Entry &entry)
+{
+    entry.fileName = fileName;
+
+    // Standard images of a folder form one pseudo series
+    if (isStandardImage(fileName)) {
+        const QString folder = QFileInfo(fileName).absolutePath();
+        entry.studyUid = folder;
+        entry.studyDescription = QFileInfo(folder).fileName();
+        entry.seriesUid = folder;
+        entry.seriesDescription = "Images";
+        return true;
+    }
+
+    DicomLoader loader;
+    if (!loader.isDicomFile(fileName)) {
+        return false;
+    }
+
+    // Attributes the browser groups and sorts by. Pixel Data is in the skip
+    // set, the parser stops in front of its value without reading it.
+    const gdcm::Tag pixelDataTag(0x7fe0, 0x0010);
+    gdcm::Reader reader;
+    reader.SetFileName(fileName.toStdString().c_str());
+    if (!reader.ReadUpToTag(pixelDataTag, std::set<gdcm::Tag>{pixelDataTag})) {
+        return false;
+    }
+    const gdcm::DataSet &dataset = reader.GetFile().GetDataSet();
+
+    entry.isDicom = true;
+    entry.patientName = tagOrEmpty(loader, dataset, gdcm::Tag(0x0010, 0x0010));
+    entry.studyUid = tagOrEmpty(loader, dataset, gdcm::Tag(0x0020, 0x000d));
+    entry.studyDate = tagOrEmpty(loader, dataset, gdcm::Tag(0x0008, 0x0020));
+    entry.studyDescription = tagOrEmpty(loader, dataset, gdcm::Tag(0x0008, 0x1030));
+    entry.seriesUid = tagOrEmpty(loader, dataset, gdcm::Tag(0x0020, 0x000e));
+    entry.seriesDescription = tagOrEmpty(loader, dataset, gdcm::Tag(0x0008, 0x103e));
+    entry.modality = tagOrEmpty(loader, dataset, gdcm::Tag(0x0008, 0x0060));
+    entry.seriesNumber = tagOrEmpty(loader, dataset, gdcm::Tag(0x0020, 0x0011)).toInt();
+    entry.instanceNumber = tagOrEmpty(loader, dataset, gdcm::Tag(0x0020, 0x0013)).toInt();
+    entry.frames = qMax(1, tagOrEmpty(loader, dataset, gdcm::Tag(0x0028, 0x0008)).toInt());
+
+    // Files without UIDs still need a group, their folder is the best guess
+    if (entry.studyUid.isEmpty()) {
+        entry.studyUid = QFileInfo(fileName).absolutePath();
+    }
+    if (entry.seriesUid.isEmpty()) {
+        entry.seriesUid = entry.studyUid;
+    }
+    return true;
+}
+
+void StudyIndexer::runScan(quint64 requestId, const QString &directory,
+                           std::shared_ptr<std::atomic_bool> cancelFlag)
+{
+    PROFILE_SCOPE("StudyIndexer::scan");
+    QElapsedTimer timer;
+    timer.start();
+
+    // Listing is cheap next to header reads, collect a batch then read it
+    QDirIterator it(directory, QDir::Files | QDir::Readable, QDirIterator::Subdirectories);
+    QStringList files;
+    int imageCount = 0;
+
+    auto flush = [&]() {
+        std::vector<Entry> entries(files.size());
+        std::vector<char> valid(files.size(), 0);
+        parallelFor(0, files.size(), [&](int first, int last) {
+            for (int i = first; i < last && !cancelFlag->load(); ++i) {
+                valid[i] = readEntry(files.at(i), entries[i]) ? 1 : 0;
+            }
+        });
+        files.clear();
+
+        QVector<Entry> batch;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (valid[i]) {
+                batch.append(entries[i]);
+            }
+        }
+        if (batch.isEmpty() || cancelFlag->load()) {
+            return;
+        }
+        imageCount += batch.size();
+
+        QMetaObject::invokeMethod(this, [this, requestId, batch]() {
+            if (scanning && requestId == currentRequest) {
+                emit entriesFound(batch);
+            }
+        }, Qt::QueuedConnection);
+    };
+
+    while (it.hasNext() && !cancelFlag->load()) {
+        files.append(it.next());
+        if (files.size() == batchSize) {
+            flush();
+        }
+    }
+    if (!files.isEmpty() && !cancelFlag->load()) {
+        flush();
+    }
+
+    if (cancelFlag->load()) {
+        qDebug() << "Dropped directory scan" << requestId << ":" << directory;
+        return;
+    }
+
+    qDebug() << "Indexed" << imageCount << "images in" << directory << "in" << timer.elapsed() << "ms";
+    QMetaObject::invokeMethod(this, [this, requestId, directory, imageCount]() {
+        if (requestId != currentRequest) {
+            return;
+        }
+        scanning = false;
+        emit scanFinished(directory, imageCount);
+    }, Qt::QueuedConnection);
+}
@@ -0,0 +1,64 @@
+#ifndef STUDYINDEXER_H
+#define STUDYINDEXER_H
+
+#include <QMetaType>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+#include <atomic>
+#include <memory>
+
+// Walks a directory tree on a background thread and reads the header of
+// every image it finds, so a browser can group files by study and series
+// without decoding pixels. Results arrive in batches while the scan runs.
+// Starting a new scan cancels the previous one.
+class StudyIndexer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Entry {
+        QString fileName;
+        QString patientName;
+        QString studyUid;
+        QString studyDate;
+        QString studyDescription;
+        QString seriesUid;
+        QString seriesDescription;
+        QString modality;
+        int seriesNumber = 0;
+        int instanceNumber = 0;
+        int frames = 1;
+        bool isDicom = false;
+    };
+
+    explicit StudyIndexer(QObject *parent = nullptr);
+    ~StudyIndexer();
+
+    void scan(const QString &directory);
+    void cancel();
+    bool isScanning() const;
+
+    // Display order inside a series, by Instance Number then file name
+    static bool lessInSeries(const Entry &a, const Entry &b);
+
+signals:
+    void entriesFound(const QVector<StudyIndexer::Entry> &entries);
+    void scanFinished(const QString &directory, int imageCount);
+
+private:
+    void runScan(quint64 requestId, const QString &directory,
+                 std::shared_ptr<std::atomic_bool> cancelFlag);
+    static bool readEntry(const QString &fileName, Entry &entry);
+
+    QThreadPool pool;  // one thread, headers are read in parallel from it
+    quint64 currentRequest;
+    std::shared_ptr<std::atomic_bool> currentCancel;
+    bool scanning;
+};
+
+Q_DECLARE_METATYPE(StudyIndexer::Entry)
+
+#endif // STUDYINDEXER_H
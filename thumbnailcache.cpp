@@ -0,0 +1,228 @@
+#include "thumbnailcache.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <algorithm>
+#include <vector>
+
+#include "dicomloader.h"
+#include "profiler.h"
+
+namespace {
+
+// Space an entry takes on disk, whole 4 KB blocks. Failure markers are
+// empty but still cost a directory entry.
+qint64 diskBytes(qint64 fileSize)
+{
+    return qMax<qint64>(1, (fileSize + 4095) / 4096) * 4096;
+}
+
+// Marks an entry opened for reading as recently used for trim(). An hour is
+// fine grained enough for LRU, so a hit only writes metadata when the stamp
+// is older than that. Failing, e.g. on a read-only cache, is harmless.
+void touch(QFile &entry)
+{
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    if (entry.fileTime(QFileDevice::FileModificationTime).secsTo(now) < 3600) {
+        return;
+    }
+    QFile file(entry.fileName());
+    if (file.open(QIODevice::ReadWrite | QIODevice::ExistingOnly)) {
+        file.setFileTime(now, QFileDevice::FileModificationTime);
+    }
+}
+
+}
+
+ThumbnailCache::ThumbnailCache(const QString &directory, int size, qint64 budgetBytes)
+    : directory(directory)
+    , size(qMax(16, size))
+    , budgetBytes(qMax<qint64>(1024 * 1024, budgetBytes))
+    , writtenSinceTrim(0)
+    , trimming(false)
+{
+}
+
+QString ThumbnailCache::defaultDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails";
+}
+
+int ThumbnailCache::thumbnailSize() const
+{
+    return size;
+}
+
+qint64 ThumbnailCache::budget() const
+{
+    return budgetBytes;
+}
+
+QString ThumbnailCache::pathFor(const QString &fileName, const char *suffix) const
+{
+    // Same key as ImageCache plus the size, a rewritten file misses
+    const QFileInfo info(fileName);
+    const QString key = QString("%1|%2|%3|%4")
+                            .arg(info.absoluteFilePath())
+                            .arg(info.size())
+                            .arg(info.lastModified().toMSecsSinceEpoch())
+                            .arg(size);
+    const QString hash = QString::fromLatin1(
+        QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex());
+
+    // Spread over 256 subdirectories, huge flat directories are slow to open
+    return directory + "/" + hash.left(2) + "/" + hash + suffix;
+}
+
+QImage ThumbnailCache::load(const QString &fileName) const
+{
+    PROFILE_SCOPE("ThumbnailCache::load");
+    QFile file(pathFor(fileName, ".png"));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QImage();
+    }
+    // Read entries outlive ones never shown again
+    touch(file);
+    QImageReader reader(&file, "png");
+    return reader.read();
+}
+
+bool ThumbnailCache::isKnownFailure(const QString &fileName) const
+{
+    QFile marker(pathFor(fileName, ".failed"));
+    if (!marker.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    touch(marker);
+    return true;
+}
+
+bool ThumbnailCache::storeFailure(const QString &fileName) const
+{
+    const QString path = pathFor(fileName, ".failed");
+    QDir().mkpath(QFileInfo(path).path());
+
+    QFile marker(path);
+    if (!marker.open(QIODevice::WriteOnly)) {
+        qDebug() << "Cannot write thumbnail marker:" << path << marker.errorString();
+        return false;
+    }
+    marker.close();
+    wrote(0);
+    return true;
+}
+
+bool ThumbnailCache::store(const QString &fileName, const QImage &thumbnail) const
+{
+    if (thumbnail.isNull()) {
+        return false;
+    }
+
+    const QString path = pathFor(fileName, ".png");
+    QDir().mkpath(QFileInfo(path).path());
+
+    // Written aside and renamed, a reader never sees half a file
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qDebug() << "Cannot write thumbnail:" << path << file.errorString();
+        return false;
+    }
+    QImageWriter writer(&file, "png");
+    writer.setCompression(1);  // fast, thumbnails are small anyway
+    if (!writer.write(thumbnail)) {
+        file.cancelWriting();
+        return false;
+    }
+    const qint64 bytes = file.size();
+    if (!file.commit()) {
+        return false;
+    }
+    wrote(bytes);
+    return true;
+}
+
+void ThumbnailCache::wrote(qint64 bytes) const
+{
+    // A trim walks the whole directory, so it runs once per eighth of the
+    // budget written
+    const qint64 cost = diskBytes(bytes);
+    if (writtenSinceTrim.fetch_add(cost) + cost >= budgetBytes / 8) {
+        writtenSinceTrim = 0;
+        trim();
+    }
+}
+
+void ThumbnailCache::trim() const
+{
+    // One walk at a time, a concurrent caller would delete the same entries
+    if (trimming.exchange(true)) {
+        return;
+    }
+    PROFILE_SCOPE("ThumbnailCache::trim");
+
+    struct Entry {
+        qint64 used;
+        qint64 bytes;
+        QString path;
+    };
+    std::vector<Entry> entries;
+    qint64 total = 0;
+    QDirIterator it(directory, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        it.next();
+        const QFileInfo info = it.fileInfo();
+        const qint64 bytes = diskBytes(info.size());
+        entries.push_back({info.lastModified().toMSecsSinceEpoch(), bytes, info.filePath()});
+        total += bytes;
+    }
+
+    if (total > budgetBytes) {
+        // Down to 90%, so the next few stores do not trim again
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+            return a.used < b.used;
+        });
+        const qint64 target = budgetBytes / 10 * 9;
+        int removed = 0;
+        for (const Entry &entry : entries) {
+            if (total <= target) {
+                break;
+            }
+            if (QFile::remove(entry.path)) {
+                total -= entry.bytes;
+                ++removed;
+            }
+        }
+        qDebug() << "Thumbnail cache trimmed" << removed << "entries," << total / 1024 << "KB left";
+    }
+    trimming = false;
+}
+
+QImage ThumbnailCache::loadOrGenerate(const QString &fileName, bool *fromCache) const
+{
+    QImage thumbnail = load(fileName);
+    const bool cached = !thumbnail.isNull() || isKnownFailure(fileName);
+    if (fromCache) {
+        *fromCache = cached;
+    }
+    if (cached) {
+        return thumbnail;
+    }
+
+    DicomLoader loader;
+    thumbnail = loader.loadThumbnail(fileName, size);
+    if (!thumbnail.isNull()) {
+        store(fileName, thumbnail);
+    } else if (QFileInfo::exists(fileName)) {
+        // Not for a file deleted meanwhile, it has nothing to be keyed on
+        storeFailure(fileName);
+    }
+    return thumbnail;
+}
@@ -0,0 +1,59 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QImage>
+#include <QString>
+#include <atomic>
+
+// Thumbnails kept on disk between runs, one small PNG per image. Files are
+// named after a hash of the image path, file size, modification time and
+// thumbnail size, so an edited image gets a new thumbnail and stale ones are
+// simply never read again. Images that fail to decode leave an empty marker
+// under the same name, so they are not decoded again until they change.
+//
+// The directory is capped at a byte budget. Reading an entry refreshes its
+// modification time, at most hourly and only where the cache is writable,
+// and trim() deletes the least recently used entries, so stale ones go
+// first. A read-only cache still serves hits. Safe to use from any number of
+// threads.
+class ThumbnailCache
+{
+public:
+    explicit ThumbnailCache(const QString &directory = defaultDirectory(), int size = 128,
+                            qint64 budgetBytes = 256LL * 1024 * 1024);
+
+    // Per user cache location, survives restarts
+    static QString defaultDirectory();
+
+    int thumbnailSize() const;
+    qint64 budget() const;
+
+    // Cached thumbnail of fileName, null when there is none yet
+    QImage load(const QString &fileName) const;
+    bool store(const QString &fileName, const QImage &thumbnail) const;
+
+    // True when fileName, unchanged since, failed to decode before
+    bool isKnownFailure(const QString &fileName) const;
+    bool storeFailure(const QString &fileName) const;
+
+    // Cached thumbnail, otherwise decodes a reduced one and stores it. Null
+    // for files that do not decode, fromCache is set when that was known.
+    QImage loadOrGenerate(const QString &fileName, bool *fromCache = nullptr) const;
+
+    // Deletes least recently used entries until the directory fits the
+    // budget. Walks the whole directory, so call it from a worker thread;
+    // store() runs it by itself once enough has been written.
+    void trim() const;
+
+private:
+    QString pathFor(const QString &fileName, const char *suffix) const;
+    void wrote(qint64 bytes) const;
+
+    QString directory;
+    int size;
+    qint64 budgetBytes;
+    mutable std::atomic<qint64> writtenSinceTrim;
+    mutable std::atomic_bool trimming;
+};
+
+#endif // THUMBNAILCACHE_H
@@ -0,0 +1,145 @@
+#include "thumbnailstrip.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QPixmap>
+#include <QThread>
+
+ThumbnailStrip::ThumbnailStrip(QWidget *parent)
+    : QListWidget(parent)
+    , currentRequest(0)
+    , pending(0)
+    , fromCacheCount(0)
+{
+    // One row, scrolled sideways
+    const int size = cache.thumbnailSize();
+    setViewMode(QListView::IconMode);
+    setFlow(QListView::LeftToRight);
+    setWrapping(false);
+    setMovement(QListView::Static);
+    setUniformItemSizes(true);
+    setIconSize(QSize(size, size));
+    setGridSize(QSize(size + 16, size + 24));
+    setTextElideMode(Qt::ElideMiddle);
+    setHorizontalScrollMode(QAbstractItemView::ScrollPerPixel);
+    setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+    setFixedHeight(size + 48);
+
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount()));
+
+    // Entries from earlier runs count against the budget too
+    pool.start([this]() {
+        cache.trim();
+    });
+
+    connect(this, &QListWidget::itemClicked, this, &ThumbnailStrip::onItemClicked);
+}
+
+ThumbnailStrip::~ThumbnailStrip()
+{
+    // Workers post back to this widget
+    cancel();
+    pool.waitForDone();
+}
+
+void ThumbnailStrip::cancel()
+{
+    if (currentCancel) {
+        currentCancel->store(true);
+    }
+    pool.clear();
+    ++currentRequest;
+}
+
+QString ThumbnailStrip::directory() const
+{
+    return currentDirectory;
+}
+
+void ThumbnailStrip::setDirectory(const QString &directory)
+{
+    cancel();
+    clear();
+    items.clear();
+    currentDirectory = directory;
+
+    const quint64 requestId = currentRequest;
+    auto cancelFlag = std::make_shared<std::atomic_bool>(false);
+    currentCancel = cancelFlag;
+
+    // Every file gets a slot right away, ones that are not images drop out
+    // when their thumbnail fails
+    const QFileInfoList entries = QDir(directory).entryInfoList(QDir::Files | QDir::Readable, QDir::Name);
+    pending = entries.size();
+    fromCacheCount = 0;
+    loadTimer.start();
+
+    for (const QFileInfo &entry : entries) {
+        const QString fileName = entry.absoluteFilePath();
+        QListWidgetItem *item = new QListWidgetItem(entry.fileName(), this);
+        item->setToolTip(fileName);
+        item->setData(Qt::UserRole, fileName);
+        items.insert(fileName, item);
+
+        // Started in folder order, so the strip fills in from the left
+        pool.start([this, requestId, fileName, cancelFlag]() {
+            if (cancelFlag->load()) {
+                return;
+            }
+            bool fromCache = false;
+            const QImage thumbnail = cache.loadOrGenerate(fileName, &fromCache);
+            QMetaObject::invokeMethod(this, [this, requestId, fileName, thumbnail, fromCache]() {
+                onThumbnailReady(requestId, fileName, thumbnail, fromCache);
+            }, Qt::QueuedConnection);
+        });
+    }
+}
+
+void ThumbnailStrip::onThumbnailReady(quint64 requestId, const QString &fileName, const QImage &thumbnail,
+                                      bool fromCache)
+{
+    if (requestId != currentRequest) {
+        return;
+    }
+
+    QListWidgetItem *item = items.value(fileName);
+    if (item) {
+        if (thumbnail.isNull()) {
+            items.remove(fileName);
+            delete takeItem(row(item));
+        } else {
+            item->setIcon(QIcon(QPixmap::fromImage(thumbnail)));
+        }
+    }
+
+    fromCacheCount += fromCache ? 1 : 0;
+    if (--pending == 0) {
+        qDebug() << "Thumbnails for" << count() << "images," << fromCacheCount << "from cache, in"
+                 << loadTimer.elapsed() << "ms";
+    }
+}
+
+void ThumbnailStrip::setCurrentFile(const QString &fileName)
+{
+    QListWidgetItem *item = items.value(fileName);
+    if (item && item != currentItem()) {
+        // Only clicks activate images, selection changes are silent
+        setCurrentItem(item);
+        scrollToItem(item, QAbstractItemView::PositionAtCenter);
+    }
+}
+
+QStringList ThumbnailStrip::shownFiles() const
+{
+    QStringList files;
+    files.reserve(count());
+    for (int i = 0; i < count(); ++i) {
+        files.append(item(i)->data(Qt::UserRole).toString());
+    }
+    return files;
+}
+
+void ThumbnailStrip::onItemClicked(QListWidgetItem *clicked)
+{
+    emit imageActivated(clicked->data(Qt::UserRole).toString(), shownFiles(), row(clicked));
+}
@@ -0,0 +1,53 @@
+#ifndef THUMBNAILSTRIP_H
+#define THUMBNAILSTRIP_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QImage>
+#include <QListWidget>
+#include <QStringList>
+#include <QThreadPool>
+#include <atomic>
+#include <memory>
+
+#include "thumbnailcache.h"
+
+// Filmstrip of the images in a folder. Thumbnails come from the on-disk
+// ThumbnailCache, missing ones are decoded at reduced size on a worker pool,
+// in parallel and in folder order. Clicking a thumbnail asks for the image.
+class ThumbnailStrip : public QListWidget
+{
+    Q_OBJECT
+
+public:
+    explicit ThumbnailStrip(QWidget *parent = nullptr);
+    ~ThumbnailStrip();
+
+    void setDirectory(const QString &directory);
+    QString directory() const;
+
+    // Highlights fileName without emitting imageActivated
+    void setCurrentFile(const QString &fileName);
+
+signals:
+    void imageActivated(const QString &fileName, const QStringList &files, int index);
+
+private:
+    void cancel();
+    void onThumbnailReady(quint64 requestId, const QString &fileName, const QImage &thumbnail,
+                          bool fromCache);
+    void onItemClicked(QListWidgetItem *item);
+    QStringList shownFiles() const;
+
+    ThumbnailCache cache;
+    QThreadPool pool;
+    QString currentDirectory;
+    quint64 currentRequest;
+    std::shared_ptr<std::atomic_bool> currentCancel;
+    QHash<QString, QListWidgetItem *> items;
+    int pending;
+    int fromCacheCount;
+    QElapsedTimer loadTimer;
+};
+
+#endif // THUMBNAILSTRIP_H
@@ -0,0 +1,59 @@
+#include "uistallmonitor.h"
+#include <QDebug>
+
+namespace {
+const int heartbeatIntervalMs = 5;
+}
+
+UiStallMonitor::UiStallMonitor(QObject *parent)
+    : QObject(parent)
+    , lastTick(0)
+    , thresholdMs(16)
+{
+    timer.setTimerType(Qt::PreciseTimer);
+    timer.setInterval(heartbeatIntervalMs);
+    connect(&timer, &QTimer::timeout, this, &UiStallMonitor::heartbeat);
+}
+
+void UiStallMonitor::start()
+{
+    stats = Stats();
+    clock.start();
+    lastTick = 0;
+    timer.start();
+}
+
+UiStallMonitor::Stats UiStallMonitor::stop()
+{
+    if (timer.isActive()) {
+        // Count the time since the last tick as well
+        heartbeat();
+        timer.stop();
+        stats.monitoredMs = clock.elapsed();
+    }
+    return stats;
+}
+
+bool UiStallMonitor::isRunning() const
+{
+    return timer.isActive();
+}
+
+void UiStallMonitor::setThresholdMs(int ms)
+{
+    thresholdMs = ms;
+}
+
+void UiStallMonitor::heartbeat()
+{
+    const qint64 now = clock.elapsed();
+    const qint64 late = now - lastTick - heartbeatIntervalMs;
+    lastTick = now;
+
+    if (late > thresholdMs) {
+        stats.totalStallMs += late;
+        stats.maxStallMs = qMax(stats.maxStallMs, late);
+        ++stats.stallCount;
+        qDebug() << "UI thread stalled for" << late << "ms";
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef UISTALLMONITOR_H
+#define UISTALLMONITOR_H
+
+#include <QObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+// Measures how long the GUI event loop is blocked. A short heartbeat timer is
+// run while monitoring and any tick that arrives late counts as a stall.
+class UiStallMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Stats {
+        qint64 monitoredMs = 0;
+        qint64 totalStallMs = 0;
+        qint64 maxStallMs = 0;
+        int stallCount = 0;
+    };
+
+    explicit UiStallMonitor(QObject *parent = nullptr);
+
+    void start();
+    Stats stop();
+    bool isRunning() const;
+
+    // Ticks later than this are reported as stalls
+    void setThresholdMs(int ms);
+
+private:
+    void heartbeat();
+
+    QTimer timer;
+    QElapsedTimer clock;
+    qint64 lastTick;
+    int thresholdMs;
+    Stats stats;
+};
+
+#endif // UISTALLMONITOR_H
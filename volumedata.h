@@ -0,0 +1,129 @@
+#ifndef VOLUMEDATA_H
+#define VOLUMEDATA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "pixelbuffer.h"
+
+// Minimal allocator handing out cache line aligned blocks, so every slice of
+// a volume starts on a boundary the SIMD kernels can rely on
+template <typename T, std::size_t Alignment>
+struct AlignedAllocator
+{
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T *p, std::size_t)
+    {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    // Default initialises instead of value initialising, so sizing a vector
+    // of samples leaves them uninitialised rather than zeroing memory that
+    // the decoders overwrite anyway
+    template <typename U>
+    void construct(U *p)
+    {
+        ::new (static_cast<void *>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args)
+    {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+using AlignedSamples = std::vector<uint16_t, AlignedAllocator<uint16_t, 64>>;
+
+// Stack of equally sized grayscale slices stored slice-major in one
+// contiguous buffer: index = (z * height + y) * width + x. Single frame
+// images are a volume with a depth of one.
+struct VolumeData
+{
+    int width = 0;
+    int height = 0;
+    int depth = 0;
+
+    // Millimetres between pixel centres, spacingZ is the slice distance
+    double spacingX = 1.0;
+    double spacingY = 1.0;
+    double spacingZ = 1.0;
+
+    int bitsStored = 0;
+    bool isSigned = false;
+    int minValue = 0;
+    int maxValue = 0;
+
+    // Either an owned AlignedSamples buffer or pixel data mapped straight
+    // from the file, the deleter releases whichever it is
+    std::shared_ptr<uint16_t> samples;
+
+    bool isNull() const
+    {
+        return !samples || width <= 0 || height <= 0 || depth <= 0;
+    }
+
+    size_t sliceSize() const
+    {
+        return size_t(width) * size_t(height);
+    }
+
+    // Allocates uninitialised storage for width x height x depth samples,
+    // every slice has to be written before it is read
+    void allocate()
+    {
+        auto buffer = std::make_shared<AlignedSamples>(sliceSize() * size_t(depth));
+        samples = std::shared_ptr<uint16_t>(buffer, buffer->data());
+    }
+
+    uint16_t *sliceData(int z)
+    {
+        return samples.get() + sliceSize() * size_t(z);
+    }
+
+    const uint16_t *sliceData(int z) const
+    {
+        return samples.get() + sliceSize() * size_t(z);
+    }
+
+    // A slice as a PixelBuffer sharing this volume's storage. The value
+    // range is the volume's, so one window/level fits every slice.
+    PixelBuffer slice(int z) const
+    {
+        PixelBuffer pixels;
+        pixels.width = width;
+        pixels.height = height;
+        pixels.bitsStored = bitsStored;
+        pixels.isSigned = isSigned;
+        pixels.minValue = minValue;
+        pixels.maxValue = maxValue;
+        pixels.data = std::shared_ptr<const uint16_t>(samples, sliceData(z));
+        return pixels;
+    }
+};
+
+#endif // VOLUMEDATA_H
@@ -0,0 +1,298 @@
+#include "volumeloader.h"
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <algorithm>
+#include <cmath>
+#include <new>
+#include <set>
+
+#include "gdcmImageReader.h"
+#include "gdcmReader.h"
+
+#include "parallelfor.h"
+#include "profiler.h"
+
+namespace {
+
+// Parses a backslash separated DS value such as Image Position (Patient)
+QVector<double> parseDecimals(const QString &value)
+{
+    QVector<double> numbers;
+    for (const QString &part : value.split('\\')) {
+        bool ok = false;
+        const double number = part.trimmed().toDouble(&ok);
+        if (!ok) {
+            return QVector<double>();
+        }
+        numbers.append(number);
+    }
+    return numbers;
+}
+
+}
+
+VolumeLoader::VolumeLoader()
+    : canceled(false)
+{
+}
+
+void VolumeLoader::setProgressCallback(const DicomLoader::ProgressCallback &callback)
+{
+    progressCallback = callback;
+}
+
+bool VolumeLoader::wasCanceled() const
+{
+    return canceled;
+}
+
+bool VolumeLoader::reportProgress(int percent, const QString &stage)
+{
+    // Slices finish on several workers at once
+    QMutexLocker locker(&progressMutex);
+
+    if (!canceled && progressCallback && !progressCallback(percent, stage)) {
+        qDebug() << "Volume load canceled during:" << stage;
+        canceled = true;
+    }
+    return !canceled;
+}
+
+bool VolumeLoader::readSliceInfo(const QString &fileName, SliceInfo &info)
+{
+    // Only header attributes are needed here, with Pixel Data in the skip set
+    // the parser stops in front of its value
+    const gdcm::Tag pixelDataTag(0x7fe0, 0x0010);
+    gdcm::Reader reader;
+    reader.SetFileName(fileName.toStdString().c_str());
+    if (!reader.ReadUpToTag(pixelDataTag, std::set<gdcm::Tag>{pixelDataTag})) {
+        return false;
+    }
+
+    const gdcm::DataSet &dataset = reader.GetFile().GetDataSet();
+    info.fileName = fileName;
+    info.seriesUid = dicomLoader.extractTag(dataset, gdcm::Tag(0x0020, 0x000e));
+    info.instanceNumber = dicomLoader.extractTag(dataset, gdcm::Tag(0x0020, 0x0013)).toInt();
+
+    info.rows = DicomLoader::extractUShort(dataset, gdcm::Tag(0x0028, 0x0010));
+    info.columns = DicomLoader::extractUShort(dataset, gdcm::Tag(0x0028, 0x0011));
+
+    const QVector<double> position = parseDecimals(dicomLoader.extractTag(dataset, gdcm::Tag(0x0020, 0x0032)));
+    const QVector<double> orientation = parseDecimals(dicomLoader.extractTag(dataset, gdcm::Tag(0x0020, 0x0037)));
+
+    if (position.size() == 3) {
+        // Slice normal is the cross product of the row and column directions
+        double normal[3] = {0.0, 0.0, 1.0};
+        if (orientation.size() == 6) {
+            normal[0] = orientation[1] * orientation[5] - orientation[2] * orientation[4];
+            normal[1] = orientation[2] * orientation[3] - orientation[0] * orientation[5];
+            normal[2] = orientation[0] * orientation[4] - orientation[1] * orientation[3];
+        }
+        info.position = position[0] * normal[0] + position[1] * normal[1] + position[2] * normal[2];
+        info.hasPosition = true;
+    }
+
+    return info.rows > 0 && info.columns > 0;
+}
+
+QList<VolumeLoader::SliceInfo> VolumeLoader::selectSeries(const QList<SliceInfo> &slices)
+{
+    // Largest group of equally sized slices within one series wins
+    QHash<QString, QList<SliceInfo>> groups;
+    for (const SliceInfo &slice : slices) {
+        groups[QString("%1/%2x%3").arg(slice.seriesUid).arg(slice.columns).arg(slice.rows)].append(slice);
+    }
+
+    QList<SliceInfo> best;
+    for (auto it = groups.cbegin(); it != groups.cend(); ++it) {
+        if (it.value().size() > best.size()) {
+            best = it.value();
+        }
+    }
+    return best;
+}
+
+void VolumeLoader::sortSlices(QList<SliceInfo> &slices)
+{
+    const bool allPositioned = std::all_of(slices.cbegin(), slices.cend(),
+                                           [](const SliceInfo &slice) { return slice.hasPosition; });
+
+    std::stable_sort(slices.begin(), slices.end(), [allPositioned](const SliceInfo &a, const SliceInfo &b) {
+        if (allPositioned && a.position != b.position) {
+            return a.position < b.position;
+        }
+        if (a.instanceNumber != b.instanceNumber) {
+            return a.instanceNumber < b.instanceNumber;
+        }
+        return a.fileName < b.fileName;
+    });
+}
+
+double VolumeLoader::sliceSpacing(const QList<SliceInfo> &slices)
+{
+    // Median distance between neighbours, robust against a missing slice
+    QVector<double> gaps;
+    for (int i = 1; i < slices.size(); ++i) {
+        if (slices[i].hasPosition && slices[i - 1].hasPosition) {
+            const double gap = std::fabs(slices[i].position - slices[i - 1].position);
+            if (gap > 1e-6) {
+                gaps.append(gap);
+            }
+        }
+    }
+    if (gaps.isEmpty()) {
+        return 1.0;
+    }
+    std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+    return gaps[gaps.size() / 2];
+}
+
+DicomLoader::LoadResult VolumeLoader::loadSeries(const QString &directory)
+{
+    PROFILE_SCOPE("VolumeLoader::loadSeries");
+    DicomLoader::LoadResult result;
+    result.metadata = DicomLoader::emptyMetadata();
+    result.isDicom = true;
+    canceled = false;
+
+    QStringList files;
+    const QFileInfoList entries = QDir(directory).entryInfoList(QDir::Files | QDir::Readable, QDir::Name);
+    for (const QFileInfo &entry : entries) {
+        if (dicomLoader.isDicomFile(entry.absoluteFilePath())) {
+            files.append(entry.absoluteFilePath());
+        }
+    }
+
+    qDebug() << "Scanning" << files.size() << "DICOM files in" << directory;
+    if (files.isEmpty() || !reportProgress(0, "Scanning")) {
+        return result;
+    }
+
+    // Header pass, in parallel as it is dominated by file open latency
+    std::vector<SliceInfo> infos(files.size());
+    std::vector<char> valid(files.size(), 0);
+    parallelFor(0, files.size(), [&](int first, int last) {
+        for (int i = first; i < last && !canceled; ++i) {
+            valid[i] = readSliceInfo(files.at(i), infos[i]) ? 1 : 0;
+        }
+    });
+
+    QList<SliceInfo> slices;
+    for (size_t i = 0; i < infos.size(); ++i) {
+        if (valid[i]) {
+            slices.append(infos[i]);
+        }
+    }
+    slices = selectSeries(slices);
+    sortSlices(slices);
+
+    if (slices.isEmpty() || !reportProgress(10, "Decoding")) {
+        return result;
+    }
+
+    auto volume = std::make_shared<VolumeData>();
+    volume->width = slices.first().columns;
+    volume->height = slices.first().rows;
+    volume->depth = slices.size();
+    volume->spacingZ = sliceSpacing(slices);
+    try {
+        volume->allocate();
+    } catch (const std::bad_alloc &) {
+        qDebug() << "Not enough memory for" << volume->depth << "slices of"
+                 << volume->width << "x" << volume->height;
+        return result;
+    }
+
+    qDebug() << "Decoding" << volume->depth << "slices of" << volume->width << "x" << volume->height;
+
+    // Decode pass, every slice lands directly in its slot of the volume
+    struct SliceFormat {
+        int bitsStored = 0;
+        bool isSigned = false;
+    };
+    std::vector<SliceFormat> formats(slices.size());
+    std::vector<char> sliceOk(slices.size(), 0);
+    std::atomic<int> decoded(0);
+    int metadataSlice = int(slices.size());
+    QMutex metadataMutex;
+
+    parallelFor(0, slices.size(), [&](int first, int last) {
+        for (int z = first; z < last && !canceled; ++z) {
+            uint16_t *slot = volume->sliceData(z);
+
+            gdcm::ImageReader reader;
+            reader.SetFileName(slices.at(z).fileName.toStdString().c_str());
+
+            bool ok = reader.Read();
+            if (ok) {
+                const gdcm::Image &image = reader.GetImage();
+                const unsigned int *dims = image.GetDimensions();
+                ok = int(dims[0]) == volume->width && int(dims[1]) == volume->height &&
+                     image.GetPixelFormat().GetSamplesPerPixel() == 1 &&
+                     DicomLoader::readPixelData(image, slot, volume->sliceSize());
+
+                if (ok) {
+                    formats[z].bitsStored = image.GetPixelFormat().GetBitsStored();
+                    formats[z].isSigned = image.GetPixelFormat().GetPixelRepresentation() == 1;
+                    sliceOk[z] = 1;
+
+                    // Spacing and display attributes come from the first slice
+                    // that decodes, slices finish in any order
+                    QMutexLocker locker(&metadataMutex);
+                    if (z < metadataSlice) {
+                        metadataSlice = z;
+                        dicomLoader.fillMetadata(reader.GetFile().GetDataSet(), image, result.metadata);
+                        volume->spacingX = image.GetSpacing()[0];
+                        volume->spacingY = image.GetSpacing()[1];
+                    }
+                }
+            }
+
+            const int done = ++decoded;
+            reportProgress(10 + int(85.0 * done / slices.size()), "Decoding");
+        }
+    });
+
+    if (canceled || metadataSlice == slices.size()) {
+        return result;
+    }
+
+    // The pixel format is that of the first slice that decoded. Slices are
+    // already sign extended to their own Bits Stored, so a different Bits
+    // Stored only widens the range; other signedness would be misread.
+    const SliceFormat &reference = formats[metadataSlice];
+    volume->bitsStored = reference.bitsStored;
+    volume->isSigned = reference.isSigned;
+    int failed = 0;
+    for (int z = 0; z < volume->depth; ++z) {
+        if (sliceOk[z] && formats[z].isSigned != reference.isSigned) {
+            qDebug() << "Slice" << z << "has a different Pixel Representation, dropped:" << slices.at(z).fileName;
+            sliceOk[z] = 0;
+        }
+        if (!sliceOk[z]) {
+            // A broken slice shows up black instead of failing the series
+            uint16_t *slot = volume->sliceData(z);
+            std::fill(slot, slot + volume->sliceSize(), uint16_t(0));
+            ++failed;
+            continue;
+        }
+        volume->bitsStored = std::max(volume->bitsStored, formats[z].bitsStored);
+    }
+    result.metadata.bitsStored = volume->bitsStored;
+
+    if (failed > 0) {
+        qDebug() << "WARNING:" << failed << "slices could not be decoded";
+    }
+
+    DicomLoader::computeRange(*volume);
+    result.metadata.numberOfFrames = volume->depth;
+    result.volume = volume;
+    result.pixels = volume->slice(0);
+    result.image = dicomLoader.convertToQImage(result.pixels, result.metadata);
+
+    reportProgress(100, "Done");
+    return result;
+}
@@ -0,0 +1,53 @@
+#ifndef VOLUMELOADER_H
+#define VOLUMELOADER_H
+
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <atomic>
+
+#include "dicomloader.h"
+#include "volumedata.h"
+
+// Assembles a directory of single frame DICOM files into one VolumeData.
+// Headers are scanned first to pick the series and sort its slices by
+// Image Position (Patient), falling back to Instance Number, then all slices
+// are decoded in parallel straight into their place in the volume.
+class VolumeLoader
+{
+public:
+    VolumeLoader();
+
+    // Same contract as DicomLoader::setProgressCallback, may be called from
+    // worker threads
+    void setProgressCallback(const DicomLoader::ProgressCallback &callback);
+    bool wasCanceled() const;
+
+    // Loads the largest series found in directory. The result holds the
+    // volume plus slice 0 as pixels/image, like a multi-frame file.
+    DicomLoader::LoadResult loadSeries(const QString &directory);
+
+private:
+    struct SliceInfo {
+        QString fileName;
+        QString seriesUid;
+        int rows = 0;
+        int columns = 0;
+        int instanceNumber = 0;
+        bool hasPosition = false;
+        double position = 0.0;  // distance along the slice normal
+    };
+
+    bool readSliceInfo(const QString &fileName, SliceInfo &info);
+    QList<SliceInfo> selectSeries(const QList<SliceInfo> &slices);
+    static void sortSlices(QList<SliceInfo> &slices);
+    static double sliceSpacing(const QList<SliceInfo> &slices);
+    bool reportProgress(int percent, const QString &stage);
+
+    DicomLoader dicomLoader;
+    DicomLoader::ProgressCallback progressCallback;
+    std::atomic<bool> canceled;
+    QMutex progressMutex;
+};
+
+#endif // VOLUMELOADER_H
@@ -0,0 +1,397 @@
+#include "volumerenderer.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QVector3D>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include "parallelfor.h"
+#include "pixelconverter.h"
+#include "profiler.h"
+
+namespace {
+
+const int tileSize = 32;
+const int runLength = 64;  // samples per trilinear kernel call at most
+const float opaqueAlpha = 0.98f;
+
+}
+
+// Transfer function baked for one frame, indexed by stored value - minValue
+struct VolumeRenderer::Lut
+{
+    std::vector<float> rgba;  // colour 0-1 and opacity per sample step
+    std::vector<int> visibleBefore;  // entries with opacity in [0, i)
+    std::vector<uint8_t> gray;  // MIP window
+    int size = 0;
+
+    bool anyVisible(int first, int last) const
+    {
+        return visibleBefore[size_t(last) + 1] != visibleBefore[size_t(first)];
+    }
+};
+
+// Ray geometry in voxel coordinates for one frame
+struct VolumeRenderer::Frame
+{
+    QVector3D origin;  // first sample of the ray through pixel (0, 0)
+    QVector3D pixelRight;
+    QVector3D pixelDown;
+    QVector3D step;
+    QVector3D upper;  // largest voxel coordinate on each axis
+    QVector3D light;  // towards the viewer, in millimetres
+    int maxSamples = 0;
+};
+
+VolumeRenderer::VolumeRenderer()
+    : slope(1.0)
+    , intercept(0.0)
+    , cellsX(0)
+    , cellsY(0)
+    , cellsZ(0)
+{
+}
+
+QQuaternion VolumeRenderer::frontView()
+{
+    // Screen right along x, screen down along -z, looking along +y
+    return QQuaternion::fromAxes(QVector3D(1, 0, 0), QVector3D(0, 0, -1), QVector3D(0, 1, 0));
+}
+
+bool VolumeRenderer::isNull() const
+{
+    return !volume || volume->isNull();
+}
+
+void VolumeRenderer::setVolume(const std::shared_ptr<const VolumeData> &newVolume, double rescaleSlope,
+                               double rescaleIntercept)
+{
+    PROFILE_SCOPE("VolumeRenderer::setVolume");
+    volume = newVolume;
+    slope = rescaleSlope;
+    intercept = rescaleIntercept;
+    cellMin.clear();
+    cellMax.clear();
+    cellsX = cellsY = cellsZ = 0;
+    if (isNull()) {
+        return;
+    }
+
+    // A cell covers voxels 8c to 8c + 8 inclusive, the upper neighbours of
+    // every sample that falls into it
+    const VolumeData &source = *volume;
+    const int cellEdge = 1 << cellShift;
+    cellsX = std::max(1, (source.width - 2) / cellEdge + 1);
+    cellsY = std::max(1, (source.height - 2) / cellEdge + 1);
+    cellsZ = std::max(1, (source.depth - 2) / cellEdge + 1);
+    const size_t cellCount = size_t(cellsX) * size_t(cellsY) * size_t(cellsZ);
+    cellMin.assign(cellCount, 0);
+    cellMax.assign(cellCount, 0);
+
+    QElapsedTimer timer;
+    timer.start();
+    parallelFor(0, cellsZ, [&](int firstZ, int lastZ) {
+        std::vector<int> rowMin(static_cast<size_t>(cellsX));
+        std::vector<int> rowMax(static_cast<size_t>(cellsX));
+        for (int cz = firstZ; cz < lastZ; ++cz) {
+            for (int cy = 0; cy < cellsY; ++cy) {
+                std::fill(rowMin.begin(), rowMin.end(), std::numeric_limits<int>::max());
+                std::fill(rowMax.begin(), rowMax.end(), std::numeric_limits<int>::min());
+                const int z1 = std::min(source.depth - 1, (cz + 1) * cellEdge);
+                const int y1 = std::min(source.height - 1, (cy + 1) * cellEdge);
+                for (int z = cz * cellEdge; z <= z1; ++z) {
+                    for (int y = cy * cellEdge; y <= y1; ++y) {
+                        const uint16_t *row = source.sliceData(z) + size_t(y) * size_t(source.width);
+                        for (int cx = 0; cx < cellsX; ++cx) {
+                            const int x0 = cx * cellEdge;
+                            const int x1 = std::min(source.width - 1, x0 + cellEdge);
+                            PixelConverter::rowMinMax(row + x0, size_t(x1 - x0 + 1), source.isSigned,
+                                                      rowMin[size_t(cx)], rowMax[size_t(cx)]);
+                        }
+                    }
+                }
+                const size_t base = (size_t(cz) * size_t(cellsY) + size_t(cy)) * size_t(cellsX);
+                for (int cx = 0; cx < cellsX; ++cx) {
+                    cellMin[base + size_t(cx)] = uint16_t(qBound(0, rowMin[size_t(cx)] - source.minValue, 65535));
+                    cellMax[base + size_t(cx)] = uint16_t(qBound(0, rowMax[size_t(cx)] - source.minValue, 65535));
+                }
+            }
+        }
+    });
+    qDebug() << "Macro cell grid" << cellsX << "x" << cellsY << "x" << cellsZ << "built in" << timer.elapsed()
+             << "ms";
+}
+
+void VolumeRenderer::bakeLut(const Settings &settings, Lut &lut) const
+{
+    lut.size = std::max(1, volume->maxValue - volume->minValue + 1);
+    lut.rgba.assign(size_t(lut.size) * 4, 0.0f);
+    lut.visibleBefore.assign(size_t(lut.size) + 1, 0);
+    lut.gray.assign(size_t(lut.size), 0);
+
+    QVector<TransferPoint> points = settings.transfer;
+    std::sort(points.begin(), points.end(),
+              [](const TransferPoint &a, const TransferPoint &b) { return a.value < b.value; });
+
+    // Opacities are given per voxel, corrected for the actual sample step
+    const double windowLow = settings.windowCenter - settings.windowWidth / 2.0;
+    const double windowWidth = std::max(settings.windowWidth, 1e-6);
+    int point = 0;
+    for (int i = 0; i < lut.size; ++i) {
+        const double value = (i + volume->minValue) * slope + intercept;
+        lut.gray[size_t(i)] = uint8_t(qBound(0.0, (value - windowLow) / windowWidth, 1.0) * 255.0 + 0.5);
+
+        float *entry = &lut.rgba[size_t(i) * 4];
+        if (!points.isEmpty() && value >= points.first().value && value <= points.last().value) {
+            while (point + 1 < points.size() && points[point + 1].value < value) {
+                ++point;
+            }
+            const TransferPoint &a = points[point];
+            const TransferPoint &b = points[std::min(point + 1, int(points.size()) - 1)];
+            const double t = b.value > a.value ? (value - a.value) / (b.value - a.value) : 0.0;
+            const double alpha = a.color.alphaF() + t * (b.color.alphaF() - a.color.alphaF());
+            entry[0] = float(a.color.redF() + t * (b.color.redF() - a.color.redF()));
+            entry[1] = float(a.color.greenF() + t * (b.color.greenF() - a.color.greenF()));
+            entry[2] = float(a.color.blueF() + t * (b.color.blueF() - a.color.blueF()));
+            entry[3] = float(1.0 - std::pow(1.0 - qBound(0.0, alpha, 1.0), settings.sampleStep));
+        }
+        lut.visibleBefore[size_t(i) + 1] = lut.visibleBefore[size_t(i)] + (entry[3] > 0.0f ? 1 : 0);
+    }
+}
+
+QImage VolumeRenderer::render(const Settings &settings, const QSize &size, const std::atomic_bool *cancel,
+                              Stats *stats) const
+{
+    PROFILE_SCOPE("VolumeRenderer::render");
+    QElapsedTimer timer;
+    timer.start();
+    if (isNull() || size.isEmpty()) {
+        return QImage();
+    }
+
+    Lut lut;
+    bakeLut(settings, lut);
+
+    // Orthographic rays, the bounding sphere of the volume fills the shorter
+    // side of the image at zoom 1
+    const VolumeData &source = *volume;
+    const QVector3D extent(float((source.width - 1) * source.spacingX), float((source.height - 1) * source.spacingY),
+                           float((source.depth - 1) * source.spacingZ));
+    const float radius = std::max(1.0f, extent.length() / 2.0f);
+    const float pixel = float(2.0 * radius / (std::max(settings.zoom, 1e-3) * std::min(size.width(), size.height())));
+    const float spacing = float(std::min({source.spacingX, source.spacingY, source.spacingZ}));
+    const float sampleDistance = float(spacing * std::max(settings.sampleStep, 0.05));
+    const QVector3D right = settings.rotation.rotatedVector(QVector3D(1, 0, 0));
+    const QVector3D down = settings.rotation.rotatedVector(QVector3D(0, 1, 0));
+    const QVector3D ahead = settings.rotation.rotatedVector(QVector3D(0, 0, 1));
+    const QVector3D toVoxel(float(1.0 / source.spacingX), float(1.0 / source.spacingY),
+                            float(1.0 / source.spacingZ));
+
+    Frame frame;
+    const QVector3D corner = extent / 2.0f - right * (pixel * (size.width() - 1) / 2.0f)
+                             - down * (pixel * (size.height() - 1) / 2.0f) - ahead * radius;
+    frame.origin = corner * toVoxel;
+    frame.pixelRight = right * pixel * toVoxel;
+    frame.pixelDown = down * pixel * toVoxel;
+    frame.step = ahead * sampleDistance * toVoxel;
+    frame.upper = QVector3D(float(source.width - 1), float(source.height - 1), float(source.depth - 1));
+    frame.light = -ahead;
+    frame.maxSamples = int(std::ceil(2.0f * radius / sampleDistance)) + 1;
+
+    QImage image(size, QImage::Format_RGB32);
+    uint32_t *bits = reinterpret_cast<uint32_t *>(image.bits());
+    const int stride = image.bytesPerLine() / 4;
+    const int tilesX = (size.width() + tileSize - 1) / tileSize;
+    const int tilesY = (size.height() + tileSize - 1) / tileSize;
+
+    Stats total;
+    std::mutex statsMutex;
+    std::atomic_bool canceled(false);
+    parallelFor(0, tilesX * tilesY, [&](int firstTile, int lastTile) {
+        Stats local;
+        for (int tile = firstTile; tile < lastTile; ++tile) {
+            if (canceled.load() || (cancel && cancel->load())) {
+                canceled.store(true);
+                return;
+            }
+            const int x0 = (tile % tilesX) * tileSize;
+            const int y0 = (tile / tilesX) * tileSize;
+            const int x1 = std::min(size.width(), x0 + tileSize);
+            const int y1 = std::min(size.height(), y0 + tileSize);
+            for (int y = y0; y < y1; ++y) {
+                uint32_t *row = bits + size_t(y) * size_t(stride);
+                for (int x = x0; x < x1; ++x) {
+                    castRay(settings, lut, frame, x, y, row[x], local);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(statsMutex);
+        total.samples += local.samples;
+        total.skippedCells += local.skippedCells;
+        total.terminatedRays += local.terminatedRays;
+    });
+
+    if (canceled.load()) {
+        return QImage();
+    }
+    total.milliseconds = timer.nsecsElapsed() / 1e6;
+    Profiler::count("ray samples", total.samples);
+    if (stats) {
+        *stats = total;
+    }
+    return image;
+}
+
+void VolumeRenderer::castRay(const Settings &settings, const Lut &lut, const Frame &frame, int x, int y,
+                             uint32_t &pixel, Stats &stats) const
+{
+    const VolumeData &source = *volume;
+    const QVector3D start = frame.origin + frame.pixelRight * float(x) + frame.pixelDown * float(y);
+
+    // Samples k with start + k * step inside the volume box
+    float kFirst = 0.0f;
+    float kLast = float(frame.maxSamples - 1);
+    for (int axis = 0; axis < 3; ++axis) {
+        const float s = frame.step[axis];
+        const float p = start[axis];
+        if (std::abs(s) < 1e-12f) {
+            if (p < 0.0f || p > frame.upper[axis]) {
+                pixel = 0xFF000000u;
+                return;
+            }
+            continue;
+        }
+        float t0 = -p / s;
+        float t1 = (frame.upper[axis] - p) / s;
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        kFirst = std::max(kFirst, t0);
+        kLast = std::min(kLast, t1);
+    }
+    const int first = int(std::ceil(kFirst));
+    const int last = int(std::floor(kLast));
+    if (first > last) {
+        pixel = 0xFF000000u;
+        return;
+    }
+
+    const bool mip = settings.mode == ShadedMip;
+    const int cellEdge = 1 << cellShift;
+    const uint16_t outside = uint16_t(source.minValue);
+    uint16_t samples[runLength];
+    float color[3] = {0.0f, 0.0f, 0.0f};
+    float alpha = 0.0f;
+    int best = -1;
+    int bestK = first;
+
+    int k = first;
+    while (k <= last) {
+        const QVector3D point = start + frame.step * float(k);
+        const int cx = std::min(cellsX - 1, std::max(0, int(point.x()) >> cellShift));
+        const int cy = std::min(cellsY - 1, std::max(0, int(point.y()) >> cellShift));
+        const int cz = std::min(cellsZ - 1, std::max(0, int(point.z()) >> cellShift));
+        const int cell[3] = {cx, cy, cz};
+
+        // Steps until the ray leaves the cell
+        float exit = std::numeric_limits<float>::max();
+        for (int axis = 0; axis < 3; ++axis) {
+            const float s = frame.step[axis];
+            if (s > 1e-12f) {
+                exit = std::min(exit, (float((cell[axis] + 1) * cellEdge) - point[axis]) / s);
+            } else if (s < -1e-12f) {
+                exit = std::min(exit, (float(cell[axis] * cellEdge) - point[axis]) / s);
+            }
+        }
+        const int inCell = std::max(1, int(std::floor(std::min(exit, float(last - k)))) + 1);
+
+        const size_t cellIndex = (size_t(cz) * size_t(cellsY) + size_t(cy)) * size_t(cellsX) + size_t(cx);
+        const bool empty = mip ? int(cellMax[cellIndex]) <= best
+                               : !lut.anyVisible(cellMin[cellIndex], cellMax[cellIndex]);
+        if (empty) {
+            ++stats.skippedCells;
+            k += inCell;
+            continue;
+        }
+
+        const int count = std::min(inCell, runLength);
+        const float startVoxel[3] = {point.x(), point.y(), point.z()};
+        const float stepVoxel[3] = {frame.step.x(), frame.step.y(), frame.step.z()};
+        PixelConverter::sampleTrilinear(source.sliceData(0), source.width, source.height, source.depth,
+                                        source.isSigned, startVoxel, stepVoxel, size_t(count), outside, samples);
+        stats.samples += count;
+
+        for (int i = 0; i < count; ++i) {
+            const int value = source.isSigned ? int(int16_t(samples[i])) : int(samples[i]);
+            const int index = qBound(0, value - source.minValue, lut.size - 1);
+            if (mip) {
+                if (index > best) {
+                    best = index;
+                    bestK = k + i;
+                }
+                continue;
+            }
+
+            const float *entry = &lut.rgba[size_t(index) * 4];
+            if (entry[3] <= 0.0f) {
+                continue;
+            }
+
+            // Headlight diffuse and specular from the central difference
+            // gradient at the nearest voxel
+            const QVector3D p = start + frame.step * float(k + i);
+            const int vx = qBound(0, int(p.x() + 0.5f), source.width - 1);
+            const int vy = qBound(0, int(p.y() + 0.5f), source.height - 1);
+            const int vz = qBound(0, int(p.z() + 0.5f), source.depth - 1);
+            auto voxel = [&source](int x, int y, int z) {
+                const uint16_t raw = source.sliceData(z)[size_t(y) * size_t(source.width) + size_t(x)];
+                return source.isSigned ? float(int16_t(raw)) : float(raw);
+            };
+            const QVector3D gradient(
+                float((voxel(std::min(vx + 1, source.width - 1), vy, vz) - voxel(std::max(vx - 1, 0), vy, vz))
+                      / source.spacingX),
+                float((voxel(vx, std::min(vy + 1, source.height - 1), vz) - voxel(vx, std::max(vy - 1, 0), vz))
+                      / source.spacingY),
+                float((voxel(vx, vy, std::min(vz + 1, source.depth - 1)) - voxel(vx, vy, std::max(vz - 1, 0)))
+                      / source.spacingZ));
+            float diffuse = 1.0f;
+            float specular = 0.0f;
+            const float length = gradient.length();
+            if (length > 1e-6f) {
+                const float facing = std::abs(QVector3D::dotProduct(gradient, frame.light)) / length;
+                diffuse = 0.3f + 0.7f * facing;
+                specular = 0.25f * std::pow(facing, 24.0f);
+            }
+
+            const float weight = (1.0f - alpha) * entry[3];
+            for (int c = 0; c < 3; ++c) {
+                color[c] += weight * std::min(1.0f, entry[c] * diffuse + specular);
+            }
+            alpha += weight;
+            if (alpha >= opaqueAlpha) {
+                break;
+            }
+        }
+
+        if (!mip && alpha >= opaqueAlpha) {
+            ++stats.terminatedRays;
+            break;
+        }
+        if (mip && best == lut.size - 1) {
+            ++stats.terminatedRays;
+            break;
+        }
+        k += count;
+    }
+
+    if (mip) {
+        // Depth cue, the maximum darkens the further back it lies
+        const float depth = last > first ? float(bestK - first) / float(last - first) : 0.0f;
+        const int gray = best < 0 ? 0 : int(lut.gray[size_t(best)] * (1.0f - 0.5f * depth) + 0.5f);
+        pixel = qRgb(gray, gray, gray);
+    } else {
+        pixel = qRgb(int(color[0] * 255.0f + 0.5f), int(color[1] * 255.0f + 0.5f), int(color[2] * 255.0f + 0.5f));
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef VOLUMERENDERER_H
+#define VOLUMERENDERER_H
+
+#include <QColor>
+#include <QImage>
+#include <QQuaternion>
+#include <QSize>
+#include <QVector>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "volumedata.h"
+
+// CPU ray caster for direct volume rendering and depth shaded MIP. Rays are
+// cast orthographically in tiles split across cores, each ray sampled with
+// the trilinear row kernel in runs. A grid of min/max macro cells of 8^3
+// voxels lets rays jump over cells the transfer function makes transparent
+// (or, for MIP, that cannot raise the maximum), and compositing stops once a
+// ray is nearly opaque.
+class VolumeRenderer
+{
+public:
+    enum Mode {
+        Composite,
+        ShadedMip
+    };
+
+    // Colour and opacity (alpha, per voxel of depth) at a modality value,
+    // interpolated linearly between points sorted by value
+    struct TransferPoint {
+        double value;
+        QColor color;
+    };
+
+    struct Settings {
+        Mode mode = Composite;
+        QVector<TransferPoint> transfer;
+
+        // MIP display window in modality units
+        double windowCenter = 0.0;
+        double windowWidth = 1.0;
+
+        // Maps screen right, down and into the screen onto volume axes
+        QQuaternion rotation;
+        double zoom = 1.0;  // 1 fits the whole volume
+
+        // Distance between samples along a ray in voxels of the finest spacing
+        double sampleStep = 0.5;
+    };
+
+    struct Stats {
+        qint64 samples = 0;
+        qint64 skippedCells = 0;
+        qint64 terminatedRays = 0;
+        double milliseconds = 0.0;
+    };
+
+    VolumeRenderer();
+
+    // Builds the macro cell grid, in parallel
+    void setVolume(const std::shared_ptr<const VolumeData> &volume, double rescaleSlope,
+                   double rescaleIntercept);
+    bool isNull() const;
+
+    // Renders size pixels, null when canceled. Safe to call from a worker
+    // thread while nothing else changes the renderer.
+    QImage render(const Settings &settings, const QSize &size, const std::atomic_bool *cancel = nullptr,
+                  Stats *stats = nullptr) const;
+
+    // Initial view, from the front with the last slice on top
+    static QQuaternion frontView();
+
+private:
+    static const int cellShift = 3;  // 8 voxels per cell edge
+
+    struct Lut;
+    struct Frame;
+    void bakeLut(const Settings &settings, Lut &lut) const;
+    void castRay(const Settings &settings, const Lut &lut, const Frame &frame, int x, int y, uint32_t &pixel,
+                 Stats &stats) const;
+
+    std::shared_ptr<const VolumeData> volume;
+    double slope;
+    double intercept;
+
+    // Smallest and largest value (as an index into the LUT) each cell and
+    // its trilinear neighbours can produce
+    int cellsX;
+    int cellsY;
+    int cellsZ;
+    std::vector<uint16_t> cellMin;
+    std::vector<uint16_t> cellMax;
+};
+
+#endif // VOLUMERENDERER_H
@@ -0,0 +1,296 @@
+#include "volumeview.h"
+#include <QHBoxLayout>
+#include <QMouseEvent>
+#include <QPainter>
+#include <QVBoxLayout>
+#include <QWheelEvent>
+#include <cmath>
+
+namespace {
+
+// Interactive frames are cast at 1/4 size, refinement then goes 1/2 and 1/1
+const int interactiveScale = 4;
+const int refineDelayMs = 150;
+
+enum Preset {
+    GrayRamp,
+    Bone,
+    Vessels
+};
+
+}
+
+VolumeView::VolumeView(QWidget *parent)
+    : QWidget(parent)
+    , windowCenter(0.0)
+    , windowWidth(1.0)
+    , currentRequest(0)
+    , frameScale(0)
+    , isRotating(false)
+{
+    modeCombo = new QComboBox(this);
+    modeCombo->addItem("DVR", VolumeRenderer::Composite);
+    modeCombo->addItem("Shaded MIP", VolumeRenderer::ShadedMip);
+    presetCombo = new QComboBox(this);
+    presetCombo->addItem("Gray Ramp", GrayRamp);
+    presetCombo->addItem("Bone", Bone);
+    presetCombo->addItem("Vessels", Vessels);
+
+    QHBoxLayout *toolLayout = new QHBoxLayout();
+    toolLayout->addWidget(modeCombo);
+    toolLayout->addWidget(presetCombo);
+    toolLayout->addStretch();
+    QVBoxLayout *layout = new QVBoxLayout(this);
+    layout->setContentsMargins(4, 4, 4, 4);
+    layout->addLayout(toolLayout);
+    layout->addStretch();
+
+    setMinimumSize(200, 200);
+    setFocusPolicy(Qt::StrongFocus);
+
+    // One frame at a time, the renderer splits it across the global pool
+    pool.setMaxThreadCount(1);
+    settings.rotation = VolumeRenderer::frontView();
+
+    refineTimer.setSingleShot(true);
+    refineTimer.setInterval(refineDelayMs);
+    connect(&refineTimer, &QTimer::timeout, this, [this]() { requestFrame(2); });
+
+    connect(modeCombo, &QComboBox::currentIndexChanged, this, [this]() {
+        updateSettings();
+        requestFrame(1);
+    });
+    connect(presetCombo, &QComboBox::currentIndexChanged, this, [this]() {
+        updateSettings();
+        requestFrame(1);
+    });
+}
+
+VolumeView::~VolumeView()
+{
+    // Workers post back to this widget
+    if (currentCancel) {
+        currentCancel->store(true);
+    }
+    pool.clear();
+    pool.waitForDone();
+}
+
+void VolumeView::setVolume(const DicomLoader::LoadResult &result)
+{
+    if (!result.volume || result.volume->depth < 2) {
+        clear();
+        return;
+    }
+
+    // The macro cell grid is built on the worker, ahead of the first frame
+    auto newRenderer = std::make_shared<VolumeRenderer>();
+    const std::shared_ptr<const VolumeData> volume = result.volume;
+    const double slope = result.metadata.rescaleSlope;
+    const double intercept = result.metadata.rescaleIntercept;
+    renderer = newRenderer;
+    pool.start([newRenderer, volume, slope, intercept]() { newRenderer->setVolume(volume, slope, intercept); });
+
+    settings.rotation = VolumeRenderer::frontView();
+    settings.zoom = 1.0;
+    updateSettings();
+    requestFrame(1);
+}
+
+void VolumeView::clear()
+{
+    if (currentCancel) {
+        currentCancel->store(true);
+    }
+    ++currentRequest;
+    renderer.reset();
+    frame = QImage();
+    frameInfo.clear();
+    update();
+}
+
+void VolumeView::setWindowLevel(double center, double width)
+{
+    windowCenter = center;
+    windowWidth = width;
+    updateSettings();
+    if (renderer && isVisible()) {
+        requestFrame(1);
+    }
+}
+
+void VolumeView::updateSettings()
+{
+    settings.mode = VolumeRenderer::Mode(modeCombo->currentData().toInt());
+    settings.windowCenter = windowCenter;
+    settings.windowWidth = windowWidth;
+
+    // Ramps span the window, opacities are per voxel of depth
+    const double low = windowCenter - windowWidth / 2.0;
+    const double high = windowCenter + windowWidth / 2.0;
+    const double mid = (low + high) / 2.0;
+    settings.transfer.clear();
+    switch (presetCombo->currentData().toInt()) {
+    case Bone:
+        settings.transfer.append({low, QColor(140, 70, 40, 0)});
+        settings.transfer.append({mid, QColor(220, 180, 140, 20)});
+        settings.transfer.append({high, QColor(255, 250, 235, 200)});
+        break;
+    case Vessels:
+        settings.transfer.append({low, QColor(120, 0, 0, 0)});
+        settings.transfer.append({mid, QColor(210, 40, 30, 60)});
+        settings.transfer.append({high, QColor(255, 230, 200, 230)});
+        break;
+    default:
+        settings.transfer.append({low, QColor(0, 0, 0, 0)});
+        settings.transfer.append({high, QColor(255, 255, 255, 120)});
+        break;
+    }
+}
+
+QRect VolumeView::canvasRect() const
+{
+    // Below the tool row
+    const int top = modeCombo->geometry().bottom() + 4;
+    return QRect(0, top, width(), std::max(0, height() - top));
+}
+
+void VolumeView::interact()
+{
+    requestFrame(interactiveScale);
+    refineTimer.start();
+}
+
+void VolumeView::requestFrame(int scale)
+{
+    if (!renderer) {
+        return;
+    }
+    const QSize canvas = canvasRect().size();
+    const QSize size(std::max(1, canvas.width() / scale), std::max(1, canvas.height() / scale));
+    if (canvas.isEmpty()) {
+        return;
+    }
+
+    // Only the newest frame matters, a running one is told to stop
+    if (currentCancel) {
+        currentCancel->store(true);
+    }
+    const quint64 requestId = ++currentRequest;
+    auto cancelFlag = std::make_shared<std::atomic_bool>(false);
+    currentCancel = cancelFlag;
+
+    VolumeRenderer::Settings frameSettings = settings;
+    frameSettings.sampleStep = scale > 1 ? 1.0 : 0.5;
+    const std::shared_ptr<const VolumeRenderer> frameRenderer = renderer;
+
+    pool.start([this, requestId, scale, size, frameSettings, frameRenderer, cancelFlag]() {
+        if (cancelFlag->load()) {
+            return;
+        }
+        VolumeRenderer::Stats stats;
+        const QImage image = frameRenderer->render(frameSettings, size, cancelFlag.get(), &stats);
+        if (image.isNull()) {
+            return;
+        }
+        QMetaObject::invokeMethod(this, [this, requestId, scale, image, stats]() {
+            onFrameReady(requestId, scale, image, stats);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void VolumeView::onFrameReady(quint64 requestId, int scale, const QImage &image,
+                              const VolumeRenderer::Stats &stats)
+{
+    if (requestId != currentRequest) {
+        return;
+    }
+    frame = image;
+    frameScale = scale;
+    frameInfo = QString("%1x%2 (1/%3): %4 ms, %5 k samples, %6 cells skipped")
+                    .arg(image.width())
+                    .arg(image.height())
+                    .arg(scale)
+                    .arg(stats.milliseconds, 0, 'f', 1)
+                    .arg(stats.samples / 1000)
+                    .arg(stats.skippedCells);
+    emit frameRendered(scale, stats.milliseconds);
+    update();
+
+    // Refinement continues while nothing new is asked for
+    if (scale == 2 && !refineTimer.isActive()) {
+        requestFrame(1);
+    }
+}
+
+void VolumeView::paintEvent(QPaintEvent *event)
+{
+    Q_UNUSED(event);
+    QPainter painter(this);
+    const QRect canvas = canvasRect();
+    painter.fillRect(canvas, Qt::black);
+    if (frame.isNull()) {
+        return;
+    }
+
+    // Coarse frames are stretched smoothly over the canvas
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, frameScale > 1);
+    painter.drawImage(canvas, frame);
+
+    painter.setPen(Qt::yellow);
+    painter.drawText(canvas.adjusted(6, 0, -6, -6), Qt::AlignLeft | Qt::AlignBottom, frameInfo);
+}
+
+void VolumeView::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        isRotating = true;
+        lastMousePoint = event->pos();
+        event->accept();
+        return;
+    }
+    QWidget::mousePressEvent(event);
+}
+
+void VolumeView::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!isRotating || !(event->buttons() & Qt::LeftButton)) {
+        QWidget::mouseMoveEvent(event);
+        return;
+    }
+
+    // Turned in screen space, horizontal drags about the vertical axis
+    const QPoint delta = event->pos() - lastMousePoint;
+    lastMousePoint = event->pos();
+    const QQuaternion turn = QQuaternion::fromAxisAndAngle(QVector3D(0, 1, 0), -0.5f * float(delta.x()))
+                             * QQuaternion::fromAxisAndAngle(QVector3D(1, 0, 0), 0.5f * float(delta.y()));
+    settings.rotation = (settings.rotation * turn).normalized();
+    interact();
+    event->accept();
+}
+
+void VolumeView::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton && isRotating) {
+        isRotating = false;
+        event->accept();
+        return;
+    }
+    QWidget::mouseReleaseEvent(event);
+}
+
+void VolumeView::wheelEvent(QWheelEvent *event)
+{
+    const double steps = event->angleDelta().y() / 120.0;
+    settings.zoom = qBound(0.25, settings.zoom * std::pow(1.15, steps), 16.0);
+    interact();
+    event->accept();
+}
+
+void VolumeView::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    if (renderer) {
+        interact();
+    }
+}
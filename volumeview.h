@@ -0,0 +1,75 @@
+#ifndef VOLUMEVIEW_H
+#define VOLUMEVIEW_H
+
+#include <QComboBox>
+#include <QImage>
+#include <QPoint>
+#include <QThreadPool>
+#include <QTimer>
+#include <QWidget>
+#include <atomic>
+#include <memory>
+
+#include "dicomloader.h"
+#include "volumerenderer.h"
+
+// 3D view of a volume rendered by VolumeRenderer on a worker thread. While
+// the user rotates (left drag) or zooms (wheel) frames are cast at a quarter
+// of the resolution with coarser sampling, once input stops the view refines
+// to half and then full resolution. Each frame's render time is shown in
+// the corner and reported through frameRendered.
+class VolumeView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit VolumeView(QWidget *parent = nullptr);
+    ~VolumeView();
+
+    void setVolume(const DicomLoader::LoadResult &result);
+    void clear();
+
+    // Transfer function ramps and the MIP window follow the 2D window
+    void setWindowLevel(double center, double width);
+
+signals:
+    void frameRendered(int scale, double milliseconds);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    void interact();
+    void requestFrame(int scale);
+    void onFrameReady(quint64 requestId, int scale, const QImage &image, const VolumeRenderer::Stats &stats);
+    void updateSettings();
+    QRect canvasRect() const;
+
+    QComboBox *modeCombo;
+    QComboBox *presetCombo;
+
+    // The renderer is replaced, never changed, while frames may be running
+    std::shared_ptr<VolumeRenderer> renderer;
+    VolumeRenderer::Settings settings;
+    double windowCenter;
+    double windowWidth;
+
+    QThreadPool pool;
+    quint64 currentRequest;
+    std::shared_ptr<std::atomic_bool> currentCancel;
+    QTimer refineTimer;
+
+    QImage frame;
+    int frameScale;
+    QString frameInfo;
+
+    bool isRotating;
+    QPoint lastMousePoint;
+};
+
+#endif // VOLUMEVIEW_H
@@ -0,0 +1,176 @@
+#include "windowlevel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+const int lutSize = 65536;
+}
+
+WindowLevelLut::WindowLevelLut()
+    : table(lutSize, 0)
+    , indexXor(0)
+    , slope(1.0)
+    , intercept(0.0)
+    , minIndex(0)
+    , maxIndex(lutSize - 1)
+    , inverted(false)
+    , windowCenter(32768.0)
+    , windowWidth(65536.0)
+    , valid(false)
+    , rebuildCount(0)
+{
+}
+
+void WindowLevelLut::setPixelFormat(bool isSigned, double rescaleSlope, double rescaleIntercept)
+{
+    // Flipping the sign bit makes signed values index the table in order
+    indexXor = isSigned ? 0x8000 : 0;
+    slope = (rescaleSlope == 0.0) ? 1.0 : rescaleSlope;
+    intercept = rescaleIntercept;
+    invalidate();
+}
+
+void WindowLevelLut::setDataRange(int minStored, int maxStored)
+{
+    const int offset = indexXor ? 32768 : 0;
+    minIndex = std::clamp(std::min(minStored, maxStored) + offset, 0, lutSize - 1);
+    maxIndex = std::clamp(std::max(minStored, maxStored) + offset, 0, lutSize - 1);
+    invalidate();
+}
+
+void WindowLevelLut::setInverted(bool invert)
+{
+    if (inverted != invert) {
+        inverted = invert;
+        invalidate();
+    }
+}
+
+void WindowLevelLut::invalidate()
+{
+    valid = false;
+}
+
+void WindowLevelLut::setWindow(double center, double width)
+{
+    width = std::max(width, 1.0);
+
+    if (!valid) {
+        windowCenter = center;
+        windowWidth = width;
+        rebuild(minIndex, maxIndex);
+        valid = true;
+        return;
+    }
+
+    // Outside both ramps every entry saturates the same way before and after
+    // the move, so only the union of the two ramps needs recomputing
+    int oldFirst, oldLast, newFirst, newLast;
+    rampRange(windowCenter, windowWidth, oldFirst, oldLast);
+    rampRange(center, width, newFirst, newLast);
+
+    windowCenter = center;
+    windowWidth = width;
+    rebuild(std::max(minIndex, std::min(oldFirst, newFirst)),
+            std::min(maxIndex, std::max(oldLast, newLast)));
+}
+
+double WindowLevelLut::center() const
+{
+    return windowCenter;
+}
+
+double WindowLevelLut::width() const
+{
+    return windowWidth;
+}
+
+void WindowLevelLut::fullRangeWindow(double &center, double &width) const
+{
+    const int offset = indexXor ? 32768 : 0;
+    const double a = modalityValue(minIndex - offset);
+    const double b = modalityValue(maxIndex - offset);
+    center = (a + b) / 2.0 + 0.5;
+    width = std::max(std::fabs(b - a) + 1.0, 1.0);
+}
+
+double WindowLevelLut::modalityValue(int stored) const
+{
+    return stored * slope + intercept;
+}
+
+void WindowLevelLut::rampRange(double center, double width, int &first, int &last) const
+{
+    const double lower = center - 0.5 - (width - 1.0) / 2.0;
+    const double upper = center - 0.5 + (width - 1.0) / 2.0;
+
+    // Back to stored values, a negative slope flips the ramp
+    double a = (lower - intercept) / slope;
+    double b = (upper - intercept) / slope;
+    if (a > b) {
+        std::swap(a, b);
+    }
+
+    const double offset = indexXor ? 32768.0 : 0.0;
+    first = int(std::clamp(std::floor(a) + offset - 1.0, 0.0, double(lutSize - 1)));
+    last = int(std::clamp(std::ceil(b) + offset + 1.0, 0.0, double(lutSize - 1)));
+}
+
+void WindowLevelLut::rebuild(int first, int last)
+{
+    rebuildCount = (last >= first) ? size_t(last - first + 1) : 0;
+
+    const int offset = indexXor ? 32768 : 0;
+    const double c = windowCenter - 0.5;
+    const double w = windowWidth - 1.0;
+
+    for (int i = first; i <= last; ++i) {
+        const double x = modalityValue(i - offset);
+
+        double y;
+        if (x <= c - w / 2.0) {
+            y = 0.0;
+        } else if (x > c + w / 2.0) {
+            y = 255.0;
+        } else {
+            y = ((x - c) / w + 0.5) * 255.0;
+        }
+
+        uint8_t value = uint8_t(std::clamp(std::lround(y), 0L, 255L));
+        table[i] = inverted ? uint8_t(255 - value) : value;
+    }
+}
+
+void WindowLevelLut::applyRow(const uint16_t *src, uint8_t *dst, size_t count) const
+{
+    const uint8_t *lut = table.data();
+    const uint16_t flip = indexXor;
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = lut[uint16_t(src[i] ^ flip)];
+    }
+}
+
+void WindowLevelLut::applyRowRgb32(const uint16_t *src, uint32_t *dst, size_t count) const
+{
+    const uint8_t *lut = table.data();
+    const uint16_t flip = indexXor;
+    for (size_t i = 0; i < count; ++i) {
+        // Opaque gray, 0xffRRGGBB as used by QImage::Format_RGB32
+        dst[i] = 0xFF000000u | (uint32_t(lut[uint16_t(src[i] ^ flip)]) * 0x010101u);
+    }
+}
+
+void WindowLevelLut::applyStridedRgb32(const uint16_t *src, size_t step, uint32_t *dst, size_t count) const
+{
+    const uint8_t *lut = table.data();
+    const uint16_t flip = indexXor;
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = 0xFF000000u | (uint32_t(lut[uint16_t(src[i * step] ^ flip)]) * 0x010101u);
+    }
+}
+
+size_t WindowLevelLut::lastRebuildCount() const
+{
+    return rebuildCount;
+}
@@ -0,0 +1,65 @@
+#ifndef WINDOWLEVEL_H
+#define WINDOWLEVEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lookup table that maps stored 16-bit pixel values to 8-bit display values
+// using the DICOM linear VOI function (PS3.3 C.11.2.1.2). Moving the window
+// only recomputes the entries between the old and new ramps, so dragging the
+// window stays cheap even for full 16-bit data.
+class WindowLevelLut
+{
+public:
+    WindowLevelLut();
+
+    // Pixel representation and modality rescale applied before windowing
+    void setPixelFormat(bool isSigned, double rescaleSlope, double rescaleIntercept);
+
+    // Stored value range actually present in the image, entries outside of
+    // it are never looked up and never rebuilt
+    void setDataRange(int minStored, int maxStored);
+
+    // MONOCHROME1 images display low values as white
+    void setInverted(bool inverted);
+
+    void setWindow(double center, double width);
+    double center() const;
+    double width() const;
+
+    // Window covering the full data range in modality units
+    void fullRangeWindow(double &center, double &width) const;
+
+    // Modality value (e.g. Hounsfield units) for a stored value
+    double modalityValue(int stored) const;
+
+    void applyRow(const uint16_t *src, uint8_t *dst, size_t count) const;
+    void applyRowRgb32(const uint16_t *src, uint32_t *dst, size_t count) const;
+
+    // Same as applyRowRgb32 but reads every step-th source sample
+    void applyStridedRgb32(const uint16_t *src, size_t step, uint32_t *dst, size_t count) const;
+
+    // Number of LUT entries touched by the last update
+    size_t lastRebuildCount() const;
+
+private:
+    void rebuild(int first, int last);
+    void rampRange(double center, double width, int &first, int &last) const;
+    void invalidate();
+
+    std::vector<uint8_t> table;
+    uint16_t indexXor;
+    double slope;
+    double intercept;
+    int minIndex;
+    int maxIndex;
+    bool inverted;
+
+    double windowCenter;
+    double windowWidth;
+    bool valid;
+    size_t rebuildCount;
+};
+
+#endif // WINDOWLEVEL_H